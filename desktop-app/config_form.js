@@ -169,25 +169,26 @@ export function generateExtraConfigForm(prefix = '') {
     </section>
 
     <section class="config-section">
-        <h3>Power Management (Reserved)</h3>
+        <h3>Power Management</h3>
         <small style="color: var(--text-muted); display:block; margin-bottom: 10px;">
-            Not supported in current firmware (shown for future use).
+            Night mode (local time, clock synced over SNTP): LCD backlight off, WiFi modem sleep,
+            CPU at 80 MHz. A button press or payment wakes it at once. Start = End disables it.
         </small>
         <div class="form-grid three">
             <div class="form-group">
                 <label>Enable Power Save</label>
                 <div class="toggle-row">
-                    <input type="checkbox" id="${p}enablePowerSave" checked disabled>
+                    <input type="checkbox" id="${p}enablePowerSave">
                     <span>Enabled</span>
                 </div>
             </div>
             <div class="form-group">
-                <label>Deep Sleep Start (Hour 0-23)</label>
-                <input type="number" id="${p}deepSleepStartHour" value="1" min="0" max="23" disabled>
+                <label>Night Start (Hour 0-23)</label>
+                <input type="number" id="${p}deepSleepStartHour" value="1" min="0" max="23">
             </div>
             <div class="form-group">
-                <label>Deep Sleep End (Hour 0-23)</label>
-                <input type="number" id="${p}deepSleepEndHour" value="6" min="0" max="23" disabled>
+                <label>Night End (Hour 0-23)</label>
+                <input type="number" id="${p}deepSleepEndHour" value="6" min="0" max="23">
             </div>
         </div>
     </section>
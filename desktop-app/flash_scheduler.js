@@ -0,0 +1,269 @@
+// Batch provisioning (main process): flash and configure many ESP32 boards
+// at once, one worker per USB port.
+//
+// Each job runs its own esptool process, then (optionally) opens the port
+// and sends the shared config merged with a per-device ID as one CFG_FRAME.
+// A failed step is retried (flash at a lower baud, since a marginal cable
+// or hub is the usual cause); a flashed board that failed configuration
+// only repeats the configuration. Progress for all ports is aggregated and
+// sent to the renderer a few times per second, and the batch ends with a
+// throughput summary.
+
+const { spawn } = require('child_process');
+const fs = require('fs');
+const { SerialPort } = require('serialport');
+const { ReadlineParser } = require('@serialport/parser-readline');
+
+// USB-UART bridges used on ESP32 boards: CP210x, CH340, FTDI, native USB
+const ESP32_USB_VIDS = ['10c4', '1a86', '0403', '303a'];
+
+const MAX_PARALLEL = 24;
+const DEFAULT_RETRIES = 2;
+const RETRY_BAUD = 115200;
+const RETRY_BACKOFF_MS = 1500;
+const BOOT_SETTLE_MS = 3000;     // After esptool's hard reset
+const CONFIG_REPLY_MS = 3000;
+const CONFIG_SENDS = 3;          // The first frame can land mid-boot
+const PROGRESS_MS = 250;
+
+// Share of a job's progress bar taken by the flash step
+const FLASH_SHARE = 90;
+
+function isEsp32Port(port) {
+    return ESP32_USB_VIDS.includes(String(port.vendorId || '').toLowerCase());
+}
+
+// {mac}: last 6 hex digits of the MAC, {n}: 1-based position in the batch
+function expandDeviceId(pattern, job) {
+    const mac = (job.mac || '').replace(/:/g, '').slice(-6).toUpperCase();
+    return pattern
+        .replace(/\{mac\}/g, mac || job.port.replace(/\W/g, ''))
+        .replace(/\{n\}/g, String(job.index + 1).padStart(3, '0'));
+}
+
+const sleep = (ms) => new Promise(resolve => setTimeout(resolve, ms));
+
+class FlashScheduler {
+    // deps: { send, esptool: { python, args }, buildConfigFrame }
+    constructor(deps, options) {
+        this.send = deps.send;
+        this.esptool = deps.esptool;
+        this.buildConfigFrame = deps.buildConfigFrame;
+        this.options = options;
+        this.cancelled = false;
+        this.progressTimer = null;
+        this.firmwareBytes = fs.statSync(options.firmwarePath).size;
+        this.jobs = options.ports.map((port, index) => ({
+            port,
+            index,
+            state: 'queued',
+            attempt: 0,
+            percent: 0,
+            flashed: false,
+            mac: '',
+            deviceId: '',
+            message: '',
+            startedAt: 0,
+            finishedAt: 0,
+            child: null
+        }));
+    }
+
+    async run() {
+        const started = Date.now();
+        this.startedAt = started;
+        const queue = this.jobs.slice();
+        const parallel = Math.max(1, Math.min(this.options.concurrency || queue.length, MAX_PARALLEL, queue.length));
+
+        this.progressTimer = setInterval(() => this.reportProgress(), PROGRESS_MS);
+        const worker = async () => {
+            while (queue.length && !this.cancelled) {
+                await this.runJob(queue.shift());
+            }
+        };
+        await Promise.all(Array.from({ length: parallel }, worker));
+        clearInterval(this.progressTimer);
+
+        this.jobs.forEach((job) => {
+            if (job.state === 'queued') job.state = 'cancelled';
+        });
+        const summary = this.summary(Date.now() - started, parallel);
+        this.reportProgress();
+        this.send('batch-done', summary);
+        console.log(`Batch provisioning: ${summary.done}/${summary.total} done in ${summary.elapsedMs} ms ` +
+            `(${summary.devicesPerHour} devices/h, ${summary.flashKBps} KB/s aggregate)`);
+        return summary;
+    }
+
+    cancel() {
+        this.cancelled = true;
+        this.jobs.forEach((job) => job.child?.kill());
+    }
+
+    async runJob(job) {
+        const retries = Number.isInteger(this.options.retries) ? this.options.retries : DEFAULT_RETRIES;
+        job.startedAt = Date.now();
+
+        for (let attempt = 0; attempt <= retries && !this.cancelled; attempt++) {
+            job.attempt = attempt + 1;
+            try {
+                if (!job.flashed) {
+                    await this.flash(job, attempt === 0 ? this.options.baud : RETRY_BAUD);
+                    job.flashed = true;
+                }
+                if (this.options.config) {
+                    await this.configure(job);
+                }
+                job.state = 'done';
+                job.percent = 100;
+                job.message = job.deviceId ? `Provisioned as ${job.deviceId}` : 'Flashed';
+                job.finishedAt = Date.now();
+                return;
+            } catch (error) {
+                job.message = error.message;
+                if (!this.cancelled && attempt < retries) {
+                    job.state = 'retrying';
+                    await sleep(RETRY_BACKOFF_MS * (attempt + 1));
+                }
+            }
+        }
+        job.state = this.cancelled ? 'cancelled' : 'failed';
+        job.finishedAt = Date.now();
+    }
+
+    flash(job, baud) {
+        job.state = 'flashing';
+        job.percent = 0;
+        const args = this.esptool.args.concat([
+            '--chip', 'esp32',
+            '--port', job.port,
+            '--baud', String(baud),
+            '--before', 'default_reset',
+            '--after', 'hard_reset',
+            'write_flash', '-z',
+            this.options.offset, this.options.firmwarePath
+        ]);
+
+        return new Promise((resolve, reject) => {
+            const child = spawn(this.esptool.python, args);
+            job.child = child;
+            let lastLine = '';
+
+            const handleOutput = (data) => {
+                const text = data.toString();
+                const mac = text.match(/MAC:\s*([0-9a-f]{2}(?::[0-9a-f]{2}){5})/i);
+                if (mac) job.mac = mac[1];
+                const pct = text.match(/(\d+)\s*%/);
+                if (pct) job.percent = Math.min(100, Number(pct[1])) * FLASH_SHARE / 100;
+                const line = text.trim().split('\n').pop();
+                if (line) lastLine = line;
+            };
+            child.stdout.on('data', handleOutput);
+            child.stderr.on('data', handleOutput);
+
+            child.on('error', (err) => {
+                job.child = null;
+                reject(new Error(`Failed to start esptool: ${err.message}`));
+            });
+            child.on('close', (code) => {
+                job.child = null;
+                if (code === 0) {
+                    job.percent = FLASH_SHARE;
+                    resolve();
+                } else {
+                    reject(new Error(`esptool exited with code ${code}: ${lastLine}`));
+                }
+            });
+        });
+    }
+
+    async configure(job) {
+        job.state = 'configuring';
+        job.deviceId = expandDeviceId(this.options.deviceIdPattern || '{mac}', job);
+        const frame = this.buildConfigFrame({ ...this.options.config, deviceId: job.deviceId });
+
+        const port = new SerialPort({ path: job.port, baudRate: 115200, autoOpen: false });
+        await new Promise((resolve, reject) => port.open(err => (err ? reject(err) : resolve())));
+        const parser = port.pipe(new ReadlineParser({ delimiter: '\n' }));
+        try {
+            await sleep(BOOT_SETTLE_MS);
+            for (let send = 0; send < CONFIG_SENDS && !this.cancelled; send++) {
+                const reply = await this.sendFrame(port, parser, frame);
+                if (reply === null) continue; // No answer yet, still booting
+                if (reply.startsWith('OK: CFG_FRAME')) {
+                    port.write('RESTART\n');
+                    await new Promise(resolve => port.drain(resolve));
+                    return;
+                }
+                if (reply.startsWith('ERROR: Unknown command')) {
+                    throw new Error('Firmware has no CFG_FRAME support');
+                }
+                throw new Error(reply);
+            }
+            throw new Error('No CFG_FRAME reply');
+        } finally {
+            if (port.isOpen) await new Promise(resolve => port.close(resolve));
+        }
+    }
+
+    // Resolves with the device verdict line, or null on timeout
+    sendFrame(port, parser, frame) {
+        return new Promise((resolve) => {
+            let timer = null;
+            const finish = (line) => {
+                clearTimeout(timer);
+                parser.off('data', onLine);
+                resolve(line);
+            };
+            const onLine = (raw) => {
+                const line = raw.trim();
+                if (line.startsWith('OK: CFG_FRAME') || line.startsWith('ERROR:')) finish(line);
+            };
+            parser.on('data', onLine);
+            timer = setTimeout(() => finish(null), CONFIG_REPLY_MS);
+            port.write(frame + '\n');
+        });
+    }
+
+    summary(elapsedMs, parallel) {
+        const count = (state) => this.jobs.filter(j => j.state === state).length;
+        const done = this.jobs.filter(j => j.state === 'done');
+        const jobMs = done.map(j => j.finishedAt - j.startedAt);
+        const seconds = Math.max(elapsedMs, 1) / 1000;
+        return {
+            total: this.jobs.length,
+            done: done.length,
+            failed: count('failed'),
+            cancelled: count('cancelled'),
+            parallel,
+            elapsedMs,
+            avgJobMs: jobMs.length ? Math.round(jobMs.reduce((a, b) => a + b, 0) / jobMs.length) : 0,
+            devicesPerHour: Math.round(done.length * 3600 / seconds),
+            // Image bytes written per second over the whole batch (compressed
+            // on the wire, so this can exceed the baud rate)
+            flashKBps: Math.round(done.length * this.firmwareBytes / 1024 / seconds)
+        };
+    }
+
+    reportProgress() {
+        const jobs = this.jobs.map(j => ({
+            port: j.port,
+            state: j.state,
+            attempt: j.attempt,
+            percent: Math.round(j.percent),
+            mac: j.mac,
+            deviceId: j.deviceId,
+            message: j.message
+        }));
+        // Failed and cancelled jobs count as finished for the overall bar
+        const percent = Math.round(this.jobs.reduce((sum, j) => sum + (j.finishedAt ? 100 : j.percent), 0) /
+            (this.jobs.length || 1));
+        this.send('batch-progress', {
+            jobs,
+            percent,
+            summary: this.summary(Date.now() - this.startedAt, 0)
+        });
+    }
+}
+
+module.exports = { FlashScheduler, isEsp32Port, expandDeviceId };
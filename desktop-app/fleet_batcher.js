@@ -0,0 +1,155 @@
+// Fleet message batching (main process).
+//
+// Thousands of devices each send a heartbeat every 30 s. Instead of one IPC
+// message per MQTT message, heartbeats are parsed here and folded into one
+// pending diff per device (only fields that changed since the last flush).
+// The diffs, plus any other messages (status/log of the selected device),
+// go to the renderer as one 'mqtt-batch' per frame. Nothing is sent while
+// the broker is quiet. Telemetry payloads may be binary (MessagePack) and
+// are decoded to JSON text here, before they cross IPC.
+
+const { decodeTelemetry } = require('./telemetry_decoder');
+
+const FLEET_FRAME_MS = 100;      // 10 batches/s at most
+const FLEET_MAX_MESSAGES = 200;  // Non-heartbeat messages kept per frame
+
+// Heartbeat fields the device list shows
+const CARD_FIELDS = ['status', 'firmware_version', 'ip', 'ssid', 'rssi', 'uptime', 'free_heap'];
+
+class FleetBatcher {
+    constructor(send, { frameMs = FLEET_FRAME_MS, now = Date.now } = {}) {
+        this.send = send;
+        this.frameMs = frameMs;
+        this.now = now;
+        this.devices = new Map(); // id -> last values sent to the renderer
+        this.pending = new Map(); // id -> diff not yet sent
+        this.messages = [];
+        this.dropped = 0;
+        this.timer = null;
+        this.stats = { ingested: 0, batches: 0, parseErrors: 0 };
+    }
+
+    ingest(topic, payload) {
+        this.stats.ingested++;
+        const parts = topic.split('/');
+        if (parts.length === 3 && parts[0] === 'vending' && parts[2] === 'heartbeat') {
+            this.ingestHeartbeat(parts[1], payload);
+        } else {
+            let message = payload.toString();
+            if (parts.length === 3 && parts[2] === 'telemetry') {
+                try {
+                    message = JSON.stringify(decodeTelemetry(payload));
+                } catch {
+                    this.stats.parseErrors++;
+                    return;
+                }
+            }
+            if (this.messages.length >= FLEET_MAX_MESSAGES) {
+                this.messages.shift();
+                this.dropped++;
+            }
+            this.messages.push({ topic, message });
+        }
+        this.schedule();
+    }
+
+    ingestHeartbeat(id, payload) {
+        let data;
+        try {
+            data = JSON.parse(payload.toString());
+        } catch {
+            this.stats.parseErrors++;
+            return;
+        }
+        let known = this.devices.get(id);
+        if (!known) {
+            known = {};
+            this.devices.set(id, known);
+        }
+        let diff = this.pending.get(id);
+        if (!diff) {
+            diff = {};
+            this.pending.set(id, diff);
+        }
+        for (const f of CARD_FIELDS) {
+            const v = data[f];
+            if (v !== undefined && known[f] !== v) {
+                known[f] = v;
+                diff[f] = v;
+            }
+        }
+        diff.lastSeen = this.now();
+        known.lastSeen = diff.lastSeen;
+    }
+
+    // Devices heard from in the last maxAgeMs, with their reported fields
+    onlineDevices(maxAgeMs) {
+        const since = this.now() - maxAgeMs;
+        const list = [];
+        this.devices.forEach((known, id) => {
+            if (known.lastSeen >= since) list.push({ id, ...known });
+        });
+        return list;
+    }
+
+    schedule() {
+        if (!this.timer) {
+            this.timer = setTimeout(() => {
+                this.timer = null;
+                this.flush();
+            }, this.frameMs);
+        }
+    }
+
+    flush() {
+        if (this.pending.size === 0 && this.messages.length === 0) return;
+        const batch = {
+            devices: Object.fromEntries(this.pending),
+            messages: this.messages,
+            dropped: this.dropped
+        };
+        this.pending = new Map();
+        this.messages = [];
+        this.dropped = 0;
+        this.stats.batches++;
+        this.send('mqtt-batch', batch);
+    }
+
+    // New broker connection: the renderer starts from an empty list
+    reset() {
+        if (this.timer) clearTimeout(this.timer);
+        this.timer = null;
+        this.devices.clear();
+        this.pending.clear();
+        this.messages = [];
+        this.dropped = 0;
+    }
+}
+
+// Synthetic heartbeats for `count` devices, spread evenly over `intervalMs`
+// (the firmware default is 30 s). Returns a stop function.
+function simulateFleet(batcher, count, intervalMs = 30000) {
+    const tickMs = 50;
+    const perTick = Math.max(1, Math.round(count * tickMs / intervalMs));
+    let next = 0;
+    let uptime = 0;
+    const timer = setInterval(() => {
+        uptime += tickMs / 1000;
+        for (let i = 0; i < perTick; i++) {
+            const n = next++ % count;
+            const id = `SIM_${String(n).padStart(5, '0')}`;
+            batcher.ingest(`vending/${id}/heartbeat`, JSON.stringify({
+                status: 'online',
+                uptime: Math.floor(uptime),
+                ip: `10.${(n >> 16) & 255}.${(n >> 8) & 255}.${n & 255}`,
+                rssi: -50 - ((n + Math.floor(uptime / 10)) % 40),
+                ssid: 'SIM_NET',
+                firmware_version: n % 10 === 0 ? '2.4.0-main' : '2.4.1-main',
+                free_heap: 150000 - (n % 5000)
+            }));
+        }
+    }, tickMs);
+    return () => clearInterval(timer);
+}
+
+module.exports = { FleetBatcher, simulateFleet, FLEET_FRAME_MS, CARD_FIELDS };
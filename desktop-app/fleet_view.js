@@ -0,0 +1,247 @@
+// Virtualized, keyed device list for the Online > Devices tab.
+//
+// Only the cards inside the viewport (plus OVERSCAN_ROWS above and below)
+// exist in the DOM; scrolled-out cards go back to a pool and are reused.
+// A batch from the main process marks the devices it touches; the next
+// animation frame rewrites the text of those that are on screen and leaves
+// every other card alone.
+
+const ROW_HEIGHT = 112;    // Card height + gap (px)
+const MIN_CARD_WIDTH = 250;
+const GAP = 15;
+const OVERSCAN_ROWS = 2;
+const OFFLINE_AFTER_MS = 90000; // Three missed 30 s heartbeats
+const STALE_CHECK_MS = 5000;
+
+export function createFleetView(viewport, { onSelect, onStats } = {}) {
+    const devices = new Map(); // id -> merged heartbeat fields
+    const order = [];          // ids in arrival order
+    const index = new Map();   // id -> position in `order`
+    const live = new Map();    // id -> card element on screen
+    const pool = [];
+    const dirty = new Set();
+    let selected = null;
+    let layoutDirty = true;
+    let frameQueued = false;
+    let cols = 1;
+    let cardWidth = MIN_CARD_WIDTH;
+
+    // Frame rate meter
+    let frames = 0;
+    let worstFrameMs = 0;
+    let lastFrameAt = 0;
+    let batches = 0;
+    let patches = 0;
+    let meterStart = performance.now();
+
+    viewport.classList.add('fleet-viewport');
+    viewport.innerHTML = '';
+    const spacer = document.createElement('div');
+    spacer.className = 'fleet-spacer';
+    viewport.appendChild(spacer);
+
+    viewport.addEventListener('scroll', () => {
+        layoutDirty = true;
+        queueFrame();
+    }, { passive: true });
+    new ResizeObserver(() => {
+        layoutDirty = true;
+        queueFrame();
+    }).observe(viewport);
+    viewport.addEventListener('click', (e) => {
+        const card = e.target.closest('.fleet-card');
+        if (card && onSelect) onSelect(card.dataset.id);
+    });
+
+    // Online/offline only changes with time: recheck what is on screen
+    setInterval(() => {
+        live.forEach((el, id) => dirty.add(id));
+        queueFrame();
+    }, STALE_CHECK_MS);
+
+    requestAnimationFrame(meter);
+
+    function applyBatch(diffs) {
+        batches++;
+        for (const [id, diff] of Object.entries(diffs)) {
+            let d = devices.get(id);
+            if (!d) {
+                d = { id };
+                devices.set(id, d);
+                index.set(id, order.length);
+                order.push(id);
+                layoutDirty = true;
+            }
+            Object.assign(d, diff);
+            if (live.has(id)) dirty.add(id);
+        }
+        queueFrame();
+    }
+
+    function setSelected(id) {
+        const prev = selected;
+        selected = id;
+        if (prev && live.has(prev)) dirty.add(prev);
+        if (id && live.has(id)) dirty.add(id);
+        queueFrame();
+    }
+
+    function queueFrame() {
+        if (frameQueued) return;
+        frameQueued = true;
+        requestAnimationFrame(render);
+    }
+
+    function render() {
+        frameQueued = false;
+        if (layoutDirty) layout();
+        dirty.forEach((id) => {
+            const el = live.get(id);
+            if (el) fillCard(el, devices.get(id));
+        });
+        patches += dirty.size;
+        dirty.clear();
+    }
+
+    function layout() {
+        layoutDirty = false;
+        const width = viewport.clientWidth;
+        cols = Math.max(1, Math.floor((width + GAP) / (MIN_CARD_WIDTH + GAP)));
+        cardWidth = Math.floor((width - GAP * (cols - 1)) / cols);
+        const rows = Math.ceil(order.length / cols);
+        spacer.style.height = `${rows * ROW_HEIGHT}px`;
+
+        const top = viewport.scrollTop;
+        const firstRow = Math.max(0, Math.floor(top / ROW_HEIGHT) - OVERSCAN_ROWS);
+        const lastRow = Math.min(rows, Math.ceil((top + viewport.clientHeight) / ROW_HEIGHT) + OVERSCAN_ROWS);
+        const from = firstRow * cols;
+        const to = Math.min(order.length, lastRow * cols);
+
+        live.forEach((el, id) => {
+            const i = index.get(id);
+            if (i < from || i >= to) {
+                live.delete(id);
+                el.style.display = 'none';
+                pool.push(el);
+            }
+        });
+
+        for (let i = from; i < to; i++) {
+            const id = order[i];
+            let el = live.get(id);
+            if (!el) {
+                el = pool.pop() || createCard();
+                el.style.display = '';
+                live.set(id, el);
+                fillCard(el, devices.get(id));
+            }
+            placeCard(el, i);
+        }
+    }
+
+    function createCard() {
+        const el = document.createElement('div');
+        el.className = 'device-card fleet-card';
+        el.innerHTML = `
+            <div class="fleet-card-title">
+                <ion-icon name="hardware-chip-outline" style="vertical-align:middle"></ion-icon>
+                <span></span>
+            </div>
+            <div class="fleet-card-body"><span></span><br><span></span><br><span></span></div>
+        `;
+        const body = el.querySelectorAll('.fleet-card-body span');
+        el._text = {
+            id: el.querySelector('.fleet-card-title span'),
+            fw: body[0],
+            ip: body[1],
+            wifi: body[2]
+        };
+        el._pos = -1;
+        el._width = 0;
+        spacer.appendChild(el);
+        return el;
+    }
+
+    function placeCard(el, i) {
+        if (el._pos !== i) {
+            el._pos = i;
+            el.style.top = `${Math.floor(i / cols) * ROW_HEIGHT}px`;
+            el.style.left = `${(i % cols) * (cardWidth + GAP)}px`;
+        }
+        if (el._width !== cardWidth) {
+            el._width = cardWidth;
+            el.style.width = `${cardWidth}px`;
+        }
+    }
+
+    // textContent only: heartbeat fields come from the network
+    function setText(node, value) {
+        if (node.textContent !== value) node.textContent = value;
+    }
+
+    function fillCard(el, d) {
+        if (el.dataset.id !== d.id) {
+            el.dataset.id = d.id;
+            el._pos = -1;
+        }
+        setText(el._text.id, d.id);
+        setText(el._text.fw, `FW: ${d.firmware_version || 'Unknown'}`);
+        setText(el._text.ip, `IP: ${d.ip || 'Unknown'}`);
+        setText(el._text.wifi, `WiFi: ${d.ssid || 'Unknown'} (${d.rssi ?? '?'} dBm)`);
+        el.classList.toggle('selected', d.id === selected);
+        el.classList.toggle('offline', Date.now() - (d.lastSeen || 0) > OFFLINE_AFTER_MS);
+    }
+
+    function meter(now) {
+        if (lastFrameAt) worstFrameMs = Math.max(worstFrameMs, now - lastFrameAt);
+        lastFrameAt = now;
+        frames++;
+        const elapsed = now - meterStart;
+        if (elapsed >= 1000) {
+            if (onStats) {
+                onStats({
+                    devices: order.length,
+                    fps: Math.round(frames * 1000 / elapsed),
+                    worstFrameMs: Math.round(worstFrameMs),
+                    batchesPerSec: Math.round(batches * 1000 / elapsed),
+                    patchesPerSec: Math.round(patches * 1000 / elapsed),
+                    onScreen: live.size
+                });
+            }
+            frames = 0;
+            batches = 0;
+            patches = 0;
+            worstFrameMs = 0;
+            meterStart = now;
+        }
+        requestAnimationFrame(meter);
+    }
+
+    function clear() {
+        devices.clear();
+        order.length = 0;
+        index.clear();
+        live.forEach((el) => {
+            el.style.display = 'none';
+            pool.push(el);
+        });
+        live.clear();
+        dirty.clear();
+        layoutDirty = true;
+        queueFrame();
+    }
+
+    // Devices with a heartbeat in the last OFFLINE_AFTER_MS
+    function onlineIds() {
+        const now = Date.now();
+        return order.filter(id => now - (devices.get(id).lastSeen || 0) <= OFFLINE_AFTER_MS);
+    }
+
+    return {
+        applyBatch,
+        onlineIds,
+        setSelected,
+        clear,
+        get size() { return order.length; }
+    };
+}
@@ -3,13 +3,14 @@ const { spawn, spawnSync } = require('child_process');
 const fs = require('fs');
 const path = require('path');
 const os = require('os');
-const crypto = require('crypto');
 const { SerialPort } = require('serialport');
 const { ReadlineParser } = require('@serialport/parser-readline');
+const { FlashScheduler, isEsp32Port } = require('./flash_scheduler');
 
 let mainWindow;
 let currentPort = null;
 let parser = null;
+let flashBatch = null;
 
 function sendToRenderer(channel, payload) {
     if (mainWindow && !mainWindow.isDestroyed()) {
@@ -61,9 +62,12 @@ app.on('window-all-closed', () => {
 // ============================================
 
 // Scan for available serial ports
-ipcMain.handle('scan-ports', async () => {
+ipcMain.handle('scan-ports', async (event, options) => {
     try {
-        const ports = await SerialPort.list();
+        let ports = await SerialPort.list();
+        if (options?.esp32Only) {
+            ports = ports.filter(isEsp32Port);
+        }
         return ports.map(port => ({
             path: port.path,
             manufacturer: port.manufacturer || 'Unknown',
@@ -147,90 +151,75 @@ ipcMain.handle('send-command', async (event, command) => {
 });
 
 // ============================================
-// IPC HANDLERS - Signing (HMAC-SHA256)
-// Mirrors firmware canonicalization (src_esp32_main/mqtt_handler.cpp)
+// IPC HANDLERS - Bulk config frame
+// Mirrors firmware CFG_FRAME (src_esp32_main/serial_config.cpp)
 // ============================================
-function isPresentForCanonical(v) {
-    if (v === undefined || v === null) return false;
-    if (typeof v === 'number' && !Number.isFinite(v)) return false;
-    return true;
+const CONFIG_FRAME_TIMEOUT_MS = 3000;
+
+function crc32(buf) {
+    let crc = 0xFFFFFFFF;
+    for (const byte of buf) {
+        crc ^= byte;
+        for (let bit = 0; bit < 8; bit++) {
+            crc = (crc >>> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return (crc ^ 0xFFFFFFFF) >>> 0;
 }
 
-function buildCanonicalPayload(type, payload, deviceId) {
-    const canonical = {};
+function buildConfigFrame(fields) {
+    const json = Buffer.from(JSON.stringify(fields), 'utf8');
+    return `CFG_FRAME:${json.length}:${crc32(json).toString(16)}:${json.toString('utf8')}`;
+}
 
-    const add = (key) => {
-        if (isPresentForCanonical(payload[key])) {
-            canonical[key] = payload[key];
-        }
-    };
+// Send all fields in one frame and wait for the device verdict.
+// Resolves with { success, message, elapsedMs, unsupported }.
+ipcMain.handle('send-config-frame', async (event, fields) => {
+    if (!currentPort || !currentPort.isOpen || !parser) {
+        return { success: false, message: 'Not connected' };
+    }
 
-    const t = String(type || '').toLowerCase();
+    const frame = buildConfigFrame(fields);
+    const started = process.hrtime.bigint();
+    const elapsedMs = () => Number(process.hrtime.bigint() - started) / 1e6;
 
-    if (t === 'payment') {
-        if (!isPresentForCanonical(payload.amount)) {
-            throw new Error('PAYMENT missing amount');
-        }
-        canonical.amount = payload.amount;
-        add('source');
-        add('transaction_id');
-        add('nonce');
-        add('user_id');
-        add('ts');
-    } else if (t === 'config') {
-        add('apply');
-        add('deviceId');
-        add('wifiSsid');
-        add('wifiPassword');
-        add('mqttBroker');
-        add('mqttPort');
-        add('mqttUsername');
-        add('mqttPassword');
-        add('pricePerLiter');
-        add('sessionTimeout');
-        add('freeWaterCooldown');
-        add('freeWaterAmount');
-        add('pulsesPerLiter');
-        add('tdsThreshold');
-        add('tdsTemperatureC');
-        add('tdsCalibrationFactor');
-        add('enableFreeWater');
-        add('relayActiveHigh');
-        add('relay_active_high');
-        add('cashPulseValue');
-        add('cashPulseGapMs');
-        add('paymentCheckInterval');
-        add('displayUpdateInterval');
-        add('tdsCheckInterval');
-        add('heartbeatInterval');
-        add('enablePowerSave');
-        add('deepSleepStartHour');
-        add('deepSleepEndHour');
-        add('transaction_id');
-        add('nonce');
-        add('ts');
-    } else if (t === 'command') {
-        add('action');
-        add('pricePerLiter');
-        add('threshold');
-        add('tdsThreshold');
-        add('duration');
-        add('reason');
-        add('transaction_id');
-        add('nonce');
-        add('ts');
-    } else if (t === 'ota') {
-        add('firmware_url');
-        add('transaction_id');
-        add('nonce');
-        add('ts');
-    } else {
-        throw new Error(`Unsupported sign type: ${type}`);
-    }
+    return new Promise((resolve) => {
+        const activeParser = parser;
+        let timer = null;
+        const finish = (result) => {
+            clearTimeout(timer);
+            activeParser.off('data', onLine);
+            resolve({ ...result, elapsedMs: Math.round(elapsedMs()) });
+        };
+        const onLine = (raw) => {
+            const line = raw.trim();
+            if (line.startsWith('OK: CFG_FRAME')) {
+                finish({ success: true, message: line });
+            } else if (line.startsWith('ERROR: Unknown command')) {
+                // Older firmware without CFG_FRAME support
+                finish({ success: false, unsupported: true, message: line });
+            } else if (line.startsWith('ERROR:')) {
+                finish({ success: false, message: line });
+            }
+        };
 
-    canonical.device_id = deviceId;
-    return JSON.stringify(canonical);
-}
+        activeParser.on('data', onLine);
+        timer = setTimeout(() => finish({ success: false, message: 'Timeout waiting for CFG_FRAME reply' }),
+            CONFIG_FRAME_TIMEOUT_MS);
+        currentPort.write(frame + '\n', (err) => {
+            if (err) finish({ success: false, message: err.message });
+        });
+    });
+});
+
+// ============================================
+// IPC HANDLERS - Signing (HMAC-SHA256)
+// Mirrors firmware canonicalization (src_esp32_main/mqtt_handler.cpp)
+// ============================================
+const { buildCanonicalPayload, signCanonical } = require('./signing');
+const { SignWorker } = require('./sign_worker');
+
+const signWorker = new SignWorker();
 
 ipcMain.handle('sign-payload', async (event, req) => {
     try {
@@ -248,9 +237,19 @@ ipcMain.handle('sign-payload', async (event, req) => {
         }
 
         const canonical = buildCanonicalPayload(type, payload, deviceId.trim());
-        const sig = crypto.createHmac('sha256', secret).update(canonical, 'utf8').digest('hex');
+        return { success: true, sig: signCanonical(canonical, secret), canonical };
+    } catch (error) {
+        return { success: false, message: error.message };
+    }
+});
 
-        return { success: true, sig, canonical };
+// Many devices in one call (fleet-wide pushes): { type, secret, items: [{ deviceId, payload }] }
+// or { type, secret, payload, deviceIds }. Large batches run on a worker thread.
+ipcMain.handle('sign-batch', async (event, req) => {
+    try {
+        const started = Date.now();
+        const result = await signWorker.sign(req || {});
+        return { success: true, sigs: result.sigs, ms: Date.now() - started };
     } catch (error) {
         return { success: false, message: error.message };
     }
@@ -312,6 +311,25 @@ function findEsptoolScript() {
     return null;
 }
 
+// Python + the arguments that run esptool
+function resolveEsptool() {
+    const python = findPython();
+    if (!python) {
+        return { success: false, message: 'Python not found. Install Python 3 first.' };
+    }
+
+    const esptoolPath = findEsptoolScript();
+    if (esptoolPath) {
+        return { success: true, python, args: [esptoolPath] };
+    }
+    // Try python -m esptool
+    const check = spawnSync(python, ['-m', 'esptool', '--version']);
+    if (check.status !== 0) {
+        return { success: false, message: 'esptool not found. Install PlatformIO or esptool.' };
+    }
+    return { success: true, python, args: ['-m', 'esptool'] };
+}
+
 // File dialog for firmware selection
 ipcMain.handle('select-firmware', async () => {
     const result = await dialog.showOpenDialog(mainWindow, {
@@ -343,23 +361,11 @@ ipcMain.handle('flash-firmware', async (event, payload) => {
             await new Promise(resolve => currentPort.close(resolve));
         }
 
-        const python = findPython();
-        if (!python) {
-            return { success: false, message: 'Python not found. Install Python 3 first.' };
-        }
-
-        let args = [];
-        const esptoolPath = findEsptoolScript();
-        if (esptoolPath) {
-            args = [esptoolPath];
-        } else {
-            // Try python -m esptool
-            const check = spawnSync(python, ['-m', 'esptool', '--version']);
-            if (check.status !== 0) {
-                return { success: false, message: 'esptool not found. Install PlatformIO or esptool.' };
-            }
-            args = ['-m', 'esptool'];
+        const esptool = resolveEsptool();
+        if (!esptool.success) {
+            return esptool;
         }
+        let args = esptool.args;
 
         const baudRate = Number(baud) || 460800;
         const flashOffset = typeof offset === 'string' && offset.trim() ? offset.trim() : '0x10000';
@@ -374,7 +380,7 @@ ipcMain.handle('flash-firmware', async (event, payload) => {
         ]);
 
         return await new Promise((resolve) => {
-            const child = spawn(python, args);
+            const child = spawn(esptool.python, args);
 
             const handleOutput = (data) => {
                 const text = data.toString();
@@ -408,18 +414,78 @@ ipcMain.handle('flash-firmware', async (event, payload) => {
     }
 });
 
+// ============================================
+// IPC HANDLERS - Batch provisioning (see flash_scheduler.js)
+// ============================================
+ipcMain.handle('batch-flash-start', async (event, payload) => {
+    try {
+        const { ports, firmwarePath, baud, offset, concurrency, retries, config, deviceIdPattern } = payload || {};
+        if (flashBatch) {
+            return { success: false, message: 'A batch is already running' };
+        }
+        if (!Array.isArray(ports) || ports.length === 0 || !firmwarePath) {
+            return { success: false, message: 'Missing ports or firmware path' };
+        }
+        if (!fs.existsSync(firmwarePath)) {
+            return { success: false, message: 'Firmware file not found' };
+        }
+
+        // The monitor connection would hold one of the ports
+        if (currentPort && currentPort.isOpen && ports.includes(currentPort.path)) {
+            await new Promise(resolve => currentPort.close(resolve));
+        }
+
+        const esptool = resolveEsptool();
+        if (!esptool.success) {
+            return esptool;
+        }
+
+        flashBatch = new FlashScheduler({ send: sendToRenderer, esptool, buildConfigFrame }, {
+            ports,
+            firmwarePath,
+            baud: Number(baud) || 460800,
+            offset: typeof offset === 'string' && offset.trim() ? offset.trim() : '0x10000',
+            concurrency: Number(concurrency) || ports.length,
+            retries: Number.isInteger(retries) ? retries : undefined,
+            config: config && typeof config === 'object' ? config : null,
+            deviceIdPattern
+        });
+        flashBatch.run()
+            .catch((error) => sendToRenderer('batch-done', { error: error.message }))
+            .finally(() => { flashBatch = null; });
+        return { success: true, jobs: ports.length };
+    } catch (error) {
+        flashBatch = null;
+        return { success: false, message: error.message };
+    }
+});
+
+ipcMain.handle('batch-flash-cancel', async () => {
+    if (!flashBatch) {
+        return { success: false, message: 'No batch running' };
+    }
+    flashBatch.cancel();
+    return { success: true };
+});
+
 console.log('eWater Device Manager started');
 
 // ============================================
 // MQTT & OTA HANDLERS
 // ============================================
 const mqtt = require('mqtt');
-const express = require('express');
-const http = require('http');
+const { OtaServer } = require('./ota_server');
+const { FleetBatcher, simulateFleet } = require('./fleet_batcher');
+const { OtaRollout } = require('./ota_rollout');
 
 let mqttClient = null;
+// MQTT traffic reaches the renderer as per-frame batches (see fleet_batcher.js)
+const fleetBatcher = new FleetBatcher(sendToRenderer);
+let stopFleetSimulation = null;
 let otaServer = null;
 let otaServerPort = 0;
+let otaServerUrl = '';
+let otaRollout = null;
 
 // MQTT Connect
 ipcMain.handle('mqtt-connect', async (event, config) => {
@@ -429,6 +495,7 @@ ipcMain.handle('mqtt-connect', async (event, config) => {
             mqttClient.end(true);
             mqttClient = null;
         }
+        fleetBatcher.reset();
 
         const { host, port, username, password } = config || {};
         if (!host || !port) {
@@ -490,11 +557,26 @@ ipcMain.handle('mqtt-connect', async (event, config) => {
         });
 
         mqttClient.on('message', (topic, message) => {
-            sendToRenderer('mqtt-message', { topic, message: message.toString() });
+            if (otaRollout) otaRollout.ingest(topic, message);
+            fleetBatcher.ingest(topic, message);
         });
     });
 });
 
+// Synthetic fleet for load testing the device list (count 0 stops it)
+ipcMain.handle('fleet-simulate', async (event, options) => {
+    const { count, intervalMs } = options || {};
+    if (stopFleetSimulation) {
+        stopFleetSimulation();
+        stopFleetSimulation = null;
+    }
+    if (!count || count < 1) {
+        return { success: true, running: false };
+    }
+    stopFleetSimulation = simulateFleet(fleetBatcher, Math.min(count, 20000), intervalMs || 30000);
+    return { success: true, running: true };
+});
+
 ipcMain.handle('mqtt-subscribe', async (event, topic) => {
     if (!mqttClient) {
         return { success: false, message: 'MQTT not connected' };
@@ -534,9 +616,27 @@ ipcMain.handle('mqtt-publish', async (event, payload) => {
     });
 });
 
+// Fleet-wide push: many messages in one IPC call
+ipcMain.handle('mqtt-publish-batch', async (event, payload) => {
+    if (!mqttClient) {
+        return { success: false, message: 'MQTT not connected' };
+    }
+    const { messages, qos } = payload || {};
+    if (!Array.isArray(messages)) {
+        return { success: false, message: 'Missing messages' };
+    }
+    const results = await Promise.all(messages.map(({ topic, message }) => new Promise((resolve) => {
+        mqttClient.publish(topic, message ?? '', { qos: qos ?? 0 }, (err) => resolve(!err));
+    })));
+    const failed = results.filter(ok => !ok).length;
+    return { success: failed === 0, sent: results.length - failed, failed };
+});
+
 // OTA Server Start
-ipcMain.handle('start-ota-server', async (event, filePath) => {
+ipcMain.handle('start-ota-server', async (event, options) => {
     try {
+        // Older callers pass just the file path
+        const { filePath, version, maxActive } = typeof options === 'string' ? { filePath: options } : options || {};
         if (!filePath) {
             return { success: false, message: 'Missing firmware file path' };
         }
@@ -550,27 +650,12 @@ ipcMain.handle('start-ota-server', async (event, filePath) => {
             otaServerPort = 0;
         }
 
-        const fileName = path.basename(filePath);
-        const appServer = express();
-        const encodedName = encodeURIComponent(fileName);
-
-        appServer.get(`/${encodedName}`, (req, res) => {
-            res.sendFile(filePath);
-        });
-
-        appServer.get('/', (req, res) => {
-            res.send(`eWater OTA server running. Download: /${encodedName}`);
+        otaServer = new OtaServer(filePath, {
+            version: typeof version === 'string' && version.trim() ? version.trim() : undefined,
+            maxActive: Number(maxActive) || undefined,
+            onProgress: (snapshot) => sendToRenderer('ota-downloads', snapshot)
         });
-
-        otaServer = http.createServer(appServer);
-
-        await new Promise((resolve, reject) => {
-            otaServer.once('error', reject);
-            otaServer.listen(0, '0.0.0.0', () => resolve());
-        });
-
-        const address = otaServer.address();
-        otaServerPort = typeof address === 'object' && address ? address.port : 0;
+        otaServerPort = await otaServer.listen(0, '0.0.0.0');
 
         // Find non-internal IPv4
         const nets = os.networkInterfaces();
@@ -587,10 +672,20 @@ ipcMain.handle('start-ota-server', async (event, filePath) => {
             if (found) break;
         }
 
-        const url = `http://${ip}:${otaServerPort}/${encodedName}`;
-        console.log(`OTA Server started at ${url}`);
-        return { success: true, url };
+        const url = `http://${ip}:${otaServerPort}${otaServer.urlPath}`;
+        otaServerUrl = url;
+        console.log(`OTA Server started at ${url} (version ${otaServer.version || 'unknown'}, ` +
+            `${otaServer.artifacts.identity.buf.length} bytes, deflate ${otaServer.artifacts.deflate.buf.length})`);
+        return {
+            success: true,
+            url,
+            version: otaServer.version,
+            maxActive: otaServer.maxActive,
+            rawBytes: otaServer.artifacts.identity.buf.length,
+            deflateBytes: otaServer.artifacts.deflate.buf.length
+        };
     } catch (error) {
+        otaServer = null;
         return { success: false, message: error.message };
     }
 });
@@ -601,6 +696,69 @@ ipcMain.handle('stop-ota-server', async () => {
         otaServer.close();
         otaServer = null;
         otaServerPort = 0;
+        otaServerUrl = '';
+    }
+    if (otaRollout) otaRollout.cancel();
+    return { success: true };
+});
+
+// Staged rollout of the image on the running OTA server (see ota_rollout.js)
+ipcMain.handle('ota-rollout-start', async (event, options) => {
+    // dryRun: only report the plan, so the user can confirm it first
+    const { deviceIds, waves, maxInFlight, soakMinutes, maxFailurePct, secret, dryRun } = options || {};
+    if (!mqttClient || !mqttClient.connected) {
+        return { success: false, message: 'MQTT not connected' };
     }
+    if (!otaServer) {
+        return { success: false, message: 'Start the OTA server first' };
+    }
+    if (!otaServer.version) {
+        return { success: false, message: 'Target version unknown: enter it before starting the server' };
+    }
+    if (otaRollout && !otaRollout.finished()) {
+        return { success: false, message: 'A rollout is already running' };
+    }
+
+    // Devices heard from in the last 90 s; an explicit list narrows it down
+    let devices = fleetBatcher.onlineDevices(90000);
+    if (Array.isArray(deviceIds) && deviceIds.length) {
+        const wanted = new Set(deviceIds);
+        devices = devices.filter(d => wanted.has(d.id));
+    }
+    if (!devices.length) {
+        return { success: false, message: 'No online devices to update' };
+    }
+
+    const rollout = new OtaRollout({
+        publish: (topic, message) => mqttClient?.publish(topic, message, { qos: 1 }),
+        subscribe: (topic) => mqttClient?.subscribe(topic, { qos: 0 }),
+        sign: (deviceId, payload) => (secret
+            ? signCanonical(buildCanonicalPayload('ota', payload, deviceId), secret)
+            : ''),
+        send: sendToRenderer
+    }, {
+        devices,
+        firmwareUrl: otaServerUrl,
+        targetVersion: otaServer.version,
+        waves: Array.isArray(waves) && waves.length ? waves : undefined,
+        maxInFlight: Number(maxInFlight) || undefined,
+        soakMs: Number.isFinite(soakMinutes) ? soakMinutes * 60000 : undefined,
+        maxFailureRate: Number.isFinite(maxFailurePct) ? maxFailurePct / 100 : undefined
+    });
+    if (!dryRun) {
+        otaRollout = rollout;
+        otaRollout.run();
+    }
+    return {
+        success: true,
+        devices: devices.length,
+        toUpdate: rollout.order.length,
+        waves: rollout.waveEnds,
+        targetVersion: otaServer.version
+    };
+});
+
+ipcMain.handle('ota-rollout-cancel', async () => {
+    if (otaRollout) otaRollout.cancel();
     return { success: true };
 });
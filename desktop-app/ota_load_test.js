@@ -0,0 +1,181 @@
+// Load test for ota_server.js: many simulated devices download at once.
+//
+//   node ota_load_test.js [--devices 200] [--max-active 16] [--kbps 300]
+//                         [--firmware path.bin] [--time-scale 0.1]
+//
+// Each simulated device behaves like the firmware's runHttpUpdate():
+// sends X-Device-Id / X-Firmware-Version / Accept-Encoding: deflate, honours
+// 304 and 503 + Retry-After (scaled by --time-scale), and resumes with
+// Range / If-Range after a dropped connection. The server paces each body
+// to --kbps, standing in for WiFi and the ESP32's small TCP window (on
+// loopback the kernel would otherwise buffer a whole image at once). Every
+// finished image is inflated and checked against the original.
+
+const http = require('http');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const zlib = require('zlib');
+const crypto = require('crypto');
+const { OtaServer } = require('./ota_server');
+
+const TARGET_VERSION = '9.9.9-main';
+
+function arg(name, fallback) {
+    const i = process.argv.indexOf('--' + name);
+    return i > 0 ? process.argv[i + 1] : fallback;
+}
+
+const DEVICES = Number(arg('devices', 200));
+const MAX_ACTIVE = Number(arg('max-active', 16));
+const KBPS = Number(arg('kbps', 300));
+const TIME_SCALE = Number(arg('time-scale', 0.1));
+const UP_TO_DATE_SHARE = 0.1; // Already on the target version
+const RAW_SHARE = 0.2;        // No inflate RAM: ask for the raw image
+const DROP_SHARE = 0.2;       // Lose the connection once mid-download
+
+// Stand-in firmware: code-like, about as compressible as a real image
+function syntheticFirmware(bytes) {
+    const words = Array.from({ length: 4096 }, () => crypto.randomBytes(3 + crypto.randomInt(6)));
+    const parts = [];
+    let size = 0;
+    while (size < bytes) {
+        const w = words[crypto.randomInt(words.length)];
+        parts.push(w);
+        size += w.length;
+    }
+    parts.push(Buffer.from(TARGET_VERSION + '\0'));
+    return Buffer.concat(parts);
+}
+
+const sleep = (ms) => new Promise(resolve => setTimeout(resolve, ms));
+const sha = (buf) => crypto.createHash('sha256').update(buf).digest('hex');
+
+// dropHalf: cut the connection halfway through the body
+function get(port, urlPath, headers, dropHalf) {
+    return new Promise((resolve) => {
+        const req = http.get({ host: '127.0.0.1', port, path: urlPath, headers, agent: false }, (res) => {
+            const dropAt = dropHalf ? Math.floor(Number(res.headers['content-length']) / 2) : 0;
+            const chunks = [];
+            let got = 0;
+            res.on('data', (chunk) => {
+                chunks.push(chunk);
+                got += chunk.length;
+                if (dropAt && got >= dropAt) req.destroy();
+            });
+            const done = () => resolve({ status: res.statusCode, headers: res.headers, body: Buffer.concat(chunks) });
+            res.on('end', done);
+            res.on('close', done);
+        });
+        req.on('error', () => resolve({ status: 0, headers: {}, body: Buffer.alloc(0) }));
+    });
+}
+
+async function device(i, port, urlPath, rawSha) {
+    const upToDate = i < DEVICES * UP_TO_DATE_SHARE;
+    const deflate = (i % 10) >= RAW_SHARE * 10;
+    let dropOnce = (i * 7) % 10 < DROP_SHARE * 10;
+    const stats = { busy: 0, resumes: 0, ok: false, current: false, ms: 0, wire: 0 };
+    const started = Date.now();
+
+    let body = [];
+    let received = 0;
+    let total = 0;
+    let etag = '';
+    let retryAfter = 0;
+    for (let attempt = 0; attempt < 40; attempt++) {
+        if (attempt > 0) await sleep((retryAfter || 2) * 1000 * TIME_SCALE * (1 + Math.random() / 2));
+        const headers = {
+            'X-Device-Id': `SIM_${String(i).padStart(3, '0')}`,
+            'X-Firmware-Version': upToDate ? TARGET_VERSION : '2.4.0-main'
+        };
+        if (deflate) headers['Accept-Encoding'] = 'deflate';
+        if (received > 0) {
+            headers.Range = `bytes=${received}-`;
+            headers['If-Range'] = etag;
+        }
+        const res = await get(port, urlPath, headers, dropOnce && received === 0);
+        retryAfter = 0;
+
+        if (res.status === 304) {
+            stats.current = true;
+            break;
+        }
+        if (res.status === 503) {
+            stats.busy++;
+            retryAfter = Number(res.headers['retry-after']) || 5;
+            continue;
+        }
+        if (res.status === 200) {
+            body = [];
+            received = 0;
+            total = Number(res.headers['content-length']);
+            etag = res.headers.etag;
+        } else if (res.status === 206) {
+            stats.resumes++;
+        } else {
+            continue;
+        }
+        body.push(res.body);
+        received += res.body.length;
+        stats.wire += res.body.length;
+        if (received < total) {
+            dropOnce = false; // Dropped (on purpose or not): resume
+            retryAfter = 0.5;
+            continue;
+        }
+        let image = Buffer.concat(body);
+        if (res.headers['content-encoding'] === 'deflate') image = zlib.inflateSync(image);
+        stats.ok = sha(image) === rawSha;
+        break;
+    }
+    stats.ms = Date.now() - started;
+    return stats;
+}
+
+async function main() {
+    const firmwareArg = arg('firmware', '');
+    const file = firmwareArg || path.join(os.tmpdir(), 'ota_load_test_firmware.bin');
+    if (!firmwareArg) fs.writeFileSync(file, syntheticFirmware(1200 * 1024));
+    const raw = fs.readFileSync(file);
+
+    const server = new OtaServer(file, {
+        version: TARGET_VERSION,
+        maxActive: MAX_ACTIVE,
+        perDeviceBps: KBPS * 1024,
+        queueWaitMs: Math.round(20000 * TIME_SCALE)
+    });
+    const port = await server.listen(0, '127.0.0.1');
+    console.log(`Image ${raw.length} bytes, deflate ${server.artifacts.deflate.buf.length} bytes; ` +
+        `${DEVICES} devices, ${MAX_ACTIVE} active max, ${KBPS} KB/s per device, time scale ${TIME_SCALE}`);
+
+    const started = Date.now();
+    const results = await Promise.all(Array.from({ length: DEVICES },
+        (_, i) => device(i, port, server.urlPath, sha(raw))));
+    const elapsed = (Date.now() - started) / 1000;
+    server.close();
+
+    const fetched = results.filter(r => !r.current);
+    const times = fetched.map(r => r.ms).sort((a, b) => a - b);
+    const pct = (p) => times.length ? (times[Math.min(times.length - 1, Math.floor(p * times.length))] / 1000).toFixed(1) : '-';
+    const wire = results.reduce((a, r) => a + r.wire, 0);
+    const s = server.snapshot();
+    console.log({
+        elapsedSec: elapsed.toFixed(1),
+        verified: results.filter(r => r.ok).length,
+        upToDate304: results.filter(r => r.current).length,
+        failed: fetched.filter(r => !r.ok).length,
+        busy503: s.rejected,
+        resumes: results.reduce((a, r) => a + r.resumes, 0),
+        serverMaxActive: s.maxActive,
+        serverMaxQueued: s.maxQueued,
+        wireMB: (wire / 1048576).toFixed(1),
+        rawEquivalentMB: (fetched.length * raw.length / 1048576).toFixed(1),
+        aggregateMBps: (wire / 1048576 / elapsed).toFixed(2),
+        deviceSecP50: pct(0.5),
+        deviceSecP95: pct(0.95)
+    });
+    process.exit(fetched.every(r => r.ok) ? 0 : 1);
+}
+
+main();
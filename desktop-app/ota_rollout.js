@@ -0,0 +1,355 @@
+// Staged fleet OTA rollout (main process).
+//
+// Sends the signed OTA command (vending/<id>/ota/in) to the fleet in waves
+// (by default 5%, 25%, 50%, then everyone), with at most maxInFlight devices
+// updating at a time so a site uplink is never asked for more than a few
+// images at once. A device counts as updated when its heartbeat reports the
+// target firmware_version.
+//
+// After each wave the rollout soaks, watching heartbeats, and halts on its
+// own when the updated devices look worse than the rest of the fleet:
+//   - too many failures: OTA_ERROR, no "Starting HTTP update" reply, no
+//     heartbeat on the target version in time, or back on the old version
+//   - regressions: an updated device reboots again or stops heartbeating
+//   - a higher UART frame error rate than the devices not yet updated
+// The gate is also checked while a wave is in flight, so a bad image stops
+// the rollout as soon as it shows.
+
+const ROLLOUT_WAVES = [5, 25, 50, 100];      // Cumulative % of the devices to update
+const ROLLOUT_MAX_IN_FLIGHT = 10;
+const ROLLOUT_SOAK_MS = 5 * 60 * 1000;       // Watch each wave before the next
+const ROLLOUT_ACK_TIMEOUT_MS = 60 * 1000;    // Command sent -> "Starting HTTP update"
+const ROLLOUT_UPDATE_TIMEOUT_MS = 10 * 60 * 1000; // Command sent -> heartbeat on target
+const ROLLOUT_SILENT_MS = 90 * 1000;         // Three missed 30 s heartbeats
+const ROLLOUT_MAX_FAILURE_RATE = 0.1;        // Failed + regressed / devices tried
+const ROLLOUT_MIN_FAILURES = 2;              // One unlucky device does not halt
+const ROLLOUT_MIN_FRAMES = 1000;             // UART frames before the error rate counts
+const ROLLOUT_ERROR_RATE_MARGIN = 0.01;      // Allowed above max(2 x old firmware, old + margin)
+const ROLLOUT_TICK_MS = 1000;
+const ROLLOUT_PROGRESS_MS = 500;
+
+// Cumulative wave percentages -> end index of each wave (last one = count)
+function waveBounds(percents, count) {
+    const ends = [];
+    for (const pct of percents) {
+        const end = Math.min(count, Math.max(1, Math.ceil(count * pct / 100)));
+        if (!ends.length || end > ends[ends.length - 1]) ends.push(end);
+    }
+    if (count && (!ends.length || ends[ends.length - 1] < count)) ends.push(count);
+    return ends;
+}
+
+// UART counters from a heartbeat (this side and the Payment side)
+function uartCounters(hb) {
+    const u = hb.uart || {};
+    const n = (v) => (Number.isFinite(v) ? v : 0);
+    return {
+        frames: n(u.good) + n(u.bad) + n(u.peer_good) + n(u.peer_bad),
+        errors: n(u.bad) + n(u.hw_errors) + n(u.peer_bad) + n(u.peer_hw_errors)
+    };
+}
+
+class OtaRollout {
+    // deps: { publish(topic, message), subscribe(topic), sign(deviceId, payload) -> sig | '', send, now }
+    // options: { devices: [{ id, firmware_version }], firmwareUrl, targetVersion,
+    //            waves, maxInFlight, soakMs, ackTimeoutMs, updateTimeoutMs, maxFailureRate }
+    constructor(deps, options) {
+        this.publish = deps.publish;
+        this.subscribe = deps.subscribe;
+        this.sign = deps.sign;
+        this.send = deps.send;
+        this.now = deps.now || Date.now;
+        this.firmwareUrl = options.firmwareUrl;
+        this.targetVersion = options.targetVersion;
+        this.maxInFlight = Math.max(1, options.maxInFlight || ROLLOUT_MAX_IN_FLIGHT);
+        this.soakMs = options.soakMs ?? ROLLOUT_SOAK_MS;
+        this.ackTimeoutMs = options.ackTimeoutMs || ROLLOUT_ACK_TIMEOUT_MS;
+        this.updateTimeoutMs = options.updateTimeoutMs || ROLLOUT_UPDATE_TIMEOUT_MS;
+        this.maxFailureRate = options.maxFailureRate ?? ROLLOUT_MAX_FAILURE_RATE;
+
+        // Already on the target: nothing to do, but still part of the fleet view
+        this.devices = new Map();
+        const todo = [];
+        for (const d of options.devices) {
+            const dev = {
+                id: d.id,
+                fromVersion: d.firmware_version || '',
+                version: d.firmware_version || '',
+                state: d.firmware_version === this.targetVersion ? 'skipped' : 'pending',
+                wave: -1,
+                sentAt: 0,
+                updatedAt: 0,
+                lastSeen: 0,
+                uptime: -1,
+                counters: null,
+                frames: 0,
+                errors: 0,
+                message: ''
+            };
+            this.devices.set(d.id, dev);
+            if (dev.state === 'pending') todo.push(dev);
+        }
+        this.order = todo;
+        this.waveEnds = waveBounds(options.waves || ROLLOUT_WAVES, todo.length);
+        this.wave = 0;
+        this.next = 0;             // Next index in `order` to send
+        this.phase = 'idle';       // dispatching | soaking | done | halted | cancelled
+        this.soakEndsAt = 0;
+        this.haltReason = '';
+        this.startedAt = 0;
+        this.timer = null;
+        this.lastProgressAt = 0;
+        this.resolveDone = null;
+    }
+
+    run() {
+        this.startedAt = this.now();
+        this.phase = this.order.length ? 'dispatching' : 'done';
+        this.subscribe('vending/+/heartbeat');
+        return new Promise((resolve) => {
+            this.resolveDone = resolve;
+            this.tick();
+            if (!this.finished()) {
+                this.timer = setInterval(() => this.tick(), ROLLOUT_TICK_MS);
+            }
+        });
+    }
+
+    cancel() {
+        if (!this.finished()) this.finish('cancelled', 'Cancelled by user');
+    }
+
+    finished() {
+        return this.phase === 'done' || this.phase === 'halted' || this.phase === 'cancelled';
+    }
+
+    // Every MQTT message while the rollout runs
+    ingest(topic, payload) {
+        const parts = topic.split('/');
+        if (parts.length < 3 || parts[0] !== 'vending') return;
+        const dev = this.devices.get(parts[1]);
+        if (!dev || this.finished()) return;
+        let data;
+        try {
+            data = JSON.parse(payload.toString());
+        } catch {
+            return;
+        }
+        if (parts[2] === 'heartbeat') {
+            this.onHeartbeat(dev, data);
+        } else if (parts[2] === 'log' && parts[3] === 'out') {
+            this.onLog(dev, data);
+        }
+    }
+
+    onHeartbeat(dev, hb) {
+        const now = this.now();
+        const rebooted = Number.isFinite(hb.uptime) && dev.uptime >= 0 && hb.uptime < dev.uptime;
+        dev.lastSeen = now;
+        if (Number.isFinite(hb.uptime)) dev.uptime = hb.uptime;
+        if (hb.firmware_version) dev.version = hb.firmware_version;
+
+        // Error counters restart with the device: only add deltas within one boot
+        const c = uartCounters(hb);
+        if (dev.counters && !rebooted && c.frames >= dev.counters.frames) {
+            dev.frames += c.frames - dev.counters.frames;
+            dev.errors += Math.max(0, c.errors - dev.counters.errors);
+        }
+        dev.counters = c;
+
+        // A timed-out device that turns up on the target later still counts
+        const inFlight = dev.state === 'sent' || dev.state === 'downloading';
+        if ((inFlight || dev.state === 'failed') && dev.version === this.targetVersion) {
+            dev.state = 'updated';
+            dev.updatedAt = now;
+            // The error rate of the new firmware starts here
+            dev.frames = 0;
+            dev.errors = 0;
+        } else if (inFlight && rebooted) {
+            dev.state = 'failed';
+            dev.message = `Rebooted on ${dev.version}`;
+        } else if (dev.state === 'updated' && rebooted) {
+            dev.state = 'regressed';
+            dev.message = dev.version === this.targetVersion ? 'Rebooted after update' : `Rolled back to ${dev.version}`;
+        }
+    }
+
+    onLog(dev, log) {
+        const event = String(log.event || '');
+        const message = String(log.message || '');
+        if (dev.state === 'sent' && event === 'OTA' && message.startsWith('Starting')) {
+            dev.state = 'downloading';
+        } else if ((dev.state === 'sent' || dev.state === 'downloading') && event === 'OTA_ERROR') {
+            dev.state = 'failed';
+            dev.message = message || 'OTA_ERROR';
+        } else if (event === 'OTA' && message.startsWith('Already up to date') && dev.state !== 'updated') {
+            dev.state = 'updated';
+            dev.updatedAt = this.now();
+        }
+    }
+
+    tick() {
+        if (this.finished()) return;
+        const now = this.now();
+        this.checkTimeouts(now);
+
+        const verdict = this.gate();
+        if (verdict) {
+            this.finish('halted', verdict);
+            return;
+        }
+
+        if (this.phase === 'dispatching') {
+            const end = this.waveEnds[this.wave];
+            while (this.next < end && this.inFlight() < this.maxInFlight) {
+                this.dispatch(this.order[this.next++], now);
+            }
+            if (this.next >= end && this.inFlight() === 0) {
+                if (this.wave === this.waveEnds.length - 1) {
+                    this.finish('done', '');
+                    return;
+                }
+                this.phase = 'soaking';
+                this.soakEndsAt = now + this.soakMs;
+            }
+        }
+        if (this.phase === 'soaking' && now >= this.soakEndsAt) {
+            this.wave++;
+            this.phase = 'dispatching';
+            this.tick();
+            return;
+        }
+        if (now - this.lastProgressAt >= ROLLOUT_PROGRESS_MS) this.reportProgress();
+    }
+
+    dispatch(dev, now) {
+        const payload = {
+            firmware_url: this.firmwareUrl,
+            nonce: `ota_${now}_${Math.random().toString(16).slice(2, 10)}`,
+            ts: now
+        };
+        const sig = this.sign(dev.id, payload);
+        if (sig) payload.sig = sig;
+        this.subscribe(`vending/${dev.id}/log/out`);
+        this.publish(`vending/${dev.id}/ota/in`, JSON.stringify(payload));
+        dev.state = 'sent';
+        dev.wave = this.wave;
+        dev.sentAt = now;
+    }
+
+    checkTimeouts(now) {
+        this.devices.forEach((dev) => {
+            if (dev.state === 'sent' && now - dev.sentAt > this.ackTimeoutMs) {
+                dev.state = 'failed';
+                dev.message = 'No reply to the OTA command (offline, busy or bad signature?)';
+            } else if (dev.state === 'downloading' && now - dev.sentAt > this.updateTimeoutMs) {
+                dev.state = 'failed';
+                dev.message = `Not on ${this.targetVersion} after ${Math.round(this.updateTimeoutMs / 60000)} min`;
+            } else if (dev.state === 'updated' && now - Math.max(dev.lastSeen, dev.updatedAt) > ROLLOUT_SILENT_MS) {
+                dev.state = 'regressed';
+                dev.message = 'No heartbeat since the update';
+            }
+        });
+    }
+
+    inFlight() {
+        let n = 0;
+        this.devices.forEach((dev) => {
+            if (dev.state === 'sent' || dev.state === 'downloading') n++;
+        });
+        return n;
+    }
+
+    // Reason to halt, or '' while the updated devices look healthy
+    gate() {
+        const c = this.counts();
+        const bad = c.failed + c.regressed;
+        const tried = c.updated + bad;
+        if (bad >= ROLLOUT_MIN_FAILURES && bad / tried > this.maxFailureRate) {
+            return `${bad} of ${tried} devices failed or regressed (${c.failed} failed, ${c.regressed} regressed)`;
+        }
+        const rate = (cohort) => (cohort.frames ? cohort.errors / cohort.frames : 0);
+        if (c.newFw.frames >= ROLLOUT_MIN_FRAMES && c.oldFw.frames >= ROLLOUT_MIN_FRAMES) {
+            const newRate = rate(c.newFw);
+            const oldRate = rate(c.oldFw);
+            if (newRate > Math.max(oldRate * 2, oldRate + ROLLOUT_ERROR_RATE_MARGIN)) {
+                return `UART error rate ${(newRate * 100).toFixed(2)}% on ${this.targetVersion} ` +
+                    `vs ${(oldRate * 100).toFixed(2)}% on the old firmware`;
+            }
+        }
+        return '';
+    }
+
+    counts() {
+        const c = {
+            total: this.devices.size, skipped: 0, pending: 0, sent: 0, downloading: 0,
+            updated: 0, failed: 0, regressed: 0,
+            newFw: { frames: 0, errors: 0 }, oldFw: { frames: 0, errors: 0 }
+        };
+        this.devices.forEach((dev) => {
+            c[dev.state]++;
+            const cohort = dev.state === 'updated' ? c.newFw : dev.state === 'pending' ? c.oldFw : null;
+            if (cohort) {
+                cohort.frames += dev.frames;
+                cohort.errors += dev.errors;
+            }
+        });
+        return c;
+    }
+
+    finish(phase, reason) {
+        this.phase = phase;
+        this.haltReason = reason;
+        clearInterval(this.timer);
+        this.timer = null;
+        const summary = this.reportProgress();
+        this.send('rollout-done', summary);
+        console.log(`OTA rollout ${phase}: ${summary.updated}/${summary.total - summary.skipped} updated` +
+            (reason ? ` (${reason})` : ''));
+        if (this.resolveDone) this.resolveDone(summary);
+    }
+
+    reportProgress() {
+        const now = this.now();
+        this.lastProgressAt = now;
+        const c = this.counts();
+        const waveEnd = this.waveEnds[this.wave] || 0;
+        const summary = {
+            phase: this.phase,
+            wave: this.wave + 1,
+            waves: this.waveEnds.length,
+            waveDevices: waveEnd - (this.waveEnds[this.wave - 1] || 0),
+            soakLeftMs: this.phase === 'soaking' ? Math.max(0, this.soakEndsAt - now) : 0,
+            haltReason: this.haltReason,
+            elapsedMs: now - this.startedAt,
+            targetVersion: this.targetVersion,
+            total: c.total,
+            skipped: c.skipped,
+            pending: c.pending,
+            inFlight: c.sent + c.downloading,
+            updated: c.updated,
+            failed: c.failed,
+            regressed: c.regressed,
+            newErrorRate: c.newFw.frames ? c.newFw.errors / c.newFw.frames : 0,
+            oldErrorRate: c.oldFw.frames ? c.oldFw.errors / c.oldFw.frames : 0
+        };
+        // Rows only for devices the rollout has touched
+        const devices = [];
+        this.devices.forEach((dev) => {
+            if (dev.wave < 0) return;
+            devices.push({
+                id: dev.id,
+                wave: dev.wave + 1,
+                state: dev.state,
+                fromVersion: dev.fromVersion,
+                version: dev.version,
+                seconds: Math.round(((dev.updatedAt || now) - dev.sentAt) / 1000),
+                message: dev.message
+            });
+        });
+        this.send('rollout-progress', { summary, devices });
+        return summary;
+    }
+}
+
+module.exports = { OtaRollout, waveBounds, uartCounters, ROLLOUT_WAVES, ROLLOUT_MAX_IN_FLIGHT };
@@ -0,0 +1,317 @@
+// Local firmware server for HTTP OTA (main process).
+//
+// A group OTA (TOPIC_GROUP_COMMAND) sends every device to this server at
+// once, so it:
+//   - serves the image from memory, raw or precompressed (zlib "deflate",
+//     inflated on the device) depending on Accept-Encoding
+//   - answers 304 to a device whose X-Firmware-Version already matches
+//   - supports Range / If-Range so a dropped download resumes
+//   - sends at most maxActive bodies at a time; further requests wait in a
+//     FIFO queue for up to queueWaitMs, then get 503 + Retry-After
+//   - tracks every device's download (bytes, rate, resumes) for the UI
+//
+// Only Node built-ins are used so ota_load_test.js can drive it directly.
+
+const http = require('http');
+const fs = require('fs');
+const path = require('path');
+const zlib = require('zlib');
+const crypto = require('crypto');
+
+const OTA_MAX_ACTIVE = 8;
+const OTA_MAX_QUEUED = 512;
+const OTA_QUEUE_WAIT_MS = 20000;  // Below the device's 30 s HTTP timeout
+const OTA_CHUNK_BYTES = 16 * 1024;
+const OTA_PROGRESS_MS = 250;
+
+// "bytes=a-b", "bytes=a-" or "bytes=-n" -> { start, end } (inclusive).
+// null: no usable range (serve the whole body); 'invalid': 416.
+function parseRange(header, size) {
+    if (!header) return null;
+    const m = /^bytes=(\d*)-(\d*)$/.exec(header.trim());
+    if (!m || (m[1] === '' && m[2] === '')) return null; // Multi-range etc.
+    let start;
+    let end;
+    if (m[1] === '') {
+        start = Math.max(0, size - Number(m[2]));
+        end = size - 1;
+    } else {
+        start = Number(m[1]);
+        end = m[2] === '' ? size - 1 : Math.min(Number(m[2]), size - 1);
+    }
+    if (start >= size || end < start) return 'invalid';
+    return { start, end };
+}
+
+// FIRMWARE_VERSION is compiled into the image as e.g. "2.4.1-main"
+function detectFirmwareVersion(buf) {
+    const m = /\d+\.\d+\.\d+-(?:main|payment)(?=\0)/.exec(buf.toString('latin1'));
+    return m ? m[0] : '';
+}
+
+function makeArtifact(buf, encoding) {
+    const hash = crypto.createHash('sha256').update(buf).digest('hex');
+    return { buf, encoding, etag: `"${hash.slice(0, 16)}-${encoding}"` };
+}
+
+class OtaServer {
+    // options: { version, maxActive, queueWaitMs, perDeviceBps, onProgress }. `version`
+    // defaults to the one found in the image; '' turns the 304 check off.
+    constructor(filePath, options = {}) {
+        this.filePath = filePath;
+        this.fileName = path.basename(filePath);
+        this.urlPath = '/' + encodeURIComponent(this.fileName);
+        this.version = options.version || '';
+        this.maxActive = options.maxActive || OTA_MAX_ACTIVE;
+        this.queueWaitMs = options.queueWaitMs || OTA_QUEUE_WAIT_MS;
+        this.onProgress = options.onProgress || null;
+        // Pace each body (0 = as fast as TCP allows). The load test uses it
+        // to stand in for a device's small TCP window on loopback.
+        this.perDeviceBps = options.perDeviceBps || 0;
+
+        const raw = fs.readFileSync(filePath);
+        if (options.version === undefined) this.version = detectFirmwareVersion(raw);
+        this.artifacts = {
+            identity: makeArtifact(raw, 'identity'),
+            deflate: makeArtifact(zlib.deflateSync(raw, { level: 9 }), 'deflate')
+        };
+        this.active = 0;
+        this.queue = [];
+        this.downloads = new Map(); // device id -> progress record
+        this.stats = { requests: 0, notModified: 0, rejected: 0, bytesSent: 0, maxActive: 0, maxQueued: 0 };
+        this.server = http.createServer((req, res) => this.handle(req, res));
+        this.progressTimer = null;
+    }
+
+    listen(port = 0, host = '0.0.0.0') {
+        return new Promise((resolve, reject) => {
+            this.server.once('error', reject);
+            this.server.listen(port, host, () => {
+                if (this.onProgress) {
+                    this.progressTimer = setInterval(() => this.reportProgress(), OTA_PROGRESS_MS);
+                }
+                resolve(this.server.address().port);
+            });
+        });
+    }
+
+    close() {
+        clearInterval(this.progressTimer);
+        this.queue.forEach(q => q.res.destroy());
+        this.queue = [];
+        this.server.close();
+        this.server.closeAllConnections?.();
+    }
+
+    handle(req, res) {
+        const url = req.url.split('?')[0];
+        if (url === '/') {
+            res.end(`eWater OTA server running. Download: ${this.urlPath}`);
+            return;
+        }
+        if (url !== this.urlPath || req.method !== 'GET') {
+            res.writeHead(404);
+            res.end();
+            return;
+        }
+
+        this.stats.requests++;
+        const deviceId = String(req.headers['x-device-id'] || req.socket.remoteAddress || 'unknown');
+        const fromVersion = String(req.headers['x-firmware-version'] || '');
+        const dl = this.track(deviceId, fromVersion);
+
+        if (this.version && fromVersion === this.version) {
+            this.stats.notModified++;
+            dl.state = 'current';
+            res.writeHead(304);
+            res.end();
+            return;
+        }
+
+        const wantsDeflate = /\bdeflate\b/.test(String(req.headers['accept-encoding'] || ''));
+        const artifact = wantsDeflate ? this.artifacts.deflate : this.artifacts.identity;
+        let range = parseRange(req.headers.range, artifact.buf.length);
+        const ifRange = req.headers['if-range'];
+        if (range && ifRange && ifRange !== artifact.etag) {
+            range = null; // Image changed since the first part: send it all
+        }
+        if (range === 'invalid') {
+            res.writeHead(416, { 'Content-Range': `bytes */${artifact.buf.length}` });
+            res.end();
+            return;
+        }
+
+        const job = { dl, req, res, artifact, range, queuedAt: Date.now(), timer: null };
+        if (this.active < this.maxActive) {
+            this.start(job);
+        } else if (this.queue.length < OTA_MAX_QUEUED) {
+            this.enqueue(job);
+        } else {
+            this.reject(job);
+        }
+    }
+
+    track(deviceId, fromVersion) {
+        let dl = this.downloads.get(deviceId);
+        if (!dl) {
+            dl = {
+                deviceId, fromVersion, state: 'queued', encoding: '', offset: 0, sent: 0, total: 0,
+                startedAt: 0, finishedAt: 0, bytesPerSec: 0, resumes: 0, busy: 0
+            };
+            this.downloads.set(deviceId, dl);
+        }
+        dl.fromVersion = fromVersion || dl.fromVersion;
+        return dl;
+    }
+
+    enqueue(job) {
+        job.dl.state = 'queued';
+        this.queue.push(job);
+        this.stats.maxQueued = Math.max(this.stats.maxQueued, this.queue.length);
+        job.timer = setTimeout(() => {
+            this.dequeue(job);
+            this.reject(job);
+        }, this.queueWaitMs);
+        job.res.on('close', () => this.dequeue(job));
+    }
+
+    dequeue(job) {
+        clearTimeout(job.timer);
+        const i = this.queue.indexOf(job);
+        if (i >= 0) this.queue.splice(i, 1);
+    }
+
+    // Retry-After: roughly when this device's turn would come round
+    reject(job) {
+        this.stats.rejected++;
+        job.dl.state = 'busy';
+        job.dl.busy++;
+        const ahead = this.queue.length / this.maxActive;
+        const retryAfter = Math.max(5, Math.min(60, Math.round(5 + ahead * 5)));
+        if (!job.res.writableEnded && !job.res.destroyed) {
+            job.res.writeHead(503, { 'Retry-After': String(retryAfter) });
+            job.res.end();
+        }
+    }
+
+    start(job) {
+        const { dl, res, artifact, range } = job;
+        this.active++;
+        this.stats.maxActive = Math.max(this.stats.maxActive, this.active);
+
+        const size = artifact.buf.length;
+        const start = range ? range.start : 0;
+        const end = range ? range.end : size - 1;
+        const headers = {
+            'Content-Type': 'application/octet-stream',
+            'Content-Length': String(end - start + 1),
+            'Accept-Ranges': 'bytes',
+            'ETag': artifact.etag,
+            'X-Image-Size': String(this.artifacts.identity.buf.length)
+        };
+        if (artifact.encoding !== 'identity') headers['Content-Encoding'] = artifact.encoding;
+        if (range) headers['Content-Range'] = `bytes ${start}-${end}/${size}`;
+
+        if (range && start > 0 && dl.total === size) dl.resumes++;
+        dl.state = 'sending';
+        dl.encoding = artifact.encoding;
+        dl.offset = start;
+        dl.sent = 0;
+        dl.total = size;
+        if (!range || !dl.startedAt) dl.startedAt = Date.now();
+
+        let released = false;
+        const release = () => {
+            if (released) return;
+            released = true;
+            this.active--;
+            const next = this.queue.shift();
+            if (next) {
+                clearTimeout(next.timer);
+                this.start(next);
+            }
+        };
+
+        res.writeHead(range ? 206 : 200, headers);
+
+        let pos = start;
+        const sendStarted = Date.now();
+        const pump = () => {
+            while (pos <= end) {
+                if (res.destroyed) return;
+                if (this.perDeviceBps) {
+                    const wait = sendStarted + (pos - start) * 1000 / this.perDeviceBps - Date.now();
+                    if (wait > 1) {
+                        setTimeout(pump, wait);
+                        return;
+                    }
+                }
+                const chunkEnd = Math.min(pos + OTA_CHUNK_BYTES, end + 1);
+                const chunk = artifact.buf.subarray(pos, chunkEnd);
+                dl.sent += chunk.length;
+                this.stats.bytesSent += chunk.length;
+                pos = chunkEnd;
+                if (!res.write(chunk)) {
+                    res.once('drain', pump);
+                    return;
+                }
+            }
+            res.end();
+        };
+        res.on('finish', () => {
+            dl.state = dl.offset + dl.sent >= size ? 'done' : 'aborted';
+            dl.finishedAt = Date.now();
+            release();
+        });
+        res.on('close', () => {
+            if (!res.writableFinished) {
+                dl.state = 'aborted';
+                dl.finishedAt = Date.now();
+            }
+            release();
+        });
+        pump();
+    }
+
+    snapshot() {
+        const now = Date.now();
+        const devices = [];
+        let sending = 0;
+        let done = 0;
+        this.downloads.forEach((dl) => {
+            const received = dl.offset + dl.sent;
+            const elapsed = ((dl.finishedAt && dl.state !== 'sending' ? dl.finishedAt : now) - dl.startedAt) / 1000;
+            dl.bytesPerSec = dl.startedAt && elapsed > 0 ? Math.round(received / elapsed) : 0;
+            if (dl.state === 'sending') sending++;
+            if (dl.state === 'done' || dl.state === 'current') done++;
+            devices.push({
+                deviceId: dl.deviceId,
+                fromVersion: dl.fromVersion,
+                state: dl.state,
+                encoding: dl.encoding,
+                percent: dl.total ? Math.floor(received * 100 / dl.total) : 0,
+                received,
+                total: dl.total,
+                bytesPerSec: dl.bytesPerSec,
+                resumes: dl.resumes,
+                busy: dl.busy
+            });
+        });
+        return {
+            devices,
+            active: this.active,
+            queued: this.queue.length,
+            sending,
+            done,
+            rawBytes: this.artifacts.identity.buf.length,
+            deflateBytes: this.artifacts.deflate.buf.length,
+            ...this.stats
+        };
+    }
+
+    reportProgress() {
+        if (this.downloads.size) this.onProgress(this.snapshot());
+    }
+}
+
+module.exports = { OtaServer, parseRange, detectFirmwareVersion, OTA_MAX_ACTIVE };
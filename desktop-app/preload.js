@@ -4,12 +4,15 @@ const { contextBridge, ipcRenderer } = require('electron');
 // the ipcRenderer without exposing the entire object
 contextBridge.exposeInMainWorld('electronAPI', {
     // Serial port operations
-    scanPorts: () => ipcRenderer.invoke('scan-ports'),
+    scanPorts: (options) => ipcRenderer.invoke('scan-ports', options),
     connectDevice: (portPath) => ipcRenderer.invoke('connect-device', portPath),
     disconnectDevice: () => ipcRenderer.invoke('disconnect-device'),
     sendCommand: (command) => ipcRenderer.invoke('send-command', command),
+    sendConfigFrame: (fields) => ipcRenderer.invoke('send-config-frame', fields),
     selectFirmware: () => ipcRenderer.invoke('select-firmware'),
     flashFirmware: (payload) => ipcRenderer.invoke('flash-firmware', payload),
+    startBatchFlash: (payload) => ipcRenderer.invoke('batch-flash-start', payload),
+    cancelBatchFlash: () => ipcRenderer.invoke('batch-flash-cancel'),
 
     // Serial data listeners
     onSerialData: (callback) => ipcRenderer.on('serial-data', (event, data) => callback(data)),
@@ -17,6 +20,8 @@ contextBridge.exposeInMainWorld('electronAPI', {
     onSerialClosed: (callback) => ipcRenderer.on('serial-closed', (event, message) => callback(message)),
     onFlashProgress: (callback) => ipcRenderer.on('flash-progress', (event, data) => callback(data)),
     onFlashDone: (callback) => ipcRenderer.on('flash-done', (event, data) => callback(data)),
+    onBatchProgress: (callback) => ipcRenderer.on('batch-progress', (event, data) => callback(data)),
+    onBatchDone: (callback) => ipcRenderer.on('batch-done', (event, data) => callback(data)),
     removeFlashListeners: () => {
         ipcRenderer.removeAllListeners('flash-progress');
         ipcRenderer.removeAllListeners('flash-done');
@@ -26,13 +31,21 @@ contextBridge.exposeInMainWorld('electronAPI', {
     mqttConnect: (config) => ipcRenderer.invoke('mqtt-connect', config),
     mqttSubscribe: (topic) => ipcRenderer.invoke('mqtt-subscribe', topic),
     mqttPublish: (payload) => ipcRenderer.invoke('mqtt-publish', payload),
+    mqttPublishBatch: (payload) => ipcRenderer.invoke('mqtt-publish-batch', payload),
     signPayload: (payload) => ipcRenderer.invoke('sign-payload', payload),
+    signBatch: (req) => ipcRenderer.invoke('sign-batch', req),
 
     // MQTT listeners
     onMqttStatus: (callback) => ipcRenderer.on('mqtt-status', (event, data) => callback(data)),
-    onMqttMessage: (callback) => ipcRenderer.on('mqtt-message', (event, data) => callback(data)),
+    onMqttBatch: (callback) => ipcRenderer.on('mqtt-batch', (event, data) => callback(data)),
+    simulateFleet: (options) => ipcRenderer.invoke('fleet-simulate', options),
 
     // OTA operations
-    startOtaServer: (file) => ipcRenderer.invoke('start-ota-server', file),
-    stopOtaServer: () => ipcRenderer.invoke('stop-ota-server')
+    startOtaServer: (options) => ipcRenderer.invoke('start-ota-server', options),
+    stopOtaServer: () => ipcRenderer.invoke('stop-ota-server'),
+    onOtaDownloads: (callback) => ipcRenderer.on('ota-downloads', (event, data) => callback(data)),
+    startOtaRollout: (options) => ipcRenderer.invoke('ota-rollout-start', options),
+    cancelOtaRollout: () => ipcRenderer.invoke('ota-rollout-cancel'),
+    onRolloutProgress: (callback) => ipcRenderer.on('rollout-progress', (event, data) => callback(data)),
+    onRolloutDone: (callback) => ipcRenderer.on('rollout-done', (event, data) => callback(data))
 });
@@ -1,4 +1,5 @@
 import { logToElement } from './utils.js';
+import { createFleetView } from './fleet_view.js';
 
 export function setupOnline(prefix) {
     const p = prefix; // 'online_'
@@ -6,14 +7,26 @@ export function setupOnline(prefix) {
     // State
     let isConnected = false;
     let selectedDevice = null;
-    let devices = new Map(); // id -> { lastSeen, firmware, ... }
     let otaServerUrl = null;
+    let simulating = false;
 
     // Elements
     const connectBtn = document.getElementById('mqttConnectBtn');
     const mqttStatusDot = document.getElementById('mqttStatusDot');
     const mqttStatusText = document.getElementById('mqttStatusText');
     const devicesList = document.getElementById('onlineDevicesList');
+    const fleetStats = document.getElementById('fleetStats');
+    const fleetSimBtn = document.getElementById('fleetSimBtn');
+    const fleetSimCount = document.getElementById('fleetSimCount');
+
+    const fleet = createFleetView(devicesList, {
+        onSelect: selectDevice,
+        onStats: (s) => {
+            if (!s.devices) return;
+            fleetStats.textContent = `${s.devices} devices | ${s.fps} fps (worst frame ${s.worstFrameMs} ms) | ` +
+                `${s.batchesPerSec} batches/s | ${s.patchesPerSec} card updates/s | ${s.onScreen} cards in DOM`;
+        }
+    });
 
     // Config
     const applyBasicConfigBtn = document.getElementById('onlineApplyBasicConfigBtn');
@@ -29,6 +42,12 @@ export function setupOnline(prefix) {
     const otaProgressText = document.getElementById('otaProgressText');
     const selectedDeviceOta = document.getElementById('selectedDeviceOta');
     const otaLogs = 'otaLogs';
+    const otaServerStats = document.getElementById('otaServerStats');
+    const otaDownloadRows = document.getElementById('otaDownloadRows');
+    const rolloutStartBtn = document.getElementById('rolloutStartBtn');
+    const rolloutCancelBtn = document.getElementById('rolloutCancelBtn');
+    const rolloutRows = document.getElementById('rolloutRows');
+    const rolloutLog = 'rolloutLog';
 
     // Monitor
     const monitorOutput = 'onlineMonitorOutput';
@@ -39,6 +58,7 @@ export function setupOnline(prefix) {
     connectBtn.addEventListener('click', toggleConnection);
     applyBasicConfigBtn?.addEventListener('click', () => sendConfig('basic'));
     applyExtraConfigBtn?.addEventListener('click', () => sendConfig('extra'));
+    document.getElementById('onlineApplyExtraFleetBtn')?.addEventListener('click', () => sendConfigToFleet('extra'));
 
     startOtaServerBtn.addEventListener('click', toggleOtaServer);
     sendOtaBtn.addEventListener('click', triggerOtaUpdate);
@@ -48,17 +68,31 @@ export function setupOnline(prefix) {
         }
     });
 
+    rolloutStartBtn.addEventListener('click', startRollout);
+    rolloutCancelBtn.addEventListener('click', () => window.electronAPI.cancelOtaRollout());
+
+    fleetSimBtn.addEventListener('click', toggleSimulation);
+
     clearMonitorBtn.addEventListener('click', () => {
         document.getElementById(monitorOutput).innerHTML = '';
     });
 
     // MQTT Listeners
+    window.electronAPI.onOtaDownloads(renderOtaDownloads);
+    window.electronAPI.onRolloutProgress(renderRolloutProgress);
+    window.electronAPI.onRolloutDone(finishRollout);
+
     window.electronAPI.onMqttStatus((data) => {
         updateStatus(data.status, data.message);
     });
 
-    window.electronAPI.onMqttMessage((data) => {
-        handleMqttMessage(data.topic, data.message);
+    // One batch per frame: coalesced heartbeat diffs + everything else in order
+    window.electronAPI.onMqttBatch((batch) => {
+        fleet.applyBatch(batch.devices);
+        batch.messages.forEach((m) => handleMqttMessage(m.topic, m.message));
+        if (batch.dropped) {
+            logToElement(monitorOutput, `${batch.dropped} messages dropped (too many in one frame)`, 'error');
+        }
     });
 
     // Online mode: some config fields are serial-only on current firmware.
@@ -106,6 +140,7 @@ export function setupOnline(prefix) {
 
         updateStatus('connecting');
 
+        fleet.clear();
         await window.electronAPI.mqttConnect({
             host, port, username: user, password: pass
         });
@@ -140,10 +175,9 @@ export function setupOnline(prefix) {
         mqttStatusText.title = message || '';
     }
 
+    // Heartbeats never get here: fleet_batcher.js folds them into batch.devices
     function handleMqttMessage(topic, msgStr) {
-        if (topic.endsWith('/heartbeat')) {
-            handleHeartbeat(topic, msgStr);
-        } else if (topic.endsWith('/status/out')) {
+        if (topic.endsWith('/status/out')) {
             if (!selectedDevice || !topic.includes(selectedDevice)) return;
             try {
                 const data = JSON.parse(msgStr);
@@ -190,6 +224,29 @@ export function setupOnline(prefix) {
                     }
                 }
             }
+        } else if (topic.endsWith('/telemetry')) {
+            // Decoded from MessagePack in the main process (telemetry_decoder.js)
+            if (!selectedDevice || !topic.includes(selectedDevice)) return;
+            try {
+                const data = JSON.parse(msgStr);
+                if (data.type !== 'stats') return; // boot/heap reports: not shown here
+                const range = (c) => `${c.min}/${c.mean}/${c.max}`;
+                logToElement(monitorOutput,
+                    `[TELEMETRY] ${data.samples}s | vol=${data.volume_l}L | flow=${range(data.flow)} L/min | ` +
+                    `tds=${range(data.tds)} | rssi=${range(data.rssi)} | heap=${range(data.heap)} | loop=${range(data.loop)}us`,
+                    'response');
+            } catch {
+                // ignore
+            }
+        } else if (topic.endsWith('/alerts')) {
+            if (!selectedDevice || !topic.includes(selectedDevice)) return;
+            try {
+                const a = JSON.parse(msgStr);
+                logToElement(monitorOutput, `[ALERT] ${a.alert} ${a.state} | value=${a.value} threshold=${a.threshold}`,
+                    a.state === 'raised' ? 'error' : 'response');
+            } catch {
+                logToElement(monitorOutput, `[ALERT] ${msgStr}`, 'error');
+            }
         } else if (topic.endsWith('/config/in')) { // Actually device sends to config/out usually? No, device receives on IN.
             // We need to listen to device responses? 
             // Currently firmware does not publish config back except on startup logs or serial.
@@ -201,47 +258,16 @@ export function setupOnline(prefix) {
         }
     }
 
-    function handleHeartbeat(topic, msgStr) {
-        try {
-            const parts = topic.split('/'); // vending/ID/heartbeat
-            const deviceId = parts[1];
-            const data = JSON.parse(msgStr);
-
-            devices.set(deviceId, {
-                lastSeen: Date.now(),
-                ...data
-            });
-
-            renderDevicesList();
-        } catch (e) {
-            console.error('HB Parse error', e);
-        }
-    }
-
-    function renderDevicesList() {
-        devicesList.innerHTML = '';
-        devices.forEach((data, id) => {
-            const card = document.createElement('div');
-            card.className = `device-card ${selectedDevice === id ? 'selected' : ''}`;
-            card.innerHTML = `
-                <div style="font-weight:bold; margin-bottom:5px">
-                    <ion-icon name="hardware-chip-outline" style="vertical-align:middle"></ion-icon> 
-                    ${id}
-                </div>
-                <div style="font-size:12px; color:#888">
-                    FW: ${data.firmware_version || 'Unknown'}<br>
-                    IP: ${data.ip || 'Unknown'}<br>
-                    WiFi: ${data.ssid || 'Unknown'} (${data.rssi} dBm)
-                </div>
-            `;
-            card.addEventListener('click', () => selectDevice(id));
-            devicesList.appendChild(card);
-        });
+    async function toggleSimulation() {
+        const count = simulating ? 0 : Number(fleetSimCount.value);
+        const res = await window.electronAPI.simulateFleet({ count });
+        simulating = !!res?.running;
+        fleetSimBtn.textContent = simulating ? 'Stop Simulation' : 'Simulate';
     }
 
     function selectDevice(id) {
         selectedDevice = id;
-        renderDevicesList(); // update selection style
+        fleet.setSelected(id);
 
         // Update header texts
         selectedDeviceConfigEls.forEach(el => (el.textContent = id));
@@ -259,6 +285,8 @@ export function setupOnline(prefix) {
         // Subscribe to logs
         window.electronAPI.mqttSubscribe(`vending/${id}/log/out`);
         window.electronAPI.mqttSubscribe(`vending/${id}/status/out`);
+        window.electronAPI.mqttSubscribe(`vending/${id}/telemetry`);
+        window.electronAPI.mqttSubscribe(`vending/${id}/alerts`);
     }
 
     async function sendConfig(part) {
@@ -268,7 +296,76 @@ export function setupOnline(prefix) {
 
         // Get API secret for signing
         const apiSecret = document.getElementById(p + 'apiSecret')?.value || '';
+        const config = buildConfigPayload(part);
+        if (!config) return;
+
+        // HIGH FIX: Add HMAC signature if API secret is provided
+        if (apiSecret) {
+            const signRes = await window.electronAPI.signPayload({
+                type: 'config',
+                deviceId: selectedDevice,
+                payload: config,
+                secret: apiSecret,
+            });
+            if (!signRes?.success) {
+                alert('Signing failed: ' + (signRes?.message || 'unknown'));
+                return;
+            }
+            config.sig = signRes.sig;
+        } else {
+            logToElement(monitorOutput, 'Warning: API Secret is empty (config will be unsigned)', 'error');
+        }
+
+        const topic = `vending/${selectedDevice}/config/in`;
+        await window.electronAPI.mqttPublish({
+            topic,
+            message: JSON.stringify(config)
+        });
+
+        logToElement(monitorOutput, `${label} configuration sent to ${topic}`, 'command');
+    }
+
+    // Same config to every online device: one batch-sign call (device_id is
+    // part of each signature) and one publish call
+    async function sendConfigToFleet(part) {
+        const ids = fleet.onlineIds();
+        if (!ids.length) return alert('No online devices');
+        const label = part === 'basic' ? 'Basic' : 'Extra';
+        if (!confirm(`Apply ${label} configuration to all ${ids.length} online devices?`)) return;
+
+        const apiSecret = document.getElementById(p + 'apiSecret')?.value || '';
+        const config = buildConfigPayload(part);
+        if (!config) return;
+
+        let sigs = null;
+        if (apiSecret) {
+            const signRes = await window.electronAPI.signBatch({
+                type: 'config',
+                payload: config,
+                deviceIds: ids,
+                secret: apiSecret
+            });
+            if (!signRes?.success) {
+                alert('Signing failed: ' + (signRes?.message || 'unknown'));
+                return;
+            }
+            sigs = signRes.sigs;
+            logToElement(monitorOutput, `Signed ${sigs.length} configs in ${signRes.ms} ms`, 'response');
+        } else {
+            logToElement(monitorOutput, 'Warning: API Secret is empty (config will be unsigned)', 'error');
+        }
 
+        const messages = ids.map((id, i) => ({
+            topic: `vending/${id}/config/in`,
+            message: JSON.stringify(sigs ? { ...config, sig: sigs[i] } : config)
+        }));
+        const res = await window.electronAPI.mqttPublishBatch({ messages });
+        logToElement(monitorOutput, `${label} configuration sent to ${res.sent ?? 0}/${ids.length} devices` +
+            (res.failed ? ` (${res.failed} failed)` : ''), res.success ? 'command' : 'error');
+    }
+
+    // Config message from the form, or null when a field is invalid
+    function buildConfigPayload(part) {
         // Construct JSON payload
         const getVal = (id) => document.getElementById(p + id).value;
         const getChk = (id) => document.getElementById(p + id).checked;
@@ -296,7 +393,7 @@ export function setupOnline(prefix) {
             if (wifiPassword) {
                 if (!wifiSsid) {
                     alert('WiFi SSID is required when setting WiFi password.');
-                    return;
+                    return null;
                 }
                 config.wifiSsid = wifiSsid;
                 config.wifiPassword = wifiPassword;
@@ -308,7 +405,7 @@ export function setupOnline(prefix) {
                 const port = Number(mqttPortRaw);
                 if (!Number.isInteger(port) || port <= 0 || port > 65535) {
                     alert('MQTT Port must be 1-65535');
-                    return;
+                    return null;
                 }
                 config.mqttPort = port;
             }
@@ -317,7 +414,7 @@ export function setupOnline(prefix) {
             if (mqttPassword) {
                 if (!mqttUsername) {
                     alert('MQTT Username is required when setting MQTT password.');
-                    return;
+                    return null;
                 }
                 config.mqttUsername = mqttUsername;
                 config.mqttPassword = mqttPassword;
@@ -343,33 +440,12 @@ export function setupOnline(prefix) {
                 displayUpdateInterval: getNum('displayUpdateInterval'),
                 tdsCheckInterval: getNum('tdsCheckInterval'),
                 heartbeatInterval: getNum('heartbeatInterval'),
+                enablePowerSave: getChk('enablePowerSave'),
+                deepSleepStartHour: getNum('deepSleepStartHour'),
+                deepSleepEndHour: getNum('deepSleepEndHour'),
             });
         }
-
-        // HIGH FIX: Add HMAC signature if API secret is provided
-        if (apiSecret) {
-            const signRes = await window.electronAPI.signPayload({
-                type: 'config',
-                deviceId: selectedDevice,
-                payload: config,
-                secret: apiSecret,
-            });
-            if (!signRes?.success) {
-                alert('Signing failed: ' + (signRes?.message || 'unknown'));
-                return;
-            }
-            config.sig = signRes.sig;
-        } else {
-            logToElement(monitorOutput, 'Warning: API Secret is empty (config will be unsigned)', 'error');
-        }
-
-        const topic = `vending/${selectedDevice}/config/in`;
-        await window.electronAPI.mqttPublish({
-            topic,
-            message: JSON.stringify(config)
-        });
-
-        logToElement(monitorOutput, `${label} configuration sent to ${topic}`, 'command');
+        return config;
     }
 
     // OTA FUNCTIONS
@@ -394,20 +470,125 @@ export function setupOnline(prefix) {
             const file = otaFileInput.files[0];
             const path = file.path;
 
-            const res = await window.electronAPI.startOtaServer(path);
+            const res = await window.electronAPI.startOtaServer({
+                filePath: path,
+                version: document.getElementById('otaTargetVersion').value.trim(),
+                maxActive: Number(document.getElementById('otaMaxActive').value)
+            });
             if (res.success) {
                 otaServerUrl = res.url;
                 startServerBtn.textContent = 'Stop Server';
                 startServerBtn.className = 'btn btn-danger btn-sm';
                 otaStatus.textContent = 'Running at ' + res.url;
                 sendOtaBtn.disabled = false;
+                otaDownloadRows.innerHTML = '';
                 logToElement(otaLogs, 'Server started: ' + res.url, 'response');
+                logToElement(otaLogs, `Version ${res.version || 'unknown (no skip)'}, ` +
+                    `${res.rawBytes} bytes raw / ${res.deflateBytes} deflate, ${res.maxActive} parallel`, 'response');
             } else {
                 logToElement(otaLogs, 'Server start failed: ' + res.message, 'error');
             }
         }
     }
 
+    // Server-side view of every device fetching the image
+    function renderOtaDownloads(snap) {
+        const kbps = snap.devices.reduce((sum, d) => sum + (d.state === 'sending' ? d.bytesPerSec : 0), 0) / 1024;
+        otaServerStats.textContent =
+            `${snap.sending} downloading, ${snap.queued} queued, ${snap.done} done | ` +
+            `${kbps.toFixed(0)} KB/s total | ${(snap.bytesSent / 1048576).toFixed(1)} MB sent | ` +
+            `${snap.notModified} already current, ${snap.rejected} busy replies`;
+
+        snap.devices.forEach((d, i) => {
+            let row = otaDownloadRows.rows[i];
+            if (!row) {
+                row = otaDownloadRows.insertRow();
+                for (let c = 0; c < 8; c++) row.insertCell();
+            }
+            const cells = [d.deviceId, d.fromVersion || '?', d.state, d.encoding || '-', String(d.percent),
+                (d.bytesPerSec / 1024).toFixed(0), String(d.resumes), String(d.busy)];
+            cells.forEach((text, c) => {
+                if (row.cells[c].textContent !== text) row.cells[c].textContent = text;
+            });
+            const look = { current: 'done', done: 'done', aborted: 'retrying', busy: 'retrying' }[d.state];
+            row.className = look ? 'batch-' + look : '';
+        });
+    }
+
+    async function startRollout() {
+        if (!otaServerUrl) return alert('Start OTA server first');
+        const waves = document.getElementById('rolloutWaves').value.split(',')
+            .map(v => Number(v.trim())).filter(v => v > 0 && v <= 100);
+        if (!waves.length) return alert('Enter the waves as cumulative percentages, e.g. 5, 25, 50, 100');
+        const deviceIds = document.getElementById('rolloutDeviceIds').value.split(',')
+            .map(v => v.trim()).filter(Boolean);
+
+        const apiSecret = document.getElementById(p + 'apiSecret')?.value || '';
+        if (!apiSecret) {
+            logToElement(rolloutLog, 'Warning: API Secret is empty (OTA commands will be unsigned)', 'error');
+        }
+        const options = {
+            deviceIds,
+            waves,
+            maxInFlight: Number(document.getElementById('rolloutMaxInFlight').value),
+            soakMinutes: Number(document.getElementById('rolloutSoakMinutes').value),
+            maxFailurePct: Number(document.getElementById('rolloutMaxFailurePct').value),
+            secret: apiSecret
+        };
+        const plan = await window.electronAPI.startOtaRollout({ ...options, dryRun: true });
+        if (!plan.success) {
+            logToElement(rolloutLog, 'Rollout not started: ' + plan.message, 'error');
+            return;
+        }
+        if (!confirm(`Update ${plan.toUpdate} of ${plan.devices} online devices to ${plan.targetVersion} ` +
+            `in ${plan.waves.length} waves (after ${plan.waves.join(', ')} devices)?`)) return;
+
+        const res = await window.electronAPI.startOtaRollout(options);
+        if (!res.success) {
+            logToElement(rolloutLog, 'Rollout not started: ' + res.message, 'error');
+            return;
+        }
+        rolloutRows.innerHTML = '';
+        rolloutStartBtn.disabled = true;
+        rolloutCancelBtn.disabled = false;
+        logToElement(rolloutLog, `Rollout of ${res.targetVersion} started: ${res.toUpdate} devices to update`, 'command');
+    }
+
+    function renderRolloutProgress(data) {
+        const s = data.summary;
+        const toUpdate = s.total - s.skipped;
+        const pct = toUpdate ? Math.round(s.updated * 100 / toUpdate) : 100;
+        document.getElementById('rolloutProgressFill').style.width = pct + '%';
+        const phase = s.phase === 'soaking' ? `soaking ${Math.ceil(s.soakLeftMs / 1000)} s` : s.phase;
+        document.getElementById('rolloutProgressText').textContent =
+            `Wave ${s.wave}/${s.waves} ${phase} | ${s.updated}/${toUpdate} updated, ${s.inFlight} in flight, ` +
+            `${s.failed} failed, ${s.regressed} regressed | UART errors ${(s.newErrorRate * 100).toFixed(2)}% new ` +
+            `vs ${(s.oldErrorRate * 100).toFixed(2)}% old`;
+
+        data.devices.forEach((d, i) => {
+            let row = rolloutRows.rows[i];
+            if (!row) {
+                row = rolloutRows.insertRow();
+                for (let c = 0; c < 7; c++) row.insertCell();
+            }
+            const cells = [d.id, String(d.wave), d.state, d.fromVersion, d.version, String(d.seconds), d.message];
+            cells.forEach((text, c) => {
+                if (row.cells[c].textContent !== text) row.cells[c].textContent = text;
+            });
+            const look = { updated: 'done', failed: 'failed', regressed: 'failed' }[d.state];
+            row.className = look ? 'batch-' + look : '';
+        });
+    }
+
+    function finishRollout(s) {
+        rolloutStartBtn.disabled = false;
+        rolloutCancelBtn.disabled = true;
+        const text = `Rollout ${s.phase}: ${s.updated}/${s.total - s.skipped} updated, ${s.failed} failed, ` +
+            `${s.regressed} regressed, ${s.skipped} already current in ${Math.round(s.elapsedMs / 60000)} min`;
+        logToElement(rolloutLog, s.haltReason ? `${text} (${s.haltReason})` : text,
+            s.phase === 'done' ? 'response' : 'error');
+    }
+
     async function triggerOtaUpdate() {
         if (!selectedDevice) return alert('Select a device');
         if (!otaServerUrl) return alert('Start OTA server first');
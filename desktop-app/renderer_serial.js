@@ -5,6 +5,7 @@ export function setupSerial(prefix) {
     let isConnected = false;
     let currentPort = null;
     let isFlashing = false;
+    let isBatchRunning = false;
     const loadedState = {
         hasReadConfig: false,
         wifiSsid: '',
@@ -64,6 +65,51 @@ export function setupSerial(prefix) {
             </div>
             <div id="serialFirmwareLog" class="console-output small"></div>
         </div>
+
+        <div class="card">
+            <h3>Batch Provisioning</h3>
+            <p class="hint">Flashes every selected ESP32 at once (one esptool per port) with the file, baud and
+                flash type above, then optionally sends the Basic + Extra config with a per-device ID.</p>
+            <div class="form-group">
+                <label>Ports:</label>
+                <div id="batchPortList" class="batch-port-list"><span class="hint">Click Scan</span></div>
+                <button class="btn btn-secondary btn-sm" id="batchScanBtn">Scan ESP32 Ports</button>
+            </div>
+            <div class="form-group">
+                <label>Parallel Jobs:</label>
+                <input type="number" id="batchConcurrency" value="20" min="1" max="24">
+            </div>
+            <div class="form-group">
+                <label>Retries per Port:</label>
+                <input type="number" id="batchRetries" value="2" min="0" max="5">
+            </div>
+            <div class="form-group">
+                <label>Configure After Flash</label>
+                <div class="toggle-row">
+                    <input type="checkbox" id="batchConfigure">
+                    <span>Send Basic + Extra config</span>
+                </div>
+            </div>
+            <div class="form-group">
+                <label>Device ID Pattern:</label>
+                <input type="text" id="batchDeviceIdPattern" value="EW_{mac}"
+                    title="{mac} = last 6 hex digits of the MAC, {n} = position in the batch">
+            </div>
+            <button class="btn btn-warning" id="batchStartBtn" disabled>⚡ Start Batch</button>
+            <button class="btn btn-danger" id="batchCancelBtn" disabled>Cancel</button>
+
+            <div class="progress-container">
+                <div class="progress-bar-bg">
+                    <div id="batchProgressFill" class="progress-fill"></div>
+                </div>
+                <span id="batchProgressText">Idle</span>
+            </div>
+            <table class="batch-table">
+                <thead><tr><th>Port</th><th>State</th><th>Try</th><th>%</th><th>Device</th><th>Message</th></tr></thead>
+                <tbody id="batchJobRows"></tbody>
+            </table>
+            <div id="batchLog" class="console-output small"></div>
+        </div>
     `;
 
     // Event Listeners
@@ -81,6 +127,12 @@ export function setupSerial(prefix) {
 
     document.getElementById('serialBrowseBtn').addEventListener('click', browseFirmware);
     document.getElementById('serialFlashBtn').addEventListener('click', flashFirmware);
+    document.getElementById('batchScanBtn').addEventListener('click', scanBatchPorts);
+    document.getElementById('batchStartBtn').addEventListener('click', startBatch);
+    document.getElementById('batchCancelBtn').addEventListener('click', () => window.electronAPI.cancelBatchFlash());
+
+    window.electronAPI.onBatchProgress(renderBatchProgress);
+    window.electronAPI.onBatchDone(finishBatch);
 
     // Initial Scan
     scanPorts();
@@ -175,14 +227,9 @@ export function setupSerial(prefix) {
         const mode = localStorage.getItem('ewater_controller_mode') || 'main';
         if (mode === 'payment') return alert('Payment controller has no configurable settings (flash + monitor only).');
 
-        const built = buildBasicConfigCommands(p, loadedState);
+        const built = buildBasicConfigFields(p, loadedState);
         if (built.error) return alert(built.error);
-        const commands = built.cmds;
-        for (const cmd of commands) {
-            logToElement(monitorOutput, '> ' + maskCommandForLog(cmd), 'command');
-            await window.electronAPI.sendCommand(cmd);
-            await delay(200);
-        }
+        if (!await provisionFields(built.fields)) return;
 
         const applyMode = document.getElementById(p + 'basic_applyMode').value;
         if (applyMode === 'now') {
@@ -198,12 +245,7 @@ export function setupSerial(prefix) {
         const mode = localStorage.getItem('ewater_controller_mode') || 'main';
         if (mode === 'payment') return alert('Payment controller has no configurable settings (flash + monitor only).');
 
-        const commands = buildExtraConfigCommands(p);
-        for (const cmd of commands) {
-            logToElement(monitorOutput, '> ' + maskCommandForLog(cmd), 'command');
-            await window.electronAPI.sendCommand(cmd);
-            await delay(200);
-        }
+        if (!await provisionFields(buildExtraConfigFields(p))) return;
 
         const applyMode = document.getElementById(p + 'extra_applyMode').value;
         if (applyMode === 'now') {
@@ -214,11 +256,37 @@ export function setupSerial(prefix) {
         logToElement(monitorOutput, 'Extra config saved!', 'response');
     }
 
+    // One CFG_FRAME round trip; falls back to SET_* lines on old firmware.
+    // Logs the provisioning time so it can be compared across devices.
+    async function provisionFields(fields) {
+        const started = performance.now();
+        const res = await window.electronAPI.sendConfigFrame(fields);
+        if (res.success) {
+            logToElement(monitorOutput, `Provisioned via CFG_FRAME in ${res.elapsedMs} ms`, 'response');
+            return true;
+        }
+        if (!res.unsupported) {
+            logToElement(monitorOutput, 'Config frame failed: ' + res.message, 'error');
+            return false;
+        }
+
+        logToElement(monitorOutput, 'Firmware has no CFG_FRAME, sending SET_* commands', 'response');
+        for (const cmd of configFieldsToCommands(fields)) {
+            logToElement(monitorOutput, '> ' + maskCommandForLog(cmd), 'command');
+            await window.electronAPI.sendCommand(cmd);
+            await delay(200);
+        }
+        const elapsed = Math.round(performance.now() - started);
+        logToElement(monitorOutput, `Provisioned via SET_* in ${elapsed} ms`, 'response');
+        return true;
+    }
+
     async function browseFirmware() {
         const res = await window.electronAPI.selectFirmware();
         if (res.success) {
             document.getElementById('serialFirmwarePath').value = res.path;
             document.getElementById('serialFlashBtn').disabled = false;
+            document.getElementById('batchStartBtn').disabled = isBatchRunning;
         }
     }
 
@@ -281,10 +349,123 @@ export function setupSerial(prefix) {
             flashBtn.disabled = false;
         }
     }
+
+    // BATCH PROVISIONING
+
+    async function scanBatchPorts() {
+        const ports = await window.electronAPI.scanPorts({ esp32Only: true });
+        const list = document.getElementById('batchPortList');
+        list.innerHTML = '';
+        if (!ports.length) {
+            list.innerHTML = '<span class="hint">No ESP32 USB adapters found</span>';
+            return;
+        }
+        ports.forEach(port => {
+            const row = document.createElement('div');
+            row.className = 'toggle-row';
+            const box = document.createElement('input');
+            box.type = 'checkbox';
+            box.value = port.path;
+            box.checked = true;
+            const name = document.createElement('span');
+            name.textContent = `${port.path} (${port.manufacturer})`;
+            row.appendChild(box);
+            row.appendChild(name);
+            list.appendChild(row);
+        });
+    }
+
+    async function startBatch() {
+        if (isBatchRunning) return;
+        const ports = [...document.querySelectorAll('#batchPortList input:checked')].map(b => b.value);
+        if (!ports.length) return alert('Select at least one port');
+
+        const type = document.getElementById('serialFlashType').value;
+        let config = null;
+        if (document.getElementById('batchConfigure').checked) {
+            const mode = localStorage.getItem('ewater_controller_mode') || 'main';
+            if (mode === 'payment') return alert('Payment controller has no configurable settings (flash + monitor only).');
+            const built = buildBasicConfigFields(p, null, { perDeviceId: true });
+            if (built.error) return alert(built.error);
+            config = { ...built.fields, ...buildExtraConfigFields(p) };
+        }
+        if (type === 'full' && !confirm('⚠️ Full Firmware mode writes to 0x0000 on EVERY selected device.\n\n' +
+            'Only use this with a complete firmware.bin that includes bootloader. Continue?')) {
+            return;
+        }
+        if (!confirm(`Flash ${ports.length} device(s)? They will restart.`)) return;
+
+        if (isConnected && ports.includes(currentPort)) {
+            setConnectedState(false); // main closes the monitor connection
+        }
+
+        const res = await window.electronAPI.startBatchFlash({
+            ports,
+            firmwarePath: document.getElementById('serialFirmwarePath').value,
+            baud: Number(document.getElementById('serialFlashBaud').value),
+            offset: type === 'full' ? '0x0000' : '0x10000',
+            concurrency: Number(document.getElementById('batchConcurrency').value),
+            retries: Number(document.getElementById('batchRetries').value),
+            config,
+            deviceIdPattern: document.getElementById('batchDeviceIdPattern').value.trim() || '{mac}'
+        });
+        if (!res.success) {
+            logToElement('batchLog', 'Batch failed to start: ' + res.message, 'error');
+            return;
+        }
+        setBatchRunning(true);
+        logToElement('batchLog', `Batch started: ${res.jobs} port(s)`, 'response');
+    }
+
+    function setBatchRunning(running) {
+        isBatchRunning = running;
+        document.getElementById('batchStartBtn').disabled = running;
+        document.getElementById('batchCancelBtn').disabled = !running;
+        document.getElementById('batchScanBtn').disabled = running;
+    }
+
+    function renderBatchProgress(data) {
+        const s = data.summary;
+        document.getElementById('batchProgressFill').style.width = data.percent + '%';
+        document.getElementById('batchProgressText').textContent =
+            `${data.percent}% | ${s.done}/${s.total} done, ${s.failed} failed | ${Math.round(s.elapsedMs / 1000)} s`;
+
+        const body = document.getElementById('batchJobRows');
+        data.jobs.forEach((job, i) => {
+            let row = body.rows[i];
+            if (!row) {
+                row = body.insertRow();
+                for (let c = 0; c < 6; c++) row.insertCell();
+            }
+            const cells = [job.port, job.state, String(job.attempt), String(job.percent),
+                job.deviceId || job.mac, job.message];
+            cells.forEach((text, c) => {
+                if (row.cells[c].textContent !== text) row.cells[c].textContent = text;
+            });
+            row.className = 'batch-' + job.state;
+        });
+        while (body.rows.length > data.jobs.length) body.deleteRow(-1);
+    }
+
+    function finishBatch(summary) {
+        setBatchRunning(false);
+        if (summary.error) {
+            logToElement('batchLog', 'Batch aborted: ' + summary.error, 'error');
+            return;
+        }
+        logToElement('batchLog',
+            `Batch finished: ${summary.done}/${summary.total} done, ${summary.failed} failed, ` +
+            `${summary.cancelled} cancelled in ${(summary.elapsedMs / 1000).toFixed(1)} s ` +
+            `(${summary.parallel} parallel, avg ${(summary.avgJobMs / 1000).toFixed(1)} s/device, ` +
+            `${summary.devicesPerHour} devices/h, ${summary.flashKBps} KB/s aggregate)`,
+            summary.failed ? 'error' : 'response');
+    }
 }
 
-// Helper to build commands from form - FIXED: Use firmware-compatible command names
-function buildBasicConfigCommands(p) {
+// Helpers to build config fields from the form. Keys match the firmware
+// CFG_FRAME / MQTT config update names.
+// perDeviceId: the caller sets deviceId itself (batch provisioning)
+function buildBasicConfigFields(p, loadedState, { perDeviceId = false } = {}) {
     const getVal = (id) => document.getElementById(p + id).value;
 
     const ssid = getVal('wifiSsid').trim();
@@ -299,84 +480,135 @@ function buildBasicConfigCommands(p) {
     if (!broker) return { error: 'MQTT broker is required' };
     const port = Number(portRaw);
     if (!Number.isInteger(port) || port <= 0 || port > 65535) return { error: 'MQTT port must be 1-65535' };
-    if (!deviceId) return { error: 'Device ID is required' };
+    if (!deviceId && !perDeviceId) return { error: 'Device ID is required' };
 
-    const cmds = [];
+    const fields = {};
 
     // WiFi: protect existing password (firmware does not print it)
     const loadedSsid = loadedState?.wifiSsid ?? '';
     if (pass) {
-        cmds.push(`SET_WIFI:${ssid}:${pass}`);
+        fields.wifiSsid = ssid;
+        fields.wifiPassword = pass;
     } else if (loadedState?.hasReadConfig && loadedSsid && ssid === loadedSsid) {
-        // keep current WiFi password by skipping SET_WIFI
+        // keep current WiFi settings
     } else if (loadedState?.hasReadConfig) {
         return { error: 'WiFi password is empty. Enter password to change WiFi settings.' };
     } else {
         return { error: 'WiFi password is empty. Enter password (or Load Basic first to keep current).' };
     }
 
-    cmds.push(`SET_MQTT:${broker}:${port}`);
+    fields.mqttBroker = broker;
+    fields.mqttPort = port;
 
     // MQTT auth: protect existing password (firmware does not print it)
     const loadedUser = loadedState?.mqttUsername ?? '';
     if (mqttPass) {
         if (!mqttUser) return { error: 'MQTT Username is required when setting password' };
-        cmds.push(`SET_MQTT_AUTH:${mqttUser}:${mqttPass}`);
+        fields.mqttUsername = mqttUser;
+        fields.mqttPassword = mqttPass;
     } else if (mqttUser) {
         if (loadedState?.hasReadConfig && loadedUser && mqttUser === loadedUser) {
-            // keep existing auth password by skipping SET_MQTT_AUTH
+            // keep existing auth
         } else {
             return { error: 'MQTT password is empty. Enter password to set/change MQTT auth.' };
         }
     }
 
-    cmds.push(`SET_DEVICE_ID:${deviceId}`);
-    cmds.push('SAVE_CONFIG');
-    return { cmds };
+    if (!perDeviceId) fields.deviceId = deviceId;
+    return { fields };
 }
 
-function buildExtraConfigCommands(p) {
+function buildExtraConfigFields(p) {
     const getVal = (id) => document.getElementById(p + id).value;
     const getChk = (id) => document.getElementById(p + id).checked;
+    // Numbers go out as JSON numbers; anything unparsable is passed through
+    // so the firmware reports it instead of silently dropping the field.
+    const getNum = (id) => {
+        const raw = getVal(id).trim();
+        const n = Number(raw);
+        return raw !== '' && Number.isFinite(n) ? n : raw;
+    };
 
-    const cmds = [];
-
-    // Vending
-    cmds.push(`SET_PRICE:${getVal('pricePerLiter')}`);
-    cmds.push(`SET_TIMEOUT:${getVal('sessionTimeout')}`);
-    cmds.push(`SET_RELAY_ACTIVE:${getChk('relayActiveHigh') ? 1 : 0}`);
-    cmds.push(`SET_FREE_WATER:${getChk('enableFreeWater') ? 1 : 0}`);
-    cmds.push(`SET_FREE_WATER_COOLDOWN:${getVal('freeWaterCooldown')}`);
-    cmds.push(`SET_FREE_WATER_AMOUNT:${getVal('freeWaterAmount')}`);
-
-    // Sensors
-    cmds.push(`SET_PULSES_PER_LITER:${getVal('pulsesPerLiter')}`);
-    cmds.push(`SET_TDS_THRESHOLD:${getVal('tdsThreshold')}`);
-    cmds.push(`SET_TDS_TEMP:${getVal('tdsTemperatureC')}`);
-    cmds.push(`SET_TDS_CALIB:${getVal('tdsCalibrationFactor')}`);
-
-    // Cash
-    cmds.push(`SET_CASH_PULSE:${getVal('cashPulseValue')}`);
-    cmds.push(`SET_CASH_GAP:${getVal('cashPulseGapMs')}`);
+    const fields = {
+        // Vending
+        pricePerLiter: getNum('pricePerLiter'),
+        sessionTimeout: getNum('sessionTimeout'),
+        relayActiveHigh: getChk('relayActiveHigh'),
+        enableFreeWater: getChk('enableFreeWater'),
+        freeWaterCooldown: getNum('freeWaterCooldown'),
+        freeWaterAmount: getNum('freeWaterAmount'),
+
+        // Sensors
+        pulsesPerLiter: getNum('pulsesPerLiter'),
+        tdsThreshold: getNum('tdsThreshold'),
+        tdsTemperatureC: getNum('tdsTemperatureC'),
+        tdsCalibrationFactor: getNum('tdsCalibrationFactor'),
+
+        // Cash
+        cashPulseValue: getNum('cashPulseValue'),
+        cashPulseGapMs: getNum('cashPulseGapMs'),
+
+        // Intervals
+        paymentCheckInterval: getNum('paymentCheckInterval'),
+        displayUpdateInterval: getNum('displayUpdateInterval'),
+        tdsCheckInterval: getNum('tdsCheckInterval'),
+        heartbeatInterval: getNum('heartbeatInterval'),
+
+        // Night power save
+        enablePowerSave: getChk('enablePowerSave'),
+        deepSleepStartHour: getNum('deepSleepStartHour'),
+        deepSleepEndHour: getNum('deepSleepEndHour'),
+
+        // Security settings
+        requireSignedMessages: getChk('requireSigned'),
+        allowRemoteNetworkConfig: getChk('allowRemoteNetworkConfig')
+    };
 
-    // Intervals
-    cmds.push(`SET_PAYMENT_INTERVAL:${getVal('paymentCheckInterval')}`);
-    cmds.push(`SET_DISPLAY_INTERVAL:${getVal('displayUpdateInterval')}`);
-    cmds.push(`SET_TDS_INTERVAL:${getVal('tdsCheckInterval')}`);
-    cmds.push(`SET_HEARTBEAT_INTERVAL:${getVal('heartbeatInterval')}`);
+    // Group ID / API secret: only sent when filled in
+    if (getVal('groupId')) fields.groupId = getVal('groupId');
+    if (getVal('apiSecret')) fields.apiSecret = getVal('apiSecret');
 
-    // Group ID
-    if (getVal('groupId')) {
-        cmds.push(`SET_GROUP:${getVal('groupId')}`);
-    }
+    return fields;
+}
 
-    // Security settings
-    if (getVal('apiSecret')) {
-        cmds.push(`SET_API_SECRET:${getVal('apiSecret')}`);
+// Legacy line-by-line equivalent of a config frame (firmware without CFG_FRAME)
+const SINGLE_FIELD_COMMANDS = {
+    deviceId: 'SET_DEVICE_ID',
+    pricePerLiter: 'SET_PRICE',
+    sessionTimeout: 'SET_TIMEOUT',
+    relayActiveHigh: 'SET_RELAY_ACTIVE',
+    enableFreeWater: 'SET_FREE_WATER',
+    freeWaterCooldown: 'SET_FREE_WATER_COOLDOWN',
+    freeWaterAmount: 'SET_FREE_WATER_AMOUNT',
+    pulsesPerLiter: 'SET_PULSES_PER_LITER',
+    tdsThreshold: 'SET_TDS_THRESHOLD',
+    tdsTemperatureC: 'SET_TDS_TEMP',
+    tdsCalibrationFactor: 'SET_TDS_CALIB',
+    cashPulseValue: 'SET_CASH_PULSE',
+    cashPulseGapMs: 'SET_CASH_GAP',
+    paymentCheckInterval: 'SET_PAYMENT_INTERVAL',
+    displayUpdateInterval: 'SET_DISPLAY_INTERVAL',
+    tdsCheckInterval: 'SET_TDS_INTERVAL',
+    heartbeatInterval: 'SET_HEARTBEAT_INTERVAL',
+    enablePowerSave: 'SET_POWER_SAVE',
+    deepSleepStartHour: 'SET_NIGHT_START',
+    deepSleepEndHour: 'SET_NIGHT_END',
+    groupId: 'SET_GROUP',
+    apiSecret: 'SET_API_SECRET',
+    requireSignedMessages: 'SET_REQUIRE_SIGNED',
+    allowRemoteNetworkConfig: 'SET_ALLOW_REMOTE_NETCFG'
+};
+
+function configFieldsToCommands(fields) {
+    const cmds = [];
+    if (fields.wifiSsid !== undefined) cmds.push(`SET_WIFI:${fields.wifiSsid}:${fields.wifiPassword}`);
+    if (fields.mqttBroker !== undefined) cmds.push(`SET_MQTT:${fields.mqttBroker}:${fields.mqttPort}`);
+    if (fields.mqttUsername !== undefined) cmds.push(`SET_MQTT_AUTH:${fields.mqttUsername}:${fields.mqttPassword}`);
+    for (const [key, name] of Object.entries(SINGLE_FIELD_COMMANDS)) {
+        const v = fields[key];
+        if (v === undefined) continue;
+        cmds.push(`${name}:${typeof v === 'boolean' ? (v ? 1 : 0) : v}`);
     }
-    cmds.push(`SET_REQUIRE_SIGNED:${getChk('requireSigned') ? 1 : 0}`);
-    cmds.push(`SET_ALLOW_REMOTE_NETCFG:${getChk('allowRemoteNetworkConfig') ? 1 : 0}`);
-
     cmds.push('SAVE_CONFIG');
     return cmds;
 }
@@ -0,0 +1,81 @@
+// Batch signing off the main process thread.
+//
+// Signing thousands of per-device payloads takes long enough to stall IPC
+// and MQTT handling, so batches above SIGN_INLINE_MAX go to one long-lived
+// worker thread. The same file is the worker (signBatch on each request)
+// and, on the main thread, the SignWorker client.
+
+const { Worker, isMainThread, parentPort } = require('worker_threads');
+const { signBatch } = require('./signing');
+
+const SIGN_INLINE_MAX = 64; // Smaller batches are quicker than a thread hop
+
+if (!isMainThread) {
+    parentPort.on('message', ({ id, req }) => {
+        try {
+            parentPort.postMessage({ id, result: signBatch(req) });
+        } catch (error) {
+            parentPort.postMessage({ id, error: error.message });
+        }
+    });
+}
+
+class SignWorker {
+    constructor() {
+        this.worker = null;
+        this.nextId = 1;
+        this.pending = new Map(); // request id -> { resolve, reject }
+    }
+
+    // Same request/result as signing.signBatch
+    sign(req) {
+        const count = Array.isArray(req.deviceIds) ? req.deviceIds.length : (req.items || []).length;
+        if (count <= SIGN_INLINE_MAX) {
+            return Promise.resolve().then(() => signBatch(req));
+        }
+        const worker = this.start();
+        const id = this.nextId++;
+        return new Promise((resolve, reject) => {
+            this.pending.set(id, { resolve, reject });
+            worker.postMessage({ id, req });
+        });
+    }
+
+    start() {
+        if (this.worker) return this.worker;
+        const worker = new Worker(__filename);
+        worker.unref(); // Never keeps the app alive
+        worker.on('message', ({ id, result, error }) => {
+            const p = this.pending.get(id);
+            if (!p) return;
+            this.pending.delete(id);
+            if (error) p.reject(new Error(error));
+            else p.resolve(result);
+        });
+        // A crashed worker fails what it had; the next batch starts a new one
+        const fail = (err) => {
+            if (this.worker !== worker) return;
+            this.worker = null;
+            this.failPending(err);
+        };
+        worker.on('error', fail);
+        worker.on('exit', (code) => fail(new Error(`Sign worker exited with code ${code}`)));
+        this.worker = worker;
+        return worker;
+    }
+
+    failPending(err) {
+        this.pending.forEach(p => p.reject(err));
+        this.pending.clear();
+    }
+
+    stop() {
+        if (!this.worker) return;
+        const worker = this.worker;
+        this.worker = null;
+        this.failPending(new Error('Sign worker stopped'));
+        worker.terminate();
+    }
+}
+
+module.exports = { SignWorker, SIGN_INLINE_MAX };
@@ -0,0 +1,129 @@
+// Signed MQTT messages: canonical form + HMAC-SHA256.
+//
+// Mirrors the CANONICAL_*_KEYS tables in src_esp32_main/config_schema.h
+// (config keys come from its DEVICE_CONFIG_FIELDS rows): the same keys in
+// the same order, absent keys skipped, device_id last. test/signing_vectors.json
+// pins the exact strings; the firmware checks them in test/run_tests.cpp
+// and this file in signing_conformance.js.
+//
+// Batch signing: device_id is the last key, so for one payload sent to many
+// devices everything before it is the same. signBatch() hashes that prefix
+// once (HMAC inner state, via Hash.copy()) and only finishes it per device.
+
+const crypto = require('crypto');
+
+const CANONICAL_FIELDS = {
+    payment: ['amount', 'source', 'transaction_id', 'nonce', 'user_id', 'nozzle', 'ts'],
+    config: [
+        'apply', 'deviceId', 'wifiSsid', 'wifiPassword', 'mqttBroker', 'mqttPort',
+        'mqttUsername', 'mqttPassword', 'pricePerLiter', 'sessionTimeout',
+        'freeWaterCooldown', 'freeWaterAmount', 'pulsesPerLiter', 'tdsThreshold',
+        'tdsTemperatureC', 'tdsCalibrationFactor', 'enableFreeWater', 'relayActiveHigh',
+        'relay_active_high', 'cashPulseValue', 'cashPulseGapMs', 'paymentCheckInterval',
+        'displayUpdateInterval', 'tdsCheckInterval', 'heartbeatInterval', 'enablePowerSave',
+        'deepSleepStartHour', 'deepSleepEndHour', 'nozzles', 'transaction_id', 'nonce', 'ts'
+    ],
+    command: ['action', 'pricePerLiter', 'threshold', 'tdsThreshold', 'duration', 'reason',
+        'transaction_id', 'nonce', 'ts'],
+    ota: ['firmware_url', 'transaction_id', 'nonce', 'ts']
+};
+
+const HMAC_BLOCK_BYTES = 64; // SHA-256 block
+
+function isPresentForCanonical(v) {
+    if (v === undefined || v === null) return false;
+    if (typeof v === 'number' && !Number.isFinite(v)) return false;
+    return true;
+}
+
+// Canonical JSON up to (not including) device_id: '{"a":1,' or '{'
+function canonicalPrefix(type, payload) {
+    const t = String(type || '').toLowerCase();
+    const fields = CANONICAL_FIELDS[t];
+    if (!fields) {
+        throw new Error(`Unsupported sign type: ${type}`);
+    }
+    if (t === 'payment' && !isPresentForCanonical(payload.amount)) {
+        throw new Error('PAYMENT missing amount');
+    }
+    const canonical = {};
+    for (const key of fields) {
+        if (isPresentForCanonical(payload[key])) {
+            canonical[key] = payload[key];
+        }
+    }
+    const json = JSON.stringify(canonical);
+    return json.length > 2 ? json.slice(0, -1) + ',' : '{';
+}
+
+function canonicalSuffix(deviceId) {
+    return `"device_id":${JSON.stringify(deviceId)}}`;
+}
+
+function buildCanonicalPayload(type, payload, deviceId) {
+    return canonicalPrefix(type, payload) + canonicalSuffix(deviceId);
+}
+
+function signCanonical(canonical, secret) {
+    return crypto.createHmac('sha256', secret).update(canonical, 'utf8').digest('hex');
+}
+
+// HMAC-SHA256 (RFC 2104) with the padded-key states kept, so a shared
+// message prefix is hashed once and copied per message.
+function createSigner(secret) {
+    let key = Buffer.from(secret, 'utf8');
+    if (key.length > HMAC_BLOCK_BYTES) key = crypto.createHash('sha256').update(key).digest();
+    const ipad = Buffer.alloc(HMAC_BLOCK_BYTES, 0x36);
+    const opad = Buffer.alloc(HMAC_BLOCK_BYTES, 0x5c);
+    for (let i = 0; i < key.length; i++) {
+        ipad[i] ^= key[i];
+        opad[i] ^= key[i];
+    }
+    const inner = crypto.createHash('sha256').update(ipad);
+    const outer = crypto.createHash('sha256').update(opad);
+    return {
+        // Inner hash over `text`; copy() it to continue with different endings
+        begin: (text) => inner.copy().update(text, 'utf8'),
+        finish: (innerHash, text) => outer.copy().update(innerHash.copy().update(text, 'utf8').digest()).digest('hex')
+    };
+}
+
+// req: { type, secret, items: [{ deviceId, payload }] }   per-device payloads
+//   or { type, secret, payload, deviceIds: [...] }         one payload, many devices
+// -> { sigs: [...] } in input order. `canonicals` too when req.withCanonical.
+function signBatch(req) {
+    const { type, secret, withCanonical } = req;
+    if (!secret || typeof secret !== 'string') {
+        throw new Error('Missing secret');
+    }
+    const signer = createSigner(secret);
+    const sigs = [];
+    const canonicals = withCanonical ? [] : null;
+    const sign = (prefixHash, prefix, deviceId) => {
+        if (typeof deviceId !== 'string' || !deviceId.trim()) {
+            throw new Error('Missing deviceId');
+        }
+        const suffix = canonicalSuffix(deviceId.trim());
+        sigs.push(signer.finish(prefixHash, suffix));
+        if (canonicals) canonicals.push(prefix + suffix);
+    };
+
+    if (Array.isArray(req.deviceIds)) {
+        const prefix = canonicalPrefix(type, req.payload || {});
+        const prefixHash = signer.begin(prefix);
+        req.deviceIds.forEach(id => sign(prefixHash, prefix, id));
+    } else {
+        for (const item of req.items || []) {
+            const prefix = canonicalPrefix(type, item.payload || {});
+            sign(signer.begin(prefix), prefix, item.deviceId);
+        }
+    }
+    return canonicals ? { sigs, canonicals } : { sigs };
+}
+
+module.exports = {
+    CANONICAL_FIELDS,
+    buildCanonicalPayload,
+    signCanonical,
+    signBatch
+};
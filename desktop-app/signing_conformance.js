@@ -0,0 +1,124 @@
+// Conformance check for signing.js against the firmware.
+//
+//   node signing_conformance.js [--devices 10000]
+//
+// 1. The canonical key order of each message type matches the firmware's
+//    CANONICAL_*_KEYS tables in src_esp32_main/config_schema.h (the config
+//    list is generated from the DEVICE_CONFIG_FIELDS rows).
+// 2. Every vector in test/signing_vectors.json (the firmware checks the same
+//    file in test/run_tests.cpp) gives the pinned canonical string and HMAC,
+//    one at a time and through signBatch on the worker thread.
+// 3. Fleet-sized batch: signBatch matches per-call signing, with timings.
+
+const fs = require('fs');
+const path = require('path');
+const { CANONICAL_FIELDS, buildCanonicalPayload, signCanonical, signBatch } = require('./signing');
+const { SignWorker, SIGN_INLINE_MAX } = require('./sign_worker');
+
+const FIRMWARE_SCHEMA = path.join(__dirname, '..', 'src_esp32_main', 'config_schema.h');
+const VECTORS = path.join(__dirname, '..', 'test', 'signing_vectors.json');
+const FIRMWARE_TABLES = { payment: 'PAYMENT', config: 'CONFIG', command: 'COMMAND', ota: 'OTA' };
+
+let failures = 0;
+function check(ok, what) {
+    if (!ok) {
+        failures++;
+        console.log('FAIL ' + what);
+    }
+}
+
+function arg(name, fallback) {
+    const i = process.argv.indexOf('--' + name);
+    return i > 0 ? process.argv[i + 1] : fallback;
+}
+
+const quoted = (text) => [...text.matchAll(/"(\w+)"/g)].map(m => m[1]);
+
+// Keys of CANONICAL_<table>_KEYS in order, DEVICE_CONFIG_FIELDS expanded
+function firmwareKeyOrder(schema, table) {
+    const start = schema.indexOf(`CANONICAL_${table}_KEYS[] = {`);
+    if (start < 0) return null;
+    const body = schema.slice(schema.indexOf('{', start), schema.indexOf('};', start));
+    const fieldsStart = schema.indexOf('#define DEVICE_CONFIG_FIELDS(X)');
+    const fields = schema.slice(fieldsStart, schema.indexOf('\n\n', fieldsStart));
+    const jsonKeys = [...fields.matchAll(/CFG_JSON\(([^)]*)\)/g)].flatMap(m => quoted(m[1]));
+    return body.split('\n').flatMap(line => {
+        if (line.trim().startsWith('#')) return [];
+        return line.includes('DEVICE_CONFIG_FIELDS(X)') ? jsonKeys : quoted(line);
+    });
+}
+
+function checkKeyOrder() {
+    const schema = fs.readFileSync(FIRMWARE_SCHEMA, 'utf8');
+    for (const [type, table] of Object.entries(FIRMWARE_TABLES)) {
+        const firmware = firmwareKeyOrder(schema, table);
+        check(firmware !== null, `CANONICAL_${table}_KEYS not found in config_schema.h`);
+        if (firmware) {
+            check(firmware.join() === CANONICAL_FIELDS[type].join(),
+                `${type} key order\n  firmware: ${firmware.join()}\n  app:      ${CANONICAL_FIELDS[type].join()}`);
+        }
+    }
+}
+
+async function checkVectors(worker) {
+    const { secret, vectors } = JSON.parse(fs.readFileSync(VECTORS, 'utf8'));
+    for (const v of vectors) {
+        const payload = JSON.parse(v.message);
+        const canonical = buildCanonicalPayload(v.type, payload, v.device_id);
+        check(canonical === v.canonical, `${v.name} canonical\n  got:    ${canonical}\n  pinned: ${v.canonical}`);
+        check(signCanonical(canonical, secret) === v.sig, `${v.name} sig`);
+    }
+
+    // Enough copies to go through the worker
+    const copies = Math.ceil((SIGN_INLINE_MAX + 1) / vectors.length);
+    const items = [];
+    for (let i = 0; i < copies; i++) {
+        vectors.forEach(v => items.push({ deviceId: v.device_id, payload: JSON.parse(v.message), type: v.type }));
+    }
+    for (const type of Object.keys(CANONICAL_FIELDS)) {
+        const subset = items.filter(it => it.type === type);
+        const expected = subset.map(it => vectors.find(v => v.type === type && v.device_id === it.deviceId &&
+            v.message === JSON.stringify(it.payload)).sig);
+        const { sigs } = await worker.sign({ type, secret, items: subset });
+        check(sigs.join() === expected.join(), `${type} batch on the worker`);
+    }
+    return vectors.length;
+}
+
+async function checkFleetBatch(worker, count) {
+    const secret = 'fleet-secret';
+    const payload = {
+        apply: 'now', pricePerLiter: 1200, sessionTimeout: 300000, freeWaterAmount: 0.25,
+        enableFreeWater: true, nonce: 'cfg_fleet', ts: Date.now()
+    };
+    const ids = Array.from({ length: count }, (_, i) => `EW_${String(i).padStart(6, '0')}`);
+
+    let t = process.hrtime.bigint();
+    const oneByOne = ids.map(id => signCanonical(buildCanonicalPayload('config', payload, id), secret));
+    const perCallMs = Number(process.hrtime.bigint() - t) / 1e6;
+
+    t = process.hrtime.bigint();
+    const inline = signBatch({ type: 'config', secret, payload, deviceIds: ids }).sigs;
+    const batchMs = Number(process.hrtime.bigint() - t) / 1e6;
+
+    t = process.hrtime.bigint();
+    const threaded = (await worker.sign({ type: 'config', secret, payload, deviceIds: ids })).sigs;
+    const workerMs = Number(process.hrtime.bigint() - t) / 1e6;
+
+    check(inline.join() === oneByOne.join(), 'fleet batch (inline) matches per-call signing');
+    check(threaded.join() === oneByOne.join(), 'fleet batch (worker) matches per-call signing');
+    console.log(`${count} devices: per call ${perCallMs.toFixed(1)} ms, batch ${batchMs.toFixed(1)} ms, ` +
+        `batch on worker ${workerMs.toFixed(1)} ms`);
+}
+
+async function main() {
+    const worker = new SignWorker();
+    checkKeyOrder();
+    const n = await checkVectors(worker);
+    await checkFleetBatch(worker, Number(arg('devices', 10000)));
+    worker.stop();
+    console.log(failures ? `${failures} check(s) failed` : `OK: key order, ${n} vectors, fleet batch`);
+    process.exit(failures ? 1 : 0);
+}
+
+main();
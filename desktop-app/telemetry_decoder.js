@@ -0,0 +1,102 @@
+// Decoder for vending/<ID>/telemetry (main process).
+//
+// The firmware sends a MessagePack record every TELEMETRY_FLUSH_S (see
+// src_esp32_main/telemetry.h) and the occasional JSON report ("boot",
+// "heap") on the same topic. decodeTelemetry() takes the raw payload and
+// returns a plain object either way; MessagePack records come back with
+// "type": "stats" and the [min, mean, max] arrays spelled out.
+//
+// Only the MessagePack types the firmware emits are handled (nil, bool,
+// ints, float32/64, str, array, map); anything else throws.
+
+const TELEMETRY_VERSION = 1;
+const STAT_CHANNELS = ['flow', 'tds', 'rssi', 'heap', 'loop'];
+
+function decodeMsgPack(buf) {
+    let pos = 0;
+    const need = (n) => {
+        if (pos + n > buf.length) throw new Error('MessagePack: truncated');
+    };
+    const str = (n) => {
+        need(n);
+        const s = buf.toString('utf8', pos, pos + n);
+        pos += n;
+        return s;
+    };
+    const array = (n) => {
+        const out = [];
+        for (let i = 0; i < n; i++) out.push(read());
+        return out;
+    };
+    const map = (n) => {
+        const out = {};
+        for (let i = 0; i < n; i++) {
+            const key = read();
+            out[key] = read();
+        }
+        return out;
+    };
+    const num = (n, fn) => {
+        need(n);
+        const v = buf[fn](pos);
+        pos += n;
+        return v;
+    };
+
+    function read() {
+        need(1);
+        const b = buf[pos++];
+        if (b <= 0x7f) return b;
+        if (b >= 0xe0) return b - 0x100;
+        if ((b & 0xf0) === 0x80) return map(b & 0x0f);
+        if ((b & 0xf0) === 0x90) return array(b & 0x0f);
+        if ((b & 0xe0) === 0xa0) return str(b & 0x1f);
+        switch (b) {
+            case 0xc0: return null;
+            case 0xc2: return false;
+            case 0xc3: return true;
+            case 0xca: return num(4, 'readFloatBE');
+            case 0xcb: return num(8, 'readDoubleBE');
+            case 0xcc: return num(1, 'readUInt8');
+            case 0xcd: return num(2, 'readUInt16BE');
+            case 0xce: return num(4, 'readUInt32BE');
+            case 0xcf: return Number(num(8, 'readBigUInt64BE'));
+            case 0xd0: return num(1, 'readInt8');
+            case 0xd1: return num(2, 'readInt16BE');
+            case 0xd2: return num(4, 'readInt32BE');
+            case 0xd3: return Number(num(8, 'readBigInt64BE'));
+            case 0xd9: return str(num(1, 'readUInt8'));
+            case 0xda: return str(num(2, 'readUInt16BE'));
+            case 0xdc: return array(num(2, 'readUInt16BE'));
+            case 0xde: return map(num(2, 'readUInt16BE'));
+            default: throw new Error(`MessagePack: unsupported type 0x${b.toString(16)}`);
+        }
+    }
+
+    const value = read();
+    if (pos !== buf.length) throw new Error('MessagePack: trailing bytes');
+    return value;
+}
+
+// float32 values (flow) come back as 2.9999999; the firmware rounded them
+const round = (v, digits) => Math.round(v * 10 ** digits) / 10 ** digits;
+
+function decodeTelemetry(payload) {
+    const buf = Buffer.isBuffer(payload) ? payload : Buffer.from(payload);
+    if (buf.length && buf[0] === 0x7b) { // '{': JSON report
+        return JSON.parse(buf.toString('utf8'));
+    }
+    const rec = decodeMsgPack(buf);
+    if (!rec || typeof rec !== 'object' || rec.v !== TELEMETRY_VERSION) {
+        throw new Error(`Unknown telemetry record version ${rec && rec.v}`);
+    }
+    const out = { type: 'stats', version: rec.v, uptime: rec.t, samples: rec.n, volume_l: round(rec.vol, 3) };
+    for (const ch of STAT_CHANNELS) {
+        const [min, mean, max] = rec[ch] || [];
+        const digits = ch === 'flow' ? 2 : 0;
+        out[ch] = { min: round(min, digits), mean: round(mean, digits), max: round(max, digits) };
+    }
+    return out;
+}
+
+module.exports = { decodeMsgPack, decodeTelemetry, TELEMETRY_VERSION, STAT_CHANNELS };
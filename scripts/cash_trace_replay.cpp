@@ -0,0 +1,198 @@
+// ============================================
+// CASH PULSE TRACE REPLAY
+// ============================================
+// Feeds recorded cash acceptor edge traces through the Payment ESP32 pulse
+// decoder (src_esp32_payment/pulse_decoder.cpp, compiled in unchanged) and
+// prints every classified burst. Use it to tune glitch/gap/width limits
+// against real acceptors before flashing.
+//
+// Capturing a trace: build the Payment firmware with
+//   build_flags = ... -D CASH_TRACE_EDGES=1
+// and save the serial monitor output while inserting notes. Only lines of the
+// form "E,<timestamp_us>,<level>" are used; everything else is ignored.
+//
+// A trace may declare the expected outcome, which turns the tool into a
+// regression check (exit status 1 on mismatch):
+//   # expect-accepted: 1000,5000
+//   # expect-rejected: 1
+//
+//   g++ -O2 -std=c++17 scripts/cash_trace_replay.cpp -o cash_replay
+//   ./cash_replay scripts/traces/*.txt
+
+#include "../src_esp32_payment/pulse_decoder.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Options {
+  int pulseValue = 1000;
+  int pulsesPerUnit = 2;
+  uint32_t glitchMs = 10;
+  uint32_t maxPulseMs = 250;
+  uint32_t gapMs = 200;
+  int jitterPct = 50;
+  std::vector<std::string> files;
+};
+
+static void usage(const char *argv0) {
+  std::printf(
+      "Usage: %s [options] trace...\n"
+      "  --pulse-value N       so'm per unit (1000)\n"
+      "  --pulses-per-unit N   acceptor pulses per unit (2)\n"
+      "  --glitch-ms N         ignore LOW pulses shorter than this (10)\n"
+      "  --max-pulse-ms N      LOW longer than this = stuck line (250)\n"
+      "  --gap-ms N            idle gap closing a burst (200)\n"
+      "  --jitter-pct N        allowed width spread within a burst (50)\n"
+      "Defaults match src_esp32_payment/cash_handler.h.\n",
+      argv0);
+}
+
+static bool parseArgs(int argc, char **argv, Options &o) {
+  for (int i = 1; i < argc; i++) {
+    const std::string a = argv[i];
+    auto next = [&](long &out) {
+      if (i + 1 >= argc) {
+        return false;
+      }
+      out = std::strtol(argv[++i], nullptr, 10);
+      return true;
+    };
+    long v = 0;
+    if (a == "--pulse-value" && next(v)) o.pulseValue = (int)v;
+    else if (a == "--pulses-per-unit" && next(v)) o.pulsesPerUnit = (int)v;
+    else if (a == "--glitch-ms" && next(v)) o.glitchMs = (uint32_t)v;
+    else if (a == "--max-pulse-ms" && next(v)) o.maxPulseMs = (uint32_t)v;
+    else if (a == "--gap-ms" && next(v)) o.gapMs = (uint32_t)v;
+    else if (a == "--jitter-pct" && next(v)) o.jitterPct = (int)v;
+    else if (a == "--help" || a == "-h") { usage(argv[0]); std::exit(0); }
+    else if (a.rfind("--", 0) == 0) {
+      std::fprintf(stderr, "Unknown option %s\n", a.c_str());
+      usage(argv[0]);
+      return false;
+    } else {
+      o.files.push_back(a);
+    }
+  }
+  if (o.files.empty() || o.pulseValue <= 0 || o.pulsesPerUnit <= 0) {
+    usage(argv[0]);
+    return false;
+  }
+  return true;
+}
+
+static std::vector<long> parseList(const std::string &s) {
+  std::vector<long> out;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.find_first_not_of(" \t") != std::string::npos) {
+      out.push_back(std::strtol(item.c_str(), nullptr, 10));
+    }
+  }
+  return out;
+}
+
+// Returns false if the trace declared expectations that were not met.
+static bool replayFile(const std::string &path, const Options &o) {
+  std::ifstream in(path);
+  if (!in) {
+    std::fprintf(stderr, "%s: cannot open\n", path.c_str());
+    return false;
+  }
+
+  CashDenomination table[CASH_NOTE_COUNT];
+  for (size_t i = 0; i < CASH_NOTE_COUNT; i++) {
+    table[i] = {(uint16_t)(CASH_NOTE_UNITS[i] * o.pulsesPerUnit), 0, 0,
+                (int32_t)CASH_NOTE_UNITS[i] * o.pulseValue};
+  }
+  CashDecoderConfig cfg{o.glitchMs * 1000, o.maxPulseMs * 1000,
+                        o.gapMs * 1000, (uint8_t)o.jitterPct};
+  CashDecoder d;
+  cashDecoderInit(d, cfg, table, CASH_NOTE_COUNT);
+
+  bool haveExpectAccepted = false, haveExpectRejected = false;
+  std::vector<long> expectAccepted;
+  long expectRejected = 0;
+  std::vector<long> accepted;
+  long rejected = 0;
+  uint32_t lastUs = 0;
+  size_t edges = 0;
+
+  std::printf("== %s\n", path.c_str());
+  auto drain = [&](uint32_t nowUs) {
+    CashBurst b;
+    while (cashDecoderPoll(d, nowUs, b)) {
+      std::printf("  %10u us  %-9s %3u pulses  width %u-%u us",
+                  b.startUs, cashBurstResultName(b.result), b.pulses,
+                  b.minWidthUs, b.maxWidthUs);
+      if (b.result == CASH_BURST_ACCEPTED) {
+        std::printf("  -> %d so'm", (int)b.value);
+        accepted.push_back(b.value);
+      } else {
+        rejected++;
+      }
+      std::printf("\n");
+    }
+  };
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("# expect-accepted:", 0) == 0) {
+      haveExpectAccepted = true;
+      expectAccepted = parseList(line.substr(18));
+      continue;
+    }
+    if (line.rfind("# expect-rejected:", 0) == 0) {
+      haveExpectRejected = true;
+      expectRejected = std::strtol(line.c_str() + 18, nullptr, 10);
+      continue;
+    }
+    unsigned long us = 0;
+    unsigned level = 0;
+    if (std::sscanf(line.c_str(), "E,%lu,%u", &us, &level) != 2) {
+      continue; // Serial noise / comments
+    }
+    // Poll just before each edge, as the firmware loop would
+    drain((uint32_t)us);
+    cashDecoderEdge(d, (uint32_t)us, level != 0);
+    lastUs = (uint32_t)us;
+    edges++;
+  }
+  drain(lastUs + cfg.maxPulseUs + cfg.burstGapUs + 1);
+
+  long total = 0;
+  for (long v : accepted) {
+    total += v;
+  }
+  std::printf("  %zu edges, %zu accepted (%ld so'm), %ld rejected, %u "
+              "glitches\n",
+              edges, accepted.size(), total, rejected, d.glitches);
+
+  bool ok = true;
+  if (haveExpectAccepted && accepted != expectAccepted) {
+    std::printf("  FAIL: accepted notes differ from expect-accepted\n");
+    ok = false;
+  }
+  if (haveExpectRejected && rejected != expectRejected) {
+    std::printf("  FAIL: expected %ld rejected bursts\n", expectRejected);
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  Options o;
+  if (!parseArgs(argc, argv, o)) {
+    return 2;
+  }
+  bool ok = true;
+  for (const std::string &f : o.files) {
+    ok = replayFile(f, o) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,1205 @@
+// ============================================
+// MQTT FLEET LOAD GENERATOR / LATENCY BENCHMARK
+// ============================================
+// Simulates thousands of vending machines against a (local) broker using the
+// exact topic scheme from generateMQTTTopics() (src_esp32_main/config.cpp):
+//
+//   vending/<id>/heartbeat     uplink, every --hb-interval (+ status/out)
+//   vending/<id>/status/out    uplink, retained, after heartbeat and payment
+//   vending/<id>/tds/out       uplink, every --tds-interval
+//   vending/<id>/log/out       uplink, Poisson (--logs-per-hour)
+//   vending/<id>/payment/in    downlink, Poisson (--payments-per-hour),
+//                              HMAC-SHA256 signed when --secret is given
+//
+// Every virtual device is its own TCP connection (MQTT 3.1.1, QoS 0 like
+// PubSubClient) and subscribes to the same topics as the firmware. A
+// "backend" connection publishes payments and subscribes to all uplink
+// topics. Payloads carry a send timestamp ("_t", microseconds) so the tool
+// reports end-to-end latency percentiles for:
+//   uplink    device publish   -> backend receive
+//   downlink  backend payment  -> device receive
+//   payment   backend payment  -> status/out from that device (round trip)
+//
+// No dependencies beyond POSIX sockets (Linux/macOS):
+//   g++ -O2 -std=c++17 -pthread scripts/mqtt_fleet_bench.cpp -o fleet_bench
+//   ./fleet_bench --broker 127.0.0.1 --devices 5000 --duration 120
+//
+// Each device needs a file descriptor: raise `ulimit -n` for big fleets.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <queue>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// ============================================
+// OPTIONS
+// ============================================
+struct Options {
+  std::string broker = "127.0.0.1";
+  int port = 1883;
+  std::string username;
+  std::string password;
+  int devices = 1000;
+  int threads = 4;
+  double duration = 60.0;       // seconds of steady-state load
+  double connectRate = 200.0;   // new connections per second
+  double hbInterval = 30.0;     // firmware default heartbeatInterval
+  double tdsInterval = 60.0;    // seconds between TDS publishes
+  double paymentsPerHour = 6.0; // per device
+  double logsPerHour = 12.0;    // per device
+  int groups = 0;               // 0 = no groupId
+  std::string prefix = "bench";
+  std::string secret; // empty = unsigned payments
+  double reportInterval = 5.0;
+  int keepAlive = 60;
+};
+
+static void usage(const char *argv0) {
+  std::printf(
+      "Usage: %s [options]\n"
+      "  --broker HOST            broker address (127.0.0.1)\n"
+      "  --port N                 broker port (1883)\n"
+      "  --user U --pass P        MQTT credentials\n"
+      "  --devices N              virtual devices (1000)\n"
+      "  --threads N              worker threads (4)\n"
+      "  --duration S             steady-state seconds after ramp-up (60)\n"
+      "  --connect-rate N         connections per second (200)\n"
+      "  --hb-interval S          heartbeat period (30)\n"
+      "  --tds-interval S         TDS publish period (60)\n"
+      "  --payments-per-hour N    payments per device per hour (6)\n"
+      "  --logs-per-hour N        log events per device per hour (12)\n"
+      "  --groups N               spread devices over N groups (0)\n"
+      "  --prefix STR             device id prefix (bench)\n"
+      "  --secret STR             sign payments with HMAC-SHA256\n"
+      "  --report S               progress report period (5)\n",
+      argv0);
+}
+
+static bool parseOptions(int argc, char **argv, Options &o) {
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    auto next = [&](const char *name) -> const char * {
+      if (i + 1 >= argc) {
+        std::fprintf(stderr, "Missing value for %s\n", name);
+        std::exit(2);
+      }
+      return argv[++i];
+    };
+    if (a == "--broker") o.broker = next("--broker");
+    else if (a == "--port") o.port = std::atoi(next("--port"));
+    else if (a == "--user") o.username = next("--user");
+    else if (a == "--pass") o.password = next("--pass");
+    else if (a == "--devices") o.devices = std::atoi(next("--devices"));
+    else if (a == "--threads") o.threads = std::atoi(next("--threads"));
+    else if (a == "--duration") o.duration = std::atof(next("--duration"));
+    else if (a == "--connect-rate") o.connectRate = std::atof(next("--connect-rate"));
+    else if (a == "--hb-interval") o.hbInterval = std::atof(next("--hb-interval"));
+    else if (a == "--tds-interval") o.tdsInterval = std::atof(next("--tds-interval"));
+    else if (a == "--payments-per-hour") o.paymentsPerHour = std::atof(next("--payments-per-hour"));
+    else if (a == "--logs-per-hour") o.logsPerHour = std::atof(next("--logs-per-hour"));
+    else if (a == "--groups") o.groups = std::atoi(next("--groups"));
+    else if (a == "--prefix") o.prefix = next("--prefix");
+    else if (a == "--secret") o.secret = next("--secret");
+    else if (a == "--report") o.reportInterval = std::atof(next("--report"));
+    else if (a == "--help" || a == "-h") { usage(argv[0]); std::exit(0); }
+    else {
+      std::fprintf(stderr, "Unknown option %s\n", a.c_str());
+      usage(argv[0]);
+      return false;
+    }
+  }
+  if (o.devices <= 0 || o.threads <= 0 || o.connectRate <= 0 ||
+      o.hbInterval <= 0 || o.tdsInterval <= 0) {
+    std::fprintf(stderr, "Counts, rates and intervals must be > 0\n");
+    return false;
+  }
+  o.threads = std::min(o.threads, o.devices);
+  return true;
+}
+
+// ============================================
+// TIME
+// ============================================
+using Clock = std::chrono::steady_clock;
+static const Clock::time_point START = Clock::now();
+
+static int64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               START)
+      .count();
+}
+
+static uint64_t epochMs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::atomic<bool> stopRequested(false);
+static void onSignal(int) { stopRequested = true; }
+
+// ============================================
+// SHA-256 / HMAC (payment signatures, mirrors hmacSha256Hex in firmware)
+// ============================================
+struct Sha256 {
+  uint32_t h[8];
+  uint8_t block[64];
+  size_t blockLen = 0;
+  uint64_t totalLen = 0;
+
+  Sha256() {
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                     0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                     0x1f83d9ab, 0x5be0cd19};
+    std::memcpy(h, init, sizeof(h));
+  }
+
+  static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+  void compress(const uint8_t *p) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 |
+             (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    uint32_t e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = hh + S1 + ch + k[i] + w[i];
+      uint32_t S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = S0 + maj;
+      hh = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+  }
+
+  void update(const uint8_t *data, size_t len) {
+    totalLen += len;
+    while (len > 0) {
+      size_t n = std::min(len, sizeof(block) - blockLen);
+      std::memcpy(block + blockLen, data, n);
+      blockLen += n;
+      data += n;
+      len -= n;
+      if (blockLen == sizeof(block)) {
+        compress(block);
+        blockLen = 0;
+      }
+    }
+  }
+
+  void finish(uint8_t out[32]) {
+    uint64_t bits = totalLen * 8;
+    uint8_t pad = 0x80;
+    update(&pad, 1);
+    uint8_t zero = 0;
+    while (blockLen != 56) {
+      update(&zero, 1);
+    }
+    uint8_t len[8];
+    for (int i = 0; i < 8; i++) {
+      len[i] = (uint8_t)(bits >> (56 - i * 8));
+    }
+    update(len, 8);
+    for (int i = 0; i < 8; i++) {
+      out[i * 4] = (uint8_t)(h[i] >> 24);
+      out[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+      out[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+      out[i * 4 + 3] = (uint8_t)h[i];
+    }
+  }
+};
+
+static std::string hmacSha256Hex(const std::string &msg,
+                                 const std::string &key) {
+  uint8_t k[64] = {0};
+  if (key.size() > sizeof(k)) {
+    Sha256 kh;
+    kh.update((const uint8_t *)key.data(), key.size());
+    kh.finish(k);
+  } else {
+    std::memcpy(k, key.data(), key.size());
+  }
+  uint8_t ipad[64], opad[64];
+  for (int i = 0; i < 64; i++) {
+    ipad[i] = k[i] ^ 0x36;
+    opad[i] = k[i] ^ 0x5c;
+  }
+  uint8_t inner[32], outer[32];
+  Sha256 ih;
+  ih.update(ipad, 64);
+  ih.update((const uint8_t *)msg.data(), msg.size());
+  ih.finish(inner);
+  Sha256 oh;
+  oh.update(opad, 64);
+  oh.update(inner, 32);
+  oh.finish(outer);
+
+  static const char hex[] = "0123456789abcdef";
+  std::string out(64, '0');
+  for (int i = 0; i < 32; i++) {
+    out[i * 2] = hex[outer[i] >> 4];
+    out[i * 2 + 1] = hex[outer[i] & 0x0F];
+  }
+  return out;
+}
+
+// ============================================
+// MQTT 3.1.1 CODEC (QoS 0 only)
+// ============================================
+static void putRemainingLength(std::string &out, size_t len) {
+  do {
+    uint8_t b = len % 128;
+    len /= 128;
+    if (len > 0) {
+      b |= 0x80;
+    }
+    out.push_back((char)b);
+  } while (len > 0);
+}
+
+static void putString(std::string &out, const std::string &s) {
+  out.push_back((char)(s.size() >> 8));
+  out.push_back((char)(s.size() & 0xFF));
+  out += s;
+}
+
+static std::string encodeConnect(const std::string &clientId,
+                                 const Options &o) {
+  std::string body;
+  putString(body, "MQTT");
+  body.push_back(4); // Protocol level 3.1.1
+  uint8_t flags = 0x02; // Clean session
+  if (!o.username.empty()) flags |= 0x80;
+  if (!o.password.empty()) flags |= 0x40;
+  body.push_back((char)flags);
+  body.push_back((char)(o.keepAlive >> 8));
+  body.push_back((char)(o.keepAlive & 0xFF));
+  putString(body, clientId);
+  if (!o.username.empty()) putString(body, o.username);
+  if (!o.password.empty()) putString(body, o.password);
+
+  std::string pkt(1, (char)0x10);
+  putRemainingLength(pkt, body.size());
+  return pkt + body;
+}
+
+static std::string encodeSubscribe(uint16_t packetId,
+                                   const std::vector<std::string> &filters) {
+  std::string body;
+  body.push_back((char)(packetId >> 8));
+  body.push_back((char)(packetId & 0xFF));
+  for (const std::string &f : filters) {
+    putString(body, f);
+    body.push_back(0); // QoS 0
+  }
+  std::string pkt(1, (char)0x82);
+  putRemainingLength(pkt, body.size());
+  return pkt + body;
+}
+
+static void appendPublish(std::string &out, const std::string &topic,
+                          const std::string &payload, bool retain) {
+  out.push_back((char)(retain ? 0x31 : 0x30));
+  putRemainingLength(out, 2 + topic.size() + payload.size());
+  putString(out, topic);
+  out += payload;
+}
+
+// ============================================
+// CONNECTION
+// ============================================
+enum ConnState : uint8_t {
+  CONN_IDLE,       // Not yet started (ramp-up)
+  CONN_CONNECTING, // TCP connect in progress
+  CONN_HANDSHAKE,  // CONNECT sent, waiting for CONNACK
+  CONN_READY,
+  CONN_FAILED,
+};
+
+struct Connection {
+  int fd = -1;
+  ConnState state = CONN_IDLE;
+  std::string tx;
+  size_t txOff = 0;
+  std::string rx;
+  int64_t lastTxUs = 0;
+};
+
+static bool resolveBroker(const Options &o, sockaddr_storage &addr,
+                          socklen_t &addrLen) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *res = nullptr;
+  std::string port = std::to_string(o.port);
+  if (getaddrinfo(o.broker.c_str(), port.c_str(), &hints, &res) != 0 || !res) {
+    return false;
+  }
+  std::memcpy(&addr, res->ai_addr, res->ai_addrlen);
+  addrLen = res->ai_addrlen;
+  freeaddrinfo(res);
+  return true;
+}
+
+static bool startConnect(Connection &c, const sockaddr_storage &addr,
+                         socklen_t addrLen) {
+  c.fd = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (c.fd < 0) {
+    return false;
+  }
+  fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(c.fd, (const sockaddr *)&addr, addrLen) < 0 &&
+      errno != EINPROGRESS) {
+    close(c.fd);
+    c.fd = -1;
+    return false;
+  }
+  c.state = CONN_CONNECTING;
+  return true;
+}
+
+static void closeConnection(Connection &c) {
+  if (c.fd >= 0) {
+    close(c.fd);
+  }
+  c.fd = -1;
+  c.state = CONN_FAILED;
+  c.tx.clear();
+  c.txOff = 0;
+  c.rx.clear();
+}
+
+// Write as much pending data as the socket accepts. False on error.
+static bool flushTx(Connection &c) {
+  while (c.txOff < c.tx.size()) {
+    ssize_t n = send(c.fd, c.tx.data() + c.txOff, c.tx.size() - c.txOff,
+#ifdef MSG_NOSIGNAL
+                     MSG_NOSIGNAL
+#else
+                     0
+#endif
+    );
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    c.txOff += (size_t)n;
+  }
+  c.tx.clear();
+  c.txOff = 0;
+  return true;
+}
+
+// Parsed inbound packet (only what the benchmark needs)
+struct Packet {
+  uint8_t type;
+  std::string topic;
+  std::string payload;
+};
+
+// Read available bytes and extract complete packets. False on EOF/error.
+static bool readPackets(Connection &c, std::vector<Packet> &out) {
+  char buf[16384];
+  for (;;) {
+    ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      c.rx.append(buf, (size_t)n);
+      continue;
+    }
+    if (n == 0) {
+      return false;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    }
+    return false;
+  }
+
+  size_t pos = 0;
+  while (c.rx.size() - pos >= 2) {
+    size_t len = 0;
+    size_t mult = 1;
+    size_t i = pos + 1;
+    bool complete = false;
+    while (i < c.rx.size() && i < pos + 5) {
+      uint8_t b = (uint8_t)c.rx[i++];
+      len += (b & 0x7F) * mult;
+      mult *= 128;
+      if ((b & 0x80) == 0) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete || c.rx.size() - i < len) {
+      break; // Need more bytes
+    }
+    Packet p;
+    p.type = (uint8_t)c.rx[pos] >> 4;
+    if (p.type == 3) { // PUBLISH (QoS 0: no packet id)
+      const size_t tlen =
+          len >= 2 ? ((uint8_t)c.rx[i] << 8) | (uint8_t)c.rx[i + 1] : 0;
+      if (len < 2 || tlen + 2 > len) {
+        pos = i + len; // Topic runs past the packet: drop it, stay framed
+        continue;
+      }
+      p.topic.assign(c.rx, i + 2, tlen);
+      p.payload.assign(c.rx, i + 2 + tlen, len - 2 - tlen);
+    } else {
+      p.payload.assign(c.rx, i, len); // Variable header (CONNACK flags/rc)
+    }
+    out.push_back(std::move(p));
+    pos = i + len;
+  }
+  c.rx.erase(0, pos);
+  return true;
+}
+
+// ============================================
+// LATENCY STATS
+// ============================================
+struct LatencyLog {
+  std::vector<uint32_t> us;
+  void add(int64_t v) { us.push_back((uint32_t)std::max<int64_t>(v, 0)); }
+  void merge(const LatencyLog &o) {
+    us.insert(us.end(), o.us.begin(), o.us.end());
+  }
+};
+
+static double percentile(std::vector<uint32_t> &v, double p) {
+  if (v.empty()) {
+    return 0.0;
+  }
+  size_t idx = (size_t)std::ceil(p / 100.0 * (double)v.size());
+  idx = std::min(std::max<size_t>(idx, 1), v.size()) - 1;
+  std::nth_element(v.begin(), v.begin() + (long)idx, v.end());
+  return v[idx] / 1000.0;
+}
+
+static void printLatency(const char *name, LatencyLog &log) {
+  std::vector<uint32_t> &v = log.us;
+  if (v.empty()) {
+    std::printf("  %-9s (no samples)\n", name);
+    return;
+  }
+  double p50 = percentile(v, 50), p90 = percentile(v, 90);
+  double p99 = percentile(v, 99), p999 = percentile(v, 99.9);
+  double max = *std::max_element(v.begin(), v.end()) / 1000.0;
+  std::printf("  %-9s n=%-9zu p50=%7.2f p90=%7.2f p99=%7.2f p99.9=%7.2f "
+              "max=%8.2f ms\n",
+              name, v.size(), p50, p90, p99, p999, max);
+}
+
+// Extract an integer JSON field ("key":123) without a JSON parser.
+static bool findIntField(const std::string &json, const char *key,
+                         int64_t &out) {
+  std::string needle = std::string("\"") + key + "\":";
+  size_t p = json.find(needle);
+  if (p == std::string::npos) {
+    return false;
+  }
+  out = std::strtoll(json.c_str() + p + needle.size(), nullptr, 10);
+  return true;
+}
+
+// Device id is the second topic level: vending/<id>/...
+static std::string deviceFromTopic(const std::string &topic) {
+  size_t a = topic.find('/');
+  size_t b = topic.find('/', a + 1);
+  if (a == std::string::npos || b == std::string::npos) {
+    return std::string();
+  }
+  return topic.substr(a + 1, b - a - 1);
+}
+
+// ============================================
+// SHARED COUNTERS
+// ============================================
+struct Counters {
+  std::atomic<uint64_t> connected{0};
+  std::atomic<uint64_t> connectFailures{0};
+  std::atomic<uint64_t> disconnects{0};
+  std::atomic<uint64_t> published{0};
+  std::atomic<uint64_t> publishedBytes{0};
+  std::atomic<uint64_t> received{0};
+};
+static Counters counters;
+
+// ============================================
+// VIRTUAL DEVICE WORKER
+// ============================================
+enum DeviceEvent : uint8_t { EV_HEARTBEAT, EV_TDS, EV_LOG };
+
+struct Scheduled {
+  int64_t atUs;
+  uint32_t device;
+  DeviceEvent event;
+  bool operator>(const Scheduled &o) const { return atUs > o.atUs; }
+};
+
+struct VirtualDevice {
+  std::string id;
+  std::string group;
+  Connection conn;
+  long balance = 0;
+  int tds = 80;
+  // Topics, same layout as generateMQTTTopics()
+  std::string tHeartbeat, tStatus, tTds, tLog, tPayment;
+};
+
+class DeviceWorker {
+public:
+  DeviceWorker(const Options &o, int index, uint32_t firstDevice,
+               uint32_t count, int64_t rampStartUs,
+               const sockaddr_storage &addr, socklen_t addrLen)
+      : opt(o), rng(1234567u + (uint32_t)index), addr(addr),
+        addrLen(addrLen) {
+    devices.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t n = firstDevice + i;
+      VirtualDevice &d = devices[i];
+      char id[64];
+      std::snprintf(id, sizeof(id), "%s_%05u", o.prefix.c_str(), n);
+      d.id = id;
+      if (o.groups > 0) {
+        d.group = "g" + std::to_string(n % (uint32_t)o.groups);
+      }
+      std::string base = "vending/" + d.id;
+      d.tHeartbeat = base + "/heartbeat";
+      d.tStatus = base + "/status/out";
+      d.tTds = base + "/tds/out";
+      d.tLog = base + "/log/out";
+      d.tPayment = base + "/payment/in";
+      // Connections are spread over the ramp according to --connect-rate
+      connectAtUs.push_back(rampStartUs +
+                            (int64_t)((double)n / o.connectRate * 1e6));
+    }
+  }
+
+  void run(int64_t stopAtUs) {
+    std::vector<pollfd> pfds;
+    std::vector<uint32_t> pfdDevice;
+    std::vector<Packet> packets;
+    size_t nextConnect = 0;
+
+    while (!stopRequested && nowUs() < stopAtUs) {
+      int64_t now = nowUs();
+
+      // Ramp-up
+      while (nextConnect < devices.size() && connectAtUs[nextConnect] <= now) {
+        VirtualDevice &d = devices[nextConnect];
+        if (!startConnect(d.conn, addr, addrLen)) {
+          counters.connectFailures++;
+          d.conn.state = CONN_FAILED;
+        }
+        nextConnect++;
+      }
+
+      // Due events
+      while (!schedule.empty() && schedule.top().atUs <= now) {
+        Scheduled ev = schedule.top();
+        schedule.pop();
+        fire(ev, now);
+      }
+
+      // Keep-alive for quiet connections
+      for (VirtualDevice &d : devices) {
+        if (d.conn.state == CONN_READY &&
+            now - d.conn.lastTxUs > (int64_t)opt.keepAlive * 500000) {
+          d.conn.tx.append("\xC0\x00", 2);
+          d.conn.lastTxUs = now;
+        }
+      }
+
+      pfds.clear();
+      pfdDevice.clear();
+      for (uint32_t i = 0; i < devices.size(); i++) {
+        Connection &c = devices[i].conn;
+        if (c.fd < 0) {
+          continue;
+        }
+        short events = POLLIN;
+        if (c.state == CONN_CONNECTING || !c.tx.empty()) {
+          events |= POLLOUT;
+        }
+        pfds.push_back({c.fd, events, 0});
+        pfdDevice.push_back(i);
+      }
+
+      int64_t waitUs = 50000;
+      if (!schedule.empty()) {
+        waitUs = std::min(waitUs, schedule.top().atUs - now);
+      }
+      if (nextConnect < devices.size()) {
+        waitUs = std::min(waitUs, connectAtUs[nextConnect] - now);
+      }
+      int timeoutMs = (int)std::max<int64_t>(0, waitUs / 1000);
+      if (pfds.empty()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+        continue;
+      }
+      int ready = poll(pfds.data(), (nfds_t)pfds.size(), timeoutMs);
+      if (ready <= 0) {
+        continue;
+      }
+
+      now = nowUs();
+      for (size_t k = 0; k < pfds.size(); k++) {
+        if (pfds[k].revents == 0) {
+          continue;
+        }
+        VirtualDevice &d = devices[pfdDevice[k]];
+        Connection &c = d.conn;
+
+        if (c.state == CONN_CONNECTING) {
+          int err = 0;
+          socklen_t len = sizeof(err);
+          getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+          if (err != 0 || (pfds[k].revents & (POLLERR | POLLHUP))) {
+            counters.connectFailures++;
+            closeConnection(c);
+            continue;
+          }
+          c.state = CONN_HANDSHAKE;
+          c.tx = encodeConnect(d.id, opt);
+          c.lastTxUs = now;
+        }
+
+        if (pfds[k].revents & POLLIN) {
+          packets.clear();
+          if (!readPackets(c, packets)) {
+            counters.disconnects++;
+            closeConnection(c);
+            continue;
+          }
+          for (Packet &p : packets) {
+            onPacket(pfdDevice[k], p, now);
+          }
+        }
+        if (!c.tx.empty() && !flushTx(c)) {
+          counters.disconnects++;
+          closeConnection(c);
+        }
+      }
+    }
+
+    for (VirtualDevice &d : devices) {
+      if (d.conn.fd >= 0) {
+        d.conn.tx.assign("\xE0\x00", 2); // DISCONNECT
+        flushTx(d.conn);
+        close(d.conn.fd);
+        d.conn.fd = -1;
+      }
+    }
+  }
+
+  LatencyLog downlink;
+
+private:
+  const Options &opt;
+  std::mt19937 rng;
+  const sockaddr_storage &addr;
+  socklen_t addrLen;
+  std::vector<VirtualDevice> devices;
+  std::vector<int64_t> connectAtUs;
+  std::priority_queue<Scheduled, std::vector<Scheduled>,
+                      std::greater<Scheduled>>
+      schedule;
+
+  double uniform() { return std::uniform_real_distribution<double>(0, 1)(rng); }
+
+  // Poisson process: exponential inter-arrival time
+  int64_t exponentialUs(double perHour) {
+    return (int64_t)(-std::log(1.0 - uniform()) * 3600e6 / perHour);
+  }
+
+  void publish(VirtualDevice &d, const std::string &topic,
+               const std::string &payload, bool retain, int64_t now) {
+    appendPublish(d.conn.tx, topic, payload, retain);
+    d.conn.lastTxUs = now;
+    counters.published++;
+    counters.publishedBytes += payload.size() + topic.size() + 4;
+  }
+
+  void onReady(uint32_t idx, int64_t now) {
+    VirtualDevice &d = devices[idx];
+    d.conn.state = CONN_READY;
+    counters.connected++;
+
+    // Same subscriptions as reconnectMQTT()
+    std::vector<std::string> filters = {
+        "vending/" + d.id + "/payment/in", "vending/" + d.id + "/config/in",
+        "vending/" + d.id + "/ota/in", "vending/broadcast/config",
+        "vending/broadcast/command"};
+    if (!d.group.empty()) {
+      filters.push_back("vending/group/" + d.group + "/config");
+      filters.push_back("vending/group/" + d.group + "/command");
+    }
+    d.conn.tx += encodeSubscribe(1, filters);
+    publishStatus(d, "IDLE", -1, now);
+
+    // Random phase so heartbeats do not arrive in lockstep
+    schedule.push({now + (int64_t)(uniform() * opt.hbInterval * 1e6), idx,
+                   EV_HEARTBEAT});
+    schedule.push({now + (int64_t)(uniform() * opt.tdsInterval * 1e6), idx,
+                   EV_TDS});
+    if (opt.logsPerHour > 0) {
+      schedule.push({now + exponentialUs(opt.logsPerHour), idx, EV_LOG});
+    }
+  }
+
+  void publishStatus(VirtualDevice &d, const char *state, int64_t paymentT,
+                     int64_t now) {
+    char buf[256];
+    int n = std::snprintf(
+        buf, sizeof(buf),
+        "{\"device_id\":\"%s\",\"state\":\"%s\",\"balance\":%ld,"
+        "\"last_dispense\":0,\"tds\":%d,\"free_water_available\":false,"
+        "\"_t\":%" PRId64,
+        d.id.c_str(), state, d.balance, d.tds, now);
+    std::string payload(buf, (size_t)n);
+    if (paymentT >= 0) {
+      payload += ",\"_pt\":" + std::to_string(paymentT);
+    }
+    payload += "}";
+    publish(d, d.tStatus, payload, true, now);
+  }
+
+  void fire(const Scheduled &ev, int64_t now) {
+    VirtualDevice &d = devices[ev.device];
+    if (d.conn.state != CONN_READY) {
+      return; // Dropped connection: stop its schedule
+    }
+    char buf[256];
+    int n = 0;
+    switch (ev.event) {
+    case EV_HEARTBEAT:
+      // main.cpp publishes status, then the heartbeat
+      publishStatus(d, "IDLE", -1, now);
+      n = std::snprintf(
+          buf, sizeof(buf),
+          "{\"status\":\"online\",\"uptime\":%" PRId64 ",\"ip\":\"10.0.%u.%u\","
+          "\"rssi\":%d,\"ssid\":\"bench\",\"firmware_version\":\"2.4.0-main\","
+          "\"free_heap\":%u,\"_t\":%" PRId64 "}",
+          now / 1000000, (ev.device >> 8) & 0xFF, ev.device & 0xFF,
+          -50 - (int)(uniform() * 30), 150000u + (unsigned)(uniform() * 20000),
+          now);
+      publish(d, d.tHeartbeat, std::string(buf, (size_t)n), false, now);
+      schedule.push({now + (int64_t)(opt.hbInterval * 1e6), ev.device,
+                     EV_HEARTBEAT});
+      break;
+    case EV_TDS:
+      d.tds = 60 + (int)(uniform() * 60);
+      n = std::snprintf(buf, sizeof(buf),
+                        "{\"device_id\":\"%s\",\"tds\":%d,\"_t\":%" PRId64 "}",
+                        d.id.c_str(), d.tds, now);
+      publish(d, d.tTds, std::string(buf, (size_t)n), false, now);
+      schedule.push(
+          {now + (int64_t)(opt.tdsInterval * 1e6), ev.device, EV_TDS});
+      break;
+    case EV_LOG:
+      n = std::snprintf(buf, sizeof(buf),
+                        "{\"device_id\":\"%s\",\"event\":\"SESSION\","
+                        "\"message\":\"Session ended\",\"_t\":%" PRId64 "}",
+                        d.id.c_str(), now);
+      publish(d, d.tLog, std::string(buf, (size_t)n), false, now);
+      schedule.push({now + exponentialUs(opt.logsPerHour), ev.device, EV_LOG});
+      break;
+    }
+  }
+
+  void onPacket(uint32_t idx, Packet &p, int64_t now) {
+    VirtualDevice &d = devices[idx];
+    switch (p.type) {
+    case 2: // CONNACK
+      if (d.conn.state != CONN_HANDSHAKE) {
+        break;
+      }
+      if (p.payload.size() >= 2 && p.payload[1] == 0) {
+        onReady(idx, now);
+      } else {
+        counters.connectFailures++; // Refused (auth, client id, ...)
+        closeConnection(d.conn);
+      }
+      break;
+    case 3: { // PUBLISH
+      counters.received++;
+      int64_t sentUs = 0;
+      if (p.topic == d.tPayment && findIntField(p.payload, "_t", sentUs)) {
+        downlink.add(now - sentUs);
+        int64_t amount = 0;
+        findIntField(p.payload, "amount", amount);
+        d.balance += (long)amount;
+        // processPayment(): status + PAYMENT log
+        publishStatus(d, "ACTIVE", sentUs, now);
+        char buf[192];
+        int n = std::snprintf(buf, sizeof(buf),
+                              "{\"device_id\":\"%s\",\"event\":\"PAYMENT\","
+                              "\"message\":\"%" PRId64 "\",\"_t\":%" PRId64 "}",
+                              d.id.c_str(), amount, now);
+        publish(d, d.tLog, std::string(buf, (size_t)n), false, now);
+        d.balance = 0; // Session spends it (keeps payloads steady)
+      }
+      break;
+    }
+    default: // SUBACK / PINGRESP
+      break;
+    }
+  }
+};
+
+// ============================================
+// BACKEND (payment publisher + uplink subscriber)
+// ============================================
+class Backend {
+public:
+  Backend(const Options &o, const sockaddr_storage &addr, socklen_t addrLen)
+      : opt(o), rng(42), addr(addr), addrLen(addrLen) {}
+
+  bool connectAll() {
+    if (!connectBlocking(pub, "bench_backend_pub") ||
+        !connectBlocking(sub, "bench_backend_sub")) {
+      return false;
+    }
+    sub.tx = encodeSubscribe(1, {"vending/+/heartbeat", "vending/+/status/out",
+                                 "vending/+/tds/out", "vending/+/log/out"});
+    return flushTx(sub);
+  }
+
+  void run(int64_t loadStartUs, int64_t stopAtUs) {
+    const double fleetPaymentsPerHour = opt.paymentsPerHour * opt.devices;
+    int64_t nextPaymentUs = loadStartUs + exponentialUs(fleetPaymentsPerHour);
+    int64_t nextReportUs = nowUs() + (int64_t)(opt.reportInterval * 1e6);
+    uint64_t lastPublished = 0, lastReceived = 0;
+    int64_t lastReportUs = nowUs();
+    std::vector<Packet> packets;
+
+    while (!stopRequested && nowUs() < stopAtUs) {
+      int64_t now = nowUs();
+
+      while (fleetPaymentsPerHour > 0 && nextPaymentUs <= now) {
+        sendPayment(now);
+        nextPaymentUs += exponentialUs(fleetPaymentsPerHour);
+      }
+      for (Connection *c : {&pub, &sub}) {
+        if (now - c->lastTxUs > (int64_t)opt.keepAlive * 500000) {
+          c->tx.append("\xC0\x00", 2);
+          c->lastTxUs = now;
+        }
+      }
+      if (!pub.tx.empty() && !flushTx(pub)) {
+        std::fprintf(stderr, "Backend publisher disconnected\n");
+        return;
+      }
+
+      if (now >= nextReportUs) {
+        uint64_t p = counters.published + paymentsSent;
+        uint64_t r = counters.received + uplinkReceived;
+        double dt = (now - lastReportUs) / 1e6;
+        std::vector<uint32_t> window = windowUplink.us;
+        std::printf("[%6.1fs] conn=%" PRIu64 "/%d  pub=%.0f/s  recv=%.0f/s  "
+                    "uplink p50=%.2fms p99=%.2fms\n",
+                    now / 1e6, counters.connected.load(), opt.devices,
+                    (p - lastPublished) / dt, (r - lastReceived) / dt,
+                    percentile(window, 50), percentile(window, 99));
+        std::fflush(stdout);
+        windowUplink.us.clear();
+        lastPublished = p;
+        lastReceived = r;
+        lastReportUs = now;
+        nextReportUs = now + (int64_t)(opt.reportInterval * 1e6);
+      }
+
+      pollfd pfds[2] = {{pub.fd, (short)(POLLIN | (pub.tx.empty() ? 0 : POLLOUT)), 0},
+                        {sub.fd, (short)(POLLIN | (sub.tx.empty() ? 0 : POLLOUT)), 0}};
+      int64_t waitUs = std::min<int64_t>(
+          {nextPaymentUs - now, nextReportUs - now, 20000});
+      int ready = poll(pfds, 2, (int)std::max<int64_t>(0, waitUs / 1000));
+      if (ready <= 0) {
+        continue;
+      }
+      now = nowUs();
+      if (pfds[1].revents & POLLIN) {
+        packets.clear();
+        if (!readPackets(sub, packets)) {
+          std::fprintf(stderr, "Backend subscriber disconnected\n");
+          return;
+        }
+        for (Packet &pk : packets) {
+          onUplink(pk, now);
+        }
+      }
+      if (!sub.tx.empty()) {
+        flushTx(sub);
+      }
+      if (pfds[0].revents & POLLIN) {
+        packets.clear();
+        readPackets(pub, packets); // PINGRESP only
+      }
+    }
+  }
+
+  void close() {
+    for (Connection *c : {&pub, &sub}) {
+      if (c->fd >= 0) {
+        ::close(c->fd);
+        c->fd = -1;
+      }
+    }
+  }
+
+  LatencyLog uplink;
+  LatencyLog roundTrip;
+  uint64_t paymentsSent = 0;
+  uint64_t uplinkReceived = 0;
+
+private:
+  const Options &opt;
+  std::mt19937 rng;
+  const sockaddr_storage &addr;
+  socklen_t addrLen;
+  Connection pub;
+  Connection sub;
+  LatencyLog windowUplink;
+  uint64_t txnCounter = 0;
+
+  double uniform() { return std::uniform_real_distribution<double>(0, 1)(rng); }
+
+  int64_t exponentialUs(double perHour) {
+    return (int64_t)(-std::log(1.0 - uniform()) * 3600e6 / perHour);
+  }
+
+  bool connectBlocking(Connection &c, const char *clientId) {
+    if (!startConnect(c, addr, addrLen)) {
+      return false;
+    }
+    pollfd pfd = {c.fd, POLLOUT, 0};
+    if (poll(&pfd, 1, 5000) <= 0) {
+      return false;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+      return false;
+    }
+    c.tx = encodeConnect(clientId, opt);
+    c.lastTxUs = nowUs();
+    if (!flushTx(c)) {
+      return false;
+    }
+    std::vector<Packet> packets;
+    int64_t deadline = nowUs() + 5000000;
+    while (nowUs() < deadline) {
+      pfd = {c.fd, POLLIN, 0};
+      if (poll(&pfd, 1, 100) > 0) {
+        if (!readPackets(c, packets)) {
+          return false;
+        }
+        for (const Packet &p : packets) {
+          if (p.type == 2) {
+            c.state = CONN_READY;
+            return p.payload.size() >= 2 && p.payload[1] == 0;
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+  // Same field order as canonicalPayment() in mqtt_handler.cpp
+  void sendPayment(int64_t now) {
+    uint32_t n = (uint32_t)(uniform() * opt.devices);
+    char id[64];
+    std::snprintf(id, sizeof(id), "%s_%05u", opt.prefix.c_str(), n);
+    int amount = 500 * (1 + (int)(uniform() * 20));
+    char txn[48];
+    std::snprintf(txn, sizeof(txn), "bench_%" PRIu64, ++txnCounter);
+    uint64_t ts = epochMs();
+
+    char canonical[256];
+    std::snprintf(canonical, sizeof(canonical),
+                  "{\"amount\":%d,\"source\":\"bench\",\"transaction_id\":"
+                  "\"%s\",\"ts\":%" PRIu64 ",\"device_id\":\"%s\"}",
+                  amount, txn, ts, id);
+
+    char payload[384];
+    int len = std::snprintf(
+        payload, sizeof(payload),
+        "{\"amount\":%d,\"source\":\"bench\",\"transaction_id\":\"%s\","
+        "\"ts\":%" PRIu64 ",\"_t\":%" PRId64 "%s%s%s}",
+        amount, txn, ts, now, opt.secret.empty() ? "" : ",\"sig\":\"",
+        opt.secret.empty() ? ""
+                           : hmacSha256Hex(canonical, opt.secret).c_str(),
+        opt.secret.empty() ? "" : "\"");
+    appendPublish(pub.tx, std::string("vending/") + id + "/payment/in",
+                  std::string(payload, (size_t)len), false);
+    pub.lastTxUs = now;
+    paymentsSent++;
+  }
+
+  void onUplink(Packet &p, int64_t now) {
+    if (p.type != 3) {
+      return;
+    }
+    uplinkReceived++;
+    int64_t sentUs = 0;
+    if (!findIntField(p.payload, "_t", sentUs)) {
+      return; // Retained status from an earlier run, or a real device
+    }
+    uplink.add(now - sentUs);
+    windowUplink.add(now - sentUs);
+    int64_t paymentUs = 0;
+    if (findIntField(p.payload, "_pt", paymentUs) &&
+        !deviceFromTopic(p.topic).empty()) {
+      roundTrip.add(now - paymentUs);
+    }
+  }
+};
+
+// ============================================
+// MAIN
+// ============================================
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    return 2;
+  }
+  std::signal(SIGINT, onSignal);
+  std::signal(SIGPIPE, SIG_IGN);
+
+  rlimit lim{};
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+    rlim_t need = (rlim_t)opt.devices + 64;
+    if (lim.rlim_cur < need) {
+      lim.rlim_cur = std::min(need, lim.rlim_max);
+      setrlimit(RLIMIT_NOFILE, &lim);
+      getrlimit(RLIMIT_NOFILE, &lim);
+      if (lim.rlim_cur < need) {
+        std::fprintf(stderr,
+                     "Warning: open file limit %llu < %llu, raise ulimit -n\n",
+                     (unsigned long long)lim.rlim_cur,
+                     (unsigned long long)need);
+      }
+    }
+  }
+
+  sockaddr_storage addr{};
+  socklen_t addrLen = 0;
+  if (!resolveBroker(opt, addr, addrLen)) {
+    std::fprintf(stderr, "Cannot resolve %s\n", opt.broker.c_str());
+    return 1;
+  }
+
+  Backend backend(opt, addr, addrLen);
+  if (!backend.connectAll()) {
+    std::fprintf(stderr, "Cannot connect to %s:%d\n", opt.broker.c_str(),
+                 opt.port);
+    return 1;
+  }
+
+  const double rampSeconds = opt.devices / opt.connectRate;
+  const int64_t rampStartUs = nowUs();
+  const int64_t loadStartUs = rampStartUs + (int64_t)(rampSeconds * 1e6);
+  const int64_t stopAtUs = loadStartUs + (int64_t)(opt.duration * 1e6);
+
+  std::printf("Fleet: %d devices on %d threads, ramp %.1fs, steady %.0fs, "
+              "hb %.0fs, %.1f payments/h/device%s\n",
+              opt.devices, opt.threads, rampSeconds, opt.duration,
+              opt.hbInterval, opt.paymentsPerHour,
+              opt.secret.empty() ? "" : " (signed)");
+
+  std::vector<DeviceWorker *> workers;
+  std::vector<std::thread> threads;
+  uint32_t perThread = (uint32_t)((opt.devices + opt.threads - 1) / opt.threads);
+  for (int t = 0; t < opt.threads; t++) {
+    uint32_t first = (uint32_t)t * perThread;
+    if (first >= (uint32_t)opt.devices) {
+      break;
+    }
+    uint32_t count = std::min(perThread, (uint32_t)opt.devices - first);
+    workers.push_back(
+        new DeviceWorker(opt, t, first, count, rampStartUs, addr, addrLen));
+  }
+  for (DeviceWorker *w : workers) {
+    threads.emplace_back([w, stopAtUs] { w->run(stopAtUs); });
+  }
+
+  backend.run(loadStartUs, stopAtUs);
+  stopRequested = true;
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  backend.close();
+
+  LatencyLog downlink;
+  for (DeviceWorker *w : workers) {
+    downlink.merge(w->downlink);
+    delete w;
+  }
+
+  const double elapsed = std::max(1e-3, (nowUs() - rampStartUs) / 1e6);
+  const uint64_t published = counters.published + backend.paymentsSent;
+  const uint64_t received = counters.received + backend.uplinkReceived;
+  std::printf("\n========== RESULTS ==========\n");
+  std::printf("  elapsed    %.1f s\n", elapsed);
+  std::printf("  devices    %" PRIu64 " connected, %" PRIu64
+              " connect failures, %" PRIu64 " disconnects\n",
+              counters.connected.load(), counters.connectFailures.load(),
+              counters.disconnects.load());
+  std::printf("  published  %" PRIu64 " msgs (%.0f msg/s, %.1f KiB/s)\n",
+              published, published / elapsed,
+              counters.publishedBytes / elapsed / 1024.0);
+  std::printf("  received   %" PRIu64 " msgs (%.0f msg/s)\n", received,
+              received / elapsed);
+  std::printf("  payments   %" PRIu64 " sent\n", backend.paymentsSent);
+  std::printf("Latency (end-to-end through broker):\n");
+  printLatency("uplink", backend.uplink);
+  printLatency("downlink", downlink);
+  printLatency("payment", backend.roundTrip);
+  return counters.connectFailures > 0 ? 3 : 0;
+}
@@ -88,11 +88,20 @@ def main() -> int:
         ("Pause Button", "PAUSE_BUTTON_PIN", "Input (PullUp)"),
         ("UART RX (from Payment)", "UART_RX_PIN", "Serial2 RX"),
         ("UART TX (to Payment)", "UART_TX_PIN", "Serial2 TX"),
+        ("Nozzle 2 Relay", "NOZZLE2_RELAY_PIN", "Output (NOZZLE_COUNT >= 2)"),
+        ("Nozzle 2 Flow Sensor", "NOZZLE2_FLOW_PIN", "Input (Interrupt)"),
+        ("Nozzle 2 Start Button", "NOZZLE2_START_PIN", "Input (PullUp)"),
+        ("Nozzle 2 Pause Button", "NOZZLE2_PAUSE_PIN", "Input (PullUp)"),
+        ("Nozzle 3 Relay", "NOZZLE3_RELAY_PIN", "Output (NOZZLE_COUNT = 3)"),
+        ("Nozzle 3 Flow Sensor", "NOZZLE3_FLOW_PIN", "Input (Interrupt)"),
+        ("Nozzle 3 Start Button", "NOZZLE3_START_PIN", "Input (PullUp)"),
+        ("Nozzle 3 Pause Button", "NOZZLE3_PAUSE_PIN", "Input (PullUp)"),
     ]
 
     pay_rows = [
         ("Cash Acceptor Pulse", "CASH_PULSE_PIN", "Input (Interrupt)"),
         ("Status LED", "LED_PIN", "Output"),
+        ("Acceptor Inhibit", "CASH_INHIBIT_PIN", "Output (active HIGH)"),
         ("UART TX (to Main)", "UART_TX_PIN", "Serial2 TX"),
         ("UART RX (from Main)", "UART_RX_PIN", "Serial2 RX"),
     ]
@@ -0,0 +1,243 @@
+#include "logger.h"
+#include <Arduino.h>
+#include <cstdio>
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+static portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+#define LOG_LOCK() portENTER_CRITICAL(&logMux)
+#define LOG_UNLOCK() portEXIT_CRITICAL(&logMux)
+#else
+#define LOG_LOCK()
+#define LOG_UNLOCK()
+#endif
+
+// ============================================
+// RING BUFFER
+// ============================================
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0,
+              "LOG_RING_SIZE must be a power of two");
+
+static LogRecord logRing[LOG_RING_SIZE];
+static uint32_t logHead = 0; // next write
+static uint32_t logTail = 0; // next read
+static uint32_t logDropped = 0;
+static uint32_t logDroppedReported = 0;
+
+#define LOG_DRAIN_TASK_STACK 3072
+#define LOG_DRAIN_TASK_PRIORITY 1 // Just above idle
+#define LOG_DRAIN_IDLE_MS 20
+#define LOG_DRAIN_BATCH 8
+
+void logInit() {
+  LOG_LOCK();
+  logHead = 0;
+  logTail = 0;
+  logDropped = 0;
+  logDroppedReported = 0;
+  LOG_UNLOCK();
+}
+
+uint32_t logTimestampMs() { return millis(); }
+
+void logPush(const LogRecord &rec) {
+  LOG_LOCK();
+  if (logHead - logTail >= LOG_RING_SIZE) {
+    logDropped++;
+    LOG_UNLOCK();
+    return;
+  }
+  logRing[logHead & (LOG_RING_SIZE - 1)] = rec;
+  logHead++;
+  LOG_UNLOCK();
+}
+
+static bool logPop(LogRecord &out) {
+  LOG_LOCK();
+  if (logTail == logHead) {
+    LOG_UNLOCK();
+    return false;
+  }
+  out = logRing[logTail & (LOG_RING_SIZE - 1)];
+  logTail++;
+  LOG_UNLOCK();
+  return true;
+}
+
+uint32_t logDroppedCount() { return logDropped; }
+
+uint32_t logPendingCount() {
+  LOG_LOCK();
+  uint32_t pending = logHead - logTail;
+  LOG_UNLOCK();
+  return pending;
+}
+
+// ============================================
+// FORMATTING (runs only in the drain context)
+// ============================================
+static const char *levelTag(uint8_t level) {
+  switch (level) {
+  case LOG_LEVEL_ERROR:
+    return "E";
+  case LOG_LEVEL_WARN:
+    return "W";
+  case LOG_LEVEL_INFO:
+    return "I";
+  default:
+    return "D";
+  }
+}
+
+// Format one conversion using the captured type, not the spec's length
+// modifiers, so a mismatched %lu/%d can never read the wrong vararg size.
+static int formatArg(char *out, size_t outSize, const char *specStart,
+                     size_t specLen, const LogRecord &rec, uint8_t argIdx) {
+  char spec[16];
+  size_t n = 0;
+  spec[n++] = '%';
+  // Copy flags/width/precision, drop length modifiers (h, l, z, j, t, L).
+  for (size_t i = 1; i + 1 < specLen && n < sizeof(spec) - 3; i++) {
+    char c = specStart[i];
+    if (strchr("hlzjtLq", c) == nullptr) {
+      spec[n++] = c;
+    }
+  }
+  char conv = specStart[specLen - 1];
+  const uint8_t type = rec.types[argIdx];
+  const LogArgValue value = rec.args[argIdx];
+
+  switch (type) {
+  case LOG_ARG_STR: {
+    spec[n++] = 's';
+    spec[n] = '\0';
+    const char *s = (value.u < LOG_STR_CAPACITY) ? rec.str + value.u : "";
+    return snprintf(out, outSize, spec, s);
+  }
+  case LOG_ARG_FLOAT:
+    if (strchr("fFeEgG", conv) == nullptr) {
+      conv = 'f';
+    }
+    spec[n++] = conv;
+    spec[n] = '\0';
+    return snprintf(out, outSize, spec, static_cast<double>(value.f));
+  case LOG_ARG_UINT:
+    if (strchr("uxXoc", conv) == nullptr) {
+      conv = 'u';
+    }
+    spec[n++] = conv;
+    spec[n] = '\0';
+    return snprintf(out, outSize, spec, static_cast<unsigned int>(value.u));
+  default:
+    if (strchr("dixXc", conv) == nullptr) {
+      conv = 'd';
+    }
+    spec[n++] = conv;
+    spec[n] = '\0';
+    return snprintf(out, outSize, spec, static_cast<int>(value.i));
+  }
+}
+
+int logFormatRecord(const LogRecord &rec, char *out, size_t outSize) {
+  if (outSize == 0) {
+    return 0;
+  }
+  int pos = snprintf(out, outSize, "[%7lu][%s] ",
+                     static_cast<unsigned long>(rec.ms), levelTag(rec.level));
+  if (pos < 0 || (size_t)pos >= outSize) {
+    out[outSize - 1] = '\0';
+    return (int)outSize - 1;
+  }
+
+  const char *p = rec.fmt ? rec.fmt : "";
+  uint8_t argIdx = 0;
+  while (*p && (size_t)pos < outSize - 1) {
+    if (*p != '%') {
+      out[pos++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      out[pos++] = '%';
+      p += 2;
+      continue;
+    }
+
+    // Find the conversion character
+    const char *q = p + 1;
+    while (*q && strchr("diuxXoscfFeEgGp", *q) == nullptr) {
+      q++;
+    }
+    if (!*q) {
+      break; // Malformed spec: stop here
+    }
+    const size_t specLen = (size_t)(q - p) + 1;
+
+    if (argIdx < rec.argc) {
+      int w = formatArg(out + pos, outSize - pos, p, specLen, rec, argIdx);
+      if (w > 0) {
+        pos += w;
+        if ((size_t)pos >= outSize) {
+          pos = (int)outSize - 1;
+        }
+      }
+    } else {
+      // Missing argument: emit "?" rather than reading garbage
+      out[pos++] = '?';
+    }
+    argIdx++;
+    p = q + 1;
+  }
+
+  out[pos] = '\0';
+  return pos;
+}
+
+// ============================================
+// DRAIN
+// ============================================
+int logDrain(int maxRecords) {
+  char line[LOG_LINE_MAX];
+  int written = 0;
+
+  uint32_t dropped = logDropped;
+  if (dropped != logDroppedReported) {
+    snprintf(line, sizeof(line), "[log] %lu records dropped",
+             static_cast<unsigned long>(dropped - logDroppedReported));
+    logDroppedReported = dropped;
+    Serial.println(line);
+  }
+
+  LogRecord rec;
+  while (written < maxRecords && logPop(rec)) {
+    logFormatRecord(rec, line, sizeof(line));
+    Serial.println(line);
+    written++;
+  }
+  return written;
+}
+
+#if defined(ESP32)
+static void logDrainTask(void *) {
+  for (;;) {
+    if (logDrain(LOG_DRAIN_BATCH) == 0) {
+      vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_IDLE_MS));
+    } else {
+      taskYIELD();
+    }
+  }
+}
+#endif
+
+void logStartDrainTask() {
+#if defined(ESP32)
+  static bool started = false;
+  if (started) {
+    return;
+  }
+  started = true;
+  xTaskCreatePinnedToCore(logDrainTask, "log_drain", LOG_DRAIN_TASK_STACK,
+                          nullptr, LOG_DRAIN_TASK_PRIORITY, nullptr,
+                          tskNO_AFFINITY);
+#endif
+}
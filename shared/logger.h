@@ -0,0 +1,208 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstdint>
+#include <cstring>
+
+// ============================================
+// DEFERRED LOGGER
+// ============================================
+// Hot paths (UART RX, payments, buttons, flow) must not block on Serial.
+// LOG_xxx() only captures the format pointer and binary arguments into a
+// fixed ring buffer; text formatting and the Serial write happen later in a
+// low-priority drain task (or via logDrain() on the host).
+//
+// Levels are filtered at compile time: a disabled LOG_xxx() expands to
+// nothing, so its arguments are not even evaluated.
+//
+// Rules for callers:
+//   - `fmt` MUST be a string literal (only the pointer is stored).
+//   - At most LOG_MAX_ARGS arguments; int/unsigned/long/float/double/bool/
+//     char and C strings are supported.
+//   - String arguments are copied (truncated) into the record, so stack
+//     buffers are safe to pass.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Set LOG_LEVEL in platformio.ini build_flags (e.g. -D LOG_LEVEL=2).
+// Default follows ENABLE_DEBUG_LOGS (debug builds log everything).
+#ifndef LOG_LEVEL
+#if defined(ENABLE_DEBUG_LOGS) && ENABLE_DEBUG_LOGS
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 32 // records (power of two)
+#endif
+
+#define LOG_MAX_ARGS 4
+#define LOG_STR_CAPACITY 32 // bytes shared by all string args of a record
+#define LOG_LINE_MAX 160    // formatted line length
+
+// ============================================
+// RECORD FORMAT
+// ============================================
+enum LogArgType : uint8_t {
+  LOG_ARG_INT = 0,
+  LOG_ARG_UINT,
+  LOG_ARG_FLOAT,
+  LOG_ARG_STR, // value.u = offset into LogRecord::str
+};
+
+union LogArgValue {
+  int32_t i;
+  uint32_t u;
+  float f;
+};
+
+struct LogRecord {
+  uint32_t ms;
+  const char *fmt;
+  uint8_t level;
+  uint8_t argc;
+  uint8_t strUsed;
+  uint8_t types[LOG_MAX_ARGS];
+  LogArgValue args[LOG_MAX_ARGS];
+  char str[LOG_STR_CAPACITY];
+};
+
+// ============================================
+// FUNCTIONS
+// ============================================
+void logInit();
+
+// Start the background drain task (ESP32 only, no-op on host).
+void logStartDrainTask();
+
+// Drain up to `maxRecords` records to Serial. Returns records written.
+int logDrain(int maxRecords);
+
+// Format a record into `out` (NUL terminated). Returns length.
+int logFormatRecord(const LogRecord &rec, char *out, size_t outSize);
+
+// Enqueue a record. Never blocks: if the ring is full the record is dropped
+// and counted.
+void logPush(const LogRecord &rec);
+
+uint32_t logDroppedCount();
+uint32_t logPendingCount();
+
+// ============================================
+// ARGUMENT CAPTURE (templates, header-only)
+// ============================================
+// Overloads use fundamental types only: int32_t is `int` or `long` depending
+// on the toolchain, so overloading on it would collide.
+inline void logCaptureArg(LogRecord &rec, int v) {
+  rec.types[rec.argc] = LOG_ARG_INT;
+  rec.args[rec.argc++].i = static_cast<int32_t>(v);
+}
+inline void logCaptureArg(LogRecord &rec, unsigned int v) {
+  rec.types[rec.argc] = LOG_ARG_UINT;
+  rec.args[rec.argc++].u = static_cast<uint32_t>(v);
+}
+inline void logCaptureArg(LogRecord &rec, long v) {
+  logCaptureArg(rec, static_cast<int>(v));
+}
+inline void logCaptureArg(LogRecord &rec, unsigned long v) {
+  logCaptureArg(rec, static_cast<unsigned int>(v));
+}
+inline void logCaptureArg(LogRecord &rec, short v) {
+  logCaptureArg(rec, static_cast<int>(v));
+}
+inline void logCaptureArg(LogRecord &rec, unsigned short v) {
+  logCaptureArg(rec, static_cast<unsigned int>(v));
+}
+inline void logCaptureArg(LogRecord &rec, unsigned char v) {
+  logCaptureArg(rec, static_cast<unsigned int>(v));
+}
+inline void logCaptureArg(LogRecord &rec, char v) {
+  logCaptureArg(rec, static_cast<int>(v));
+}
+inline void logCaptureArg(LogRecord &rec, bool v) {
+  logCaptureArg(rec, v ? 1 : 0);
+}
+inline void logCaptureArg(LogRecord &rec, float v) {
+  rec.types[rec.argc] = LOG_ARG_FLOAT;
+  rec.args[rec.argc++].f = v;
+}
+inline void logCaptureArg(LogRecord &rec, double v) {
+  logCaptureArg(rec, static_cast<float>(v));
+}
+inline void logCaptureArg(LogRecord &rec, const char *s) {
+  rec.types[rec.argc] = LOG_ARG_STR;
+  rec.args[rec.argc++].u = rec.strUsed;
+  if (rec.strUsed >= LOG_STR_CAPACITY) {
+    return; // No room left - formats as empty string
+  }
+  const size_t room = LOG_STR_CAPACITY - rec.strUsed - 1;
+  size_t n = s ? strnlen(s, room) : 0;
+  if (n > 0) {
+    memcpy(rec.str + rec.strUsed, s, n);
+  }
+  rec.str[rec.strUsed + n] = '\0';
+  rec.strUsed = static_cast<uint8_t>(rec.strUsed + n + 1);
+}
+inline void logCaptureArg(LogRecord &rec, char *s) {
+  logCaptureArg(rec, static_cast<const char *>(s));
+}
+
+inline void logCaptureArgs(LogRecord &) {}
+
+template <typename T, typename... Rest>
+inline void logCaptureArgs(LogRecord &rec, T first, Rest... rest) {
+  if (rec.argc < LOG_MAX_ARGS) {
+    logCaptureArg(rec, first);
+  }
+  logCaptureArgs(rec, rest...);
+}
+
+uint32_t logTimestampMs();
+
+template <typename... Args>
+inline void logWrite(uint8_t level, const char *fmt, Args... args) {
+  static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments");
+  LogRecord rec;
+  rec.ms = logTimestampMs();
+  rec.fmt = fmt;
+  rec.level = level;
+  rec.argc = 0;
+  rec.strUsed = 0;
+  logCaptureArgs(rec, args...);
+  logPush(rec);
+}
+
+// ============================================
+// MACROS (compile-time level filtering)
+// ============================================
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logWrite(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logWrite(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef STATE_SYNC_H
+#define STATE_SYNC_H
+
+#include "uart_protocol.h"
+
+// ============================================
+// STATE REPLICATION (Main ESP -> Payment ESP)
+// ============================================
+// Main pushes a versioned snapshot of what the Payment ESP32 needs to decide
+// whether to take cash. It is sent whenever a field changes, as a delta
+// against the last snapshot the Payment ESP32 acknowledged:
+//
+//   $SYN,<ver>,<base>,<mask>,<field>...*CS   Main -> Payment
+//   $SAK,<ver>*CS                            Payment -> Main (version held)
+//
+// All numbers are lowercase hex to stay within UART_MAX_DATA_LEN. base = 0
+// marks a full snapshot (every field present). A delta whose base does not
+// match the held version is ignored; the SAK then reports the old version and
+// Main answers with a full snapshot. The Payment heartbeat also carries the
+// held version ($HB,<uptime>,<ver>) so a rebooted Payment ESP32 is resynced.
+
+#define CMD_SYNC "SYN"
+#define CMD_SYNC_ACK "SAK"
+
+#define SYNC_F_STATE 0x1
+#define SYNC_F_BALANCE 0x2
+#define SYNC_F_INHIBIT 0x4
+#define SYNC_F_PRICE 0x8
+#define SYNC_F_ALL 0xF
+
+// Why Main wants the acceptor inhibited (bit mask, 0 = accept cash)
+#define INHIBIT_EMERGENCY 0x01 // Fleet emergencyShutdown until "resume"
+#define INHIBIT_OTA 0x02       // Firmware download in progress
+#define INHIBIT_SERVICE 0x04   // SET_SERVICE_MODE:1 until SET_SERVICE_MODE:0
+// Reasons an operator has to lift by hand; Main keeps these in NVS so a
+// reboot does not quietly re-enable the acceptor
+#define INHIBIT_LATCHED (INHIBIT_EMERGENCY | INHIBIT_SERVICE)
+
+struct StateSnapshot {
+  uint16_t version; // 0 = nothing received yet
+  uint8_t state;    // SystemState on the Main ESP32
+  uint8_t inhibit;  // INHIBIT_* mask
+  int32_t balance;
+  int32_t price; // Price per liter
+};
+
+// Next version after `v`, skipping 0 on wrap
+inline uint16_t syncNextVersion(uint16_t v) {
+  return (uint16_t)(v == 0xFFFF ? 1 : v + 1);
+}
+
+// Fields that differ between two snapshots (version ignored)
+inline uint8_t syncDiff(const StateSnapshot &a, const StateSnapshot &b) {
+  uint8_t mask = 0;
+  if (a.state != b.state)
+    mask |= SYNC_F_STATE;
+  if (a.balance != b.balance)
+    mask |= SYNC_F_BALANCE;
+  if (a.inhibit != b.inhibit)
+    mask |= SYNC_F_INHIBIT;
+  if (a.price != b.price)
+    mask |= SYNC_F_PRICE;
+  return mask;
+}
+
+// Encode `cur` as a delta against `base`, or as a full snapshot if base is
+// null. Returns false if it does not fit.
+inline bool syncEncode(char *data, size_t size, const StateSnapshot &cur,
+                       const StateSnapshot *base) {
+  const uint8_t mask = base ? syncDiff(cur, *base) : SYNC_F_ALL;
+  int len = snprintf(data, size, "%x,%x,%x", cur.version,
+                     base ? base->version : 0, mask);
+  if (len < 0 || (size_t)len >= size) {
+    return false;
+  }
+  if (mask & SYNC_F_STATE)
+    len += snprintf(data + len, size - len, ",%x", cur.state);
+  if ((size_t)len < size && (mask & SYNC_F_BALANCE))
+    len += snprintf(data + len, size - len, ",%lx",
+                    (unsigned long)(uint32_t)cur.balance);
+  if ((size_t)len < size && (mask & SYNC_F_INHIBIT))
+    len += snprintf(data + len, size - len, ",%x", cur.inhibit);
+  if ((size_t)len < size && (mask & SYNC_F_PRICE))
+    len += snprintf(data + len, size - len, ",%lx",
+                    (unsigned long)(uint32_t)cur.price);
+  return (size_t)len < size && len <= UART_MAX_DATA_LEN;
+}
+
+// Apply an encoded snapshot to `held`. Returns the changed-field mask, or -1
+// if the frame is malformed or its base is not the held version.
+inline int syncApply(StateSnapshot &held, const char *data) {
+  char *end = nullptr;
+  const unsigned long ver = strtoul(data, &end, 16);
+  if (*end != ',' || ver == 0 || ver > 0xFFFF)
+    return -1;
+  const unsigned long base = strtoul(end + 1, &end, 16);
+  if (*end != ',')
+    return -1;
+  const unsigned long mask = strtoul(end + 1, &end, 16);
+  if (mask > SYNC_F_ALL || (base == 0 && mask != SYNC_F_ALL))
+    return -1;
+  if (base != 0 && base != held.version)
+    return -1;
+
+  StateSnapshot next = held;
+  const uint8_t fields[] = {SYNC_F_STATE, SYNC_F_BALANCE, SYNC_F_INHIBIT,
+                            SYNC_F_PRICE};
+  for (uint8_t f : fields) {
+    if (!(mask & f))
+      continue;
+    if (*end != ',')
+      return -1;
+    const unsigned long v = strtoul(end + 1, &end, 16);
+    if (f == SYNC_F_STATE)
+      next.state = (uint8_t)v;
+    else if (f == SYNC_F_BALANCE)
+      next.balance = (int32_t)(uint32_t)v;
+    else if (f == SYNC_F_INHIBIT)
+      next.inhibit = (uint8_t)v;
+    else
+      next.price = (int32_t)(uint32_t)v;
+  }
+  if (*end != '\0')
+    return -1;
+
+  next.version = (uint16_t)ver;
+  const int changed = syncDiff(next, held);
+  held = next;
+  return changed;
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef UART_LINK_H
+#define UART_LINK_H
+
+#include "uart_protocol.h"
+
+// ============================================
+// UART LINK TRAINING
+// ============================================
+// Both ESP32s boot at UART_BAUD. The Payment ESP32 then steps the link up one
+// baud at a time; each step is kept only if a CRC-checked test block passes
+// in both directions over the real cable:
+//
+//   Payment                               Main
+//   $LNK,REQ,<baud>*CS          ------>
+//                               <------  $LNK,OK,<baud>*CS   (or NAK)
+//   ---- both switch to <baud> ----
+//   <test block>                ------>
+//                               <------  $LNK,RES,<baud>,<ok>,<biterr>*CS
+//                               <------  <test block>
+//   $LNK,COMMIT,<baud>*CS       ------>
+//                               <------  $LNK,DONE,<baud>*CS
+//
+// Any timeout reverts both sides to the previous baud. At a trained baud an
+// error-rate spike (or silence) drops the link back to UART_BAUD; the side
+// that notices sends $LNK,DOWN first, and the Payment ESP32 retrains with the
+// failed baud as a ceiling.
+//
+// Test block (raw bytes, not a text line):
+//   0xA5 0x5A | LINK_PATTERN_LEN pattern bytes | CRC-16/CCITT (big endian)
+// The pattern starts with worst-case bytes (0x00/0xFF/0x55/0xAA, long runs)
+// followed by PRBS-7, seeded per baud so a stale block cannot pass.
+
+#define CMD_LINK "LNK"       // $LNK,op,baud[,ok,biterr]*CS
+#define CMD_LINK_STATS "LQS" // $LQS,good,bad,hwerr*CS - Payment's link view
+
+#define LINK_OP_REQ "REQ"
+#define LINK_OP_OK "OK"
+#define LINK_OP_NAK "NAK"
+#define LINK_OP_RES "RES"
+#define LINK_OP_COMMIT "COMMIT"
+#define LINK_OP_DONE "DONE"
+#define LINK_OP_DOWN "DOWN"
+
+// Highest baud either side will train to. Long or unshielded cables may need
+// a lower limit (-D UART_LINK_MAX_BAUD=115200).
+#ifndef UART_LINK_MAX_BAUD
+#define UART_LINK_MAX_BAUD 460800
+#endif
+
+#define LINK_PATTERN_LEN 64
+#define LINK_BLOCK_LEN (2 + LINK_PATTERN_LEN + 2)
+#define LINK_SYNC0 0xA5
+#define LINK_SYNC1 0x5A
+
+#define LINK_REPLY_TIMEOUT_MS 300  // Wait for OK/RES/DONE
+#define LINK_SETTLE_MS 20          // After a baud switch, before sending
+#define LINK_TRAIN_TIMEOUT_MS 1000 // Main reverts if training stalls
+#define LINK_SILENCE_MS 25000      // No valid frame at a trained baud
+#define LINK_SPIKE_BAD_FRAMES 4    // Bad frames among the last 16 -> fall back
+
+static const uint32_t UART_LINK_BAUDS[] = {9600,   19200,  38400, 57600,
+                                           115200, 230400, 460800};
+#define UART_LINK_BAUD_COUNT                                                   \
+  (sizeof(UART_LINK_BAUDS) / sizeof(UART_LINK_BAUDS[0]))
+
+// ============================================
+// BAUD LADDER
+// ============================================
+inline int linkBaudIndex(uint32_t baud) {
+  for (size_t i = 0; i < UART_LINK_BAUD_COUNT; i++) {
+    if (UART_LINK_BAUDS[i] == baud) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+inline bool linkBaudSupported(uint32_t baud) {
+  return linkBaudIndex(baud) >= 0 && baud <= UART_LINK_MAX_BAUD;
+}
+
+// Next step above `baud` not exceeding `ceiling` (0 = none)
+inline uint32_t linkNextBaud(uint32_t baud, uint32_t ceiling) {
+  const int i = linkBaudIndex(baud);
+  if (i < 0 || i + 1 >= (int)UART_LINK_BAUD_COUNT) {
+    return 0;
+  }
+  const uint32_t next = UART_LINK_BAUDS[i + 1];
+  return (next <= ceiling && next <= UART_LINK_MAX_BAUD) ? next : 0;
+}
+
+// Step below `baud` (UART_BAUD at the bottom)
+inline uint32_t linkLowerBaud(uint32_t baud) {
+  const int i = linkBaudIndex(baud);
+  return i > 0 ? UART_LINK_BAUDS[i - 1] : (uint32_t)UART_BAUD;
+}
+
+// ============================================
+// TEST BLOCK
+// ============================================
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+inline uint16_t linkCrc16(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021)
+                           : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+inline void linkPattern(uint8_t *out, uint32_t baud) {
+  static const uint8_t fixed[] = {0x00, 0xFF, 0x55, 0xAA, 0x00, 0x00,
+                                  0xFF, 0xFF, 0x0F, 0xF0, 0x01, 0x80};
+  size_t n = 0;
+  for (; n < sizeof(fixed); n++) {
+    out[n] = fixed[n];
+  }
+  // Distinct non-zero seed per ladder step
+  uint8_t lfsr = (uint8_t)((((linkBaudIndex(baud) + 1) * 19) & 0x7F) | 0x01);
+  for (; n < LINK_PATTERN_LEN; n++) {
+    uint8_t byte = 0;
+    for (int b = 0; b < 8; b++) {
+      const uint8_t bit = ((lfsr >> 6) ^ (lfsr >> 5)) & 1; // x^7 + x^6 + 1
+      lfsr = (uint8_t)(((lfsr << 1) | bit) & 0x7F);
+      byte = (uint8_t)((byte << 1) | bit);
+    }
+    out[n] = byte;
+  }
+}
+
+inline void linkBuildBlock(uint8_t *block, uint32_t baud) {
+  block[0] = LINK_SYNC0;
+  block[1] = LINK_SYNC1;
+  linkPattern(block + 2, baud);
+  const uint16_t crc = linkCrc16(block + 2, LINK_PATTERN_LEN);
+  block[2 + LINK_PATTERN_LEN] = (uint8_t)(crc >> 8);
+  block[3 + LINK_PATTERN_LEN] = (uint8_t)(crc & 0xFF);
+}
+
+// Byte-wise receiver: hunts for the sync word, then collects one block
+struct LinkBlockRx {
+  uint8_t buf[LINK_BLOCK_LEN];
+  uint8_t len;
+};
+
+inline void linkBlockRxReset(LinkBlockRx &rx) { rx.len = 0; }
+
+// Returns true once a complete block has been collected
+inline bool linkBlockRxFeed(LinkBlockRx &rx, uint8_t c) {
+  if (rx.len == 0) {
+    if (c == LINK_SYNC0) {
+      rx.buf[rx.len++] = c;
+    }
+    return false;
+  }
+  if (rx.len == 1) {
+    if (c == LINK_SYNC1) {
+      rx.buf[rx.len++] = c;
+    } else if (c != LINK_SYNC0) {
+      rx.len = 0;
+    }
+    return false;
+  }
+  rx.buf[rx.len++] = c;
+  return rx.len == LINK_BLOCK_LEN;
+}
+
+// Verify a collected block. Returns true if the CRC matches and the pattern
+// is the one expected for `baud`; bitErrors counts flipped pattern bits.
+inline bool linkBlockCheck(const LinkBlockRx &rx, uint32_t baud,
+                           uint16_t &bitErrors) {
+  uint8_t expected[LINK_PATTERN_LEN];
+  linkPattern(expected, baud);
+  bitErrors = 0;
+  for (size_t i = 0; i < LINK_PATTERN_LEN; i++) {
+    bitErrors += (uint16_t)__builtin_popcount(rx.buf[2 + i] ^ expected[i]);
+  }
+  const uint16_t crc = ((uint16_t)rx.buf[2 + LINK_PATTERN_LEN] << 8) |
+                       rx.buf[3 + LINK_PATTERN_LEN];
+  return bitErrors == 0 && crc == linkCrc16(rx.buf + 2, LINK_PATTERN_LEN);
+}
+
+// ============================================
+// LINK QUALITY
+// ============================================
+struct UartLinkStats {
+  uint32_t baud;
+  uint32_t goodFrames;    // Frames with a valid checksum
+  uint32_t badFrames;     // Checksum/format errors, oversized lines
+  uint32_t hwErrors;      // UART framing/parity/break errors
+  uint32_t trainings;     // Successful baud steps
+  uint32_t trainFailures; // Steps that were reverted
+  uint32_t fallbacks;     // Drops back to UART_BAUD
+  uint16_t lastBitErrors; // From the most recent test block
+  uint16_t window;        // Last 16 frames, bit set = bad
+};
+
+inline void linkStatsReset(UartLinkStats &s, uint32_t baud) {
+  memset(&s, 0, sizeof(s));
+  s.baud = baud;
+}
+
+inline void linkRecordFrame(UartLinkStats &s, bool good) {
+  s.window = (uint16_t)((s.window << 1) | (good ? 0 : 1));
+  if (good) {
+    s.goodFrames++;
+  } else {
+    s.badFrames++;
+  }
+}
+
+// Hardware errors count towards the spike window like bad frames
+inline void linkRecordHwErrors(UartLinkStats &s, uint32_t count) {
+  s.hwErrors += count;
+  for (uint32_t i = 0; i < count && i < 16; i++) {
+    s.window = (uint16_t)((s.window << 1) | 1);
+  }
+}
+
+inline bool linkErrorSpike(const UartLinkStats &s) {
+  return __builtin_popcount(s.window) >= LINK_SPIKE_BAD_FRAMES;
+}
+
+#endif
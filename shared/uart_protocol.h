@@ -9,7 +9,7 @@
 // ============================================
 // UART CONFIGURATION
 // ============================================
-#define UART_BAUD 9600
+#define UART_BAUD 9600 // Boot/rendezvous baud; see uart_link.h for training
 // UART pins are defined per-controller in:
 // - `src_esp32_main/hardware.h`
 // - `src_esp32_payment/hardware.h`
@@ -0,0 +1,98 @@
+#include "boot_timing.h"
+#include "../shared/logger.h"
+#include "config.h"
+#include "config_storage.h"
+#include "mqtt_handler.h"
+#include "ota_handler.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#if defined(ESP32)
+#include <esp_system.h>
+#endif
+
+// ============================================
+// BOOT RECORDS
+// ============================================
+// RTC_NOINIT keeps the record through watchdog, panic, brownout and
+// ESP.restart() resets (RTC_DATA_ATTR data is reloaded on every reset but a
+// deep-sleep wake, and the Main controller never deep-sleeps). After power
+// loss it holds garbage, which the magic check rejects.
+RTC_NOINIT_ATTR static BootRecord rtcBoot;
+static BootRecord previousBoot; // Last boot, if it never reported
+static bool hasPreviousBoot = false;
+
+void bootTimingBegin() {
+  if (rtcBoot.magic == BOOT_TIMING_MAGIC && !rtcBoot.reported) {
+    previousBoot = rtcBoot;
+    hasPreviousBoot = true;
+  }
+
+  uint8_t reason = 0;
+#if defined(ESP32)
+  reason = (uint8_t)esp_reset_reason();
+#endif
+  bootRecordStart(rtcBoot, millis(), reason);
+}
+
+void bootPhaseDone(BootPhase phase) {
+  if (phase >= BOOT_PHASE_COUNT || rtcBoot.phaseMs[phase] != 0) {
+    return;
+  }
+  bootRecordMark(rtcBoot, phase, millis());
+  LOG_INFO("Boot phase %s done at %lu ms (+%lu)", bootPhaseName(phase),
+           (unsigned long)rtcBoot.phaseMs[phase],
+           (unsigned long)bootPhaseDuration(rtcBoot, phase));
+}
+
+bool isBootPhaseDone(BootPhase phase) {
+  return phase < BOOT_PHASE_COUNT && rtcBoot.phaseMs[phase] != 0;
+}
+
+// ============================================
+// BOOT REPORT
+// ============================================
+static void fillBootJson(JsonObject obj, const BootRecord &r) {
+  obj["reset_reason"] = r.resetReason;
+  obj["start_ms"] = r.startMs;
+  JsonObject phases = obj["phases"].to<JsonObject>();
+  JsonObject at = obj["phase_end_ms"].to<JsonObject>();
+  for (uint8_t p = 0; p < BOOT_PHASE_COUNT; p++) {
+    if (r.phaseMs[p] == 0) {
+      continue; // Not reached
+    }
+    phases[bootPhaseName(p)] = bootPhaseDuration(r, (BootPhase)p);
+    at[bootPhaseName(p)] = r.phaseMs[p];
+  }
+}
+
+void processBootReport() {
+  if (rtcBoot.reported || !mqttClient.connected()) {
+    return;
+  }
+  bootPhaseDone(BOOT_PHASE_MQTT);
+
+  JsonDocument doc;
+  JsonObject root = doc.to<JsonObject>();
+  root["type"] = "boot";
+  root["device_id"] = deviceConfig.device_id;
+  root["firmware_version"] = FIRMWARE_VERSION;
+  fillBootJson(root, rtcBoot);
+  doc["cash_ready_ms"] = rtcBoot.phaseMs[BOOT_PHASE_PAYMENT];
+  doc["online_ms"] = rtcBoot.phaseMs[BOOT_PHASE_MQTT];
+  if (hasPreviousBoot) {
+    fillBootJson(doc["previous"].to<JsonObject>(), previousBoot);
+  }
+
+  String output;
+  serializeJson(doc, output);
+  if (!mqttClient.publish(TOPIC_TELEMETRY, output.c_str())) {
+    return; // Retry next loop
+  }
+  rtcBoot.reported = true;
+  hasPreviousBoot = false;
+
+  char msg[64];
+  snprintf(msg, sizeof(msg), "Device started %s", FIRMWARE_VERSION);
+  publishLog("SYSTEM", msg);
+}
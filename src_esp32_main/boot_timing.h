@@ -0,0 +1,115 @@
+#ifndef BOOT_TIMING_H
+#define BOOT_TIMING_H
+
+#include <stdint.h>
+#include <string.h>
+
+// ============================================
+// PHASED BOOT
+// ============================================
+// setup() only brings up what is needed to vend safely and take cash; the
+// network is started from loop() afterwards:
+//
+//   IO       watchdog, relays forced OFF, buttons            setup()
+//   CONFIG   NVS config, serial console                      setup()
+//   PAYMENT  sensors, state machine, ledger, UART link       setup()
+//            -> cash from the Payment ESP32 is credited from here on
+//   DISPLAY  LCD                                             setup()
+//   WIFI     associated with the AP                          loop()
+//   MQTT     broker connected                                loop()
+//
+// The end time of each phase (millis()) is kept in RTC memory and
+// published once on TOPIC_TELEMETRY after MQTT connects. A boot that never
+// got that far (reset before connecting) is reported with the next one.
+
+#define BOOT_TIMING_MAGIC 0x42543031 // "BT01"
+#define BOOT_MQTT_JITTER_MS 5000     // Spread of the first broker connect
+
+enum BootPhase : uint8_t {
+  BOOT_PHASE_IO,
+  BOOT_PHASE_CONFIG,
+  BOOT_PHASE_PAYMENT,
+  BOOT_PHASE_DISPLAY,
+  BOOT_PHASE_WIFI,
+  BOOT_PHASE_MQTT,
+  BOOT_PHASE_COUNT
+};
+
+struct BootRecord {
+  uint32_t magic;
+  uint32_t startMs;                    // millis() when setup() began
+  uint32_t phaseMs[BOOT_PHASE_COUNT]; // End of each phase (0 = not reached)
+  uint8_t resetReason;                 // esp_reset_reason_t
+  bool reported;                       // Published on TOPIC_TELEMETRY
+};
+
+inline void bootRecordStart(BootRecord &r, uint32_t nowMs,
+                            uint8_t resetReason) {
+  memset(&r, 0, sizeof(r));
+  r.magic = BOOT_TIMING_MAGIC;
+  r.startMs = nowMs;
+  r.resetReason = resetReason;
+}
+
+// First mark wins; later calls for the same phase are ignored
+inline void bootRecordMark(BootRecord &r, BootPhase phase, uint32_t nowMs) {
+  if (phase < BOOT_PHASE_COUNT && r.phaseMs[phase] == 0) {
+    r.phaseMs[phase] = nowMs ? nowMs : 1;
+  }
+}
+
+// Time spent in `phase` (from the end of the last reached earlier phase, or
+// from setup() start). 0 if the phase was not reached.
+inline uint32_t bootPhaseDuration(const BootRecord &r, BootPhase phase) {
+  if (phase >= BOOT_PHASE_COUNT || r.phaseMs[phase] == 0) {
+    return 0;
+  }
+  uint32_t from = r.startMs;
+  for (int8_t p = (int8_t)phase - 1; p >= 0; p--) {
+    if (r.phaseMs[p] != 0) {
+      from = r.phaseMs[p];
+      break;
+    }
+  }
+  return r.phaseMs[phase] > from ? r.phaseMs[phase] - from : 0;
+}
+
+// Per-device delay of the first broker connect, so a district powering up
+// together does not hit the broker in the same second (FNV-1a of device id)
+inline uint32_t bootMqttJitterMs(const char *deviceId) {
+  uint32_t h = 2166136261u;
+  for (; deviceId && *deviceId; deviceId++) {
+    h = (h ^ (uint8_t)*deviceId) * 16777619u;
+  }
+  return h % BOOT_MQTT_JITTER_MS;
+}
+
+inline const char *bootPhaseName(uint8_t phase) {
+  switch (phase) {
+  case BOOT_PHASE_IO:
+    return "io";
+  case BOOT_PHASE_CONFIG:
+    return "config";
+  case BOOT_PHASE_PAYMENT:
+    return "payment";
+  case BOOT_PHASE_DISPLAY:
+    return "display";
+  case BOOT_PHASE_WIFI:
+    return "wifi";
+  case BOOT_PHASE_MQTT:
+    return "mqtt";
+  default:
+    return "?";
+  }
+}
+
+// ============================================
+// FUNCTIONS
+// ============================================
+void bootTimingBegin(); // First thing in setup()
+void bootPhaseDone(BootPhase phase);
+bool isBootPhaseDone(BootPhase phase);
+// Publishes the boot report once MQTT is connected (call every loop)
+void processBootReport();
+
+#endif
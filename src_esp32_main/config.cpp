@@ -1,13 +1,23 @@
 #include "config.h"
+#include "config_snapshot.h"
 #include "config_storage.h"
 #include "display.h"
+#include "power_save.h"
+#include "wifi_cache.h"
 #include <WiFi.h>
 #include <cstdio>
+#include <esp_netif.h>
+#include <esp_netif_net_stack.h>
+#include <lwip/dhcp.h>
+#include <lwip/netif.h>
+#include <time.h>
 
 // ============================================
 // GLOBAL CONFIG INSTANCE (from deviceConfig)
 // ============================================
-Config config;
+Config config; // loop()'s copy, see refreshRuntimeConfig()
+static ConfigSnapshot<Config> runtimeSnapshot;
+static uint32_t runtimeSnapshotSeen = 0;
 
 // ============================================
 // MQTT TOPICS (Generated dynamically)
@@ -22,6 +32,8 @@ char TOPIC_OTA_IN[64]; // OTA firmware update
 char TOPIC_TELEMETRY[64];
 char TOPIC_ALERTS[64];
 char TOPIC_DIAGNOSTICS[64];
+char TOPIC_LEDGER_OUT[64];
+char TOPIC_LEDGER_ACK[64];
 
 // Fleet Management Topics
 char TOPIC_BROADCAST_CONFIG[64];
@@ -43,6 +55,15 @@ static WiFiConnectState wifiState = WIFI_IDLE;
 static unsigned long wifiStartMs = 0;
 static unsigned long wifiRetryMs = 0;
 
+// Fast reconnect (see wifi_cache.h). RTC_NOINIT memory keeps the cache and
+// the lease across every reset but power loss (RTC_DATA_ATTR would be
+// reloaded on each one); NVS keeps the cache across power loss.
+RTC_NOINIT_ATTR static WiFiCache wifiCache;
+RTC_NOINIT_ATTR static WiFiLease wifiLease;
+static WiFiConnectMode wifiMode = WIFI_CONNECT_FULL;
+static unsigned long wifiOutageStartMs = 0; // Boot or link loss
+static WiFiConnectStats wifiStats;
+
 static void printWiFiStatus(const char *message) {
   lcd.setCursor(0, 1);
   lcd.print("WiFi: ");
@@ -53,47 +74,167 @@ static void printWiFiStatus(const char *message) {
   }
 }
 
-static void startWiFiConnect() {
-  if (deviceConfig.wifi_ssid[0] == '\0') {
-    Serial.println("WiFi not configured!");
-    printWiFiStatus("Not configured");
-    wifiState = WIFI_FAILED;
-    return;
+static uint32_t currentCredHash() {
+  return wifiCredHash(deviceConfig.wifi_ssid, deviceConfig.wifi_password);
+}
+
+// Lease time the DHCP client got for the current address (0 if unknown)
+static uint32_t dhcpLeaseSeconds() {
+  esp_netif_t *sta = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+  struct netif *nif =
+      sta ? (struct netif *)esp_netif_get_netif_impl(sta) : nullptr;
+  struct dhcp *dhcp = nif ? netif_dhcp_data(nif) : nullptr;
+  return dhcp ? dhcp->offered_t0_lease : 0;
+}
+
+// The system clock runs on through soft resets (not power loss)
+static uint32_t wallClockS() { return (uint32_t)time(nullptr); }
+
+static bool isWiFiLeaseValid() {
+  return wifiLeaseUsable(wifiLease, wifiCache.ip, wallClockS());
+}
+
+static void loadWiFiCache() {
+  if (wifiCache.magic == WIFI_CACHE_MAGIC) {
+    return; // Survived in RTC memory: same power cycle
+  }
+  wifiLease.magic = 0; // A lease from before power loss is not ours
+  preferences.begin("ewater", true);
+  const size_t n = preferences.getBytes("wifi_cache", &wifiCache,
+                                        sizeof(wifiCache));
+  preferences.end();
+  if (n != sizeof(wifiCache)) {
+    memset(&wifiCache, 0, sizeof(wifiCache));
+  }
+}
+
+static void saveWiFiCache() {
+  WiFiCache next;
+  memset(&next, 0, sizeof(next));
+  next.magic = WIFI_CACHE_MAGIC;
+  next.credHash = currentCredHash();
+  const uint8_t *bssid = WiFi.BSSID();
+  if (bssid) {
+    memcpy(next.bssid, bssid, sizeof(next.bssid));
+  }
+  next.channel = (uint8_t)WiFi.channel();
+  next.ip = (uint32_t)WiFi.localIP();
+  next.gateway = (uint32_t)WiFi.gatewayIP();
+  next.subnet = (uint32_t)WiFi.subnetMask();
+  next.dns = (uint32_t)WiFi.dnsIP();
+
+  // A static-IP connect did not talk to DHCP: the lease end stays put
+  if (wifiMode != WIFI_CONNECT_FAST_IP) {
+    wifiLeaseSet(wifiLease, next.ip, wallClockS(), dhcpLeaseSeconds());
   }
 
-  Serial.print("Connecting to WiFi: ");
-  Serial.println(deviceConfig.wifi_ssid);
+  // Only write flash when the AP or address actually changed
+  const bool changed = memcmp(&next, &wifiCache, sizeof(next)) != 0;
+  wifiCache = next;
+  if (changed) {
+    preferences.begin("ewater", false);
+    preferences.putBytes("wifi_cache", &wifiCache, sizeof(wifiCache));
+    preferences.end();
+  }
+}
 
+static void beginWiFi(WiFiConnectMode mode) {
   WiFi.mode(WIFI_STA);
   WiFi.persistent(false);
-  WiFi.setSleep(false);
-  WiFi.begin(deviceConfig.wifi_ssid, deviceConfig.wifi_password);
+  WiFi.setSleep(isPowerSaveNight() ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE);
+
+  if (mode == WIFI_CONNECT_FAST_IP) {
+    WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway),
+                IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+  } else {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // DHCP
+  }
 
+  if (mode == WIFI_CONNECT_FULL) {
+    WiFi.begin(deviceConfig.wifi_ssid, deviceConfig.wifi_password);
+  } else {
+    // Known AP and channel: skips the scan
+    WiFi.begin(deviceConfig.wifi_ssid, deviceConfig.wifi_password,
+               wifiCache.channel, wifiCache.bssid, true);
+  }
+
+  wifiMode = mode;
   wifiState = WIFI_CONNECTING;
   wifiStartMs = millis();
+}
+
+static void startWiFiConnect() {
+  if (deviceConfig.wifi_ssid[0] == '\0') {
+    Serial.println("WiFi not configured!");
+    printWiFiStatus("Not configured");
+    wifiState = WIFI_FAILED;
+    return;
+  }
+
+  const WiFiConnectMode mode =
+      wifiPickMode(wifiCache, currentCredHash(), isWiFiLeaseValid());
+  Serial.printf("Connecting to WiFi: %s (%s)\n", deviceConfig.wifi_ssid,
+                wifiModeName(mode));
+  beginWiFi(mode);
   printWiFiStatus("Connecting...");
 }
 
-void setupWiFi() { startWiFiConnect(); }
+void setupWiFi() {
+  loadWiFiCache();
+  wifiOutageStartMs = millis();
+  startWiFiConnect();
+}
 
 void processWiFi() {
   if (wifiState == WIFI_CONNECTED && WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi disconnected");
     printWiFiStatus("Disconnected");
-    wifiState = WIFI_FAILED;
-    wifiRetryMs = millis();
+    // Retry at once: the fast path costs a few hundred ms
+    wifiOutageStartMs = millis();
+    startWiFiConnect();
+    return;
+  }
+
+  // On a static IP nothing renews the lease: go back to DHCP before the
+  // router can hand the address to someone else
+  if (wifiState == WIFI_CONNECTED && wifiMode == WIFI_CONNECT_FAST_IP &&
+      !isWiFiLeaseValid()) {
+    Serial.println("WiFi cached IP lease ending, reconnecting with DHCP");
+    wifiLease.magic = 0;
+    wifiOutageStartMs = millis();
+    WiFi.disconnect();
+    beginWiFi(WIFI_CONNECT_FAST);
+    return;
   }
 
   if (wifiState == WIFI_CONNECTING) {
     if (WiFi.status() == WL_CONNECTED) {
-      Serial.println("WiFi Connected!");
-      Serial.print("IP: ");
-      Serial.println(WiFi.localIP());
+      const uint32_t elapsed = millis() - wifiOutageStartMs;
+      wifiStatsRecord(wifiStats, wifiMode, elapsed);
+      saveWiFiCache();
+      Serial.printf("WiFi Connected (%s, %lu ms)! IP: %s\n",
+                    wifiModeName(wifiMode), (unsigned long)elapsed,
+                    WiFi.localIP().toString().c_str());
       printWiFiStatus("Connected");
       wifiState = WIFI_CONNECTED;
       return;
     }
-    if (millis() - wifiStartMs > 10000) {
+    const unsigned long timeout = (wifiMode == WIFI_CONNECT_FULL)
+                                      ? WIFI_FULL_TIMEOUT_MS
+                                      : WIFI_FAST_TIMEOUT_MS;
+    if (millis() - wifiStartMs > timeout) {
+      if (wifiMode != WIFI_CONNECT_FULL) {
+        // AP moved or lease gone: scan now instead of waiting for a retry
+        wifiStats.fastFailed++;
+        if (wifiCacheFastFailed(wifiCache)) {
+          Serial.println("WiFi cache dropped");
+        }
+        wifiLease.magic = 0;
+        Serial.println("WiFi fast connect timeout, scanning");
+        WiFi.disconnect();
+        beginWiFi(WIFI_CONNECT_FULL);
+        return;
+      }
       Serial.println("WiFi connect timeout");
       printWiFiStatus("Failed");
       wifiState = WIFI_FAILED;
@@ -106,43 +247,35 @@ void processWiFi() {
     if (deviceConfig.wifi_ssid[0] == '\0') {
       return;
     }
-    if (millis() - wifiRetryMs > 10000) {
+    if (millis() - wifiRetryMs > WIFI_RETRY_MS) {
       startWiFiConnect();
     }
   }
 }
 
+const WiFiConnectStats &getWiFiConnectStats() { return wifiStats; }
+
 // ============================================
 // CONFIG APPLY (Runtime)
 // ============================================
 void applyRuntimeConfig() {
-  config.pricePerLiter = deviceConfig.pricePerLiter;
-  config.sessionTimeout = deviceConfig.sessionTimeout;
-  config.freeWaterCooldown = deviceConfig.freeWaterCooldown;
-  config.freeWaterAmount = deviceConfig.freeWaterAmount;
-  config.pulsesPerLiter = deviceConfig.pulsesPerLiter;
-  config.tdsThreshold = deviceConfig.tdsThreshold;
-  config.tdsTemperatureC = deviceConfig.tdsTemperatureC;
-  config.tdsCalibrationFactor = deviceConfig.tdsCalibrationFactor;
-  config.enableFreeWater = deviceConfig.enableFreeWater;
   // Hardware policy: relay is fixed Active-HIGH.
   deviceConfig.relayActiveHigh = true;
-  config.relayActiveHigh = true;
-  config.cashPulseValue = deviceConfig.cashPulseValue;
-  config.cashPulseGapMs = deviceConfig.cashPulseGapMs;
-  config.paymentCheckInterval = deviceConfig.paymentCheckInterval;
-  config.displayUpdateInterval = deviceConfig.displayUpdateInterval;
-  config.tdsCheckInterval = deviceConfig.tdsCheckInterval;
-  config.heartbeatInterval = deviceConfig.heartbeatInterval;
+  runtimeSnapshot.publish(runtimeConfigFrom(deviceConfig));
 
   generateMQTTTopics();
 }
 
+bool refreshRuntimeConfig() {
+  return runtimeSnapshot.readIfNewer(config, runtimeSnapshotSeen);
+}
+
 // ============================================
 // CONFIG INITIALIZATION
 // ============================================
 void initConfig() {
   applyRuntimeConfig();
+  refreshRuntimeConfig();
   Serial.println("Config initialized from storage");
 }
 
@@ -173,6 +306,10 @@ void generateMQTTTopics() {
   snprintf(TOPIC_ALERTS, sizeof(TOPIC_ALERTS), "vending/%s/alerts", deviceId);
   snprintf(TOPIC_DIAGNOSTICS, sizeof(TOPIC_DIAGNOSTICS),
            "vending/%s/diagnostics", deviceId);
+  snprintf(TOPIC_LEDGER_OUT, sizeof(TOPIC_LEDGER_OUT), "vending/%s/ledger/out",
+           deviceId);
+  snprintf(TOPIC_LEDGER_ACK, sizeof(TOPIC_LEDGER_ACK), "vending/%s/ledger/ack",
+           deviceId);
 
   // Broadcast topics (all devices)
   // Broadcast topics (all devices)
@@ -1,29 +1,45 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "config_storage.h"
+#include "hardware.h"
+#include "wifi_cache.h"
 #include <Arduino.h>
 
 // ============================================
-// CONFIGURATION STRUCTURE
+// RUNTIME CONFIGURATION (HOT PATH)
 // ============================================
+// The fields loop(), the state machine, display and sensors read, packed
+// into one small struct. deviceConfig (config_storage.h) is the only config
+// model: this is a read-only snapshot built from it by runtimeConfigFrom()
+// and published whole by applyRuntimeConfig(). loop() adopts the newest
+// snapshot at the top of each pass (refreshRuntimeConfig), so one pass never
+// sees half of an update. Defaults live in config_schema.h.
 struct Config {
-  int pricePerLiter = 1000;                 // so'm
-  unsigned long sessionTimeout = 300000;    // 5 min (ms)
-  unsigned long freeWaterCooldown = 180000; // 3 min (ms)
-  float freeWaterAmount = 0.2;              // 200ml (liters)
-  float pulsesPerLiter = 450.0;             // Flow sensor calibration
-  int tdsThreshold = 100;                   // ppm - warning only
-  float tdsTemperatureC = 25.0;             // TDS compensation temp
-  float tdsCalibrationFactor = 0.5;         // TDS calibration multiplier
-  bool enableFreeWater = true;              // Feature flag
-  bool relayActiveHigh = true;        // Relay polarity (forced Active HIGH)
-  int cashPulseValue = 1000;          // so'm per pulse
-  unsigned long cashPulseGapMs = 120; // gap to close pulse burst
-  unsigned long paymentCheckInterval = 2000; // 2s
-  unsigned long displayUpdateInterval = 100; // 100ms
-  unsigned long tdsCheckInterval = 5000;     // 5s
-  unsigned long heartbeatInterval = 30000;   // 30s
-  // Power Management removed
+  // Read every loop pass
+  unsigned long sessionTimeout;        // ms
+  unsigned long displayUpdateInterval; // ms
+  unsigned long tdsCheckInterval;      // ms
+  unsigned long heartbeatInterval;     // ms
+  unsigned long paymentCheckInterval;  // ms
+  // Sessions and dispensing
+  int pricePerLiter;                       // so'm
+  float pulsesPerLiter;                    // Flow sensor calibration
+  int nozzlePricePerLiter[NOZZLE_MAX];     // -1 = pricePerLiter (0 unused)
+  float nozzlePulsesPerLiter[NOZZLE_MAX];  // 0 = pulsesPerLiter (0 unused)
+  float freeWaterAmount;                   // liters
+  unsigned long freeWaterCooldown;         // ms
+  int cashPulseValue;                      // so'm per pulse
+  unsigned long cashPulseGapMs;            // gap to close pulse burst
+  // TDS (warning only)
+  float tdsTemperatureC;
+  float tdsCalibrationFactor;
+  int tdsThreshold; // ppm
+  // Night power save (see power_save.h); local hours 0-23
+  int8_t deepSleepStartHour;
+  int8_t deepSleepEndHour;
+  bool enablePowerSave;
+  bool enableFreeWater;
 };
 
 // ============================================
@@ -39,6 +55,8 @@ extern char TOPIC_OTA_IN[64];
 extern char TOPIC_TELEMETRY[64];
 extern char TOPIC_ALERTS[64];
 extern char TOPIC_DIAGNOSTICS[64];
+extern char TOPIC_LEDGER_OUT[64]; // Session ledger batches
+extern char TOPIC_LEDGER_ACK[64]; // Backend ledger acknowledgements
 
 // LOW FIX: Removed unused extern declarations (wifi_ssid, mqtt_broker, etc.)
 // These are now handled within DeviceConfig struct in config_storage.h
@@ -54,13 +72,58 @@ extern char TOPIC_GROUP_COMMAND[64];
 // ============================================
 extern Config config;
 
+// Effective price / flow calibration of a nozzle
+inline int nozzlePrice(uint8_t nozzle) {
+  return (nozzle > 0 && nozzle < NOZZLE_MAX &&
+          config.nozzlePricePerLiter[nozzle] >= 0)
+             ? config.nozzlePricePerLiter[nozzle]
+             : config.pricePerLiter;
+}
+
+inline float nozzlePulsesPerLiter(uint8_t nozzle) {
+  return (nozzle > 0 && nozzle < NOZZLE_MAX &&
+          config.nozzlePulsesPerLiter[nozzle] > 0.0f)
+             ? config.nozzlePulsesPerLiter[nozzle]
+             : config.pulsesPerLiter;
+}
+
+// Hot-path snapshot of a (validated) DeviceConfig
+inline Config runtimeConfigFrom(const DeviceConfig &dc) {
+  Config c;
+  c.sessionTimeout = dc.sessionTimeout;
+  c.displayUpdateInterval = dc.displayUpdateInterval;
+  c.tdsCheckInterval = dc.tdsCheckInterval;
+  c.heartbeatInterval = dc.heartbeatInterval;
+  c.paymentCheckInterval = dc.paymentCheckInterval;
+  c.pricePerLiter = dc.pricePerLiter;
+  c.pulsesPerLiter = dc.pulsesPerLiter;
+  for (int i = 0; i < NOZZLE_MAX; i++) {
+    c.nozzlePricePerLiter[i] = dc.nozzlePricePerLiter[i];
+    c.nozzlePulsesPerLiter[i] = dc.nozzlePulsesPerLiter[i];
+  }
+  c.freeWaterAmount = dc.freeWaterAmount;
+  c.freeWaterCooldown = dc.freeWaterCooldown;
+  c.cashPulseValue = dc.cashPulseValue;
+  c.cashPulseGapMs = dc.cashPulseGapMs;
+  c.tdsTemperatureC = dc.tdsTemperatureC;
+  c.tdsCalibrationFactor = dc.tdsCalibrationFactor;
+  c.tdsThreshold = dc.tdsThreshold;
+  c.deepSleepStartHour = (int8_t)dc.deepSleepStartHour;
+  c.deepSleepEndHour = (int8_t)dc.deepSleepEndHour;
+  c.enablePowerSave = dc.enablePowerSave;
+  c.enableFreeWater = dc.enableFreeWater;
+  return c;
+}
+
 // ============================================
 // FUNCTIONS
 // ============================================
 void setupWiFi();
 void processWiFi();
+const WiFiConnectStats &getWiFiConnectStats(); // Reconnect timing
 void initConfig();
-void applyRuntimeConfig();
+void applyRuntimeConfig();   // Publish deviceConfig as the next snapshot
+bool refreshRuntimeConfig(); // loop(): adopt a newer snapshot into `config`
 void generateMQTTTopics(); // Generate topics from device_id
 
 #endif
@@ -0,0 +1,186 @@
+#ifndef CONFIG_SCHEMA_H
+#define CONFIG_SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ============================================
+// DEVICE CONFIG FIELD SCHEMA
+// ============================================
+// One row per scalar DeviceConfig field. Defaults, validation, NVS
+// load/save (config_storage*.cpp), printCurrentConfig() and the signed
+// config canonical form (mqtt_handler.cpp) are all generated from it, so a
+// new setting is added here once. Nozzle overrides are arrays and stay
+// hand-written next to each generated loop.
+//
+//   X(member, json, nvsKey, default, check, section, label, show)
+//
+//   json    CFG_JSON("key") / CFG_JSON("key", "alias"): keys of the field in
+//           signed config messages. CFG_NO_JSON: not settable over MQTT.
+//   check   CFG_ANY, CFG_CLAMP(lo, hi) (pull into range) or
+//           CFG_RESET(lo, hi) (back to default), applied by validateConfig()
+//   show    How printCurrentConfig() prints it; the desktop app parses
+//           these lines (renderer_serial.js parseConfigLine), keep labels.
+//
+// Row order of the CFG_JSON rows is the canonical key order of signed config
+// messages, shared with desktop-app/signing.js (checked by
+// signing_conformance.js and test/signing_vectors.json). Never reorder
+// them; a new key goes where the app expects it.
+
+enum ConfigSection {
+  CFG_SECTION_WIFI,
+  CFG_SECTION_MQTT,
+  CFG_SECTION_VENDING,
+  CFG_SECTION_POWER,
+  CFG_SECTION_STATUS
+};
+
+enum ConfigShowKind {
+  CFG_PRINT_HIDDEN,   // Not printed
+  CFG_PRINT_TEXT,     // As is
+  CFG_PRINT_OPTIONAL, // As is, "(not set)" when empty
+  CFG_PRINT_SECRET,   // "********", "(not set)" when empty
+  CFG_PRINT_YES_NO,
+  CFG_PRINT_ENABLED,  // Enabled / Disabled
+  CFG_PRINT_ALLOWED,  // Allowed / Disabled
+  CFG_PRINT_NUMBER,   // digits decimals (floats), then unit
+  CFG_PRINT_SECONDS,  // Milliseconds shown as " sec"
+  CFG_PRINT_ML        // Liters shown as " ml"
+};
+
+struct ConfigShow {
+  ConfigShowKind kind;
+  uint8_t digits;
+  const char *unit;
+};
+
+struct ConfigRange {
+  bool checked;
+  bool clamp; // false: reset to the default
+  double lo;
+  double hi;
+};
+
+#define CFG_NO_MAX 4294967295.0
+
+#define CFG_JSON(...) __VA_ARGS__,
+#define CFG_NO_JSON
+#define CFG_ANY (ConfigRange{false, false, 0, 0})
+#define CFG_CLAMP(lo, hi) (ConfigRange{true, true, (lo), (hi)})
+#define CFG_RESET(lo, hi) (ConfigRange{true, false, (lo), (hi)})
+#define CFG_SHOW(kind) (ConfigShow{kind, 0, ""})
+#define CFG_SHOW_NUMBER(digits, unit)                                          \
+  (ConfigShow{CFG_PRINT_NUMBER, (digits), (unit)})
+
+// clang-format off
+#define DEVICE_CONFIG_FIELDS(X)                                                                                              \
+  X(device_id, CFG_JSON("deviceId"), "device_id", "VendingMachine_001", CFG_ANY,                                            \
+    CFG_SECTION_MQTT, "Device ID", CFG_SHOW(CFG_PRINT_TEXT))                                                                 \
+  X(wifi_ssid, CFG_JSON("wifiSsid"), "wifi_ssid", "", CFG_ANY,                                                               \
+    CFG_SECTION_WIFI, "SSID", CFG_SHOW(CFG_PRINT_OPTIONAL))                                                                  \
+  X(wifi_password, CFG_JSON("wifiPassword"), "wifi_pass", "", CFG_ANY,                                                       \
+    CFG_SECTION_WIFI, "Password", CFG_SHOW(CFG_PRINT_SECRET))                                                                \
+  X(mqtt_broker, CFG_JSON("mqttBroker"), "mqtt_broker", "ec2-3-72-68-85.eu-central-1.compute.amazonaws.com", CFG_ANY,       \
+    CFG_SECTION_MQTT, "Broker", CFG_SHOW(CFG_PRINT_TEXT))                                                                    \
+  X(mqtt_port, CFG_JSON("mqttPort"), "mqtt_port", 1883, CFG_RESET(1, 65535),                                                 \
+    CFG_SECTION_MQTT, "Port", CFG_SHOW_NUMBER(0, ""))                                                                        \
+  X(mqtt_username, CFG_JSON("mqttUsername"), "mqtt_user", "", CFG_ANY,                                                       \
+    CFG_SECTION_MQTT, "Username", CFG_SHOW(CFG_PRINT_OPTIONAL))                                                              \
+  X(mqtt_password, CFG_JSON("mqttPassword"), "mqtt_pass", "", CFG_ANY,                                                       \
+    CFG_SECTION_MQTT, "MQTT Password", CFG_SHOW(CFG_PRINT_HIDDEN))                                                           \
+  X(api_secret, CFG_NO_JSON, "api_secret", "", CFG_ANY,                                                                      \
+    CFG_SECTION_MQTT, "API Secret", CFG_SHOW(CFG_PRINT_SECRET))                                                              \
+  X(requireSignedMessages, CFG_NO_JSON, "req_signed", false, CFG_ANY,                                                        \
+    CFG_SECTION_MQTT, "Require Signed", CFG_SHOW(CFG_PRINT_YES_NO))                                                          \
+  X(allowRemoteNetworkConfig, CFG_NO_JSON, "allow_netcfg", true, CFG_ANY,                                                    \
+    CFG_SECTION_MQTT, "Remote Network Config", CFG_SHOW(CFG_PRINT_ALLOWED))                                                  \
+  X(groupId, CFG_NO_JSON, "group_id", "", CFG_ANY,                                                                           \
+    CFG_SECTION_MQTT, "Group ID", CFG_SHOW(CFG_PRINT_OPTIONAL))                                                              \
+  X(pricePerLiter, CFG_JSON("pricePerLiter"), "price", 1000, CFG_CLAMP(0, CFG_NO_MAX),                                       \
+    CFG_SECTION_VENDING, "Price per Liter", CFG_SHOW_NUMBER(0, " so'm"))                                                     \
+  X(sessionTimeout, CFG_JSON("sessionTimeout"), "sess_timeout", 300000, CFG_RESET(1000, CFG_NO_MAX),                         \
+    CFG_SECTION_VENDING, "Session Timeout", CFG_SHOW(CFG_PRINT_SECONDS))                                                     \
+  X(freeWaterCooldown, CFG_JSON("freeWaterCooldown"), "free_cooldown", 180000, CFG_ANY,                                      \
+    CFG_SECTION_VENDING, "Free Water Cooldown", CFG_SHOW(CFG_PRINT_SECONDS))                                                 \
+  X(freeWaterAmount, CFG_JSON("freeWaterAmount"), "free_amount", 0.2f, CFG_CLAMP(0, CFG_NO_MAX),                             \
+    CFG_SECTION_VENDING, "Free Water Amount", CFG_SHOW(CFG_PRINT_ML))                                                        \
+  X(pulsesPerLiter, CFG_JSON("pulsesPerLiter"), "pulses", 450.0f, CFG_ANY,                                                   \
+    CFG_SECTION_VENDING, "Pulses per Liter", CFG_SHOW_NUMBER(2, ""))                                                         \
+  X(tdsThreshold, CFG_JSON("tdsThreshold"), "tds_thresh", 100, CFG_ANY,                                                      \
+    CFG_SECTION_VENDING, "TDS Threshold", CFG_SHOW_NUMBER(0, " ppm"))                                                        \
+  X(tdsTemperatureC, CFG_JSON("tdsTemperatureC"), "tds_temp", 25.0f, CFG_ANY,                                                \
+    CFG_SECTION_VENDING, "TDS Temperature", CFG_SHOW_NUMBER(1, " C"))                                                        \
+  X(tdsCalibrationFactor, CFG_JSON("tdsCalibrationFactor"), "tds_calib", 0.5f, CFG_RESET(0.01, 10.0),                        \
+    CFG_SECTION_VENDING, "TDS Calibration", CFG_SHOW_NUMBER(3, ""))                                                          \
+  X(enableFreeWater, CFG_JSON("enableFreeWater"), "enable_free", true, CFG_ANY,                                              \
+    CFG_SECTION_VENDING, "Free Water", CFG_SHOW(CFG_PRINT_ENABLED))                                                          \
+  X(relayActiveHigh, CFG_JSON("relayActiveHigh", "relay_active_high"), "relay_active_high", true, CFG_RESET(1, 1),           \
+    CFG_SECTION_VENDING, "Relay Active High", CFG_SHOW(CFG_PRINT_YES_NO))                                                    \
+  X(cashPulseValue, CFG_JSON("cashPulseValue"), "cash_pulse", 1000, CFG_RESET(1, CFG_NO_MAX),                                \
+    CFG_SECTION_VENDING, "Cash Pulse Value", CFG_SHOW_NUMBER(0, " so'm"))                                                    \
+  X(cashPulseGapMs, CFG_JSON("cashPulseGapMs"), "cash_gap", 120, CFG_ANY,                                                    \
+    CFG_SECTION_VENDING, "Cash Pulse Gap", CFG_SHOW_NUMBER(0, " ms"))                                                        \
+  X(paymentCheckInterval, CFG_JSON("paymentCheckInterval"), "pay_interval", 2000, CFG_ANY,                                   \
+    CFG_SECTION_VENDING, "Payment Interval", CFG_SHOW_NUMBER(0, " ms"))                                                      \
+  X(displayUpdateInterval, CFG_JSON("displayUpdateInterval"), "disp_interval", 100, CFG_ANY,                                 \
+    CFG_SECTION_VENDING, "Display Interval", CFG_SHOW_NUMBER(0, " ms"))                                                      \
+  X(tdsCheckInterval, CFG_JSON("tdsCheckInterval"), "tds_interval", 5000, CFG_ANY,                                           \
+    CFG_SECTION_VENDING, "TDS Interval", CFG_SHOW_NUMBER(0, " ms"))                                                          \
+  X(heartbeatInterval, CFG_JSON("heartbeatInterval"), "hb_interval", 30000, CFG_ANY,                                         \
+    CFG_SECTION_VENDING, "Heartbeat Interval", CFG_SHOW_NUMBER(0, " ms"))                                                    \
+  X(enablePowerSave, CFG_JSON("enablePowerSave"), "enable_ps", false, CFG_ANY,                                               \
+    CFG_SECTION_POWER, "Enable Power Save", CFG_SHOW(CFG_PRINT_YES_NO))                                                      \
+  X(deepSleepStartHour, CFG_JSON("deepSleepStartHour"), "sleep_start", 1, CFG_RESET(0, 23),                                  \
+    CFG_SECTION_POWER, "Deep Sleep Start", CFG_SHOW(CFG_PRINT_HIDDEN))                                                       \
+  X(deepSleepEndHour, CFG_JSON("deepSleepEndHour"), "sleep_end", 6, CFG_RESET(0, 23),                                        \
+    CFG_SECTION_POWER, "Deep Sleep End", CFG_SHOW(CFG_PRINT_HIDDEN))                                                         \
+  X(configured, CFG_NO_JSON, "configured", false, CFG_ANY,                                                                   \
+    CFG_SECTION_STATUS, "Configured", CFG_SHOW(CFG_PRINT_YES_NO))                                                            \
+  X(configVersion, CFG_NO_JSON, "cfg_version", 1, CFG_ANY,                                                                   \
+    CFG_SECTION_STATUS, "Config Version", CFG_SHOW_NUMBER(0, ""))
+// clang-format on
+
+// ============================================
+// SIGNED MESSAGE CANONICAL SCHEMA
+// ============================================
+// Canonical form signed by the server and checked by the firmware: the keys
+// below that are present, in this order, then device_id. `firstRequired`
+// writes the first key even when absent (as null). The config list is
+// generated from DEVICE_CONFIG_FIELDS.
+#define CANONICAL_MAX_KEYS 40
+
+struct CanonicalSchema {
+  const char *const *keys;
+  uint8_t count;
+  bool firstRequired;
+};
+
+static const char *const CANONICAL_PAYMENT_KEYS[] = {
+    "amount", "source", "transaction_id", "nonce", "user_id", "nozzle", "ts"};
+
+static const char *const CANONICAL_CONFIG_KEYS[] = {
+    "apply",
+#define X(member, json, ...) json
+    DEVICE_CONFIG_FIELDS(X)
+#undef X
+    "nozzles", "transaction_id", "nonce", "ts"};
+
+static const char *const CANONICAL_COMMAND_KEYS[] = {
+    "action",   "pricePerLiter", "threshold",      "tdsThreshold", "duration",
+    "reason",   "transaction_id", "nonce",         "ts"};
+
+static const char *const CANONICAL_OTA_KEYS[] = {"firmware_url",
+                                                 "transaction_id", "nonce",
+                                                 "ts"};
+
+static const char *const CANONICAL_LEDGER_ACK_KEYS[] = {"last_seq", "nonce",
+                                                        "ts"};
+
+#define CANONICAL_SCHEMA(keys, firstRequired)                                  \
+  (CanonicalSchema{keys, sizeof(keys) / sizeof(keys[0]), firstRequired})
+
+static_assert(sizeof(CANONICAL_CONFIG_KEYS) / sizeof(CANONICAL_CONFIG_KEYS[0]) <=
+                  CANONICAL_MAX_KEYS,
+              "Raise CANONICAL_MAX_KEYS");
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef CONFIG_SNAPSHOT_H
+#define CONFIG_SNAPSHOT_H
+
+#include <atomic>
+#include <stdint.h>
+
+// ============================================
+// DOUBLE-BUFFERED CONFIG SNAPSHOT
+// ============================================
+// One writer publishes complete values; any task reads the latest one
+// whole. The writer fills the slot readers are not on and then bumps
+// `published`, so a reader copies a finished value without a lock. It only
+// retries if two publishes land while it copies (the writer reused its
+// slot), which config updates never come close to.
+template <typename T> class ConfigSnapshot {
+public:
+  void publish(const T &value) {
+    const uint32_t next = published.load(std::memory_order_relaxed) + 1;
+    writing.store(next, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slots[next & 1] = value;
+    published.store(next, std::memory_order_release);
+  }
+
+  // Version of the latest publish (0: nothing published yet)
+  uint32_t version() const { return published.load(std::memory_order_acquire); }
+
+  uint32_t read(T &out) const {
+    for (;;) {
+      const uint32_t v = published.load(std::memory_order_acquire);
+      out = slots[v & 1];
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (writing.load(std::memory_order_relaxed) - v < 2) {
+        return v;
+      }
+    }
+  }
+
+  // Copies the snapshot into `out` only if it is newer than `seen`
+  bool readIfNewer(T &out, uint32_t &seen) const {
+    if (version() == seen) {
+      return false;
+    }
+    seen = read(out);
+    return true;
+  }
+
+private:
+  T slots[2];
+  std::atomic<uint32_t> writing{0};   // Publish in progress (or last done)
+  std::atomic<uint32_t> published{0}; // Last finished publish
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef CONFIG_STORAGE_H
 #define CONFIG_STORAGE_H
 
+#include "hardware.h"
 #include <Arduino.h>
 #include <Preferences.h>
 
@@ -35,6 +36,8 @@ struct DeviceConfig {
   bool relayActiveHigh;
   int cashPulseValue;
   unsigned long cashPulseGapMs;
+  int nozzlePricePerLiter[NOZZLE_MAX];    // -1 = same as pricePerLiter
+  float nozzlePulsesPerLiter[NOZZLE_MAX]; // 0 = same as pulsesPerLiter
 
   // Intervals
   unsigned long paymentCheckInterval;
@@ -55,6 +58,12 @@ struct DeviceConfig {
   bool configured;
 };
 
+// Durations arrive as seconds (<= 3600) or milliseconds (> 3600); every
+// input path (MQTT config, SET_* and CFG_FRAME) reads them the same way
+inline unsigned long normalizeSecondsOrMs(unsigned long value) {
+  return value <= 3600UL ? value * 1000UL : value;
+}
+
 // ============================================
 // GLOBAL INSTANCES
 // ============================================
@@ -71,6 +80,7 @@ void scheduleConfigSave();
 void processConfigSave();
 void loadDefaultConfig();
 void validateConfig(); // Added validation Function
+bool validateConfigValues(DeviceConfig &c); // Schema checks, true if changed
 void printCurrentConfig();
 bool isConfigured();
 
@@ -1,43 +1,53 @@
 #include "config_storage.h"
+#include "config_schema.h"
 #include <Arduino.h>
 
+// Out-of-range values are pulled into range or reset to the schema
+// default, as the field's check in DEVICE_CONFIG_FIELDS says.
+template <size_t N>
+static bool applyConfigRange(char (&)[N], const char *, const ConfigRange &) {
+  return false;
+}
+
+template <typename T, typename D>
+static bool applyConfigRange(T &value, D def, const ConfigRange &range) {
+  const double v = value;
+  if (!range.checked || (v >= range.lo && v <= range.hi)) {
+    return false;
+  }
+  if (range.clamp) {
+    value = static_cast<T>(v < range.lo ? range.lo : range.hi);
+  } else {
+    value = static_cast<T>(def);
+  }
+  return true;
+}
+
 // ============================================
 // VALIDATE CONFIGURATION
 // ============================================
-void validateConfig() {
+bool validateConfigValues(DeviceConfig &c) {
   bool changed = false;
 
-  if (deviceConfig.pricePerLiter < 0) {
-    deviceConfig.pricePerLiter = 0;
-    changed = true;
-  }
-  if (deviceConfig.sessionTimeout < 1000) {
-    deviceConfig.sessionTimeout = 300000; // Reset to 5 min if too small
-    changed = true;
-  }
-  if (deviceConfig.mqtt_port <= 0) {
-    deviceConfig.mqtt_port = 1883;
-    changed = true;
-  }
-  if (deviceConfig.freeWaterAmount < 0) {
-    deviceConfig.freeWaterAmount = 0;
-    changed = true;
-  }
-  if (deviceConfig.tdsCalibrationFactor <= 0.01 ||
-      deviceConfig.tdsCalibrationFactor > 10.0) {
-    deviceConfig.tdsCalibrationFactor = 0.5; // Reset to reasonable default
-    changed = true;
-  }
-  if (deviceConfig.cashPulseValue <= 0) {
-    deviceConfig.cashPulseValue = 1000;
-    changed = true;
-  }
-  if (!deviceConfig.relayActiveHigh) {
-    deviceConfig.relayActiveHigh = true;
-    changed = true;
-  }
+#define X(member, json, nvsKey, def, check, ...)                               \
+  changed |= applyConfigRange(c.member, def, check);
+  DEVICE_CONFIG_FIELDS(X)
+#undef X
+  for (int i = 0; i < NOZZLE_MAX; i++) {
+    if (c.nozzlePricePerLiter[i] < -1) {
+      c.nozzlePricePerLiter[i] = -1;
+      changed = true;
+    }
+    if (c.nozzlePulsesPerLiter[i] < 0.0f) {
+      c.nozzlePulsesPerLiter[i] = 0.0f;
+      changed = true;
+    }
+  }
+  return changed;
+}
 
-  if (changed) {
+void validateConfig() {
+  if (validateConfigValues(deviceConfig)) {
     Serial.println("Config validation corrected invalid values.");
     saveConfigToStorage();
   }
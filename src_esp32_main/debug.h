@@ -3,6 +3,9 @@
 
 // Conditional debug logging system
 // Set ENABLE_DEBUG_LOGS=0 in platformio.ini for production builds
+//
+// NOTE: These macros write to Serial synchronously. Hot paths (UART, payment,
+// buttons, flow) use the deferred LOG_xxx() macros from shared/logger.h.
 
 #ifndef ENABLE_DEBUG_LOGS
 #define ENABLE_DEBUG_LOGS 1 // Default: enabled for development
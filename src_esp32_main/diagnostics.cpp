@@ -1,177 +1,220 @@
 #include "diagnostics.h"
+#include "../shared/logger.h"
 #include "config.h"
-#include "debug.h"
 #include "display.h"
 #include "hardware.h"
 #include "mqtt_handler.h"
 #include "relay_control.h"
-#include "sensors.h"
 #include "state_machine.h"
+#include "uart_receiver.h"
 #include <ArduinoJson.h>
 #include <WiFi.h>
+#include <Wire.h>
+
+// ============================================
+// HEALTH STATE
+// ============================================
+static HealthReport health;
+static HealthReport published;
+static bool hasPublished = false;
+static unsigned long lastTickMs = 0;
+static unsigned long lastPublishMs = 0;
+
+// Flow: pulses seen with the valve closed
+static unsigned long lastPulses[NOZZLE_COUNT];
+static unsigned long valveClosedMs[NOZZLE_COUNT]; // 0 = valve open
+static DiagHourCount strayPulses[NOZZLE_COUNT];
+
+static DiagTdsStats tdsStats;
+
+// LCD: address-only I2C probe, bit set = NACK
+static uint16_t i2cNackWindow = 0;
+static uint32_t i2cNacks = 0;
+static unsigned long lastProbeMs = 0;
+
+static uint32_t lastUartHwErrors = 0;
+
+static uint32_t lastMqttConnects = 0;
+static DiagHourCount mqttReconnects;
+
+void initDiagnostics() {
+  memset(&health, 0, sizeof(health));
+  const unsigned long now = millis();
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    lastPulses[i] = nozzles[i].flowPulseCount;
+    valveClosedMs[i] = now;
+    memset(&strayPulses[i], 0, sizeof(strayPulses[i]));
+    strayPulses[i].startMs = now;
+  }
+  memset(&tdsStats, 0, sizeof(tdsStats));
+  memset(&mqttReconnects, 0, sizeof(mqttReconnects));
+  mqttReconnects.startMs = now;
+  lastUartHwErrors = getUartLinkStats().hwErrors;
+  lastMqttConnects = getMqttConnectCount();
+}
 
-static HealthCheck lastHealthCheck;
-
-// Run comprehensive hardware diagnostics
-HealthCheck runDiagnostics() {
-  HealthCheck health;
-  health.timestamp = millis() / 1000;
-  health.failureCount = 0;
-
-  DEBUG_PRINTLN("Running system diagnostics...");
-
-  // 1. Flow Sensor Test
-  // Check if counter is stable when idle (no false pulses)
-  if (currentState == IDLE || currentState == ACTIVE) {
-    unsigned long before = flowPulseCount;
-    delay(100);
-    unsigned long after = flowPulseCount;
-    health.flowSensorOk = (after == before); // Should be stable when idle
-
-    if (!health.flowSensorOk) {
-      health.failureCount++;
-      DEBUG_PRINTLN("⚠️ Flow sensor: unstable readings");
-    } else {
-      DEBUG_PRINTLN("✓ Flow sensor: OK");
+void diagRecordTds(float ppm) { diagTdsAdd(tdsStats, ppm); }
+
+// ============================================
+// COMPONENT SCORES
+// ============================================
+static uint8_t scoreFlow(unsigned long now) {
+  uint8_t worst = 100;
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    const unsigned long pulses = nozzles[i].flowPulseCount;
+    // The state machine zeroes the counter at session start
+    const unsigned long delta =
+        pulses >= lastPulses[i] ? pulses - lastPulses[i] : pulses;
+    lastPulses[i] = pulses;
+
+    if (isNozzleRelayOn(i)) {
+      valveClosedMs[i] = 0;
+    } else if (valveClosedMs[i] == 0) {
+      valveClosedMs[i] = now ? now : 1; // Just closed: coast-down follows
+    } else if (now - valveClosedMs[i] >= DIAG_LEAK_SETTLE_MS && delta > 0) {
+      diagCountAdd(strayPulses[i], delta, now);
     }
-  } else {
-    health.flowSensorOk = true; // Skip test during dispense
+    const uint8_t s = diagScoreLeak(diagCountGet(strayPulses[i], now));
+    worst = s < worst ? s : worst;
   }
+  return worst;
+}
 
-  // 2. TDS Sensor Test
-  // Check if readings are in valid range
-  float tds = readTDS();
-  health.tdsSensorOk = (tds >= 0 && tds < 2000); // Valid water TDS range
-
-  if (!health.tdsSensorOk) {
-    health.failureCount++;
-    DEBUG_PRINTF("⚠️ TDS sensor: invalid reading %.1f ppm\n", tds);
-  } else {
-    DEBUG_PRINTF("✓ TDS sensor: %.1f ppm\n", tds);
+static uint8_t scoreRelay() {
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    if (nozzles[i].state == IDLE && nozzles[i].balance == 0 &&
+        isNozzleRelayOn(i)) {
+      return 0; // Stuck ON
+    }
   }
+  return 100;
+}
 
-  // 3. Cash Acceptor Test
-  // For now, assume OK (no error tracking implemented yet)
-  health.cashAcceptorOk = true;
-  DEBUG_PRINTLN("→ Cash acceptor: OK");
-
-  // 4. Relay Test
-  // SAFETY FIX: Do not toggle relay. Only verify it is OFF in IDLE.
-  if (currentState == IDLE && balance == 0) {
-    // In IDLE, relay should be OFF. If ON, it's stuck.
-    if (isRelayOn()) {
-      health.relayOk = false;
-      health.failureCount++;
-      DEBUG_PRINTLN("⚠️ Relay: Stuck ON (Critical Fail)");
-    } else {
-      health.relayOk = true;
-      DEBUG_PRINTLN("✓ Relay: OK (OFF)");
+static uint8_t scoreDisplay(unsigned long now) {
+  if (lastProbeMs == 0 || now - lastProbeMs >= DIAG_I2C_PROBE_MS) {
+    lastProbeMs = now ? now : 1;
+    Wire.beginTransmission(LCD_I2C_ADDR);
+    const bool nack = Wire.endTransmission() != 0;
+    i2cNackWindow = (uint16_t)((i2cNackWindow << 1) | (nack ? 1 : 0));
+    if (nack) {
+      i2cNacks++;
     }
-  } else {
-    health.relayOk = true; // Skip test when not safe
-    DEBUG_PRINTLN("→ Relay: skipped (not safe to test)");
   }
+  return diagScoreDisplay(i2cNackWindow);
+}
 
-  // 5. Display Test (LCD I2C - assume OK if initialized)
-  health.displayOk = true; // LCD doesn't have width/height check
+static uint8_t scoreCash() {
+  const UartLinkStats &link = getUartLinkStats();
+  const uint32_t newHw = link.hwErrors - lastUartHwErrors;
+  lastUartHwErrors = link.hwErrors;
+  return diagScoreLink(isPaymentEspConnected(), link.window, newHw);
+}
 
-  if (!health.displayOk) {
-    health.failureCount++;
-    DEBUG_PRINTLN("⚠️ Display: not initialized");
-  } else {
-    DEBUG_PRINTLN("✓ Display: OK");
+static uint8_t scoreMqtt(unsigned long now) {
+  const uint32_t connects = getMqttConnectCount();
+  if (connects > lastMqttConnects) {
+    // The first connect after boot is not a reconnect
+    const uint32_t n = connects - lastMqttConnects;
+    diagCountAdd(mqttReconnects, lastMqttConnects == 0 ? n - 1 : n, now);
+    lastMqttConnects = connects;
   }
+  return diagScoreMqtt(mqttClient.connected(),
+                       diagCountGet(mqttReconnects, now));
+}
 
-  // 6. WiFi Test
-  health.wifiOk = (WiFi.status() == WL_CONNECTED);
-
-  if (!health.wifiOk) {
-    health.failureCount++;
-    DEBUG_PRINTLN("⚠️ WiFi: disconnected");
-  } else {
-    DEBUG_PRINTLN("✓ WiFi: connected");
+// ============================================
+// PROCESS (every loop)
+// ============================================
+void processDiagnostics() {
+  const unsigned long now = millis();
+  if (now - lastTickMs < DIAG_TICK_MS) {
+    return;
   }
-
-  // 7. MQTT Test
-  health.mqttOk = mqttClient.connected();
-
-  if (!health.mqttOk) {
-    health.failureCount++;
-    DEBUG_PRINTLN("⚠️ MQTT: disconnected");
-  } else {
-    DEBUG_PRINTLN("✓ MQTT: connected");
+  lastTickMs = now;
+
+  health.score[DIAG_FLOW] = scoreFlow(now);
+  health.score[DIAG_TDS] = diagScoreTds(tdsStats);
+  health.score[DIAG_CASH] = scoreCash();
+  health.score[DIAG_RELAY] = scoreRelay();
+  health.score[DIAG_DISPLAY] = scoreDisplay(now);
+  health.score[DIAG_WIFI] =
+      diagScoreWifi(WiFi.status() == WL_CONNECTED, WiFi.RSSI());
+  health.score[DIAG_MQTT] = scoreMqtt(now);
+
+  health.overall = 100;
+  for (uint8_t c = 0; c < DIAG_COMPONENT_COUNT; c++) {
+    health.level[c] = diagLevel(health.score[c]);
+    if (health.score[c] < health.overall) {
+      health.overall = health.score[c];
+    }
   }
+  health.timestamp = now / 1000;
 
-  DEBUG_PRINTF("Diagnostics complete. Failures: %d\n", health.failureCount);
-
-  // Store for later reference
-  lastHealthCheck = health;
-
-  // Send simple logs for critical failures (instead of Alerts)
-  if (!health.flowSensorOk) {
-    publishLog("DIAG_FAIL", "Flow sensor unstable");
-  }
-  if (!health.relayOk && currentState == IDLE) {
-    publishLog("DIAG_FAIL", "Relay stuck ON");
-  }
-  if (!health.displayOk) {
-    publishLog("DIAG_FAIL", "Display malfunction");
+  if (hasPublished && (!diagShouldPublish(health, published) ||
+                       now - lastPublishMs < DIAG_MIN_PUBLISH_MS)) {
+    return;
   }
-  if (!health.tdsSensorOk) {
-    publishLog("DIAG_FAIL", "TDS sensor invalid");
+  if (!mqttClient.connected()) {
+    return; // Sent (with the MQTT score) once the broker is back
   }
-  if (!health.wifiOk || !health.mqttOk) {
-    // Can't publish if no network, but let's try
+  for (uint8_t c = 0; c < DIAG_COMPONENT_COUNT; c++) {
+    if (health.level[c] == DIAG_FAIL &&
+        (!hasPublished || published.level[c] != DIAG_FAIL)) {
+      LOG_WARN("Health: %s failed (score %u)", diagComponentName(c),
+               (unsigned)health.score[c]);
+    }
   }
-
-  return health;
+  publishHealthReport(health);
+  published = health;
+  hasPublished = true;
+  lastPublishMs = now;
 }
 
 // Publish health report to MQTT
-void publishHealthReport(const HealthCheck &health) {
+void publishHealthReport(const HealthReport &report) {
   if (!mqttClient.connected()) {
-    DEBUG_PRINTLN("Cannot publish diagnostics: MQTT disconnected");
     return;
   }
 
   JsonDocument doc;
+  doc["timestamp"] = report.timestamp;
+  doc["overall"] = report.overall;
 
-  doc["timestamp"] = health.timestamp;
-
+  // `components` stays a bool map (false = fail) for existing consumers
   JsonObject components = doc["components"].to<JsonObject>();
-  components["flowSensor"] = health.flowSensorOk;
-  components["tdsSensor"] = health.tdsSensorOk;
-  components["cashAcceptor"] = health.cashAcceptorOk;
-  components["relay"] = health.relayOk;
-  components["display"] = health.displayOk;
-  components["wifi"] = health.wifiOk;
-  components["mqtt"] = health.mqttOk;
-
-  doc["failureCount"] = health.failureCount;
-
-  // List failed components
+  JsonObject scores = doc["scores"].to<JsonObject>();
+  JsonObject levels = doc["levels"].to<JsonObject>();
   JsonArray failed = doc["failedComponents"].to<JsonArray>();
-  if (!health.flowSensorOk)
-    failed.add("flowSensor");
-  if (!health.tdsSensorOk)
-    failed.add("tdsSensor");
-  if (!health.cashAcceptorOk)
-    failed.add("cashAcceptor");
-  if (!health.relayOk)
-    failed.add("relay");
-  if (!health.displayOk)
-    failed.add("display");
-  if (!health.wifiOk)
-    failed.add("wifi");
-  if (!health.mqttOk)
-    failed.add("mqtt");
+  int failures = 0;
+  for (uint8_t c = 0; c < DIAG_COMPONENT_COUNT; c++) {
+    const char *name = diagComponentName(c);
+    components[name] = report.level[c] != DIAG_FAIL;
+    scores[name] = report.score[c];
+    levels[name] = diagLevelName(report.level[c]);
+    if (report.level[c] == DIAG_FAIL) {
+      failed.add(name);
+      failures++;
+    }
+  }
+  doc["failureCount"] = failures;
+
+  // Raw inputs behind the scores
+  JsonObject detail = doc["detail"].to<JsonObject>();
+  const unsigned long now = millis();
+  JsonArray leak = detail["stray_pulses_1h"].to<JsonArray>();
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    leak.add(diagCountGet(strayPulses[i], now));
+  }
+  detail["tds_mean"] = tdsStats.mean;
+  detail["tds_stddev"] = sqrtf(tdsStats.var);
+  detail["i2c_nacks"] = i2cNacks;
+  detail["uart_bad_recent"] = diagPopcount16(getUartLinkStats().window);
+  detail["mqtt_reconnects_1h"] = diagCountGet(mqttReconnects, now);
+  detail["rssi"] = WiFi.RSSI();
 
   String payload;
   serializeJson(doc, payload);
-
   mqttClient.publish(TOPIC_DIAGNOSTICS, payload.c_str(), false);
-  DEBUG_PRINTLN("Health report published to MQTT");
 }
 
-// Get last health check results
-HealthCheck getLastHealth() { return lastHealthCheck; }
+const HealthReport &getLastHealth() { return health; }
@@ -3,22 +3,210 @@
 
 #include <Arduino.h>
 
-// Health check result structure
-struct HealthCheck {
-  bool flowSensorOk;
-  bool tdsSensorOk;
-  bool cashAcceptorOk;
-  bool relayOk;
-  bool displayOk;
-  bool wifiOk;
-  bool mqttOk;
-  uint32_t timestamp;
-  int failureCount;
+// ============================================
+// CONTINUOUS HEALTH SCORING
+// ============================================
+// Every component gets a 0-100 score from data the firmware already has,
+// updated once per DIAG_TICK_MS from loop() (a few comparisons; nothing
+// waits or toggles hardware):
+//
+//   flowSensor    pulses counted while the nozzle's valve is closed (leak
+//                 or a noisy sensor), after DIAG_LEAK_SETTLE_MS coast-down
+//   tdsSensor     range and running variance of the loop's TDS samples
+//   cashAcceptor  Payment ESP32 link: connected, bad frames, UART errors
+//   relay         valve driven ON while its nozzle is idle with no credit
+//   display       ACKs from an address-only I2C probe of the LCD
+//   wifi          connected, RSSI
+//   mqtt          connected, reconnects within the last hour
+//
+// A report goes to TOPIC_DIAGNOSTICS only when a component changes level
+// (ok / degraded / fail) or its score moves by DIAG_SCORE_STEP.
+
+#define DIAG_TICK_MS 1000
+#define DIAG_I2C_PROBE_MS 10000
+#define DIAG_LEAK_SETTLE_MS 3000
+#define DIAG_WINDOW_MS 3600000UL // Leak pulses / MQTT reconnects per hour
+#define DIAG_MIN_PUBLISH_MS 5000 // Rate limit for flapping components
+#define DIAG_SCORE_STEP 10
+
+#define DIAG_SCORE_OK 80       // >= : ok
+#define DIAG_SCORE_DEGRADED 40 // >= : degraded, below: fail
+
+enum DiagComponent : uint8_t {
+  DIAG_FLOW,
+  DIAG_TDS,
+  DIAG_CASH,
+  DIAG_RELAY,
+  DIAG_DISPLAY,
+  DIAG_WIFI,
+  DIAG_MQTT,
+  DIAG_COMPONENT_COUNT
+};
+
+enum DiagLevel : uint8_t { DIAG_OK, DIAG_DEGRADED, DIAG_FAIL };
+
+struct HealthReport {
+  uint8_t score[DIAG_COMPONENT_COUNT];
+  uint8_t level[DIAG_COMPONENT_COUNT]; // DiagLevel
+  uint8_t overall;                     // Lowest component score
+  uint32_t timestamp;                  // Uptime (s) of the last update
+};
+
+// EWMA mean/variance of TDS samples (alpha 1/8)
+struct DiagTdsStats {
+  float mean;
+  float var;
+  float last;
+  uint32_t samples;
+};
+
+// Events over roughly the last hour: two half-hour buckets
+struct DiagHourCount {
+  uint32_t cur;
+  uint32_t prev;
+  unsigned long startMs;
 };
 
-// Main diagnostics functions
-HealthCheck runDiagnostics();
-void publishHealthReport(const HealthCheck &health);
-HealthCheck getLastHealth();
+inline void diagCountRoll(DiagHourCount &c, unsigned long nowMs) {
+  const unsigned long half = DIAG_WINDOW_MS / 2;
+  const unsigned long age = nowMs - c.startMs;
+  if (age >= half) {
+    c.prev = (age >= 2 * half) ? 0 : c.cur;
+    c.cur = 0;
+    c.startMs = nowMs;
+  }
+}
+
+inline void diagCountAdd(DiagHourCount &c, uint32_t n, unsigned long nowMs) {
+  diagCountRoll(c, nowMs);
+  c.cur += n;
+}
+
+inline uint32_t diagCountGet(DiagHourCount &c, unsigned long nowMs) {
+  diagCountRoll(c, nowMs);
+  return c.cur + c.prev;
+}
+
+// ============================================
+// SCORING (pure, unit tested)
+// ============================================
+inline uint8_t diagLevel(uint8_t score) {
+  return score >= DIAG_SCORE_OK         ? DIAG_OK
+         : score >= DIAG_SCORE_DEGRADED ? DIAG_DEGRADED
+                                        : DIAG_FAIL;
+}
+
+inline uint8_t diagClamp(int v) {
+  return (uint8_t)(v < 0 ? 0 : v > 100 ? 100 : v);
+}
+
+inline uint8_t diagPopcount16(uint16_t w) {
+  uint8_t n = 0;
+  for (; w; w &= (uint16_t)(w - 1)) {
+    n++;
+  }
+  return n;
+}
+
+// Stray pulses per hour with every valve closed. A couple are vibration;
+// a steady drip of 20+ (~45 ml at 450 pulses/L) is a leak or a bad sensor.
+inline uint8_t diagScoreLeak(uint32_t strayPulses) {
+  return strayPulses <= 2 ? 100 : diagClamp(100 - (int)(strayPulses - 2) * 5);
+}
+
+inline void diagTdsAdd(DiagTdsStats &s, float ppm) {
+  s.last = ppm;
+  if (s.samples++ == 0) {
+    s.mean = ppm;
+    s.var = 0.0f;
+    return;
+  }
+  const float d = ppm - s.mean;
+  s.mean += d / 8.0f;
+  s.var = (s.var + d * d / 8.0f) * 7.0f / 8.0f;
+}
+
+// Out of range = probe fault. A noisy reading (std dev 10 -> 110 ppm)
+// scores down linearly; a flat zero means a dry or unplugged probe.
+inline uint8_t diagScoreTds(const DiagTdsStats &s) {
+  if (s.samples == 0) {
+    return 100; // No data yet
+  }
+  if (s.last < 0.0f || s.last >= 2000.0f) {
+    return 0;
+  }
+  if (s.samples >= 8 && s.mean < 1.0f) {
+    return 50;
+  }
+  const float sd = sqrtf(s.var);
+  return diagClamp(100 - (int)(sd - 10.0f));
+}
+
+// `window`: last 16 frames / probes, bit set = failed
+inline uint8_t diagScoreWindow(uint16_t window) {
+  return diagClamp(100 - diagPopcount16(window) * 10);
+}
+
+inline uint8_t diagScoreLink(bool connected, uint16_t badWindow,
+                             uint32_t newHwErrors) {
+  if (!connected) {
+    return 0;
+  }
+  return diagClamp(diagScoreWindow(badWindow) - (int)newHwErrors * 10);
+}
+
+// Two failed probes in a row: the LCD is gone (unplugged or bus stuck)
+inline uint8_t diagScoreDisplay(uint16_t nackWindow) {
+  return (nackWindow & 0x3) == 0x3 ? 0 : diagScoreWindow(nackWindow);
+}
+
+inline uint8_t diagScoreWifi(bool connected, int rssi) {
+  if (!connected) {
+    return 0;
+  }
+  if (rssi >= -67) {
+    return 100;
+  }
+  return diagClamp(100 - (-67 - rssi) * 4); // -87 dBm -> 20
+}
+
+inline uint8_t diagScoreMqtt(bool connected, uint32_t reconnectsPerHour) {
+  return connected ? diagClamp(100 - (int)reconnectsPerHour * 20) : 0;
+}
+
+// Publish if any level changed or any score moved by DIAG_SCORE_STEP
+inline bool diagShouldPublish(const HealthReport &now,
+                              const HealthReport &published) {
+  for (uint8_t c = 0; c < DIAG_COMPONENT_COUNT; c++) {
+    const int d = (int)now.score[c] - (int)published.score[c];
+    if (now.level[c] != published.level[c] || d >= DIAG_SCORE_STEP ||
+        d <= -DIAG_SCORE_STEP) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline const char *diagComponentName(uint8_t c) {
+  static const char *const names[DIAG_COMPONENT_COUNT] = {
+      "flowSensor", "tdsSensor", "cashAcceptor", "relay",
+      "display",    "wifi",      "mqtt"};
+  return c < DIAG_COMPONENT_COUNT ? names[c] : "?";
+}
+
+inline const char *diagLevelName(uint8_t level) {
+  return level == DIAG_OK ? "ok" : level == DIAG_DEGRADED ? "degraded" : "fail";
+}
+
+// ============================================
+// FUNCTIONS
+// ============================================
+void initDiagnostics();
+// Once per loop; does work every DIAG_TICK_MS and publishes on change
+void processDiagnostics();
+// Feed the TDS reading the loop already took
+void diagRecordTds(float ppm);
+void publishHealthReport(const HealthReport &health);
+const HealthReport &getLastHealth();
 
 #endif
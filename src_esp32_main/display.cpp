@@ -95,6 +95,10 @@ static void drawProgressBar(int row, int percent) {
   lcd.print(pctBuf);
 }
 
+// Nozzle whose session is on screen (see getFocusNozzle)
+static uint8_t shownNozzle = 0;
+static const NozzleSession *shown = &nozzles[0];
+
 static void drawStatusLine() {
   bool wifiOk = (WiFi.status() == WL_CONNECTED);
   bool mqttOk = mqttClient.connected();
@@ -103,7 +107,12 @@ static void drawStatusLine() {
 
   // TDS info
   char tdsBuf[12];
+#if NOZZLE_COUNT > 1
+  snprintf(tdsBuf, sizeof(tdsBuf), "#%u TDS:%3d", (unsigned)shownNozzle + 1,
+           tdsPPM);
+#else
   snprintf(tdsBuf, sizeof(tdsBuf), "TDS:%3dppm", tdsPPM);
+#endif
   lcd.print(tdsBuf);
 
   // Spacer
@@ -154,6 +163,7 @@ void updateDisplay() {
   static int lastTds = -1;
   static bool lastWifiOk = false;
   static bool lastMqttOk = false;
+  static uint8_t lastNozzle = 0;
   static unsigned long lastUpdateMs = 0;
 
   // Temporary message handling
@@ -178,16 +188,20 @@ void updateDisplay() {
     return;
   }
 
+  shownNozzle = getFocusNozzle();
+  shown = &nozzles[shownNozzle];
+
   const bool wifiOk = (WiFi.status() == WL_CONNECTED);
   const bool mqttOk = mqttClient.connected();
-  const int dispensed100 = (int)(totalDispensedLiters * 100.0f + 0.5f);
-  const int freeMl = (int)(freeWaterDispensed * 1000.0f + 0.5f);
-  const bool freeOffer = (config.enableFreeWater && currentState == IDLE &&
-                          !freeWaterUsed && millis() >= freeWaterAvailableTime);
+  const int dispensed100 = (int)(shown->totalDispensedLiters * 100.0f + 0.5f);
+  const int freeMl = (int)(shown->freeWaterDispensed * 1000.0f + 0.5f);
+  const bool freeOffer =
+      (config.enableFreeWater && shown->state == IDLE &&
+       !shown->freeWaterUsed && millis() >= shown->freeWaterAvailableTime);
 
   int timeoutSec = -1;
-  if (currentState == ACTIVE || currentState == PAUSED) {
-    unsigned long elapsed = millis() - lastSessionActivity;
+  if (shown->state == ACTIVE || shown->state == PAUSED) {
+    unsigned long elapsed = millis() - shown->lastSessionActivity;
     unsigned long timeLeft = (elapsed >= config.sessionTimeout)
                                  ? 0
                                  : (config.sessionTimeout - elapsed);
@@ -195,8 +209,9 @@ void updateDisplay() {
   }
 
   // Check if anything changed
-  bool stateChanged = (currentState != lastState);
-  bool balanceChanged = (balance != lastBalance);
+  bool stateChanged =
+      (shown->state != lastState || shownNozzle != lastNozzle);
+  bool balanceChanged = (shown->balance != lastBalance);
   bool dispensedChanged = (dispensed100 != lastDispensed100);
   bool freeChanged = (freeMl != lastFreeMl);
   bool offerChanged = (freeOffer != lastFreeOffer);
@@ -221,7 +236,7 @@ void updateDisplay() {
   }
 
   // Draw state-specific content
-  switch (currentState) {
+  switch (shown->state) {
   case IDLE:
     displayIdle();
     break;
@@ -243,8 +258,9 @@ void updateDisplay() {
   drawStatusLine();
 
   // Update cached values
-  lastState = currentState;
-  lastBalance = balance;
+  lastState = shown->state;
+  lastNozzle = shownNozzle;
+  lastBalance = shown->balance;
   lastDispensed100 = dispensed100;
   lastFreeMl = freeMl;
   lastFreeOffer = freeOffer;
@@ -259,8 +275,8 @@ void updateDisplay() {
 // ============================================
 
 void displayIdle() {
-  bool freeOffer = (config.enableFreeWater && !freeWaterUsed &&
-                    millis() >= freeWaterAvailableTime);
+  bool freeOffer = (config.enableFreeWater && !shown->freeWaterUsed &&
+                    millis() >= shown->freeWaterAvailableTime);
 
   if (freeOffer) {
     // Free water available
@@ -282,7 +298,7 @@ void displayActive() {
   // Line 0: Balance
   lcd.setCursor(0, 0);
   char buf[21];
-  snprintf(buf, sizeof(buf), "Balans: %ld so'm", balance);
+  snprintf(buf, sizeof(buf), "Balans: %ld so'm", shown->balance);
   lcd.print(buf);
   // Clear rest of line
   for (int i = strlen(buf); i < LCD_COLS; i++)
@@ -290,7 +306,7 @@ void displayActive() {
 
   // Line 1: Dispensed
   lcd.setCursor(0, 1);
-  snprintf(buf, sizeof(buf), "Quyildi: %.2fL", totalDispensedLiters);
+  snprintf(buf, sizeof(buf), "Quyildi: %.2fL", shown->totalDispensedLiters);
   lcd.print(buf);
   for (int i = strlen(buf); i < LCD_COLS; i++)
     lcd.print(' ');
@@ -305,7 +321,7 @@ void displayPaused() {
   // Line 1: Balance
   lcd.setCursor(0, 1);
   char buf[21];
-  snprintf(buf, sizeof(buf), "Balans: %ld so'm", balance);
+  snprintf(buf, sizeof(buf), "Balans: %ld so'm", shown->balance);
   lcd.print(buf);
   for (int i = strlen(buf); i < LCD_COLS; i++)
     lcd.print(' ');
@@ -329,14 +345,14 @@ void displayDispensing() {
   // Line 1: Dispensed amount
   lcd.setCursor(0, 1);
   char buf[21];
-  snprintf(buf, sizeof(buf), "Quyildi: %.2f L", totalDispensedLiters);
+  snprintf(buf, sizeof(buf), "Quyildi: %.2f L", shown->totalDispensedLiters);
   lcd.print(buf);
   for (int i = strlen(buf); i < LCD_COLS; i++)
     lcd.print(' ');
 
   // Line 2: Balance
   lcd.setCursor(0, 2);
-  snprintf(buf, sizeof(buf), "Balans: %ld so'm", balance);
+  snprintf(buf, sizeof(buf), "Balans: %ld so'm", shown->balance);
   lcd.print(buf);
   for (int i = strlen(buf); i < LCD_COLS; i++)
     lcd.print(' ');
@@ -347,7 +363,7 @@ void displayFreeWater() {
 
   // Line 1: Progress in ml
   float targetMl = config.freeWaterAmount * 1000;
-  float currentMl = freeWaterDispensed * 1000;
+  float currentMl = shown->freeWaterDispensed * 1000;
 
   lcd.setCursor(0, 1);
   char buf[21];
@@ -362,7 +378,7 @@ void displayFreeWater() {
   // Line 2: Progress bar
   int percent = 0;
   if (config.freeWaterAmount > 0) {
-    percent = (int)((freeWaterDispensed / config.freeWaterAmount) * 100);
+    percent = (int)((shown->freeWaterDispensed / config.freeWaterAmount) * 100);
     if (percent < 0)
       percent = 0;
     if (percent > 100)
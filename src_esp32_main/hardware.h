@@ -31,6 +31,40 @@
 #define START_BUTTON_PIN 25 // Start/Resume button (INPUT_PULLUP)
 #define PAUSE_BUTTON_PIN 26 // Pause button (INPUT_PULLUP)
 
+// ============================================
+// NOZZLES (independent outlets)
+// ============================================
+// Each nozzle has its own valve relay, flow meter and START/PAUSE buttons.
+// Nozzle 1 (index 0) uses the pins above; larger kiosks add outlets with
+// -D NOZZLE_COUNT=2 (or 3). The TDS sensor and LCD stay shared. Nozzles are
+// numbered from 1 in pin names, MQTT, serial commands and on the LCD.
+#ifndef NOZZLE_COUNT
+#define NOZZLE_COUNT 1
+#endif
+#define NOZZLE_MAX 3
+
+#define NOZZLE2_RELAY_PIN 19
+#define NOZZLE2_FLOW_PIN 34 // Input only, external pull-up
+#define NOZZLE2_START_PIN 27
+#define NOZZLE2_PAUSE_PIN 14
+
+#define NOZZLE3_RELAY_PIN 23
+#define NOZZLE3_FLOW_PIN 39 // Input only (VN), external pull-up
+#define NOZZLE3_START_PIN 13
+#define NOZZLE3_PAUSE_PIN 4
+
+static_assert(NOZZLE_COUNT >= 1 && NOZZLE_COUNT <= NOZZLE_MAX,
+              "NOZZLE_COUNT must be 1..NOZZLE_MAX");
+
+static const uint8_t NOZZLE_RELAY_PINS[NOZZLE_MAX] = {
+    RELAY_PIN, NOZZLE2_RELAY_PIN, NOZZLE3_RELAY_PIN};
+static const uint8_t NOZZLE_FLOW_PINS[NOZZLE_MAX] = {
+    FLOW_SENSOR_PIN, NOZZLE2_FLOW_PIN, NOZZLE3_FLOW_PIN};
+static const uint8_t NOZZLE_START_PINS[NOZZLE_MAX] = {
+    START_BUTTON_PIN, NOZZLE2_START_PIN, NOZZLE3_START_PIN};
+static const uint8_t NOZZLE_PAUSE_PINS[NOZZLE_MAX] = {
+    PAUSE_BUTTON_PIN, NOZZLE2_PAUSE_PIN, NOZZLE3_PAUSE_PIN};
+
 // ============================================
 // UART (from Payment ESP32)
 // ============================================
@@ -0,0 +1,264 @@
+#include "heap_monitor.h"
+#include "../shared/logger.h"
+#include "config.h"
+#include "config_storage.h"
+#include "mqtt_handler.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// ============================================
+// TASKS WATCHED
+// ============================================
+// Stack headroom of the tasks this firmware runs or leans on. Handles are
+// looked up by name until found (tiT only exists once WiFi has started).
+struct WatchedTask {
+  const char *label;
+  const char *name;
+  TaskHandle_t handle;
+};
+
+static WatchedTask watchedTasks[] = {
+    {"loop", "loopTask", nullptr},
+    {"log_drain", "log_drain", nullptr},
+    {"tcpip", "tiT", nullptr},
+};
+static const uint8_t WATCHED_TASK_COUNT =
+    sizeof(watchedTasks) / sizeof(watchedTasks[0]);
+
+// Lowest free stack the task has had, in bytes (ESP-IDF counts bytes).
+// -1 if the task does not exist.
+static int32_t taskStackFree(WatchedTask &t) {
+  if (!t.handle) {
+    t.handle = xTaskGetHandle(t.name);
+    if (!t.handle) {
+      return -1;
+    }
+  }
+  return (int32_t)uxTaskGetStackHighWaterMark(t.handle);
+}
+
+// ============================================
+// PER-MODULE COUNTERS (debug builds)
+// ============================================
+#if HEAP_TRACK_MODULES
+static TaskHandle_t trackedTask = nullptr; // The loop task
+static volatile uint8_t currentModule = HEAP_MOD_OTHER;
+static HeapModuleStats moduleStats[HEAP_MOD_COUNT];
+
+uint8_t heapEnterModule(uint8_t module) {
+  const uint8_t prev = currentModule;
+  if (xTaskGetCurrentTaskHandle() == trackedTask) {
+    currentModule = module;
+  }
+  return prev;
+}
+
+void heapLeaveModule(uint8_t previous) {
+  if (xTaskGetCurrentTaskHandle() == trackedTask) {
+    currentModule = previous;
+  }
+}
+
+const HeapModuleStats &getHeapModuleStats(uint8_t module) {
+  return moduleStats[module < HEAP_MOD_COUNT ? module : HEAP_MOD_OTHER];
+}
+
+// Only the loop task enters modules, so only it writes the counters
+static inline HeapModuleStats *trackedModule() {
+  if (currentModule == HEAP_MOD_OTHER ||
+      xTaskGetCurrentTaskHandle() != trackedTask) {
+    return nullptr;
+  }
+  return &moduleStats[currentModule];
+}
+
+// Linked with -Wl,--wrap=<fn>: every call to fn lands here first
+extern "C" {
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_calloc(size_t count, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  void *ptr = __real_malloc(size);
+  HeapModuleStats *s = ptr ? trackedModule() : nullptr;
+  if (s) {
+    heapModuleNoteAlloc(*s, size);
+  }
+  return ptr;
+}
+
+void __wrap_free(void *ptr) {
+  HeapModuleStats *s = ptr ? trackedModule() : nullptr;
+  if (s) {
+    heapModuleNoteFree(*s);
+  }
+  __real_free(ptr);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  void *ptr = __real_calloc(count, size);
+  HeapModuleStats *s = ptr ? trackedModule() : nullptr;
+  if (s) {
+    heapModuleNoteAlloc(*s, count * size);
+  }
+  return ptr;
+}
+
+// A resize keeps the block count; only new blocks and frees move `live`
+void *__wrap_realloc(void *ptr, size_t size) {
+  void *out = __real_realloc(ptr, size);
+  HeapModuleStats *s = trackedModule();
+  if (s) {
+    if (!ptr && out) {
+      heapModuleNoteAlloc(*s, size);
+    } else if (ptr && size == 0) {
+      heapModuleNoteFree(*s);
+    } else if (out) {
+      s->bytes += size;
+    }
+  }
+  return out;
+}
+}
+#endif
+
+// ============================================
+// SAMPLING AND TREND
+// ============================================
+static HeapTrend trend;
+static unsigned long lastSampleMs = 0;
+static unsigned long intervalStartMs = 0;
+static bool leakFlagged = false;
+static bool fragFlagged = false;
+static bool stackFlagged = false;
+
+void initHeapMonitor() {
+  heapTrendReset(trend);
+  intervalStartMs = millis();
+#if HEAP_TRACK_MODULES
+  trackedTask = xTaskGetCurrentTaskHandle();
+#endif
+}
+
+HeapSnapshot getHeapSnapshot() {
+  HeapSnapshot s;
+  s.freeBytes = ESP.getFreeHeap();
+  s.largestBlock = ESP.getMaxAllocHeap();
+  s.minEverFree = ESP.getMinFreeHeap();
+  s.fragPct = heapFragmentationPct(s.freeBytes, s.largestBlock);
+  return s;
+}
+
+bool isHeapLeakSuspected() { return leakFlagged; }
+
+// Logged and raised as an ALERT once per episode
+static void checkHeapAlarms(const HeapSnapshot &snap, int32_t slope) {
+  const bool leak = heapLeakSuspected(trend);
+  if (leak && !leakFlagged) {
+    char msg[80];
+    snprintf(msg, sizeof(msg), "Heap leak suspected: %ld B/h, %lu B free",
+             (long)slope, (unsigned long)snap.freeBytes);
+    LOG_WARN("%s", msg);
+    publishLog("ALERT", msg);
+  }
+  leakFlagged = leak;
+
+  const bool frag = heapFragmented(snap.freeBytes, snap.largestBlock);
+  if (frag && !fragFlagged) {
+    char msg[80];
+    snprintf(msg, sizeof(msg), "Heap fragmented: %u%%, largest block %lu B",
+             (unsigned)snap.fragPct, (unsigned long)snap.largestBlock);
+    LOG_WARN("%s", msg);
+    publishLog("ALERT", msg);
+  }
+  fragFlagged = frag;
+
+  bool stackLow = false;
+  for (uint8_t i = 0; i < WATCHED_TASK_COUNT; i++) {
+    const int32_t stackFree = taskStackFree(watchedTasks[i]);
+    if (stackFree >= 0 && stackFree < HEAP_STACK_WARN_BYTES) {
+      if (!stackFlagged) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "Task %s stack low: %ld B free",
+                 watchedTasks[i].label, (long)stackFree);
+        LOG_WARN("%s", msg);
+        publishLog("ALERT", msg);
+      }
+      stackLow = true;
+    }
+  }
+  stackFlagged = stackLow;
+}
+
+static void publishHeapReport(const HeapSnapshot &snap, int32_t slope) {
+  if (!mqttClient.connected()) {
+    return; // The trend keeps going; the next interval reports it
+  }
+  HeapScope heapScope(HEAP_MOD_REPORT);
+
+  JsonDocument doc;
+  doc["type"] = "heap";
+  doc["device_id"] = deviceConfig.device_id;
+  doc["uptime"] = millis() / 1000;
+  doc["free"] = snap.freeBytes;
+  doc["largest_block"] = snap.largestBlock;
+  doc["min_free"] = snap.minEverFree;
+  doc["frag_pct"] = snap.fragPct;
+
+  JsonObject t = doc["trend"].to<JsonObject>();
+  t["interval_s"] = HEAP_TREND_INTERVAL_MS / 1000;
+  JsonArray low = t["low"].to<JsonArray>();
+  for (uint8_t i = 0; i < trend.count; i++) {
+    low.add(heapTrendPoint(trend, i));
+  }
+  t["slope_per_h"] = slope;
+  t["leak_suspected"] = leakFlagged;
+
+  JsonObject stack = doc["stack_free"].to<JsonObject>();
+  for (uint8_t i = 0; i < WATCHED_TASK_COUNT; i++) {
+    const int32_t stackFree = taskStackFree(watchedTasks[i]);
+    if (stackFree >= 0) {
+      stack[watchedTasks[i].label] = stackFree;
+    }
+  }
+
+#if HEAP_TRACK_MODULES
+  JsonObject modules = doc["modules"].to<JsonObject>();
+  for (uint8_t m = HEAP_MOD_OTHER + 1; m < HEAP_MOD_COUNT; m++) {
+    const HeapModuleStats &s = moduleStats[m];
+    JsonObject o = modules[heapModuleName(m)].to<JsonObject>();
+    o["allocs"] = s.allocs;
+    o["frees"] = s.frees;
+    o["live"] = heapModuleLive(s);
+    o["peak_live"] = s.peakLive;
+    o["bytes"] = s.bytes;
+  }
+#endif
+
+  String output;
+  serializeJson(doc, output);
+  mqttClient.publish(TOPIC_TELEMETRY, output.c_str());
+}
+
+void processHeapMonitor() {
+  const unsigned long now = millis();
+  if (now - lastSampleMs < HEAP_SAMPLE_MS) {
+    return;
+  }
+  lastSampleMs = now;
+
+  const HeapSnapshot snap = getHeapSnapshot();
+  heapTrendSample(trend, snap.freeBytes);
+  if (now - intervalStartMs < HEAP_TREND_INTERVAL_MS) {
+    return;
+  }
+  intervalStartMs = now;
+  heapTrendCloseInterval(trend);
+
+  const int32_t slope = heapTrendSlopePerHour(trend);
+  checkHeapAlarms(snap, slope);
+  publishHeapReport(snap, slope);
+}
@@ -0,0 +1,208 @@
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+#include <stdint.h>
+#include <string.h>
+
+// ============================================
+// HEAP HEALTH MONITOR
+// ============================================
+// Free heap alone hides fragmentation: the total can look fine while no
+// single block is large enough for a TLS handshake or an OTA buffer. Once a
+// second the loop samples the free heap and the largest free block. The
+// lowest free heap of each HEAP_TREND_INTERVAL_MS goes into a one-hour ring,
+// and the slope of that ring flags a leak long before the watchdog does.
+// Every interval a "heap" report goes out on TOPIC_TELEMETRY, together with
+// the stack headroom of each task.
+//
+// Debug builds can count allocations per module as well. Build with
+// HEAP_TRACK_MODULES=1 and link with --wrap=malloc/free/realloc/calloc (the
+// esp32_main_heapdebug env does both).
+// Allocations made in the loop task inside a HeapScope are charged to the
+// scope's module.
+
+#ifndef HEAP_TRACK_MODULES
+#define HEAP_TRACK_MODULES 0
+#endif
+
+#define HEAP_SAMPLE_MS 1000
+#define HEAP_TREND_INTERVAL_MS 300000UL // One trend point per 5 min
+#define HEAP_TREND_POINTS 12            // One hour of points
+#define HEAP_TREND_MIN_POINTS 6         // Before a slope is reported
+#define HEAP_LEAK_BYTES_PER_HOUR 2048   // Sustained loss that flags a leak
+#define HEAP_FRAG_WARN_PCT 60           // Free heap split this badly...
+#define HEAP_FRAG_WARN_BLOCK 16384      // ...with no block this large
+#define HEAP_STACK_WARN_BYTES 512       // Task stack headroom warning
+
+enum HeapModule : uint8_t {
+  HEAP_MOD_OTHER, // Outside any HeapScope (not counted)
+  HEAP_MOD_MQTT,
+  HEAP_MOD_SERIAL,
+  HEAP_MOD_OTA,
+  HEAP_MOD_REPORT, // Heartbeat and telemetry publishers
+  HEAP_MOD_COUNT
+};
+
+// Counted by call, not by block: a block allocated in one module and freed
+// in another moves `live` in both. A `live` that keeps rising is the leak.
+struct HeapModuleStats {
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t bytes;   // Requested in total
+  int32_t peakLive; // Most allocs - frees seen
+};
+
+struct HeapTrend {
+  uint32_t low[HEAP_TREND_POINTS]; // Lowest free heap per interval
+  uint8_t count;
+  uint8_t head; // Next slot to write
+  uint32_t intervalLow;
+};
+
+// Share of the free heap that is not in the largest block (0-100)
+inline uint8_t heapFragmentationPct(uint32_t freeBytes, uint32_t largest) {
+  if (freeBytes == 0 || largest >= freeBytes) {
+    return 0;
+  }
+  return (uint8_t)(100 - (uint64_t)largest * 100 / freeBytes);
+}
+
+inline bool heapFragmented(uint32_t freeBytes, uint32_t largest) {
+  return heapFragmentationPct(freeBytes, largest) >= HEAP_FRAG_WARN_PCT &&
+         largest < HEAP_FRAG_WARN_BLOCK;
+}
+
+inline void heapTrendReset(HeapTrend &t) {
+  memset(&t, 0, sizeof(t));
+  t.intervalLow = UINT32_MAX;
+}
+
+inline void heapTrendSample(HeapTrend &t, uint32_t freeBytes) {
+  if (freeBytes < t.intervalLow) {
+    t.intervalLow = freeBytes;
+  }
+}
+
+// Ends the interval: its low becomes the newest trend point
+inline void heapTrendCloseInterval(HeapTrend &t) {
+  if (t.intervalLow == UINT32_MAX) {
+    return; // No samples
+  }
+  t.low[t.head] = t.intervalLow;
+  t.head = (uint8_t)((t.head + 1) % HEAP_TREND_POINTS);
+  if (t.count < HEAP_TREND_POINTS) {
+    t.count++;
+  }
+  t.intervalLow = UINT32_MAX;
+}
+
+// Trend point `i`, oldest first
+inline uint32_t heapTrendPoint(const HeapTrend &t, uint8_t i) {
+  const uint8_t oldest =
+      (uint8_t)((t.head + HEAP_TREND_POINTS - t.count) % HEAP_TREND_POINTS);
+  return t.low[(oldest + i) % HEAP_TREND_POINTS];
+}
+
+// Least-squares slope of the trend in bytes per hour (negative: shrinking).
+// 0 until HEAP_TREND_MIN_POINTS points are in.
+inline int32_t heapTrendSlopePerHour(const HeapTrend &t) {
+  if (t.count < HEAP_TREND_MIN_POINTS) {
+    return 0;
+  }
+  const float n = t.count;
+  const float meanX = (n - 1) / 2.0f;
+  float meanY = 0;
+  for (uint8_t i = 0; i < t.count; i++) {
+    meanY += heapTrendPoint(t, i);
+  }
+  meanY /= n;
+  float sxy = 0;
+  float sxx = 0;
+  for (uint8_t i = 0; i < t.count; i++) {
+    const float dx = i - meanX;
+    sxy += dx * ((float)heapTrendPoint(t, i) - meanY);
+    sxx += dx * dx;
+  }
+  const float perInterval = sxy / sxx;
+  return (int32_t)(perInterval * (3600000.0f / HEAP_TREND_INTERVAL_MS));
+}
+
+// Needs the full hour, a steady loss, and a newest low below the oldest
+// (a single dip that has recovered is not a leak)
+inline bool heapLeakSuspected(const HeapTrend &t) {
+  return t.count == HEAP_TREND_POINTS &&
+         heapTrendSlopePerHour(t) <= -HEAP_LEAK_BYTES_PER_HOUR &&
+         heapTrendPoint(t, t.count - 1) < heapTrendPoint(t, 0);
+}
+
+inline int32_t heapModuleLive(const HeapModuleStats &s) {
+  return (int32_t)(s.allocs - s.frees);
+}
+
+inline void heapModuleNoteAlloc(HeapModuleStats &s, uint32_t bytes) {
+  s.allocs++;
+  s.bytes += bytes;
+  if (heapModuleLive(s) > s.peakLive) {
+    s.peakLive = heapModuleLive(s);
+  }
+}
+
+inline void heapModuleNoteFree(HeapModuleStats &s) { s.frees++; }
+
+inline const char *heapModuleName(uint8_t module) {
+  switch (module) {
+  case HEAP_MOD_OTHER:
+    return "other";
+  case HEAP_MOD_MQTT:
+    return "mqtt";
+  case HEAP_MOD_SERIAL:
+    return "serial";
+  case HEAP_MOD_OTA:
+    return "ota";
+  case HEAP_MOD_REPORT:
+    return "report";
+  default:
+    return "?";
+  }
+}
+
+// Charges loop-task allocations to `module` until the scope ends
+#if HEAP_TRACK_MODULES
+uint8_t heapEnterModule(uint8_t module); // Returns the previous module
+void heapLeaveModule(uint8_t previous);
+
+class HeapScope {
+public:
+  explicit HeapScope(HeapModule module) : prev(heapEnterModule(module)) {}
+  ~HeapScope() { heapLeaveModule(prev); }
+
+private:
+  uint8_t prev;
+};
+#else
+class HeapScope {
+public:
+  explicit HeapScope(HeapModule) {}
+};
+#endif
+
+// ============================================
+// FUNCTIONS
+// ============================================
+struct HeapSnapshot {
+  uint32_t freeBytes;
+  uint32_t largestBlock;
+  uint32_t minEverFree;
+  uint8_t fragPct;
+};
+
+void initHeapMonitor(); // In setup(), from the loop task
+// Samples once a second; publishes the "heap" telemetry each interval
+void processHeapMonitor();
+HeapSnapshot getHeapSnapshot();
+bool isHeapLeakSuspected();
+#if HEAP_TRACK_MODULES
+const HeapModuleStats &getHeapModuleStats(uint8_t module);
+#endif
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// ============================================
+// FIXED JSON ARENA
+// ============================================
+// Bump allocator over a caller-owned buffer, for the JsonDocuments built
+// while one MQTT message is handled. Memory comes back when the arena is
+// rewound (JsonArenaScope). Only the newest block can grow, shrink or be
+// freed in place, which is how ArduinoJson uses memory: it grows a string
+// while parsing it and trims the last pool when it is done. A request that
+// does not fit fails, and ArduinoJson reports NoMemory, instead of falling
+// back to the heap.
+#define JSON_ARENA_ALIGN 8
+
+class JsonArena {
+public:
+  JsonArena(uint8_t *buffer, size_t size)
+      : buf(buffer), cap(size & ~(size_t)(JSON_ARENA_ALIGN - 1)) {}
+
+  void *allocate(size_t size) {
+    const size_t need = HEADER + alignUp(size);
+    if (need < size || need > cap - top) {
+      failed++;
+      return nullptr;
+    }
+    Header *h = reinterpret_cast<Header *>(buf + top);
+    h->size = (uint32_t)size;
+    h->prev = (uint32_t)last;
+    last = top;
+    top += need;
+    notePeak();
+    return buf + last + HEADER;
+  }
+
+  void deallocate(void *ptr) {
+    if (!ptr || !isLast(ptr)) {
+      return; // Given back by the next rewind
+    }
+    top = last;
+    last = headerAt(last)->prev;
+  }
+
+  void *reallocate(void *ptr, size_t size) {
+    if (!ptr) {
+      return allocate(size);
+    }
+    if (isLast(ptr)) {
+      const size_t end = last + HEADER + alignUp(size);
+      if (end < size || end > cap) {
+        failed++;
+        return nullptr;
+      }
+      headerAt(last)->size = (uint32_t)size;
+      top = end;
+      notePeak();
+      return ptr;
+    }
+    const size_t oldSize =
+        reinterpret_cast<Header *>(static_cast<uint8_t *>(ptr) - HEADER)->size;
+    void *moved = allocate(size);
+    if (moved) {
+      memcpy(moved, ptr, oldSize < size ? oldSize : size);
+    }
+    return moved;
+  }
+
+  size_t mark() const { return top; }
+
+  // Frees every block allocated after `m` was taken
+  void rewind(size_t m) {
+    if (m < top) {
+      top = m;
+      last = NO_BLOCK; // Blocks below the mark are never resized in place
+    }
+  }
+
+  // Peak use since the last call, then starts a new measurement
+  size_t takePeak() {
+    const size_t p = peak;
+    peak = top;
+    return p;
+  }
+
+  size_t used() const { return top; }
+  size_t capacity() const { return cap; }
+  size_t highWater() const { return highest; }
+  uint32_t failures() const { return failed; }
+
+private:
+  struct Header {
+    uint32_t size; // Requested bytes
+    uint32_t prev; // Offset of the block before, for freeing in place
+  };
+  static const size_t HEADER = JSON_ARENA_ALIGN;
+  static const size_t NO_BLOCK = (size_t)-1;
+  static_assert(sizeof(Header) <= JSON_ARENA_ALIGN, "Header must fit");
+
+  static size_t alignUp(size_t n) {
+    return (n + JSON_ARENA_ALIGN - 1) & ~(size_t)(JSON_ARENA_ALIGN - 1);
+  }
+  Header *headerAt(size_t offset) {
+    return reinterpret_cast<Header *>(buf + offset);
+  }
+  bool isLast(const void *ptr) const {
+    return last != NO_BLOCK && ptr == buf + last + HEADER;
+  }
+  void notePeak() {
+    if (top > peak) {
+      peak = top;
+    }
+    if (top > highest) {
+      highest = top;
+    }
+  }
+
+  uint8_t *buf;
+  size_t cap;
+  size_t top = 0;
+  size_t last = NO_BLOCK;
+  size_t peak = 0;
+  size_t highest = 0;
+  uint32_t failed = 0;
+};
+
+// Rewinds the arena to where it was when the scope was entered. Declare it
+// before the JsonDocuments it covers so they are destroyed first.
+class JsonArenaScope {
+public:
+  explicit JsonArenaScope(JsonArena &a) : arena(a), start(a.mark()) {}
+  ~JsonArenaScope() { arena.rewind(start); }
+  JsonArenaScope(const JsonArenaScope &) = delete;
+  JsonArenaScope &operator=(const JsonArenaScope &) = delete;
+
+private:
+  JsonArena &arena;
+  size_t start;
+};
+
+// ArduinoJson allocator on a JsonArena: JsonDocument doc(&allocator)
+class JsonArenaAllocator : public ArduinoJson::Allocator {
+public:
+  explicit JsonArenaAllocator(JsonArena &a) : arena(a) {}
+  void *allocate(size_t size) override { return arena.allocate(size); }
+  void deallocate(void *ptr) override { arena.deallocate(ptr); }
+  void *reallocate(void *ptr, size_t size) override {
+    return arena.reallocate(ptr, size);
+  }
+
+private:
+  JsonArena &arena;
+};
+
+#endif
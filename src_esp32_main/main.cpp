@@ -20,18 +20,24 @@
  * Version: 2.4.0 - Dual ESP32 Architecture
  */
 
+#include "../shared/logger.h"
+#include "boot_timing.h"
 #include "config.h"
 #include "config_storage.h"
 #include "debug.h"
 #include "diagnostics.h"
 #include "display.h"
 #include "hardware.h"
+#include "heap_monitor.h"
 #include "mqtt_handler.h"
 #include "ota_handler.h" // OTA firmware updates
+#include "power_save.h"
 #include "relay_control.h"
 #include "sensors.h"
 #include "serial_config.h"
+#include "session_ledger.h"
 #include "state_machine.h"
+#include "telemetry.h"
 #include "uart_receiver.h" // Replaces payment.h - receives from Payment ESP32
 #include <ArduinoJson.h>   // Required for heartbeat
 #include <WiFi.h>          // For heartbeat WiFi.localIP() and WiFi.RSSI()
@@ -45,20 +51,65 @@
 unsigned long lastDisplayUpdate = 0;
 unsigned long lastTdsCheck = 0;
 unsigned long lastHeartbeat = 0;
-// Globals from state_machine.cpp
-extern unsigned long lastSessionActivity;
-extern unsigned long freeWaterAvailableTime;
-extern bool freeWaterUsed;
 
 // Constants
 const int WATCHDOG_TIMEOUT_SECONDS = 30;
 
+// ============================================
+// DEFERRED NETWORK BRING-UP
+// ============================================
+// setup() stops once the machine can vend and take cash (see boot_timing.h).
+// WiFi, OTA and MQTT are started here from loop(), one step per pass, so no
+// step holds up the payment path. The first broker connect waits a
+// per-device jitter: after a district-wide power cut every unit comes back
+// at once.
+enum NetBootStage : uint8_t {
+  NET_BOOT_START,     // Start the WiFi connect
+  NET_BOOT_WIFI,      // Waiting for association
+  NET_BOOT_MQTT_WAIT, // Waiting out the connect jitter
+  NET_BOOT_DONE       // Normal reconnect handling in loop()
+};
+static NetBootStage netBootStage = NET_BOOT_START;
+static unsigned long mqttStartAtMs = 0;
+
+static void processNetworkBoot() {
+  switch (netBootStage) {
+  case NET_BOOT_START:
+    setupWiFi();
+    netBootStage = NET_BOOT_WIFI;
+    break;
+  case NET_BOOT_WIFI:
+    if (WiFi.status() == WL_CONNECTED) {
+      bootPhaseDone(BOOT_PHASE_WIFI);
+      setupOTA(); // Needs the interface up
+      startTimeSync();
+      mqttStartAtMs = millis() + bootMqttJitterMs(deviceConfig.device_id);
+      netBootStage = NET_BOOT_MQTT_WAIT;
+    }
+    break;
+  case NET_BOOT_MQTT_WAIT:
+    if ((long)(millis() - mqttStartAtMs) >= 0) {
+      setupMQTT();
+      netBootStage = NET_BOOT_DONE;
+    }
+    break;
+  case NET_BOOT_DONE:
+    break;
+  }
+}
+
 // ============================================
 // SETUP
 // ============================================
 void setup() {
+  Serial.setRxBufferSize(2048); // Room for a CFG_FRAME or SET_* burst
   Serial.begin(115200);
-  delay(100); // Wait for serial
+  bootTimingBegin();
+
+  // Deferred logger: hot paths enqueue, a low-priority task prints
+  logInit();
+  logStartDrainTask();
+  initHeapMonitor();
 
   DEBUG_PRINTLN("\n\n=== VENDING MACHINE STARTING ===");
 
@@ -70,16 +121,20 @@ void setup() {
   esp_task_wdt_add(NULL); // Add current task to watchdog
   DEBUG_PRINTLN("✓ Watchdog enabled - system will auto-recover from freezes");
 
-  // GPIO Setup
-  pinMode(RELAY_PIN, OUTPUT);
-  pinMode(START_BUTTON_PIN, INPUT_PULLUP);
-  pinMode(PAUSE_BUTTON_PIN, INPUT_PULLUP);
-
-  setRelay(false);
-
-  // Initialize modules
-  initDisplay();
+  // ============================================
+  // PHASE 1: SAFETY-CRITICAL IO
+  // ============================================
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    pinMode(NOZZLE_RELAY_PINS[i], OUTPUT);
+    pinMode(NOZZLE_START_PINS[i], INPUT_PULLUP);
+    pinMode(NOZZLE_PAUSE_PINS[i], INPUT_PULLUP);
+    setNozzleRelay(i, false);
+  }
+  bootPhaseDone(BOOT_PHASE_IO);
 
+  // ============================================
+  // PHASE 2: CONFIG
+  // ============================================
   // Load config from EEPROM FIRST
   initConfigStorage();
 
@@ -95,30 +150,37 @@ void setup() {
 
   // Now initialize with loaded config
   initConfig();
-  // Ensure relay is OFF (ACTIVE_HIGH hardware policy)
-  setRelay(false);
+  // Ensure relays are OFF (ACTIVE_HIGH hardware policy)
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    setNozzleRelay(i, false);
+  }
   DEBUG_PRINT("Relay boot check (OFF) pin level: ");
   DEBUG_PRINTLN(digitalRead(RELAY_PIN) == HIGH ? "HIGH" : "LOW");
+  bootPhaseDone(BOOT_PHASE_CONFIG);
+
+  // ============================================
+  // PHASE 3: PAYMENT PATH (cash accepted from here on)
+  // ============================================
   initSensors();
   initStateMachine();
+  initSessionLedger(); // Flash ring of per-session records
   initUartReceiver(); // UART from Payment ESP32 (replaces initPayment)
+  bootPhaseDone(BOOT_PHASE_PAYMENT);
 
-  // WiFi / MQTT (only if configured)
-  if (configured) {
-    setupWiFi();
-    setupMQTT();
-    setupOTA(); // OTA firmware updates
-  }
+  // ============================================
+  // PHASE 4: DISPLAY
+  // ============================================
+  initDisplay();
+  initPowerSave();
+  initDiagnostics();
+  initTelemetry();
+  bootPhaseDone(BOOT_PHASE_DISPLAY);
 
+  // WiFi / OTA / MQTT follow from loop() (processNetworkBoot); the boot
+  // report and "Device started" log go out once the broker is reached.
   DEBUG_PRINTLN("=== SYSTEM READY ===\n");
   DEBUG_PRINT("Firmware Version: ");
   DEBUG_PRINTLN(FIRMWARE_VERSION);
-
-  if (configured) {
-    char msg[64];
-    snprintf(msg, sizeof(msg), "Device started %s", FIRMWARE_VERSION);
-    publishLog("SYSTEM", msg);
-  }
 }
 
 // ============================================
@@ -127,24 +189,32 @@ void setup() {
 void loop() {
   // Reset watchdog timer - "I'm alive!"
   esp_task_wdt_reset();
+  telemetryLoopTick();
 
   unsigned long now = millis();
 
+  // Config updates published during the last pass take effect here, whole
+  if (refreshRuntimeConfig()) {
+    applyConfigStateEffects();
+  }
+
   // WiFi connection state machine
   if (isConfigured()) {
+    processNetworkBoot();
     processWiFi();
 
-    // MQTT Connection - only if WiFi is connected
-    if (WiFi.status() == WL_CONNECTED) {
+    // MQTT Connection - only if WiFi is connected (and set up)
+    if (netBootStage == NET_BOOT_DONE && WiFi.status() == WL_CONNECTED) {
       if (!mqttClient.connected()) {
         // CRITICAL FIX: Only attempt reconnection if IDLE to prevent blocking
-        // during dispensing
-        if (currentState == IDLE) {
+        // during dispensing (on any nozzle)
+        if (areAllNozzlesIdle()) {
           reconnectMQTT();
         }
       } else {
         // Only process MQTT loop if connected
         mqttClient.loop();
+        processBootReport();
       }
     }
   }
@@ -163,8 +233,9 @@ void loop() {
   // Payments now come via UART from Payment ESP32
   processUartReceiver();
 
-  // Task 2: Display Update
-  if (now - lastDisplayUpdate >= config.displayUpdateInterval) {
+  // Task 2: Display Update (not redrawn while the backlight is off)
+  if (!isPowerSaveNight() &&
+      now - lastDisplayUpdate >= config.displayUpdateInterval) {
     lastDisplayUpdate = now;
     updateDisplay();
   }
@@ -173,6 +244,8 @@ void loop() {
   if (now - lastTdsCheck >= config.tdsCheckInterval) {
     lastTdsCheck = now;
     tdsPPM = readTDS();
+    diagRecordTds(tdsPPM);
+    telemetryRecordTds(tdsPPM);
     publishTDS();
   }
 
@@ -181,24 +254,21 @@ void loop() {
   // Applies to all non-IDLE states:
   //   ACTIVE/PAUSED: timeout if user doesn't press START
   //   DISPENSING/FREE_WATER: timeout if flow sensor stops (safety)
-  if (currentState != IDLE) {
-    if (millis() - lastSessionActivity >= config.sessionTimeout) {
-      handleSessionTimeout();
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    if (nozzles[i].state != IDLE &&
+        millis() - nozzles[i].lastSessionActivity >= config.sessionTimeout) {
+      handleSessionTimeout(i);
     }
   }
 
   // Task 5: Free Water Timer
-  if (config.enableFreeWater && currentState == IDLE && !freeWaterUsed) {
-    if (now >= freeWaterAvailableTime) {
-      // Display will show free water offer
-      // Logic handled in updateDisplay usually
-    }
-  }
+  // Free water offer is shown by updateDisplay() per focus nozzle
 
   // Task 6: Heartbeat
   if (now - lastHeartbeat >= config.heartbeatInterval) {
     lastHeartbeat = now;
-    publishStatus();
+    requestStatusPublish();
+    HeapScope heapScope(HEAP_MOD_REPORT);
 
     // MEDIUM FIX: Heartbeat with all required fields per MQTT_API.md
     JsonDocument hb;
@@ -208,47 +278,127 @@ void loop() {
     hb["rssi"] = WiFi.RSSI();
     hb["ssid"] = WiFi.SSID(); // LOW FIX: Added ssid for UI
     hb["firmware_version"] = FIRMWARE_VERSION;
-    hb["free_heap"] = ESP.getFreeHeap();
+    const HeapSnapshot heap = getHeapSnapshot();
+    hb["free_heap"] = heap.freeBytes;
+    hb["largest_block"] = heap.largestBlock;
+    hb["min_free_heap"] = heap.minEverFree;
+    hb["heap_frag"] = heap.fragPct;
+
+    // WiFi (re)connect timing: fast = cached BSSID/channel, no scan
+    const WiFiConnectStats &ws = getWiFiConnectStats();
+    JsonObject wifi = hb["wifi"].to<JsonObject>();
+    wifi["connect_ms"] = ws.lastMs;
+    wifi["max_connect_ms"] = ws.maxMs;
+    wifi["mode"] = wifiModeName(ws.lastMode);
+    wifi["connects"] = ws.connects;
+    wifi["fast_ok"] = ws.fastOk;
+    wifi["fast_failed"] = ws.fastFailed;
+
+    // Night power save: time per mode and average draw
+    const PowerStats &ps = getPowerStats();
+    JsonObject power = hb["power"].to<JsonObject>();
+    power["mode"] = powerModeName(isPowerSaveNight() ? POWER_MODE_NIGHT
+                                                     : POWER_MODE_DAY);
+    power["time_synced"] = isTimeSynced();
+    power["day_s"] = ps.modeMs[POWER_MODE_DAY] / 1000;
+    power["night_s"] = ps.modeMs[POWER_MODE_NIGHT] / 1000;
+    power["night_entries"] = ps.nightEntries;
+    power["wakes"] = ps.wakes;
+    power["day_ma"] = powerModeMa(ps, POWER_MODE_DAY);
+    power["night_ma"] = powerModeMa(ps, POWER_MODE_NIGHT);
+    power["avg_ma"] = powerAverageMa(ps);
+    power["measured"] = ps.samples[POWER_MODE_DAY] > 0;
+
+    // Inter-ESP UART link quality (this side, and as reported by Payment)
+    const UartLinkStats &link = getUartLinkStats();
+    JsonObject uart = hb["uart"].to<JsonObject>();
+    uart["baud"] = link.baud;
+    uart["good"] = link.goodFrames;
+    uart["bad"] = link.badFrames;
+    uart["hw_errors"] = link.hwErrors;
+    uart["trainings"] = link.trainings;
+    uart["train_failures"] = link.trainFailures;
+    uart["fallbacks"] = link.fallbacks;
+    uart["bit_errors"] = link.lastBitErrors;
+    const UartLinkStats &peer = getPeerUartLinkStats();
+    uart["peer_good"] = peer.goodFrames;
+    uart["peer_bad"] = peer.badFrames;
+    uart["peer_hw_errors"] = peer.hwErrors;
+
+    // Inbound MQTT JSON arena: sizing margin per message kind
+    const MqttArenaStats arena = getMqttArenaStats();
+    JsonObject mqttJson = hb["mqtt_json"].to<JsonObject>();
+    mqttJson["arena"] = arena.capacity;
+    mqttJson["high_water"] = arena.highWater;
+    mqttJson["overflows"] = arena.overflows;
+    JsonObject peaks = mqttJson["peak"].to<JsonObject>();
+    for (uint8_t k = 0; k < MQTT_MSG_KIND_COUNT; k++) {
+      peaks[mqttMessageKindName(k)] = arena.peak[k];
+    }
     String hbStr;
     serializeJson(hb, hbStr);
     publishMQTT(TOPIC_HEARTBEAT, hbStr.c_str());
   }
 
-  // Task 7: Button Handling (debounced)
-  static unsigned long lastStartPress = 0;
-  static unsigned long lastPausePress = 0;
+  // Task 7: Button Handling (debounced, per nozzle)
+  static unsigned long lastStartPress[NOZZLE_COUNT] = {};
+  static unsigned long lastPausePress[NOZZLE_COUNT] = {};
   const unsigned long DEBOUNCE = 200;
 
-  if (digitalRead(START_BUTTON_PIN) == LOW &&
-      (now - lastStartPress >= DEBOUNCE)) {
-    lastStartPress = now;
-    Serial.print("▶️ START pressed! State=");
-    Serial.println(currentState);
-    handleStartButton();
-  }
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    if (digitalRead(NOZZLE_START_PINS[i]) == LOW &&
+        (now - lastStartPress[i] >= DEBOUNCE)) {
+      lastStartPress[i] = now;
+      LOG_DEBUG("START pressed, nozzle=%u state=%d", (unsigned)i,
+                (int)nozzles[i].state);
+      powerNoteActivity();
+      handleStartButton(i);
+    }
 
-  if (digitalRead(PAUSE_BUTTON_PIN) == LOW &&
-      (now - lastPausePress >= DEBOUNCE)) {
-    lastPausePress = now;
-    Serial.print("⏸️ PAUSE pressed! State=");
-    Serial.println(currentState);
-    handlePauseButton();
+    if (digitalRead(NOZZLE_PAUSE_PINS[i]) == LOW &&
+        (now - lastPausePress[i] >= DEBOUNCE)) {
+      lastPausePress[i] = now;
+      LOG_DEBUG("PAUSE pressed, nozzle=%u state=%d", (unsigned)i,
+                (int)nozzles[i].state);
+      powerNoteActivity();
+      handlePauseButton(i);
+    }
   }
 
+  // Night power save: mode check (wakes at once on a button or credit)
+  processPowerSave();
+
+  // Component health scores, published on change
+  processDiagnostics();
+
+  // Heap and stack trends on TOPIC_TELEMETRY
+  processHeapMonitor();
+
+  // 1 Hz telemetry aggregate (MessagePack) and threshold alerts
+  processTelemetry();
+
   // Task 8: Flow Sensor Processing
-  if (currentState == DISPENSING || currentState == FREE_WATER) {
-    processFlowSensor();
-    // HIGH FIX: lastSessionActivity is now updated ONLY when actual flow
-    // detected (inside processFlowSensor when litersDiff >= 0.01) This ensures
-    // valve closes if flow sensor fails (no fake activity)
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    if (nozzles[i].state == DISPENSING || nozzles[i].state == FREE_WATER) {
+      processFlowSensor(i);
+      // HIGH FIX: lastSessionActivity is now updated ONLY when actual flow
+      // detected (inside processFlowSensor when litersDiff >= 0.01) This
+      // ensures valve closes if flow sensor fails (no fake activity)
+    }
   }
 
-  // Task 9: Serial Configuration
+  // Task 9: Session ledger batch upload (waits for backend ACK)
+  processSessionLedger();
+
+  // Task 10: Serial Configuration
   handleSerialConfig();
 
   // Deferred config save (debounced)
   processConfigSave();
 
+  // Leftover state events, then one coalesced status publish
+  processStateMachine();
+
   // Tasks Removed: PowerManager, Analytics, SystemHealth
 
   delay(1); // Yield to keep watchdog happy without blocking too long
@@ -1,16 +1,23 @@
 #include "mqtt_handler.h"
+#include "../shared/logger.h"
 #include "config.h"
 #include "config_storage.h"
+#include "config_schema.h"
 #include "display.h"
+#include "heap_monitor.h"
+#include "json_arena.h"
 #include "ota_handler.h"
 #include "relay_control.h"
 #include "sensors.h"
+#include "session_ledger.h"
 #include "state_machine.h"
+#include "uart_receiver.h"
 #include <ArduinoJson.h>
 #include <WiFi.h>
 #include <cstring>
 #include <esp_task_wdt.h>
 #include <mbedtls/md.h>
+#include <strings.h>
 
 // ============================================
 // MQTT CLIENT
@@ -26,23 +33,134 @@ static DeviceConfig prevNetworkConfig;
 static const unsigned long networkApplyTimeoutMs = 30000;
 
 static const int RECENT_TXN_CACHE = 8;
-static String recentTxnIds[RECENT_TXN_CACHE];
+static uint64_t recentTxnHashes[RECENT_TXN_CACHE];
 static int recentTxnIndex = 0;
 
+// ============================================
+// MESSAGE MEMORY
+// ============================================
+// Every JsonDocument built while a message is handled lives in mqttArena
+// and is dropped when mqttCallback returns. Filters keep only the fields a
+// handler reads (the signed ones and their aliases), so large or padded
+// messages cannot grow the parsed document.
+alignas(JSON_ARENA_ALIGN) static uint8_t mqttArenaBuf[MQTT_JSON_ARENA_SIZE];
+static JsonArena mqttArena(mqttArenaBuf, sizeof(mqttArenaBuf));
+static JsonArenaAllocator mqttJsonAllocator(mqttArena);
+static uint32_t mqttArenaPeak[MQTT_MSG_KIND_COUNT];
+
+// Canonical form of the message being verified
+static char canonicalBuf[MQTT_BUFFER_SIZE];
+
+// Unsigned snake_case aliases handleConfigUpdate also accepts
+static const char *const CONFIG_ALIAS_KEYS[] = {
+    "wifi_ssid",       "wifi_password",       "mqtt_broker",
+    "mqtt_port",       "mqtt_username",       "mqtt_password",
+    "device_id",       "price_per_liter",     "session_timeout",
+    "free_water_amount", "free_water_cooldown", "pulses_per_liter",
+    "tds_threshold"};
+
+static JsonDocument mqttFilters[MQTT_MSG_KIND_COUNT];
+
+static void addFilterKeys(JsonDocument &filter, const char *const *keys,
+                          size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    filter[keys[i]] = true;
+  }
+}
+
+#define ADD_FILTER_KEYS(filter, keys)                                          \
+  addFilterKeys(filter, keys, sizeof(keys) / sizeof(keys[0]))
+
+// Built once on the heap, at setup (or the first message in tests)
+static void buildMqttFilters() {
+  static bool built = false;
+  if (built) {
+    return;
+  }
+  built = true;
+  ADD_FILTER_KEYS(mqttFilters[MQTT_MSG_PAYMENT], CANONICAL_PAYMENT_KEYS);
+  ADD_FILTER_KEYS(mqttFilters[MQTT_MSG_CONFIG], CANONICAL_CONFIG_KEYS);
+  ADD_FILTER_KEYS(mqttFilters[MQTT_MSG_CONFIG], CONFIG_ALIAS_KEYS);
+  ADD_FILTER_KEYS(mqttFilters[MQTT_MSG_COMMAND], CANONICAL_COMMAND_KEYS);
+  ADD_FILTER_KEYS(mqttFilters[MQTT_MSG_OTA], CANONICAL_OTA_KEYS);
+  ADD_FILTER_KEYS(mqttFilters[MQTT_MSG_LEDGER_ACK], CANONICAL_LEDGER_ACK_KEYS);
+  for (uint8_t k = 0; k < MQTT_MSG_KIND_COUNT; k++) {
+    mqttFilters[k]["sig"] = true;
+    mqttFilters[k]["auth"]["sig"] = true;
+  }
+}
+
+static int mqttMessageKind(const char *topic) {
+  if (strcmp(topic, TOPIC_PAYMENT_IN) == 0) {
+    return MQTT_MSG_PAYMENT;
+  }
+  if (strcmp(topic, TOPIC_CONFIG_IN) == 0 ||
+      strcmp(topic, TOPIC_BROADCAST_CONFIG) == 0 ||
+      strcmp(topic, TOPIC_GROUP_CONFIG) == 0) {
+    return MQTT_MSG_CONFIG;
+  }
+  if (strcmp(topic, TOPIC_BROADCAST_COMMAND) == 0 ||
+      strcmp(topic, TOPIC_GROUP_COMMAND) == 0) {
+    return MQTT_MSG_COMMAND;
+  }
+  if (strcmp(topic, TOPIC_OTA_IN) == 0) {
+    return MQTT_MSG_OTA;
+  }
+  if (strcmp(topic, TOPIC_LEDGER_ACK) == 0) {
+    return MQTT_MSG_LEDGER_ACK;
+  }
+  return -1;
+}
+
+const char *mqttMessageKindName(uint8_t kind) {
+  static const char *const names[MQTT_MSG_KIND_COUNT] = {
+      "payment", "config", "command", "ota", "ledger_ack"};
+  return kind < MQTT_MSG_KIND_COUNT ? names[kind] : "unknown";
+}
+
+MqttArenaStats getMqttArenaStats() {
+  MqttArenaStats stats;
+  stats.capacity = mqttArena.capacity();
+  stats.highWater = mqttArena.highWater();
+  for (uint8_t k = 0; k < MQTT_MSG_KIND_COUNT; k++) {
+    stats.peak[k] = mqttArenaPeak[k];
+  }
+  stats.overflows = mqttArena.failures();
+  return stats;
+}
+
+// Serializes `doc` into the arena and publishes it. Call inside a
+// JsonArenaScope, which gives the text back with the document.
+static bool publishJson(const char *topic, const JsonDocument &doc,
+                        bool retained) {
+  const size_t len = measureJson(doc);
+  char *out = static_cast<char *>(mqttArena.allocate(len + 1));
+  if (!out) {
+    LOG_WARN("MQTT publish to %s dropped: arena full", topic);
+    return false;
+  }
+  serializeJson(doc, out, len + 1);
+  return mqttClient.publish(topic, out, retained);
+}
+
 // ============================================
 // MQTT SETUP
 // ============================================
 void setupMQTT() {
+  buildMqttFilters();
   mqttClient.setServer(deviceConfig.mqtt_broker, deviceConfig.mqtt_port);
   mqttClient.setCallback(mqttCallback);
-  mqttClient.setBufferSize(
-      2048); // Increased from 1024 for large signed messages
+  mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
   mqttClient.setKeepAlive(60);
   mqttClient.setSocketTimeout(30);
 
   reconnectMQTT();
 }
 
+static uint32_t mqttConnectCount = 0;
+
+uint32_t getMqttConnectCount() { return mqttConnectCount; }
+
 void reconnectMQTT() {
   static unsigned long lastAttempt = 0;
   static unsigned int failedAttempts = 0;
@@ -66,10 +184,11 @@ void reconnectMQTT() {
       (failedAttempts < maxBackoffIndex) ? failedAttempts : maxBackoffIndex;
   unsigned long retryInterval = backoffDelays[backoffIndex];
 
-  if (now - lastAttempt < retryInterval) {
+  // First attempt after boot goes out at once (main.cpp already jittered it)
+  if (lastAttempt != 0 && now - lastAttempt < retryInterval) {
     return;
   }
-  lastAttempt = now;
+  lastAttempt = now ? now : 1;
 
   Serial.print("Connecting to MQTT (attempt ");
   Serial.print(failedAttempts + 1);
@@ -87,11 +206,13 @@ void reconnectMQTT() {
   if (mqttClient.connect(clientId, username, password)) {
     Serial.println("MQTT Connected!");
     failedAttempts = 0; // Reset counter on success
+    mqttConnectCount++;
 
     // Subscribe to topics
     mqttClient.subscribe(TOPIC_PAYMENT_IN);
     mqttClient.subscribe(TOPIC_CONFIG_IN);
     mqttClient.subscribe(TOPIC_OTA_IN);
+    mqttClient.subscribe(TOPIC_LEDGER_ACK);
 
     // Subscribe to broadcast topics (all devices)
     mqttClient.subscribe(TOPIC_BROADCAST_CONFIG);
@@ -124,72 +245,75 @@ void reconnectMQTT() {
 // ============================================
 // MQTT CALLBACK - Handle incoming messages
 // ============================================
-static unsigned long normalizeSecondsOrMs(unsigned long value) {
-  if (value == 0) {
-    return value;
-  }
-  // Accept seconds (<= 3600) or milliseconds (> 3600)
-  if (value <= 3600UL) {
-    return value * 1000UL;
-  }
-  return value;
-}
-
-static void copyToBuffer(char *dst, size_t dstSize, const String &src) {
-  size_t n = src.length();
+static void copyToBuffer(char *dst, size_t dstSize, const char *src) {
+  size_t n = strlen(src);
   if (n >= dstSize) {
     n = dstSize - 1;
   }
-  memcpy(dst, src.c_str(), n);
+  memcpy(dst, src, n);
   dst[n] = '\0';
 }
 
-static String hmacSha256Hex(const String &data, const char *key) {
+// Lowercase hex HMAC-SHA256 of `data` into `out` ("" on failure)
+static void hmacSha256Hex(const char *data, const char *key, char out[65]) {
+  out[0] = '\0';
   unsigned char hmac[32];
   mbedtls_md_context_t ctx;
   mbedtls_md_init(&ctx);
   const mbedtls_md_info_t *info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
   if (!info) {
     mbedtls_md_free(&ctx);
-    return String();
+    return;
   }
   if (mbedtls_md_setup(&ctx, info, 1) != 0) {
     mbedtls_md_free(&ctx);
-    return String();
+    return;
   }
   mbedtls_md_hmac_starts(&ctx, (const unsigned char *)key, strlen(key));
-  mbedtls_md_hmac_update(&ctx, (const unsigned char *)data.c_str(),
-                         data.length());
+  mbedtls_md_hmac_update(&ctx, (const unsigned char *)data, strlen(data));
   mbedtls_md_hmac_finish(&ctx, hmac);
   mbedtls_md_free(&ctx);
 
   static const char hexChars[] = "0123456789abcdef";
-  char out[65];
   for (int i = 0; i < 32; i++) {
     out[i * 2] = hexChars[(hmac[i] >> 4) & 0x0F];
     out[i * 2 + 1] = hexChars[hmac[i] & 0x0F];
   }
   out[64] = '\0';
-  return String(out);
 }
 
-static bool isNewTxnId(const String &txnId) {
-  if (txnId.length() == 0) {
+static uint64_t fnv1a64(const void *data, size_t len) {
+  static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+  static const uint64_t FNV_PRIME = 1099511628211ULL;
+  uint64_t hash = FNV_OFFSET;
+
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+// Recent payment ids are kept as hashes, whatever their length
+static bool isNewTxnId(const char *txnId) {
+  if (!txnId || !txnId[0]) {
     return false;
   }
+  const uint64_t hash = fnv1a64(txnId, strlen(txnId));
   for (int i = 0; i < RECENT_TXN_CACHE; i++) {
-    if (recentTxnIds[i] == txnId) {
+    if (recentTxnHashes[i] == hash) {
       return false;
     }
   }
   return true;
 }
 
-static void rememberTxnId(const String &txnId) {
-  if (txnId.length() == 0) {
+static void rememberTxnId(const char *txnId) {
+  if (!txnId || !txnId[0]) {
     return;
   }
-  recentTxnIds[recentTxnIndex] = txnId;
+  recentTxnHashes[recentTxnIndex] = fnv1a64(txnId, strlen(txnId));
   recentTxnIndex = (recentTxnIndex + 1) % RECENT_TXN_CACHE;
 }
 
@@ -203,139 +327,101 @@ static const char *getSignatureField(const JsonDocument &doc) {
   return nullptr;
 }
 
-static String canonicalPayment(const JsonDocument &doc) {
-  JsonDocument canonical;
-  canonical["amount"] = doc["amount"];
-  if (!doc["source"].isNull())
-    canonical["source"] = doc["source"];
-  if (!doc["transaction_id"].isNull())
-    canonical["transaction_id"] = doc["transaction_id"];
-  if (!doc["nonce"].isNull())
-    canonical["nonce"] = doc["nonce"];
-  if (!doc["user_id"].isNull())
-    canonical["user_id"] = doc["user_id"];
-  if (!doc["ts"].isNull())
-    canonical["ts"] = doc["ts"];
-  canonical["device_id"] = deviceConfig.device_id;
+// Keys of a canonical schema sorted once, so each message member is placed
+// by binary search instead of probing the message once per schema key.
+struct CanonicalIndex {
+  CanonicalSchema schema;
+  uint8_t sorted[CANONICAL_MAX_KEYS];
+
+  explicit CanonicalIndex(const CanonicalSchema &s) : schema(s) {
+    for (uint8_t i = 0; i < schema.count; i++) {
+      uint8_t j = i;
+      while (j > 0 && strcmp(schema.keys[sorted[j - 1]], schema.keys[i]) > 0) {
+        sorted[j] = sorted[j - 1];
+        j--;
+      }
+      sorted[j] = i;
+    }
+  }
 
-  String out;
-  serializeJson(canonical, out);
-  return out;
-}
+  int find(const char *key) const {
+    int lo = 0;
+    int hi = schema.count - 1;
+    while (lo <= hi) {
+      const int mid = (lo + hi) / 2;
+      const int cmp = strcmp(key, schema.keys[sorted[mid]]);
+      if (cmp == 0) {
+        return sorted[mid];
+      }
+      if (cmp < 0) {
+        hi = mid - 1;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    return -1;
+  }
+};
+
+// One pass over the message members, then the present ones in schema
+// order and device_id last. Unknown members are not signed. The text goes
+// to canonicalBuf ("" if it does not fit, which no signature matches).
+static const char *canonicalFromSchema(const JsonDocument &doc,
+                                       const CanonicalIndex &index) {
+  JsonVariantConst slots[CANONICAL_MAX_KEYS];
+  for (JsonPairConst member : doc.as<JsonObjectConst>()) {
+    const int slot = index.find(member.key().c_str());
+    if (slot >= 0) {
+      slots[slot] = member.value();
+    }
+  }
 
-static String canonicalConfig(const JsonDocument &doc) {
-  JsonDocument canonical;
-  if (!doc["apply"].isNull())
-    canonical["apply"] = doc["apply"];
-  if (!doc["deviceId"].isNull())
-    canonical["deviceId"] = doc["deviceId"];
-  if (!doc["wifiSsid"].isNull())
-    canonical["wifiSsid"] = doc["wifiSsid"];
-  if (!doc["wifiPassword"].isNull())
-    canonical["wifiPassword"] = doc["wifiPassword"];
-  if (!doc["mqttBroker"].isNull())
-    canonical["mqttBroker"] = doc["mqttBroker"];
-  if (!doc["mqttPort"].isNull())
-    canonical["mqttPort"] = doc["mqttPort"];
-  if (!doc["mqttUsername"].isNull())
-    canonical["mqttUsername"] = doc["mqttUsername"];
-  if (!doc["mqttPassword"].isNull())
-    canonical["mqttPassword"] = doc["mqttPassword"];
-  if (!doc["pricePerLiter"].isNull())
-    canonical["pricePerLiter"] = doc["pricePerLiter"];
-  if (!doc["sessionTimeout"].isNull())
-    canonical["sessionTimeout"] = doc["sessionTimeout"];
-  if (!doc["freeWaterCooldown"].isNull())
-    canonical["freeWaterCooldown"] = doc["freeWaterCooldown"];
-  if (!doc["freeWaterAmount"].isNull())
-    canonical["freeWaterAmount"] = doc["freeWaterAmount"];
-  if (!doc["pulsesPerLiter"].isNull())
-    canonical["pulsesPerLiter"] = doc["pulsesPerLiter"];
-  if (!doc["tdsThreshold"].isNull())
-    canonical["tdsThreshold"] = doc["tdsThreshold"];
-  if (!doc["tdsTemperatureC"].isNull())
-    canonical["tdsTemperatureC"] = doc["tdsTemperatureC"];
-  if (!doc["tdsCalibrationFactor"].isNull())
-    canonical["tdsCalibrationFactor"] = doc["tdsCalibrationFactor"];
-  if (!doc["enableFreeWater"].isNull())
-    canonical["enableFreeWater"] = doc["enableFreeWater"];
-  if (!doc["relayActiveHigh"].isNull())
-    canonical["relayActiveHigh"] = doc["relayActiveHigh"];
-  if (!doc["relay_active_high"].isNull())
-    canonical["relay_active_high"] = doc["relay_active_high"];
-  if (!doc["cashPulseValue"].isNull())
-    canonical["cashPulseValue"] = doc["cashPulseValue"];
-  if (!doc["cashPulseGapMs"].isNull())
-    canonical["cashPulseGapMs"] = doc["cashPulseGapMs"];
-  if (!doc["paymentCheckInterval"].isNull())
-    canonical["paymentCheckInterval"] = doc["paymentCheckInterval"];
-  if (!doc["displayUpdateInterval"].isNull())
-    canonical["displayUpdateInterval"] = doc["displayUpdateInterval"];
-  if (!doc["tdsCheckInterval"].isNull())
-    canonical["tdsCheckInterval"] = doc["tdsCheckInterval"];
-  if (!doc["heartbeatInterval"].isNull())
-    canonical["heartbeatInterval"] = doc["heartbeatInterval"];
-  if (!doc["enablePowerSave"].isNull())
-    canonical["enablePowerSave"] = doc["enablePowerSave"];
-  if (!doc["deepSleepStartHour"].isNull())
-    canonical["deepSleepStartHour"] = doc["deepSleepStartHour"];
-  if (!doc["deepSleepEndHour"].isNull())
-    canonical["deepSleepEndHour"] = doc["deepSleepEndHour"];
-  if (!doc["transaction_id"].isNull())
-    canonical["transaction_id"] = doc["transaction_id"];
-  if (!doc["nonce"].isNull())
-    canonical["nonce"] = doc["nonce"];
-  if (!doc["ts"].isNull())
-    canonical["ts"] = doc["ts"];
+  JsonArenaScope scope(mqttArena);
+  JsonDocument canonical(&mqttJsonAllocator);
+  for (uint8_t i = 0; i < index.schema.count; i++) {
+    if (!slots[i].isNull() || (i == 0 && index.schema.firstRequired)) {
+      canonical[index.schema.keys[i]] = slots[i];
+    }
+  }
   canonical["device_id"] = deviceConfig.device_id;
 
-  String out;
-  serializeJson(canonical, out);
-  return out;
+  if (canonical.overflowed() ||
+      measureJson(canonical) >= sizeof(canonicalBuf)) {
+    canonicalBuf[0] = '\0';
+  } else {
+    serializeJson(canonical, canonicalBuf, sizeof(canonicalBuf));
+  }
+  return canonicalBuf;
 }
 
-static String canonicalCommand(const JsonDocument &doc) {
-  JsonDocument canonical;
-  if (!doc["action"].isNull())
-    canonical["action"] = doc["action"];
-  if (!doc["pricePerLiter"].isNull())
-    canonical["pricePerLiter"] = doc["pricePerLiter"];
-  if (!doc["threshold"].isNull())
-    canonical["threshold"] = doc["threshold"];
-  if (!doc["tdsThreshold"].isNull())
-    canonical["tdsThreshold"] = doc["tdsThreshold"];
-  if (!doc["duration"].isNull())
-    canonical["duration"] = doc["duration"];
-  if (!doc["reason"].isNull())
-    canonical["reason"] = doc["reason"];
-  if (!doc["transaction_id"].isNull())
-    canonical["transaction_id"] = doc["transaction_id"];
-  if (!doc["nonce"].isNull())
-    canonical["nonce"] = doc["nonce"];
-  if (!doc["ts"].isNull())
-    canonical["ts"] = doc["ts"];
-  canonical["device_id"] = deviceConfig.device_id;
+static const char *canonicalPayment(const JsonDocument &doc) {
+  static const CanonicalIndex index(
+      CANONICAL_SCHEMA(CANONICAL_PAYMENT_KEYS, true));
+  return canonicalFromSchema(doc, index);
+}
 
-  String out;
-  serializeJson(canonical, out);
-  return out;
+static const char *canonicalConfig(const JsonDocument &doc) {
+  static const CanonicalIndex index(
+      CANONICAL_SCHEMA(CANONICAL_CONFIG_KEYS, false));
+  return canonicalFromSchema(doc, index);
 }
 
-static String canonicalOta(const JsonDocument &doc) {
-  JsonDocument canonical;
-  if (!doc["firmware_url"].isNull())
-    canonical["firmware_url"] = doc["firmware_url"];
-  if (!doc["transaction_id"].isNull())
-    canonical["transaction_id"] = doc["transaction_id"];
-  if (!doc["nonce"].isNull())
-    canonical["nonce"] = doc["nonce"];
-  if (!doc["ts"].isNull())
-    canonical["ts"] = doc["ts"];
-  canonical["device_id"] = deviceConfig.device_id;
+static const char *canonicalCommand(const JsonDocument &doc) {
+  static const CanonicalIndex index(
+      CANONICAL_SCHEMA(CANONICAL_COMMAND_KEYS, false));
+  return canonicalFromSchema(doc, index);
+}
+
+static const char *canonicalOta(const JsonDocument &doc) {
+  static const CanonicalIndex index(
+      CANONICAL_SCHEMA(CANONICAL_OTA_KEYS, false));
+  return canonicalFromSchema(doc, index);
+}
 
-  String out;
-  serializeJson(canonical, out);
-  return out;
+static const char *canonicalLedgerAck(const JsonDocument &doc) {
+  static const CanonicalIndex index(
+      CANONICAL_SCHEMA(CANONICAL_LEDGER_ACK_KEYS, true));
+  return canonicalFromSchema(doc, index);
 }
 
 static bool extractSignedTs(const JsonDocument &doc, uint64_t &tsOut) {
@@ -346,31 +432,18 @@ static bool extractSignedTs(const JsonDocument &doc, uint64_t &tsOut) {
   return tsOut != 0;
 }
 
-static String extractSignedNonce(const JsonDocument &doc) {
+static const char *extractSignedNonce(const JsonDocument &doc) {
   if (doc["nonce"].is<const char *>()) {
-    return String(doc["nonce"].as<const char *>());
+    return doc["nonce"].as<const char *>();
   }
   if (doc["transaction_id"].is<const char *>()) {
-    return String(doc["transaction_id"].as<const char *>());
+    return doc["transaction_id"].as<const char *>();
   }
-  return String();
+  return "";
 }
 
-static uint64_t fnv1a64(const void *data, size_t len) {
-  static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
-  static const uint64_t FNV_PRIME = 1099511628211ULL;
-  uint64_t hash = FNV_OFFSET;
-
-  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
-  for (size_t i = 0; i < len; i++) {
-    hash ^= bytes[i];
-    hash *= FNV_PRIME;
-  }
-  return hash;
-}
-
-static uint64_t hashNonceTs(const String &nonce, uint64_t ts) {
-  uint64_t hash = fnv1a64(nonce.c_str(), nonce.length());
+static uint64_t hashNonceTs(const char *nonce, uint64_t ts) {
+  uint64_t hash = fnv1a64(nonce, strlen(nonce));
   // Mix timestamp bytes into the hash to reduce collision risk.
   for (int i = 0; i < 8; i++) {
     uint8_t b = (uint8_t)((ts >> (i * 8)) & 0xFF);
@@ -412,21 +485,25 @@ static bool enforceSignedReplayProtection(const JsonDocument &doc,
     return true;
   }
 
+  char msg[64];
   uint64_t ts = 0;
   if (!extractSignedTs(doc, ts)) {
-    publishLog("ERROR", (String(context) + " missing ts").c_str());
+    snprintf(msg, sizeof(msg), "%s missing ts", context);
+    publishLog("ERROR", msg);
     return false;
   }
 
-  String nonce = extractSignedNonce(doc);
-  if (nonce.length() == 0) {
-    publishLog("ERROR", (String(context) + " missing nonce").c_str());
+  const char *nonce = extractSignedNonce(doc);
+  if (!nonce[0]) {
+    snprintf(msg, sizeof(msg), "%s missing nonce", context);
+    publishLog("ERROR", msg);
     return false;
   }
 
   uint64_t nonceHash = hashNonceTs(nonce, ts);
   if (!checkAndStorePersistentNonce(idxKey, bufKey, nonceHash)) {
-    publishLog("ERROR", (String(context) + " replay detected").c_str());
+    snprintf(msg, sizeof(msg), "%s replay detected", context);
+    publishLog("ERROR", msg);
     return false;
   }
 
@@ -434,7 +511,7 @@ static bool enforceSignedReplayProtection(const JsonDocument &doc,
 }
 
 static bool verifySignedMessage(const JsonDocument &doc,
-                                const String &payload) {
+                                const char *payload) {
   if (!deviceConfig.requireSignedMessages) {
     return true;
   }
@@ -450,55 +527,85 @@ static bool verifySignedMessage(const JsonDocument &doc,
     return false;
   }
 
-  String expected = hmacSha256Hex(payload, secret);
-  String provided = String(sig);
-  provided.toLowerCase();
-  expected.toLowerCase();
-
-  if (provided != expected) {
+  char expected[65];
+  hmacSha256Hex(payload, secret, expected);
+  if (!payload[0] || !expected[0] || strcasecmp(sig, expected) != 0) {
     publishLog("ERROR", "Invalid signature");
     return false;
   }
   return true;
 }
 
+static void handleMqttMessage(const char *topic, int kind, byte *payload,
+                              unsigned int length);
+
 void mqttCallback(char *topic, byte *payload, unsigned int length) {
-  Serial.print("Message arrived [");
-  Serial.print(topic);
-  Serial.print("]: ");
+  LOG_DEBUG("MQTT rx [%s] %u bytes", topic, length);
 
-  // Parse JSON
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, payload, length);
+  const int kind = mqttMessageKind(topic);
+  if (kind < 0) {
+    return;
+  }
+  buildMqttFilters();
 
+  // Everything below allocates from mqttArena, given back on return
+  HeapScope heapScope(HEAP_MOD_MQTT);
+  JsonArenaScope scope(mqttArena);
+  mqttArena.takePeak();
+  handleMqttMessage(topic, kind, payload, length);
+  const uint32_t peak = mqttArena.takePeak();
+  if (peak > mqttArenaPeak[kind]) {
+    mqttArenaPeak[kind] = peak;
+  }
+}
+
+static void handleMqttMessage(const char *topic, int kind, byte *payload,
+                              unsigned int length) {
+  // Parse JSON, keeping only the fields this kind of message uses
+  JsonDocument doc(&mqttJsonAllocator);
+  DeserializationError error =
+      deserializeJson(doc, payload, length,
+                      DeserializationOption::Filter(mqttFilters[kind]));
+
+  if (error == DeserializationError::NoMemory) {
+    LOG_WARN("MQTT message on %s too large (%u bytes)", topic, length);
+    return;
+  }
   if (error) {
-    Serial.println("JSON parse error!");
+    LOG_WARN("MQTT JSON parse error on %s", topic);
     return;
   }
 
-  String topicStr = String(topic);
-
   // Handle Payment
-  if (topicStr == TOPIC_PAYMENT_IN) {
+  if (kind == MQTT_MSG_PAYMENT) {
     if (!doc["amount"].is<int>()) {
-      Serial.println("ERROR: Missing payment amount");
+      LOG_WARN("Payment rejected: missing amount");
       publishLog("ERROR", "Missing payment amount");
       return;
     }
 
-    String canonical = canonicalPayment(doc);
-    if (!verifySignedMessage(doc, canonical)) {
-      Serial.println("Payment rejected: signature invalid");
+    if (!verifySignedMessage(doc, canonicalPayment(doc))) {
+      LOG_WARN("Payment rejected: signature invalid");
       return;
     }
 
     int amount = doc["amount"].as<int>();
-    String source = doc["source"] | "unknown";
-    String txnId = doc["transaction_id"] | "";
-    if (txnId.length() == 0) {
+    const char *source = doc["source"] | "unknown";
+    const char *txnId = doc["transaction_id"] | "";
+    if (!txnId[0]) {
       txnId = doc["nonce"] | "";
     }
-    String userId = doc["user_id"] | "";
+    const char *userId = doc["user_id"] | "";
+    // Optional 1-based outlet; without it the focus nozzle is credited
+    int nozzle = -1;
+    if (!doc["nozzle"].isNull()) {
+      const int n = doc["nozzle"].as<int>();
+      if (n < 1 || n > NOZZLE_COUNT) {
+        publishLog("ERROR", "Payment for unknown nozzle");
+        return;
+      }
+      nozzle = n - 1;
+    }
 
     if (deviceConfig.requireSignedMessages) {
       uint64_t ts = 0;
@@ -506,7 +613,7 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
         publishLog("ERROR", "PAYMENT missing ts");
         return;
       }
-      if (txnId.length() == 0) {
+      if (!txnId[0]) {
         publishLog("ERROR", "PAYMENT missing transaction_id/nonce");
         return;
       }
@@ -519,14 +626,12 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
 
     // analytics.recordPayment(amount); // Removed
 
-    processPayment(amount, source.c_str(),
-                   txnId.length() ? txnId.c_str() : nullptr,
-                   userId.length() ? userId.c_str() : nullptr);
-  } else if (topicStr == TOPIC_CONFIG_IN) {
-    Serial.println("Config update received");
-    String canonical = canonicalConfig(doc);
-    if (!verifySignedMessage(doc, canonical)) {
-      Serial.println("Config rejected: signature invalid");
+    processPayment(amount, source, txnId[0] ? txnId : nullptr,
+                   userId[0] ? userId : nullptr, nozzle);
+  } else if (strcmp(topic, TOPIC_CONFIG_IN) == 0) {
+    LOG_DEBUG("Config update received");
+    if (!verifySignedMessage(doc, canonicalConfig(doc))) {
+      LOG_WARN("Config rejected: signature invalid");
       return;
     }
     if (!enforceSignedReplayProtection(doc, "CONFIG", "cfg_nonce_idx",
@@ -534,13 +639,11 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
       return;
     }
     handleConfigUpdate(doc);
-  } else if (topicStr == TOPIC_BROADCAST_CONFIG ||
-             topicStr == TOPIC_GROUP_CONFIG) {
-    Serial.println("Broadcast/Group config received");
+  } else if (kind == MQTT_MSG_CONFIG) { // Broadcast or group
+    LOG_DEBUG("Broadcast/Group config received");
 
-    String canonical = canonicalConfig(doc);
-    if (!verifySignedMessage(doc, canonical)) {
-      Serial.println("Broadcast config rejected: signature invalid");
+    if (!verifySignedMessage(doc, canonicalConfig(doc))) {
+      LOG_WARN("Broadcast config rejected: signature invalid");
       return;
     }
     if (!enforceSignedReplayProtection(doc, "BROADCAST_CONFIG", "cfg_nonce_idx",
@@ -548,39 +651,43 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
       return;
     }
 
-    // Handle common config updates with range validation
+    // Common config updates, range-checked and applied together
+    DeviceConfig next = deviceConfig;
+    bool valid = true;
     if (!doc["pricePerLiter"].isNull()) {
       int price = doc["pricePerLiter"];
       if (price >= 100 && price <= 100000) { // Range validation
-        deviceConfig.pricePerLiter = price;
-        saveConfigToStorage();
-        applyRuntimeConfig();
-        Serial.println("Price updated via broadcast");
+        next.pricePerLiter = price;
       } else {
-        Serial.println("Broadcast price rejected: out of range");
+        LOG_WARN("Broadcast price rejected: out of range (%d)", price);
+        valid = false;
       }
     }
     if (!doc["tdsThreshold"].isNull()) {
       int tds = doc["tdsThreshold"];
       if (tds >= 0 && tds <= 2000) { // Range validation
-        deviceConfig.tdsThreshold = tds;
-        saveConfigToStorage();
-        applyRuntimeConfig(); // FIX: Apply runtime config for TDS too
-        Serial.println("TDS threshold updated via broadcast");
+        next.tdsThreshold = tds;
       } else {
-        Serial.println("Broadcast TDS rejected: out of range");
+        LOG_WARN("Broadcast TDS rejected: out of range (%d)", tds);
+        valid = false;
       }
     }
+    if (valid && (next.pricePerLiter != deviceConfig.pricePerLiter ||
+                  next.tdsThreshold != deviceConfig.tdsThreshold)) {
+      deviceConfig = next;
+      saveConfigToStorage();
+      applyRuntimeConfig();
+      LOG_INFO("Config updated via broadcast: price %d, TDS %d",
+               next.pricePerLiter, next.tdsThreshold);
+    }
   }
   // Handle Broadcast/Group Commands
-  else if (topicStr == TOPIC_BROADCAST_COMMAND ||
-           topicStr == TOPIC_GROUP_COMMAND) {
-    Serial.println("Broadcast/Group command received");
+  else if (kind == MQTT_MSG_COMMAND) {
+    LOG_DEBUG("Broadcast/Group command received");
 
     // CRITICAL FIX: Verify signature for commands (must include `action`)
-    String canonical = canonicalCommand(doc);
-    if (!verifySignedMessage(doc, canonical)) {
-      Serial.println("Command rejected: signature invalid");
+    if (!verifySignedMessage(doc, canonicalCommand(doc))) {
+      LOG_WARN("Command rejected: signature invalid");
       return;
     }
     if (!enforceSignedReplayProtection(doc, "COMMAND", "cmd_nonce_idx",
@@ -588,18 +695,20 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
       return;
     }
 
-    String action = doc["action"] | "";
+    const char *action = doc["action"] | "";
 
-    if (action == "updatePrice" && !doc["pricePerLiter"].isNull()) {
+    if (strcmp(action, "updatePrice") == 0 &&
+        !doc["pricePerLiter"].isNull()) {
       deviceConfig.pricePerLiter = doc["pricePerLiter"];
       saveConfigToStorage();
       applyRuntimeConfig();
       publishLog("FLEET", "Price updated via broadcast");
-    } else if (action == "updateTdsThreshold" && !doc["threshold"].isNull()) {
+    } else if (strcmp(action, "updateTdsThreshold") == 0 &&
+               !doc["threshold"].isNull()) {
       deviceConfig.tdsThreshold = doc["threshold"];
       saveConfigToStorage();
       publishLog("FLEET", "TDS threshold updated");
-    } else if (action == "identify") {
+    } else if (strcmp(action, "identify") == 0) {
       // Blink display or LED for physical identification
       int duration = doc["duration"] | 10;
 
@@ -629,25 +738,30 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
 
       // Restore normal display after identify
       displayIdle();
-    } else if (action == "emergencyShutdown") {
-      String reason = doc["reason"] | "Emergency";
-      String msg = "EMERGENCY SHUTDOWN: " + reason;
-      // alertCritical(CAT_SYSTEM, msg.c_str());
-      publishLog("ALERT", msg.c_str()); // Replaced with simple log
+    } else if (strcmp(action, "emergencyShutdown") == 0) {
+      const char *reason = doc["reason"] | "Emergency";
+      char msg[96];
+      snprintf(msg, sizeof(msg), "EMERGENCY SHUTDOWN: %s", reason);
+      // alertCritical(CAT_SYSTEM, msg);
+      publishLog("ALERT", msg); // Replaced with simple log
       publishLog("FLEET", "Emergency shutdown initiated");
-      // Force safe stop
-      setRelay(false);
-      currentState = IDLE;
-      balance = 0;
-      publishStatus();
+      // Force safe stop on every nozzle (relay OFF, balance forfeited)
+      for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+        postStateEvent(SM_EV_ABORT, i);
+      }
+      dispatchStateEvents();
+      // Refuse further cash until the fleet sends "resume"
+      setPaymentInhibit(INHIBIT_EMERGENCY, true);
+    } else if (strcmp(action, "resume") == 0) {
+      setPaymentInhibit(INHIBIT_EMERGENCY, false);
+      publishLog("FLEET", "Cash acceptance resumed");
     }
-  } else if (topicStr == TOPIC_OTA_IN) {
-    Serial.println("OTA update command received");
+  } else if (kind == MQTT_MSG_OTA) {
+    LOG_INFO("OTA update command received");
 
     // CRITICAL FIX: Verify signature for OTA (include url + ts + nonce)
-    String canonical = canonicalOta(doc);
-    if (!verifySignedMessage(doc, canonical)) {
-      Serial.println("OTA rejected: signature invalid");
+    if (!verifySignedMessage(doc, canonicalOta(doc))) {
+      LOG_WARN("OTA rejected: signature invalid");
       return;
     }
     if (!enforceSignedReplayProtection(doc, "OTA", "ota_nonce_idx",
@@ -655,12 +769,23 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
       return;
     }
 
-    if (!doc["firmware_url"].is<String>()) {
+    if (!doc["firmware_url"].is<const char *>()) {
       publishLog("OTA_ERROR", "Missing firmware_url");
       return;
     }
-    String firmwareUrl = doc["firmware_url"].as<String>();
-    triggerOTAUpdate(firmwareUrl.c_str());
+    triggerOTAUpdate(doc["firmware_url"].as<const char *>());
+  } else if (kind == MQTT_MSG_LEDGER_ACK) {
+    // ACKs only move the cursor forward, so a replayed ACK is harmless and
+    // no nonce bookkeeping is needed beyond the signature.
+    if (!verifySignedMessage(doc, canonicalLedgerAck(doc))) {
+      LOG_WARN("Ledger ACK rejected: signature invalid");
+      return;
+    }
+    if (!doc["last_seq"].is<uint32_t>()) {
+      publishLog("ERROR", "Ledger ACK missing last_seq");
+      return;
+    }
+    ledgerHandleAck(doc["last_seq"].as<uint32_t>());
   }
 }
 
@@ -668,7 +793,7 @@ void mqttCallback(char *topic, byte *payload, unsigned int length) {
 // PAYMENT PROCESSING (shared by MQTT & cash pulses)
 // ============================================
 void processPayment(int amount, const char *source, const char *txnId,
-                    const char *userId) {
+                    const char *userId, int nozzle) {
   if (amount <= 0) {
     publishLog("ERROR", "Invalid payment: negative or zero amount");
     return;
@@ -680,48 +805,28 @@ void processPayment(int amount, const char *source, const char *txnId,
 
   const char *safeSource = (source && source[0]) ? source : "unknown";
 
-  Serial.print("Payment received: ");
-  Serial.print(amount);
-  Serial.print(" from ");
-  Serial.println(safeSource);
-
-  if (txnId && txnId[0]) {
-    Serial.print("Transaction ID: ");
-    Serial.println(txnId);
-  }
-
-  balance += amount;
-
-  if (balance > 0) {
-    if (currentState == IDLE) {
-      // Normal: Start paid session from idle
-      currentState = ACTIVE;
-      sessionStartBalance = balance;
-      freeWaterUsed = false;
-    } else if (currentState == FREE_WATER) {
-      // Payment during free water: continue as paid dispensing immediately.
-      Serial.println("💰 Payment during FREE_WATER → switching to DISPENSING");
-      currentState = DISPENSING;
-      sessionStartBalance = balance;
-      freeWaterUsed = true; // Don't allow free water again this session
-      flowPulseCount = 0;
-      lastDispensedLiters = 0.0;
-      totalDispensedLiters = 0.0;
-      setRelay(true);
-    } else if (currentState == DISPENSING) {
-      // Payment during dispensing: add to balance, continue dispensing
-      Serial.println("💰 Additional payment during DISPENSING");
-    } else if (currentState == PAUSED) {
-      // Payment during pause: add to balance
-      Serial.println("💰 Payment during PAUSED - balance increased");
-    }
-  }
+  LOG_INFO("Payment %d from %s txn=%s", amount, safeSource,
+           (txnId && txnId[0]) ? txnId : "-");
+
+  const uint8_t n = (nozzle >= 0 && nozzle < NOZZLE_COUNT)
+                        ? static_cast<uint8_t>(nozzle)
+                        : getFocusNozzle();
 
-  resetSessionTimer();
+  ledgerOnPayment(amount, n);
+  nozzles[n].balance += amount;
+  resetSessionTimer(n);
+
+  // IDLE -> ACTIVE, FREE_WATER -> DISPENSING, otherwise balance only
+  postStateEvent(SM_EV_PAYMENT, n);
+  dispatchStateEvents();
 
   char paymentLog[256];
   int offset =
       snprintf(paymentLog, sizeof(paymentLog), "%d|%s", amount, safeSource);
+#if NOZZLE_COUNT > 1
+  offset += snprintf(paymentLog + offset, sizeof(paymentLog) - offset,
+                     "|N%u", (unsigned)n + 1);
+#endif
 
   if (txnId && txnId[0] && offset < sizeof(paymentLog)) {
     int written = snprintf(paymentLog + offset, sizeof(paymentLog) - offset,
@@ -734,14 +839,27 @@ void processPayment(int amount, const char *source, const char *txnId,
   }
 
   publishLog("PAYMENT", paymentLog);
-  publishStatus();
 }
 
 // ============================================
 // CONFIG UPDATE HANDLER
 // ============================================
+static bool hasConfigKey(const JsonDocument &doc, const char *key,
+                         const char *alt) {
+  return !doc[key].isNull() || !doc[alt].isNull();
+}
+
+// First out-of-range field of an update; the whole update is dropped
+static void rejectConfigField(const char *&rejected, const char *key) {
+  if (!rejected) {
+    rejected = key;
+  }
+}
+
 void handleConfigUpdate(JsonDocument &doc) {
-  DeviceConfig prevConfig = deviceConfig;
+  // Built on a copy and committed only if every field present is valid
+  DeviceConfig next = deviceConfig;
+  const char *rejected = nullptr;
   bool updated = false;
   bool wifiChanged = false;
   bool mqttChanged = false;
@@ -751,36 +869,44 @@ void handleConfigUpdate(JsonDocument &doc) {
   if (allowNetConfig) {
     // WiFi
     // HIGH FIX: Support snake_case keys
-    String ssid = doc["wifiSsid"] | doc["wifi_ssid"] | "";
-    if (ssid.length() > 0 && ssid.length() < 32) {
-      copyToBuffer(deviceConfig.wifi_ssid, sizeof(deviceConfig.wifi_ssid),
-                   ssid);
+    const char *ssid = doc["wifiSsid"] | doc["wifi_ssid"] | "";
+    const size_t ssidLen = strlen(ssid);
+    if (ssidLen > 0 && ssidLen < 32) {
+      copyToBuffer(next.wifi_ssid, sizeof(next.wifi_ssid), ssid);
       wifiChanged = true;
       updated = true;
+    } else if (ssidLen > 0) {
+      rejectConfigField(rejected, "wifiSsid");
     }
 
-    String pass = doc["wifiPassword"] | doc["wifi_password"] | "";
-    if (pass.length() > 0 && pass.length() < 64) {
-      copyToBuffer(deviceConfig.wifi_password,
-                   sizeof(deviceConfig.wifi_password), pass);
+    const char *pass = doc["wifiPassword"] | doc["wifi_password"] | "";
+    const size_t passLen = strlen(pass);
+    if (passLen > 0 && passLen < 64) {
+      copyToBuffer(next.wifi_password, sizeof(next.wifi_password), pass);
       wifiChanged = true;
       updated = true;
+    } else if (passLen > 0) {
+      rejectConfigField(rejected, "wifiPassword");
     }
 
     // MQTT
-    String broker = doc["mqttBroker"] | doc["mqtt_broker"] | "";
-    if (broker.length() > 0 && broker.length() < 128) {
-      copyToBuffer(deviceConfig.mqtt_broker, sizeof(deviceConfig.mqtt_broker),
-                   broker);
+    const char *broker = doc["mqttBroker"] | doc["mqtt_broker"] | "";
+    const size_t brokerLen = strlen(broker);
+    if (brokerLen > 0 && brokerLen < 128) {
+      copyToBuffer(next.mqtt_broker, sizeof(next.mqtt_broker), broker);
       mqttChanged = true;
       updated = true;
+    } else if (brokerLen > 0) {
+      rejectConfigField(rejected, "mqttBroker");
     }
 
     int port = doc["mqttPort"] | doc["mqtt_port"] | 0;
     if (port > 0 && port < 65536) {
-      deviceConfig.mqtt_port = port;
+      next.mqtt_port = port;
       mqttChanged = true;
       updated = true;
+    } else if (hasConfigKey(doc, "mqttPort", "mqtt_port")) {
+      rejectConfigField(rejected, "mqttPort");
     }
 
     // MQTT auth (optional). Only update if key is present to allow partial
@@ -788,34 +914,39 @@ void handleConfigUpdate(JsonDocument &doc) {
     bool hasUser = doc["mqttUsername"].is<const char *>() ||
                    doc["mqtt_username"].is<const char *>();
     if (hasUser) {
-      String user = doc["mqttUsername"] | doc["mqtt_username"] | "";
-      if (user.length() < 32) { // Allow empty but not too long
-        copyToBuffer(deviceConfig.mqtt_username,
-                     sizeof(deviceConfig.mqtt_username), user);
+      const char *user = doc["mqttUsername"] | doc["mqtt_username"] | "";
+      if (strlen(user) < 32) { // Allow empty but not too long
+        copyToBuffer(next.mqtt_username, sizeof(next.mqtt_username), user);
         mqttChanged = true;
         updated = true;
+      } else {
+        rejectConfigField(rejected, "mqttUsername");
       }
     }
 
     bool hasPass = doc["mqttPassword"].is<const char *>() ||
                    doc["mqtt_password"].is<const char *>();
     if (hasPass) {
-      String mqttPass = doc["mqttPassword"] | doc["mqtt_password"] | "";
-      if (mqttPass.length() < 64) {
-        copyToBuffer(deviceConfig.mqtt_password,
-                     sizeof(deviceConfig.mqtt_password), mqttPass);
+      const char *mqttPass = doc["mqttPassword"] | doc["mqtt_password"] | "";
+      if (strlen(mqttPass) < 64) {
+        copyToBuffer(next.mqtt_password, sizeof(next.mqtt_password),
+                     mqttPass);
         mqttChanged = true;
         updated = true;
+      } else {
+        rejectConfigField(rejected, "mqttPassword");
       }
     }
 
     // Device ID
-    String devId = doc["deviceId"] | doc["device_id"] | "";
-    if (devId.length() > 0 && devId.length() < 32) {
-      copyToBuffer(deviceConfig.device_id, sizeof(deviceConfig.device_id),
-                   devId);
+    const char *devId = doc["deviceId"] | doc["device_id"] | "";
+    const size_t devIdLen = strlen(devId);
+    if (devIdLen > 0 && devIdLen < 32) {
+      copyToBuffer(next.device_id, sizeof(next.device_id), devId);
       deviceIdChanged = true;
       updated = true;
+    } else if (devIdLen > 0) {
+      rejectConfigField(rejected, "deviceId");
     }
   } else {
     // Check for attempted network config when disabled
@@ -834,68 +965,109 @@ void handleConfigUpdate(JsonDocument &doc) {
 
   int price = GET_INT("pricePerLiter", "price_per_liter");
   if (price > 0 && price <= 100000) {
-    deviceConfig.pricePerLiter = price;
+    next.pricePerLiter = price;
     updated = true;
+  } else if (hasConfigKey(doc, "pricePerLiter", "price_per_liter")) {
+    rejectConfigField(rejected, "pricePerLiter");
   }
 
   int sessionTimeout = GET_INT("sessionTimeout", "session_timeout");
   if (sessionTimeout > 0) {
-    deviceConfig.sessionTimeout = normalizeSecondsOrMs(sessionTimeout);
+    next.sessionTimeout = normalizeSecondsOrMs(sessionTimeout);
     updated = true;
+  } else if (hasConfigKey(doc, "sessionTimeout", "session_timeout")) {
+    rejectConfigField(rejected, "sessionTimeout");
   }
 
   int freeCooldown = GET_INT("freeWaterCooldown", "free_water_cooldown");
   if (freeCooldown > 0) {
-    deviceConfig.freeWaterCooldown = normalizeSecondsOrMs(freeCooldown);
+    next.freeWaterCooldown = normalizeSecondsOrMs(freeCooldown);
     updated = true;
+  } else if (hasConfigKey(doc, "freeWaterCooldown", "free_water_cooldown")) {
+    rejectConfigField(rejected, "freeWaterCooldown");
   }
 
   float freeAmount = GET_FLOAT("freeWaterAmount", "free_water_amount");
   if (freeAmount > 0) {
-    deviceConfig.freeWaterAmount = freeAmount;
+    next.freeWaterAmount = freeAmount;
     updated = true;
+  } else if (hasConfigKey(doc, "freeWaterAmount", "free_water_amount")) {
+    rejectConfigField(rejected, "freeWaterAmount");
   }
 
   float pulses = GET_FLOAT("pulsesPerLiter", "pulses_per_liter");
   if (pulses > 0) {
-    deviceConfig.pulsesPerLiter = pulses;
+    next.pulsesPerLiter = pulses;
     updated = true;
+  } else if (hasConfigKey(doc, "pulsesPerLiter", "pulses_per_liter")) {
+    rejectConfigField(rejected, "pulsesPerLiter");
+  }
+
+  // Per-nozzle overrides: [{"nozzle":2,"pricePerLiter":..,"pulsesPerLiter":..}]
+  // Nozzle 1 is the base price/calibration above; -1 / 0 reverts to it.
+  JsonArrayConst nozzleCfg = doc["nozzles"].as<JsonArrayConst>();
+  for (JsonObjectConst n : nozzleCfg) {
+    const int idx = (n["nozzle"] | 0) - 1;
+    if (idx < 1 || idx >= NOZZLE_COUNT) {
+      publishLog("CONFIG", "Unknown nozzle ignored");
+      continue;
+    }
+    if (!n["pricePerLiter"].isNull()) {
+      const int p = n["pricePerLiter"].as<int>();
+      if (p == -1 || (p > 0 && p <= 100000)) {
+        next.nozzlePricePerLiter[idx] = p;
+        updated = true;
+      } else {
+        rejectConfigField(rejected, "nozzles");
+      }
+    }
+    if (!n["pulsesPerLiter"].isNull()) {
+      const float p = n["pulsesPerLiter"].as<float>();
+      if (p >= 0.0f && p <= 5000.0f) {
+        next.nozzlePulsesPerLiter[idx] = p;
+        updated = true;
+      } else {
+        rejectConfigField(rejected, "nozzles");
+      }
+    }
   }
 
   int tdsThresh = GET_INT("tdsThreshold", "tds_threshold");
   if (tdsThresh >= 0) {
-    deviceConfig.tdsThreshold = tdsThresh;
+    next.tdsThreshold = tdsThresh;
     updated = true;
+  } else if (hasConfigKey(doc, "tdsThreshold", "tds_threshold")) {
+    rejectConfigField(rejected, "tdsThreshold");
   }
 
-  // ... (Abbreviated for brevity, applying pattern to others)
-  // Reverting to direct checks for remaining fields to ensure correctness
-  // without macro magic complexity
-
   if (!doc["tdsTemperatureC"].isNull()) {
     float temp = doc["tdsTemperatureC"].as<float>();
     if (temp >= 0.0f && temp <= 80.0f) {
-      deviceConfig.tdsTemperatureC = temp;
+      next.tdsTemperatureC = temp;
       updated = true;
+    } else {
+      rejectConfigField(rejected, "tdsTemperatureC");
     }
   }
   if (!doc["tdsCalibrationFactor"].isNull()) {
     float factor = doc["tdsCalibrationFactor"].as<float>();
     if (factor > 0.0f && factor <= 5.0f) {
-      deviceConfig.tdsCalibrationFactor = factor;
+      next.tdsCalibrationFactor = factor;
       updated = true;
+    } else {
+      rejectConfigField(rejected, "tdsCalibrationFactor");
     }
   }
   if (!doc["enableFreeWater"].isNull()) {
-    deviceConfig.enableFreeWater = doc["enableFreeWater"].as<bool>();
+    next.enableFreeWater = doc["enableFreeWater"].as<bool>();
     updated = true;
   }
   if (!doc["relayActiveHigh"].isNull()) {
-    deviceConfig.relayActiveHigh = true;
+    next.relayActiveHigh = true;
     updated = true;
   }
   if (!doc["relay_active_high"].isNull()) {
-    deviceConfig.relayActiveHigh = true;
+    next.relayActiveHigh = true;
     updated = true;
   }
 
@@ -903,15 +1075,19 @@ void handleConfigUpdate(JsonDocument &doc) {
   if (!doc["cashPulseValue"].isNull()) {
     int value = doc["cashPulseValue"].as<int>();
     if (value > 0 && value <= 100000) {
-      deviceConfig.cashPulseValue = value;
+      next.cashPulseValue = value;
       updated = true;
+    } else {
+      rejectConfigField(rejected, "cashPulseValue");
     }
   }
   if (!doc["cashPulseGapMs"].isNull()) {
     unsigned long gap = doc["cashPulseGapMs"].as<unsigned long>();
     if (gap >= 20 && gap <= 1000) {
-      deviceConfig.cashPulseGapMs = gap;
+      next.cashPulseGapMs = gap;
       updated = true;
+    } else {
+      rejectConfigField(rejected, "cashPulseGapMs");
     }
   }
 
@@ -919,48 +1095,85 @@ void handleConfigUpdate(JsonDocument &doc) {
   if (!doc["paymentCheckInterval"].isNull()) {
     unsigned long interval = doc["paymentCheckInterval"].as<unsigned long>();
     if (interval >= 200 && interval <= 600000) {
-      deviceConfig.paymentCheckInterval = interval;
+      next.paymentCheckInterval = interval;
       updated = true;
+    } else {
+      rejectConfigField(rejected, "paymentCheckInterval");
     }
   }
   if (!doc["displayUpdateInterval"].isNull()) {
     unsigned long interval = doc["displayUpdateInterval"].as<unsigned long>();
     if (interval >= 50 && interval <= 10000) {
-      deviceConfig.displayUpdateInterval = interval;
+      next.displayUpdateInterval = interval;
       updated = true;
+    } else {
+      rejectConfigField(rejected, "displayUpdateInterval");
     }
   }
   if (!doc["tdsCheckInterval"].isNull()) {
     unsigned long interval = doc["tdsCheckInterval"].as<unsigned long>();
     if (interval >= 1000 && interval <= 600000) {
-      deviceConfig.tdsCheckInterval = interval;
+      next.tdsCheckInterval = interval;
       updated = true;
+    } else {
+      rejectConfigField(rejected, "tdsCheckInterval");
     }
   }
   if (!doc["heartbeatInterval"].isNull()) {
     unsigned long interval = doc["heartbeatInterval"].as<unsigned long>();
     if (interval >= 1000 && interval <= 3600000) {
-      deviceConfig.heartbeatInterval = interval;
+      next.heartbeatInterval = interval;
       updated = true;
+    } else {
+      rejectConfigField(rejected, "heartbeatInterval");
     }
   }
 
-  // Power Management Removed
+  // Night power save (local hours; start == end leaves no window)
+  if (!doc["enablePowerSave"].isNull()) {
+    next.enablePowerSave = doc["enablePowerSave"].as<bool>();
+    updated = true;
+  }
+  if (!doc["deepSleepStartHour"].isNull()) {
+    int hour = doc["deepSleepStartHour"].as<int>();
+    if (hour >= 0 && hour <= 23) {
+      next.deepSleepStartHour = hour;
+      updated = true;
+    } else {
+      rejectConfigField(rejected, "deepSleepStartHour");
+    }
+  }
+  if (!doc["deepSleepEndHour"].isNull()) {
+    int hour = doc["deepSleepEndHour"].as<int>();
+    if (hour >= 0 && hour <= 23) {
+      next.deepSleepEndHour = hour;
+      updated = true;
+    } else {
+      rejectConfigField(rejected, "deepSleepEndHour");
+    }
+  }
 
+  if (rejected) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Rejected: invalid %s", rejected);
+    LOG_WARN("Config update %s", msg);
+    publishLog("CONFIG", msg);
+    return;
+  }
   if (!updated) {
     return;
   }
 
-  // ... rest of function ...
-
-  deviceConfig.configured = (deviceConfig.wifi_ssid[0] != '\0' &&
-                             deviceConfig.mqtt_broker[0] != '\0');
+  next.configured = (next.wifi_ssid[0] != '\0' && next.mqtt_broker[0] != '\0');
+  validateConfigValues(next);
 
+  // Commit: the loop picks the new snapshot up at its next pass
+  const DeviceConfig prevConfig = deviceConfig;
+  deviceConfig = next;
   scheduleConfigSave();
 
-  String applyMode = doc["apply"] | "now";
-  applyMode.toLowerCase();
-  if (applyMode == "restart") {
+  const char *applyMode = doc["apply"] | "now";
+  if (strcasecmp(applyMode, "restart") == 0) {
     saveConfigToStorage();
     publishLog("CONFIG", "Saved. Restarting.");
     delay(200);
@@ -969,7 +1182,6 @@ void handleConfigUpdate(JsonDocument &doc) {
   }
 
   applyRuntimeConfig();
-  applyConfigStateEffects();
 
   if (wifiChanged) {
     setupWiFi();
@@ -981,9 +1193,9 @@ void handleConfigUpdate(JsonDocument &doc) {
   }
   beginNetworkApply(prevConfig, wifiChanged, mqttChanged || deviceIdChanged);
 
-  Serial.println("Config updated!");
+  LOG_INFO("Config updated from backend");
   publishLog("CONFIG", "Updated from backend");
-  publishStatus();
+  requestStatusPublish();
 }
 
 // ============================================
@@ -1025,7 +1237,6 @@ void processNetworkApply() {
   deviceConfig = prevNetworkConfig;
   saveConfigToStorage();
   applyRuntimeConfig();
-  applyConfigStateEffects();
 
   setupWiFi();
   mqttClient.disconnect();
@@ -1037,7 +1248,7 @@ void processNetworkApply() {
   pendingMqttApply = false;
 
   publishLog("CONFIG", "Network config rollback");
-  publishStatus();
+  requestStatusPublish();
 }
 
 // ============================================
@@ -1047,18 +1258,13 @@ void publishStatus() {
   if (!mqttClient.connected()) {
     return;
   }
-  JsonDocument doc;
+  JsonArenaScope scope(mqttArena);
+  JsonDocument doc(&mqttJsonAllocator);
 
   doc["device_id"] = deviceConfig.device_id;
 
   // MEDIUM FIX: Send state as string, not enum/int
-  const char *stateNames[] = {"IDLE", "ACTIVE", "DISPENSING", "PAUSED",
-                              "FREE_WATER"};
-  const int stateIndex = static_cast<int>(currentState);
-  doc["state"] = (stateIndex >= 0 && stateIndex < (int)(sizeof(stateNames) /
-                                                        sizeof(stateNames[0])))
-                     ? stateNames[stateIndex]
-                     : "UNKNOWN";
+  doc["state"] = getStateName(currentState);
 
   doc["balance"] = balance;
   doc["last_dispense"] =
@@ -1067,29 +1273,36 @@ void publishStatus() {
   doc["free_water_available"] =
       (millis() >= freeWaterAvailableTime && !freeWaterUsed);
 
-  String output;
-  serializeJson(doc, output);
+#if NOZZLE_COUNT > 1
+  // Top-level fields above describe nozzle 1
+  JsonArray list = doc["nozzles"].to<JsonArray>();
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    JsonObject n = list.add<JsonObject>();
+    n["nozzle"] = i + 1;
+    n["state"] = getStateName(nozzles[i].state);
+    n["balance"] = nozzles[i].balance;
+    n["last_dispense"] = nozzles[i].totalDispensedLiters;
+    n["price"] = nozzlePrice(i);
+  }
+#endif
 
   // QoS 1, Retained = true (for latest status)
-  mqttClient.publish(TOPIC_STATUS_OUT, output.c_str(), true);
+  publishJson(TOPIC_STATUS_OUT, doc, true);
 }
 
 void publishLog(const char *event, const char *message) {
-  JsonDocument doc;
+  if (!mqttClient.connected()) {
+    return;
+  }
+  JsonArenaScope scope(mqttArena);
+  JsonDocument doc(&mqttJsonAllocator);
 
   doc["device_id"] = deviceConfig.device_id;
   doc["event"] = event;
   doc["message"] = message;
 
-  String output;
-  serializeJson(doc, output);
-
-  if (!mqttClient.connected()) {
-    return;
-  }
-
   // QoS 1 for logs (important events)
-  mqttClient.publish(TOPIC_LOG_OUT, output.c_str(), false);
+  publishJson(TOPIC_LOG_OUT, doc, false);
 }
 
 void publishMQTT(const char *topic, const char *message) {
@@ -10,15 +10,42 @@
 // ============================================
 extern PubSubClient mqttClient;
 
+#define MQTT_BUFFER_SIZE 2048 // Largest packet (signed config messages)
+// JsonDocuments of one message (parsed, canonical, replies); nothing on the
+// heap while a message is handled. See getMqttArenaStats() for the margin.
+#define MQTT_JSON_ARENA_SIZE 8192
+
+// Inbound message kinds, each parsed through its own filter
+enum MqttMessageKind : uint8_t {
+  MQTT_MSG_PAYMENT,
+  MQTT_MSG_CONFIG, // Device, broadcast and group config
+  MQTT_MSG_COMMAND,
+  MQTT_MSG_OTA,
+  MQTT_MSG_LEDGER_ACK,
+  MQTT_MSG_KIND_COUNT
+};
+
+struct MqttArenaStats {
+  uint32_t capacity;
+  uint32_t highWater;                  // Most bytes ever in use
+  uint32_t peak[MQTT_MSG_KIND_COUNT];  // Most bytes one message took
+  uint32_t overflows;                  // Allocations the arena refused
+};
+
 // ============================================
 // FUNCTIONS
 // ============================================
 void setupMQTT();
 void reconnectMQTT();
+// Successful broker connects since boot (the first one included)
+uint32_t getMqttConnectCount();
+MqttArenaStats getMqttArenaStats();
+const char *mqttMessageKindName(uint8_t kind);
 void mqttCallback(char *topic, byte *payload, unsigned int length);
 void handleConfigUpdate(JsonDocument &doc);
+// Credit `amount` to `nozzle` (0-based; -1 = getFocusNozzle())
 void processPayment(int amount, const char *source, const char *txnId,
-                    const char *userId);
+                    const char *userId, int nozzle = -1);
 void publishStatus();
 void publishLog(const char *event, const char *message);
 void publishMQTT(const char *topic, const char *message);
@@ -0,0 +1,74 @@
+#ifndef OTA_DOWNLOAD_H
+#define OTA_DOWNLOAD_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ============================================
+// RESUMABLE HTTP OTA DOWNLOAD
+// ============================================
+// A group OTA makes every device hit the local OTA server at once. The
+// download is written to survive that:
+//
+//   - X-Firmware-Version is sent; 304 means this image is already running
+//   - Accept-Encoding: deflate; a zlib image is inflated on the fly (ROM
+//     miniz) into Update, X-Image-Size gives the flash size up front
+//   - a dropped or stalled transfer resumes with Range/If-Range from the
+//     last byte received, keeping the inflate state in RAM
+//   - 503 (server at its connection cap) is retried after Retry-After plus
+//     per-device jitter; other failures back off exponentially
+
+#define OTA_MAX_ATTEMPTS 10
+#define OTA_BACKOFF_BASE_MS 2000
+#define OTA_BACKOFF_MAX_MS 30000
+#define OTA_HTTP_TIMEOUT_MS 30000 // Server may hold a queued request ~20 s
+#define OTA_STALL_MS 15000        // No body bytes for this long: reconnect
+#define OTA_CHUNK_BYTES 1024
+
+// "bytes <start>-<end>/<total>" -> start, total
+inline bool otaParseContentRange(const char *s, uint32_t &start,
+                                 uint32_t &total) {
+  if (!s || strncmp(s, "bytes ", 6) != 0) {
+    return false;
+  }
+  char *end = nullptr;
+  const unsigned long a = strtoul(s + 6, &end, 10);
+  if (end == s + 6 || *end != '-') {
+    return false;
+  }
+  const char *p = end + 1;
+  const unsigned long b = strtoul(p, &end, 10);
+  if (end == p || *end != '/' || b < a) {
+    return false;
+  }
+  p = end + 1;
+  const unsigned long t = strtoul(p, &end, 10);
+  if (end == p || *end != '\0' || t <= b) {
+    return false;
+  }
+  start = (uint32_t)a;
+  total = (uint32_t)t;
+  return true;
+}
+
+// Wait before retry `attempt` (1 = first retry). A server Retry-After wins;
+// either way up to half the delay again is added from `seed` so a group
+// that was turned away together does not come back together.
+inline uint32_t otaRetryDelayMs(uint8_t attempt, uint32_t retryAfterS,
+                                uint32_t seed) {
+  uint32_t base;
+  if (retryAfterS > 0) {
+    base = retryAfterS * 1000UL;
+  } else {
+    const uint8_t shift = attempt > 1 ? (uint8_t)(attempt - 1) : 0;
+    base = shift >= 4 ? OTA_BACKOFF_MAX_MS : OTA_BACKOFF_BASE_MS << shift;
+    if (base > OTA_BACKOFF_MAX_MS) {
+      base = OTA_BACKOFF_MAX_MS;
+    }
+  }
+  const uint32_t h = (seed ^ attempt) * 2654435761u;
+  return base + (h >> 8) % (base / 2 + 1);
+}
+
+#endif
@@ -1,13 +1,22 @@
 #include "ota_handler.h"
 #include "config.h"
 #include "config_storage.h"
+#include "heap_monitor.h"
 #include "mqtt_handler.h"
+#include "ota_download.h"
+#include "uart_receiver.h"
 #include <ArduinoOTA.h>
 #include <HTTPClient.h>
 #include <Update.h>
 #include <WiFi.h>
+#include <esp32/rom/miniz.h>
+#include <esp_system.h>
 #include <esp_task_wdt.h>
 
+// Both update paths block the loop; have the Payment ESP32 inhibit the cash
+// acceptor first so no note is taken that cannot be applied.
+#define OTA_INHIBIT_SYNC_MS 300
+
 // ============================================
 // OTA SETUP
 // ============================================
@@ -37,6 +46,8 @@ void setupOTA() {
     }
     Serial.println("OTA: Start updating " + type);
     publishLog("OTA", ("Started: " + type).c_str());
+    setPaymentInhibit(INHIBIT_OTA, true);
+    syncPaymentStateNow(OTA_INHIBIT_SYNC_MS);
   });
 
   ArduinoOTA.onEnd([]() {
@@ -81,6 +92,7 @@ void setupOTA() {
 
     Serial.println(errMsg);
     publishLog("OTA_ERROR", errMsg);
+    setPaymentInhibit(INHIBIT_OTA, false);
   });
 
   ArduinoOTA.begin();
@@ -94,76 +106,276 @@ void setupOTA() {
 // ============================================
 // OTA HANDLE (Call in loop)
 // ============================================
-void handleOTA() { ArduinoOTA.handle(); }
+void handleOTA() {
+  HeapScope heapScope(HEAP_MOD_OTA);
+  ArduinoOTA.handle();
+}
 
 // ============================================
 // TRIGGER OTA UPDATE FROM URL (via MQTT)
 // ============================================
-void triggerOTAUpdate(const char *firmwareUrl) {
-  Serial.println("OTA: Starting HTTP update...");
-  Serial.print("URL: ");
-  Serial.println(firmwareUrl);
+enum OtaStep : uint8_t {
+  OTA_STEP_DONE,
+  OTA_STEP_CURRENT, // Server: this version is already running (304)
+  OTA_STEP_RETRY,
+  OTA_STEP_FAILED
+};
 
-  publishLog("OTA", "Starting HTTP update...");
+// One firmware transfer, kept across reconnects so it can resume
+struct OtaTransfer {
+  uint32_t received;  // Body bytes so far (compressed if deflate)
+  uint32_t bodySize;  // Full body size
+  uint32_t imageSize; // Firmware size written to flash
+  bool deflate;
+  bool begun; // Update.begin() done
+  bool inflateDone;
+  String etag;
+  tinfl_decompressor *inf; // Null: no RAM for inflate, identity only
+  uint8_t *dict;           // TINFL_LZ_DICT_SIZE circular output window
+  size_t dictOfs;
+};
 
-  HTTPClient http;
-  http.begin(firmwareUrl);
+static void otaResetTransfer(OtaTransfer &t) {
+  if (t.begun) {
+    Update.abort();
+  }
+  t.received = 0;
+  t.bodySize = 0;
+  t.imageSize = 0;
+  t.deflate = false;
+  t.begun = false;
+  t.inflateDone = false;
+  t.etag = "";
+  t.dictOfs = 0;
+}
 
-  int httpCode = http.GET();
-  if (httpCode != HTTP_CODE_OK) {
-    Serial.printf("OTA: HTTP error: %d\n", httpCode);
-    publishLog("OTA_ERROR", "HTTP download failed");
-    http.end();
-    return;
+// Inflate `len` zlib bytes into Update
+static bool otaInflateWrite(OtaTransfer &t, const uint8_t *in, size_t len) {
+  for (;;) {
+    size_t inBytes = len;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - t.dictOfs;
+    const tinfl_status st = tinfl_decompress(
+        t.inf, in, &inBytes, t.dict, t.dict + t.dictOfs, &outBytes,
+        TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+    in += inBytes;
+    len -= inBytes;
+    if (outBytes > 0 &&
+        Update.write(t.dict + t.dictOfs, outBytes) != outBytes) {
+      return false;
+    }
+    t.dictOfs = (t.dictOfs + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    if (st < 0) {
+      return false;
+    }
+    if (st == TINFL_STATUS_DONE) {
+      t.inflateDone = true;
+      return true;
+    }
+    if (st == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0) {
+      return true;
+    }
   }
+}
 
-  int contentLength = http.getSize();
-  if (contentLength <= 0) {
+// Full (200) response: start the flash write
+static bool otaBeginTransfer(HTTPClient &http, OtaTransfer &t) {
+  otaResetTransfer(t);
+  const int size = http.getSize();
+  t.deflate = t.inf && http.header("Content-Encoding") == "deflate";
+  const long imageSize =
+      t.deflate ? http.header("X-Image-Size").toInt() : size;
+  if (size <= 0 || imageSize <= 0) {
     Serial.println("OTA: Invalid content length");
     publishLog("OTA_ERROR", "Invalid firmware size");
-    http.end();
-    return;
+    return false;
   }
+  t.bodySize = (uint32_t)size;
+  t.imageSize = (uint32_t)imageSize;
+  t.etag = http.header("ETag");
+  Serial.printf("OTA: Firmware size: %u bytes (%s, %u on the wire)\n",
+                (unsigned)t.imageSize, t.deflate ? "deflate" : "raw",
+                (unsigned)t.bodySize);
 
-  Serial.printf("OTA: Firmware size: %d bytes\n", contentLength);
-
-  bool canBegin = Update.begin(contentLength);
-  if (!canBegin) {
+  if (!Update.begin(t.imageSize)) {
     Serial.println("OTA: Not enough space");
     publishLog("OTA_ERROR", "Not enough flash space");
+    return false;
+  }
+  t.begun = true;
+  if (t.deflate) {
+    tinfl_init(t.inf);
+  }
+  return true;
+}
+
+static OtaStep otaDownloadOnce(const char *firmwareUrl, OtaTransfer &t,
+                               uint32_t &retryAfterS) {
+  retryAfterS = 0;
+  HTTPClient http;
+  // HTTP/1.0: no chunked bodies, and HTTPClient adds no Accept-Encoding
+  http.useHTTP10(true);
+  http.setTimeout(OTA_HTTP_TIMEOUT_MS);
+  if (!http.begin(firmwareUrl)) {
+    publishLog("OTA_ERROR", "Invalid firmware URL");
+    return OTA_STEP_FAILED;
+  }
+  static const char *headerKeys[] = {"Content-Encoding", "Content-Range",
+                                     "ETag", "Retry-After", "X-Image-Size"};
+  http.collectHeaders(headerKeys, sizeof(headerKeys) / sizeof(headerKeys[0]));
+  http.addHeader("X-Device-Id", deviceConfig.device_id);
+  http.addHeader("X-Firmware-Version", FIRMWARE_VERSION);
+  if (t.inf) {
+    http.addHeader("Accept-Encoding", "deflate");
+  }
+  if (t.received > 0) {
+    http.addHeader("Range", "bytes=" + String(t.received) + "-");
+    if (t.etag.length() > 0) {
+      http.addHeader("If-Range", t.etag);
+    }
+  }
+
+  const int httpCode = http.GET();
+  OtaStep step = OTA_STEP_RETRY;
+  if (httpCode == HTTP_CODE_NOT_MODIFIED) {
+    step = OTA_STEP_CURRENT;
+  } else if (httpCode == HTTP_CODE_SERVICE_UNAVAILABLE) {
+    retryAfterS = (uint32_t)http.header("Retry-After").toInt();
+    Serial.printf("OTA: Server busy, retry in %us\n", (unsigned)retryAfterS);
+  } else if (httpCode == HTTP_CODE_PARTIAL_CONTENT && t.begun) {
+    uint32_t start = 0;
+    uint32_t total = 0;
+    if (!otaParseContentRange(http.header("Content-Range").c_str(), start,
+                              total) ||
+        start != t.received || total != t.bodySize) {
+      Serial.println("OTA: Range mismatch, starting over");
+      otaResetTransfer(t);
+    } else {
+      Serial.printf("OTA: Resuming at %u bytes\n", (unsigned)start);
+    }
+  } else if (httpCode == HTTP_CODE_OK) {
+    // Also when the image changed under a resume (If-Range failed)
+    if (!otaBeginTransfer(http, t)) {
+      step = OTA_STEP_FAILED;
+    }
+  } else if (httpCode < 0 || httpCode >= 500) {
+    Serial.printf("OTA: HTTP error: %d\n", httpCode);
+  } else {
+    Serial.printf("OTA: HTTP error: %d\n", httpCode);
+    publishLog("OTA_ERROR", "HTTP download failed");
+    step = OTA_STEP_FAILED;
+  }
+  // Only a started 200 or a matching 206 carries body to write
+  if (step != OTA_STEP_RETRY || !t.begun ||
+      (httpCode != HTTP_CODE_OK && httpCode != HTTP_CODE_PARTIAL_CONTENT)) {
     http.end();
-    return;
+    return step;
   }
 
-  // Get stream
+  // Stream the body; a drop or stall leaves `received` for the next Range
   WiFiClient *stream = http.getStreamPtr();
+  static uint8_t buff[OTA_CHUNK_BYTES];
+  static unsigned long lastReport = 0;
+  unsigned long lastDataMs = millis();
 
-  // Write firmware
-  size_t written = 0;
-  uint8_t buff[128];
-  unsigned long lastReport = 0;
-
-  while (http.connected() && written < contentLength) {
+  while (t.received < t.bodySize) {
     esp_task_wdt_reset();
 
-    size_t available = stream->available();
-    if (available) {
-      int c = stream->readBytes(buff, min(available, sizeof(buff)));
-      written += Update.write(buff, c);
+    const size_t available = stream->available();
+    if (available == 0) {
+      if (!http.connected() || millis() - lastDataMs > OTA_STALL_MS) {
+        break;
+      }
+      delay(1);
+      continue;
+    }
+    const size_t want = min(available, (size_t)(t.bodySize - t.received));
+    const int c = stream->readBytes(buff, min(want, sizeof(buff)));
+    if (c <= 0) {
+      continue;
+    }
+    lastDataMs = millis();
+    const bool ok = t.deflate ? otaInflateWrite(t, buff, c)
+                              : Update.write(buff, c) == (size_t)c;
+    if (!ok) {
+      Serial.printf("OTA: Write failed: %s\n", Update.errorString());
+      publishLog("OTA_ERROR", t.deflate ? "Inflate/flash write failed"
+                                        : "Flash write failed");
+      http.end();
+      return OTA_STEP_FAILED;
+    }
+    t.received += c;
+
+    // Report progress every 5 seconds
+    if (millis() - lastReport > 5000) {
+      int percent = (int)((uint64_t)t.received * 100 / t.bodySize);
+      Serial.printf("OTA: %d%%\r", percent);
+
+      char msg[32];
+      snprintf(msg, sizeof(msg), "Progress: %d%%", percent);
+      publishLog("OTA", msg);
+
+      lastReport = millis();
+    }
+  }
+  http.end();
+  return t.received >= t.bodySize ? OTA_STEP_DONE : OTA_STEP_RETRY;
+}
+
+static void runHttpUpdate(const char *firmwareUrl) {
+  Serial.println("OTA: Starting HTTP update...");
+  Serial.print("URL: ");
+  Serial.println(firmwareUrl);
 
-      // Report progress every 5 seconds
-      if (millis() - lastReport > 5000) {
-        int percent = (written * 100) / contentLength;
-        Serial.printf("OTA: %d%%\r", percent);
+  publishLog("OTA", "Starting HTTP update...");
 
-        char msg[32];
-        snprintf(msg, sizeof(msg), "Progress: %d%%", percent);
-        publishLog("OTA", msg);
+  OtaTransfer t;
+  t.inf = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+  t.dict = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE);
+  if (!t.inf || !t.dict) {
+    free(t.inf); // Not enough RAM to inflate: ask for the raw image
+    free(t.dict);
+    t.inf = nullptr;
+    t.dict = nullptr;
+  }
+  t.begun = false;
+  otaResetTransfer(t);
 
-        lastReport = millis();
+  const uint32_t seed = esp_random();
+  uint32_t retryAfterS = 0;
+  OtaStep step = OTA_STEP_RETRY;
+  for (uint8_t attempt = 0; attempt < OTA_MAX_ATTEMPTS; attempt++) {
+    if (attempt > 0) {
+      const unsigned long waitMs = otaRetryDelayMs(attempt, retryAfterS, seed);
+      const unsigned long start = millis();
+      while (millis() - start < waitMs) {
+        esp_task_wdt_reset();
+        delay(100);
       }
     }
-    delay(1);
+    step = otaDownloadOnce(firmwareUrl, t, retryAfterS);
+    if (step != OTA_STEP_RETRY) {
+      break;
+    }
+  }
+
+  free(t.inf);
+  free(t.dict);
+
+  if (step == OTA_STEP_CURRENT) {
+    Serial.println("OTA: Already running this firmware");
+    publishLog("OTA", "Already up to date (" FIRMWARE_VERSION ")");
+    return;
+  }
+  if (step != OTA_STEP_DONE || (t.deflate && !t.inflateDone)) {
+    if (step == OTA_STEP_RETRY) {
+      publishLog("OTA_ERROR", "HTTP download failed");
+    } else if (step == OTA_STEP_DONE) {
+      publishLog("OTA_ERROR", "Compressed image truncated");
+    }
+    if (t.begun) {
+      Update.abort();
+    }
+    return;
   }
 
   if (Update.end()) {
@@ -181,6 +393,16 @@ void triggerOTAUpdate(const char *firmwareUrl) {
     Serial.printf("OTA: Error: %s\n", Update.errorString());
     publishLog("OTA_ERROR", Update.errorString());
   }
+}
 
-  http.end();
+void triggerOTAUpdate(const char *firmwareUrl) {
+  HeapScope heapScope(HEAP_MOD_OTA);
+  setPaymentInhibit(INHIBIT_OTA, true);
+  if (!syncPaymentStateNow(OTA_INHIBIT_SYNC_MS)) {
+    Serial.println("OTA: Payment ESP did not confirm inhibit");
+  }
+
+  runHttpUpdate(firmwareUrl); // Restarts on success
+
+  setPaymentInhibit(INHIBIT_OTA, false);
 }
@@ -0,0 +1,128 @@
+#include "power_save.h"
+#include "../shared/logger.h"
+#include "config.h"
+#include "display.h"
+#include "mqtt_handler.h"
+#include "state_machine.h"
+#include <Arduino.h>
+#include <WiFi.h>
+#include <time.h>
+
+// ============================================
+// POWER SAVE STATE
+// ============================================
+static PowerMode powerMode = POWER_MODE_DAY;
+static PowerStats powerStats;
+static unsigned long lastActivityMs = 0;
+static unsigned long modeSinceMs = 0; // Start of the not yet accounted span
+static unsigned long lastCheckMs = 0;
+static bool timeSyncStarted = false;
+
+void initPowerSave() {
+  memset(&powerStats, 0, sizeof(powerStats));
+  powerMode = POWER_MODE_DAY;
+  lastActivityMs = millis();
+  modeSinceMs = lastActivityMs;
+}
+
+void startTimeSync() {
+  if (timeSyncStarted) {
+    return;
+  }
+  timeSyncStarted = true;
+  configTzTime(LOCAL_TZ, "pool.ntp.org", "time.google.com");
+  LOG_INFO("SNTP started (TZ %s)", LOCAL_TZ);
+}
+
+bool isTimeSynced() {
+  return time(nullptr) > 1600000000; // Same test as the session ledger
+}
+
+bool isPowerSaveNight() { return powerMode == POWER_MODE_NIGHT; }
+
+static void accountModeTime() {
+  const unsigned long now = millis();
+  powerStats.modeMs[powerMode] += now - modeSinceMs;
+  modeSinceMs = now;
+}
+
+const PowerStats &getPowerStats() {
+  accountModeTime();
+  return powerStats;
+}
+
+static void applyPowerMode(PowerMode mode) {
+  if (mode == powerMode) {
+    return;
+  }
+  accountModeTime();
+  powerMode = mode;
+
+  if (mode == POWER_MODE_NIGHT) {
+    powerStats.nightEntries++;
+    lcd.noBacklight();
+    WiFi.setSleep(WIFI_PS_MIN_MODEM);
+    setCpuFrequencyMhz(POWER_NIGHT_CPU_MHZ);
+    // Keepalive is negotiated at CONNECT: reconnect (all nozzles are idle)
+    mqttClient.setKeepAlive(POWER_NIGHT_KEEPALIVE_S);
+    if (mqttClient.connected()) {
+      mqttClient.disconnect();
+    }
+    LOG_INFO("Power save: night mode");
+  } else {
+    setCpuFrequencyMhz(POWER_DAY_CPU_MHZ);
+    WiFi.setSleep(WIFI_PS_NONE);
+    lcd.backlight();
+    // Pinging more often than negotiated is harmless; no reconnect, which
+    // could otherwise be held off by a session starting right now
+    mqttClient.setKeepAlive(POWER_DAY_KEEPALIVE_S);
+    LOG_INFO("Power save: day mode");
+  }
+}
+
+void powerNoteActivity() {
+  lastActivityMs = millis();
+  if (powerMode == POWER_MODE_NIGHT) {
+    powerStats.wakes++;
+    applyPowerMode(POWER_MODE_DAY);
+  }
+}
+
+// ============================================
+// PROCESS (every loop)
+// ============================================
+void processPowerSave() {
+  const bool allIdle = areAllNozzlesIdle();
+  if (!allIdle) {
+    if (powerMode == POWER_MODE_NIGHT) {
+      powerNoteActivity(); // Credit arrived (cash or MQTT)
+    } else {
+      lastActivityMs = millis();
+    }
+  }
+
+  const unsigned long now = millis();
+  if (now - lastCheckMs < POWER_CHECK_MS) {
+    return;
+  }
+  lastCheckMs = now;
+
+#ifdef POWER_SENSE_PIN
+  const float ma = analogReadMilliVolts(POWER_SENSE_PIN) * POWER_SENSE_MA_PER_MV;
+  powerStats.sampleSumMa[powerMode] += (uint32_t)ma;
+  powerStats.samples[powerMode]++;
+#endif
+
+  int hour = -1;
+  const bool synced = isTimeSynced();
+  if (synced) {
+    const time_t t = time(nullptr);
+    struct tm local;
+    localtime_r(&t, &local);
+    hour = local.tm_hour;
+  }
+  applyPowerMode(powerPickMode(config.enablePowerSave, synced, hour,
+                               config.deepSleepStartHour,
+                               config.deepSleepEndHour, allIdle,
+                               now - lastActivityMs));
+}
@@ -0,0 +1,120 @@
+#ifndef POWER_SAVE_H
+#define POWER_SAVE_H
+
+#include <stdint.h>
+
+// ============================================
+// SCHEDULED POWER SAVE (NIGHT MODE)
+// ============================================
+// With enablePowerSave set and the clock synced over SNTP, the Main ESP32
+// drops to night mode between deepSleepStartHour and deepSleepEndHour (local
+// time) while every nozzle is idle:
+//
+//   - LCD backlight off (the display is not redrawn)
+//   - WiFi modem sleep: the radio wakes for the AP's DTIM beacons only
+//   - MQTT keepalive raised so pings rarely wake the radio
+//   - CPU 240 -> 80 MHz (APB stays at 80 MHz, UART baud rates unchanged)
+//
+// Nothing is powered down, so buttons and UART cash are still seen at once:
+// a button press or a non-idle nozzle (cash credited, MQTT payment) returns
+// to day mode in the same loop pass and holds it for POWER_WAKE_HOLD_MS.
+// The Payment ESP32 keeps counting pulses regardless.
+
+// Local time zone for the night window (POSIX TZ). Uzbekistan, UTC+5 no DST.
+#ifndef LOCAL_TZ
+#define LOCAL_TZ "<+05>-5"
+#endif
+
+#define POWER_WAKE_HOLD_MS 120000 // Full power after the last activity
+#define POWER_CHECK_MS 1000       // Mode check / current sample period
+#define POWER_DAY_CPU_MHZ 240
+#define POWER_NIGHT_CPU_MHZ 80
+#define POWER_DAY_KEEPALIVE_S 60
+#define POWER_NIGHT_KEEPALIVE_S 240
+
+// Nominal Main board draw per mode (ESP32 datasheet figures plus the LCD
+// backlight). Used when no current sense is fitted; with POWER_SENSE_PIN
+// defined (shunt amplifier into an ADC pin) the measured average is used.
+#define POWER_DAY_NOMINAL_MA 150
+#define POWER_NIGHT_NOMINAL_MA 35
+#ifndef POWER_SENSE_MA_PER_MV
+#define POWER_SENSE_MA_PER_MV 1.0f // Amplifier gain: mA per mV at the pin
+#endif
+
+enum PowerMode : uint8_t { POWER_MODE_DAY, POWER_MODE_NIGHT, POWER_MODE_COUNT };
+
+struct PowerStats {
+  uint32_t modeMs[POWER_MODE_COUNT]; // Time spent in each mode since boot
+  uint32_t nightEntries;
+  uint32_t wakes; // Night mode left early for a customer
+  uint32_t samples[POWER_MODE_COUNT];
+  uint64_t sampleSumMa[POWER_MODE_COUNT];
+};
+
+// True if `hour` lies in [start, end), wrapping past midnight when
+// start > end. start == end (or any hour out of 0-23) is an empty window.
+inline bool powerInNightWindow(int hour, int startHour, int endHour) {
+  if (hour < 0 || hour > 23 || startHour < 0 || startHour > 23 ||
+      endHour < 0 || endHour > 23 || startHour == endHour) {
+    return false;
+  }
+  if (startHour < endHour) {
+    return hour >= startHour && hour < endHour;
+  }
+  return hour >= startHour || hour < endHour;
+}
+
+// `hour` is only meaningful when `timeSynced`
+inline PowerMode powerPickMode(bool enabled, bool timeSynced, int hour,
+                               int startHour, int endHour, bool allIdle,
+                               uint32_t msSinceActivity) {
+  if (!enabled || !timeSynced || !allIdle ||
+      msSinceActivity < POWER_WAKE_HOLD_MS) {
+    return POWER_MODE_DAY;
+  }
+  return powerInNightWindow(hour, startHour, endHour) ? POWER_MODE_NIGHT
+                                                      : POWER_MODE_DAY;
+}
+
+// Average draw of `mode`: measured if sampled, else the nominal figure
+inline uint32_t powerModeMa(const PowerStats &s, PowerMode mode) {
+  if (mode >= POWER_MODE_COUNT) {
+    return 0;
+  }
+  if (s.samples[mode] > 0) {
+    return (uint32_t)(s.sampleSumMa[mode] / s.samples[mode]);
+  }
+  return mode == POWER_MODE_NIGHT ? POWER_NIGHT_NOMINAL_MA
+                                  : POWER_DAY_NOMINAL_MA;
+}
+
+// Time-weighted average draw since boot
+inline uint32_t powerAverageMa(const PowerStats &s) {
+  uint64_t totalMs = 0;
+  uint64_t weighted = 0;
+  for (uint8_t m = 0; m < POWER_MODE_COUNT; m++) {
+    totalMs += s.modeMs[m];
+    weighted += (uint64_t)s.modeMs[m] * powerModeMa(s, (PowerMode)m);
+  }
+  return totalMs ? (uint32_t)(weighted / totalMs)
+                 : powerModeMa(s, POWER_MODE_DAY);
+}
+
+inline const char *powerModeName(uint8_t mode) {
+  return mode == POWER_MODE_NIGHT ? "night" : "day";
+}
+
+// ============================================
+// FUNCTIONS
+// ============================================
+void initPowerSave();
+void startTimeSync(); // Once WiFi is up (SNTP keeps resyncing on its own)
+bool isTimeSynced();
+void processPowerSave(); // Every loop
+// Button press or other customer activity: back to day mode now
+void powerNoteActivity();
+bool isPowerSaveNight();
+// Snapshot with the time in the current mode accounted up to now
+const PowerStats &getPowerStats();
+
+#endif
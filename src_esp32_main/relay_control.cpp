@@ -1,6 +1,6 @@
 #include "relay_control.h"
+#include "../shared/logger.h"
 #include "config.h"
-#include "debug.h"
 #include "hardware.h"
 #include <Arduino.h>
 
@@ -11,18 +11,22 @@ static int relayOnLevel() { return HIGH; }
 
 static int relayOffLevel() { return LOW; }
 
-void setRelay(bool on) {
-  config.relayActiveHigh = true; // keep runtime config aligned with HW policy
+void setNozzleRelay(uint8_t nozzle, bool on) {
+  if (nozzle >= NOZZLE_COUNT) {
+    return;
+  }
   int level = on ? relayOnLevel() : relayOffLevel();
-  digitalWrite(RELAY_PIN, level);
+  digitalWrite(NOZZLE_RELAY_PINS[nozzle], level);
 
-  DEBUG_PRINT("RELAY CMD: ");
-  DEBUG_PRINT(on ? "ON" : "OFF");
-  DEBUG_PRINT(" | mode=");
-  DEBUG_PRINT("ACTIVE_HIGH");
-  DEBUG_PRINT(" (Pin Level: ");
-  DEBUG_PRINT(level == HIGH ? "HIGH" : "LOW");
-  DEBUG_PRINTLN(")");
+  LOG_DEBUG("Relay %u %s (pin %s)", (unsigned)nozzle, on ? "ON" : "OFF",
+            level == HIGH ? "HIGH" : "LOW");
 }
 
-bool isRelayOn() { return digitalRead(RELAY_PIN) == relayOnLevel(); }
+bool isNozzleRelayOn(uint8_t nozzle) {
+  return nozzle < NOZZLE_COUNT &&
+         digitalRead(NOZZLE_RELAY_PINS[nozzle]) == relayOnLevel();
+}
+
+void setRelay(bool on) { setNozzleRelay(0, on); }
+
+bool isRelayOn() { return isNozzleRelayOn(0); }
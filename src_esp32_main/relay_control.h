@@ -2,9 +2,14 @@
 #define RELAY_CONTROL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // Relay control helpers (respect active-high/active-low config)
-void setRelay(bool on);
+void setRelay(bool on); // Nozzle 0
 bool isRelayOn();
 
+// Valve relay of one nozzle (0..NOZZLE_COUNT-1)
+void setNozzleRelay(uint8_t nozzle, bool on);
+bool isNozzleRelayOn(uint8_t nozzle);
+
 #endif
@@ -16,15 +16,20 @@ int tdsPPM = 0;
 // ============================================
 void initSensors() {
   pinMode(TDS_PIN, INPUT);
-  pinMode(FLOW_SENSOR_PIN, INPUT_PULLUP);
-  attachInterrupt(digitalPinToInterrupt(FLOW_SENSOR_PIN), flowSensorISR,
-                  RISING);
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    pinMode(NOZZLE_FLOW_PINS[i], INPUT_PULLUP);
+    attachInterruptArg(digitalPinToInterrupt(NOZZLE_FLOW_PINS[i]),
+                       flowSensorISR, &nozzles[i], RISING);
+  }
 }
 
 // ============================================
 // FLOW SENSOR ISR
 // ============================================
-void IRAM_ATTR flowSensorISR() { flowPulseCount++; }
+// One handler for all nozzles; `arg` is the nozzle's NozzleSession
+void IRAM_ATTR flowSensorISR(void *arg) {
+  static_cast<NozzleSession *>(arg)->flowPulseCount++;
+}
 
 // ============================================
 // TDS SENSOR
@@ -15,6 +15,6 @@ void publishTDS();
 // ============================================
 // FLOW SENSOR ISR
 // ============================================
-void flowSensorISR();
+void flowSensorISR(void *arg);
 
 #endif
@@ -2,32 +2,41 @@
 #include "config.h"
 #include "config_storage.h"
 #include "hardware.h"
+#include "heap_monitor.h"
 #include "mqtt_handler.h"
 #include "relay_control.h"
 #include "sensors.h"
 #include "state_machine.h"
+#include "uart_receiver.h"
+#include <ArduinoJson.h>
 #include <WiFi.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
-static void copyToBuffer(char *dst, size_t dstSize, const String &src) {
-  size_t n = src.length();
+// ============================================
+// CONFIGURATION
+// ============================================
+#define SERIAL_CMD_MAX_LEN 1536 // Longest line: a full CFG_FRAME
+#define SERIAL_CMD_MAX_ARGS 3
+#define SERIAL_CMD_NAME_MAX 32
+#define SERIAL_REPLY_MAX 96
+
+// ============================================
+// HELPERS
+// ============================================
+static void copyToBuffer(char *dst, size_t dstSize, const char *src) {
+  size_t n = strlen(src);
   if (n >= dstSize) {
     n = dstSize - 1;
   }
-  memcpy(dst, src.c_str(), n);
+  memcpy(dst, src, n);
   dst[n] = '\0';
 }
 
-static unsigned long normalizeSecondsOrMs(unsigned long value) {
-  if (value == 0) {
-    return value;
-  }
-  if (value <= 3600UL) {
-    return value * 1000UL;
-  }
-  return value;
-}
-
 static float normalizeFreeWaterAmount(float value) {
   // Accept liters (<= 5.0) or ml (> 5.0)
   if (value <= 0.0f) {
@@ -39,508 +48,968 @@ static float normalizeFreeWaterAmount(float value) {
   return value;
 }
 
+static char *trimInPlace(char *s) {
+  while (*s && isspace((unsigned char)*s)) {
+    s++;
+  }
+  char *end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+  return s;
+}
+
 // ============================================
-// INITIALIZATION
+// TYPED ARGUMENT PARSERS (strict: whole token must parse)
 // ============================================
-void initSerialConfig() {
-  Serial.println("\n╔════════════════════════════════════════╗");
-  Serial.println("║   eWater Vending Machine v2.0         ║");
-  Serial.println("║   Serial Configuration Interface       ║");
-  Serial.println("╚════════════════════════════════════════╝");
-  Serial.println("\nType 'HELP' for available commands\n");
+static bool parseLongArg(const char *s, long &out) {
+  if (!s || !*s) {
+    return false;
+  }
+  char *end = nullptr;
+  errno = 0;
+  long v = strtol(s, &end, 10);
+  if (errno != 0 || end == s || *end != '\0') {
+    return false;
+  }
+  out = v;
+  return true;
+}
+
+static bool parseFloatArg(const char *s, float &out) {
+  if (!s || !*s) {
+    return false;
+  }
+  char *end = nullptr;
+  float v = strtof(s, &end);
+  if (end == s || *end != '\0') {
+    return false;
+  }
+  out = v;
+  return true;
+}
+
+static bool parseFlagArg(const char *s, bool &out) {
+  if (s && s[0] && s[1] == '\0' && (s[0] == '0' || s[0] == '1')) {
+    out = (s[0] == '1');
+    return true;
+  }
+  return false;
 }
 
 // ============================================
-// HANDLE SERIAL INPUT
+// REPLIES (suppressed while a batch is running)
 // ============================================
-void handleSerialConfig() {
-  static String buffer;
-  while (Serial.available()) {
-    char c = (char)Serial.read();
+static bool batchActive = false;
+static uint16_t batchOkCount = 0;
+static uint16_t batchErrorCount = 0;
+static char batchFirstError[SERIAL_REPLY_MAX];
+
+static void reply(bool ok, const char *fmt, va_list ap) {
+  char msg[SERIAL_REPLY_MAX];
+  vsnprintf(msg, sizeof(msg), fmt, ap);
+
+  if (!batchActive) {
+    Serial.print(ok ? "OK: " : "ERROR: ");
+    Serial.println(msg);
+    return;
+  }
+  if (ok) {
+    batchOkCount++;
+    return;
+  }
+  if (batchErrorCount == 0) {
+    copyToBuffer(batchFirstError, sizeof(batchFirstError), msg);
+  }
+  batchErrorCount++;
+}
 
-    if (c == '\n' || c == '\r') {
-      if (buffer.length() > 0) {
-        buffer.trim();
-        if (buffer.length() > 0) {
-          processCommand(buffer);
-        }
-        buffer = "";
-      }
-      continue;
-    }
+static void replyOk(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  reply(true, fmt, ap);
+  va_end(ap);
+}
 
-    if (buffer.length() < 128) {
-      buffer += c;
-    }
+static void replyError(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  reply(false, fmt, ap);
+  va_end(ap);
+}
+
+static void replyNote(const char *msg) {
+  if (!batchActive) {
+    Serial.println(msg);
   }
 }
 
 // ============================================
-// PROCESS COMMAND
+// COMMAND HANDLERS
 // ============================================
-void processCommand(String cmd) {
-  String cmdUpper = cmd;
-  cmdUpper.toUpperCase();
+typedef void (*SerialCmdHandler)(char **args);
+
+static void cmdApplyConfig(char **) {
+  applyRuntimeConfig();
+  setupWiFi();
+  mqttClient.disconnect();
+  mqttClient.setServer(deviceConfig.mqtt_broker, deviceConfig.mqtt_port);
+  reconnectMQTT();
+  replyOk("Configuration applied");
+}
 
-  Serial.print("> ");
-  Serial.println(cmd);
+static void cmdBatchBegin(char **) {
+  batchActive = true;
+  batchOkCount = 0;
+  batchErrorCount = 0;
+  batchFirstError[0] = '\0';
+  Serial.println("OK: BATCH started");
+}
 
-  // GET_CONFIG
-  if (cmdUpper == "GET_CONFIG") {
-    printCurrentConfig();
-    Serial.println("OK");
-  }
-
-  // SET_WIFI:ssid:password
-  else if (cmdUpper.startsWith("SET_WIFI:")) {
-    int idx1 = cmd.indexOf(':');
-    int idx2 = cmd.indexOf(':', idx1 + 1);
-
-    if (idx2 > 0) {
-      String ssid = cmd.substring(idx1 + 1, idx2);
-      String pass = cmd.substring(idx2 + 1);
-
-      if (ssid.length() > 0 && ssid.length() < 32 && pass.length() < 64) {
-        copyToBuffer(deviceConfig.wifi_ssid, sizeof(deviceConfig.wifi_ssid),
-                     ssid);
-        copyToBuffer(deviceConfig.wifi_password,
-                     sizeof(deviceConfig.wifi_password), pass);
-        deviceConfig.configured = true;
-        Serial.println("OK: WiFi configured");
-        Serial.println("Note: Use SAVE_CONFIG to persist");
-      } else {
-        Serial.println("ERROR: Invalid SSID length");
+static void cmdBatchEnd(char **) {
+  if (!batchActive) {
+    replyError("No batch in progress");
+    return;
+  }
+  batchActive = false;
+  if (batchErrorCount == 0) {
+    replyOk("BATCH %u commands", (unsigned)batchOkCount);
+  } else {
+    replyError("BATCH %u ok, %u failed (first: %s)", (unsigned)batchOkCount,
+               (unsigned)batchErrorCount, batchFirstError);
+  }
+}
+
+static void cmdFactoryReset(char **) {
+  Serial.println("WARNING: This will reset all settings!");
+  Serial.println("Type 'YES' to confirm...");
+
+  unsigned long startTime = millis();
+  while (millis() - startTime < 10000) {
+    if (Serial.available()) {
+      char confirm[8];
+      size_t len = Serial.readBytesUntil('\n', confirm, sizeof(confirm) - 1);
+      confirm[len] = '\0';
+      char *answer = trimInPlace(confirm);
+
+      if (strcasecmp(answer, "YES") == 0) {
+        loadDefaultConfig();
+        saveConfigToStorage();
+        Serial.println("OK: Factory reset completed");
+        Serial.println("Device will restart in 3 seconds...");
+        delay(3000);
+        ESP.restart();
+        return;
       }
-    } else {
-      Serial.println("ERROR: Format: SET_WIFI:ssid:password");
+      Serial.println("CANCELLED: Factory reset aborted");
+      return;
     }
+    delay(10);
   }
+  Serial.println("TIMEOUT: Factory reset aborted");
+}
 
-  // SET_MQTT:broker:port
-  else if (cmdUpper.startsWith("SET_MQTT:")) {
-    int idx1 = cmd.indexOf(':');
-    int idx2 = cmd.indexOf(':', idx1 + 1);
+static void cmdGetConfig(char **) {
+  printCurrentConfig();
+  Serial.println("OK");
+}
 
-    if (idx2 > 0) {
-      String broker = cmd.substring(idx1 + 1, idx2);
-      int port = cmd.substring(idx2 + 1).toInt();
+static void cmdGetGroup(char **) {
+  if (deviceConfig.groupId[0] != '\0') {
+    Serial.print("Group ID: ");
+    Serial.println(deviceConfig.groupId);
+  } else {
+    Serial.println("Group ID: (not set)");
+  }
+}
 
-      if (broker.length() > 0 && broker.length() < 128 && port > 0 &&
-          port < 65536) {
-        copyToBuffer(deviceConfig.mqtt_broker, sizeof(deviceConfig.mqtt_broker),
-                     broker);
-        deviceConfig.mqtt_port = port;
-        Serial.println("OK: MQTT broker configured");
-        Serial.println("Note: Use SAVE_CONFIG to persist");
-      } else {
-        Serial.println("ERROR: Invalid broker or port");
-      }
-    } else {
-      Serial.println("ERROR: Format: SET_MQTT:broker:port");
-    }
+static void cmdGetStatus(char **) { showStatus(); }
+
+static void cmdHelp(char **) { showHelp(); }
+
+static void cmdLoadConfig(char **) {
+  loadConfigFromStorage();
+  replyOk("Configuration reloaded from EEPROM");
+  if (!batchActive) {
+    printCurrentConfig();
   }
+}
 
-  // SET_MQTT_AUTH:username:password
-  else if (cmdUpper.startsWith("SET_MQTT_AUTH:")) {
-    int idx1 = cmd.indexOf(':');
-    int idx2 = cmd.indexOf(':', idx1 + 1);
+static void cmdRestart(char **) {
+  Serial.println("OK: Restarting device...");
+  delay(500);
+  ESP.restart();
+}
 
-    if (idx2 > 0) {
-      String user = cmd.substring(idx1 + 1, idx2);
-      String pass = cmd.substring(idx2 + 1);
+static void cmdSaveConfig(char **) {
+  saveConfigToStorage();
+  replyOk("Configuration saved to EEPROM");
+}
 
-      if (user.length() < 32 && pass.length() < 64) {
-        copyToBuffer(deviceConfig.mqtt_username,
-                     sizeof(deviceConfig.mqtt_username), user);
-        copyToBuffer(deviceConfig.mqtt_password,
-                     sizeof(deviceConfig.mqtt_password), pass);
-        Serial.println("OK: MQTT auth configured");
-      } else {
-        Serial.println("ERROR: Invalid MQTT auth length");
-      }
-    } else {
-      Serial.println("ERROR: Format: SET_MQTT_AUTH:username:password");
-    }
+static void cmdSetAllowRemoteNetcfg(char **args) {
+  bool allow = false;
+  if (!parseFlagArg(args[0], allow)) {
+    replyError("Format: SET_ALLOW_REMOTE_NETCFG:1|0");
+    return;
   }
+  deviceConfig.allowRemoteNetworkConfig = allow;
+  replyOk("Remote network config %s", allow ? "allowed" : "disabled");
+}
 
-  // SET_API_SECRET:value
-  else if (cmdUpper.startsWith("SET_API_SECRET:")) {
-    String secret = cmd.substring(15);
-    if (secret.length() < 64) {
-      copyToBuffer(deviceConfig.api_secret, sizeof(deviceConfig.api_secret),
-                   secret);
-      Serial.println("OK: API secret updated");
-    } else {
-      Serial.println("ERROR: API secret too long (max 63 chars)");
-    }
+static void cmdSetApiSecret(char **args) {
+  if (strlen(args[0]) >= sizeof(deviceConfig.api_secret)) {
+    replyError("API secret too long (max 63 chars)");
+    return;
   }
+  copyToBuffer(deviceConfig.api_secret, sizeof(deviceConfig.api_secret),
+               args[0]);
+  replyOk("API secret updated");
+}
 
-  // SET_REQUIRE_SIGNED:1|0
-  else if (cmdUpper.startsWith("SET_REQUIRE_SIGNED:")) {
-    int val = cmd.substring(19).toInt();
-    deviceConfig.requireSignedMessages = (val == 1);
-    Serial.print("OK: Require signed messages ");
-    Serial.println(deviceConfig.requireSignedMessages ? "enabled" : "disabled");
+static void cmdSetCashGap(char **args) {
+  long gap = 0;
+  if (!parseLongArg(args[0], gap) || gap < 20 || gap > 1000) {
+    replyError("Cash pulse gap must be 20-1000 ms");
+    return;
   }
+  deviceConfig.cashPulseGapMs = (unsigned long)gap;
+  replyOk("Cash pulse gap set to %ld ms", gap);
+}
 
-  // SET_ALLOW_REMOTE_NETCFG:1|0
-  else if (cmdUpper.startsWith("SET_ALLOW_REMOTE_NETCFG:")) {
-    int val = cmd.substring(24).toInt();
-    deviceConfig.allowRemoteNetworkConfig = (val == 1);
-    Serial.print("OK: Remote network config ");
-    Serial.println(deviceConfig.allowRemoteNetworkConfig ? "allowed"
-                                                         : "disabled");
+static void cmdSetCashPulse(char **args) {
+  long value = 0;
+  if (!parseLongArg(args[0], value) || value <= 0 || value > 100000) {
+    replyError("Cash pulse value must be 1-100000");
+    return;
   }
+  deviceConfig.cashPulseValue = (int)value;
+  replyOk("Cash pulse value set to %ld so'm", value);
+}
 
-  // SET_DEVICE_ID:name
-  else if (cmdUpper.startsWith("SET_DEVICE_ID:")) {
-    String devId = cmd.substring(14);
-    if (devId.length() > 0 && devId.length() < 32) {
-      copyToBuffer(deviceConfig.device_id, sizeof(deviceConfig.device_id),
-                   devId);
-      Serial.println("OK: Device ID set to " + devId);
-    } else {
-      Serial.println("ERROR: Invalid device ID");
-    }
+static void cmdSetDeviceId(char **args) {
+  size_t len = strlen(args[0]);
+  if (len == 0 || len >= sizeof(deviceConfig.device_id)) {
+    replyError("Invalid device ID");
+    return;
   }
+  copyToBuffer(deviceConfig.device_id, sizeof(deviceConfig.device_id),
+               args[0]);
+  replyOk("Device ID set to %s", deviceConfig.device_id);
+}
 
-  // SET_PRICE:amount
-  else if (cmdUpper.startsWith("SET_PRICE:")) {
-    int price = cmd.substring(10).toInt();
-    if (price > 0 && price <= 100000) {
-      deviceConfig.pricePerLiter = price;
-      Serial.print("OK: Price set to ");
-      Serial.print(price);
-      Serial.println(" so'm per liter");
-    } else {
-      Serial.println("ERROR: Price must be 1-100000");
-    }
+static void cmdSetDisplayInterval(char **args) {
+  long interval = 0;
+  if (!parseLongArg(args[0], interval) || interval < 50 || interval > 10000) {
+    replyError("Display interval must be 50-10000 ms");
+    return;
   }
+  deviceConfig.displayUpdateInterval = (unsigned long)interval;
+  replyOk("Display interval set to %ld ms", interval);
+}
 
-  // SET_TIMEOUT:seconds
-  else if (cmdUpper.startsWith("SET_TIMEOUT:")) {
-    int seconds = cmd.substring(12).toInt();
-    if (seconds >= 60 && seconds <= 3600) {
-      deviceConfig.sessionTimeout = seconds * 1000;
-      Serial.print("OK: Timeout set to ");
-      Serial.print(seconds);
-      Serial.println(" seconds");
-    } else {
-      Serial.println("ERROR: Timeout must be 60-3600 seconds");
-    }
+static void cmdSetFreeWater(char **args) {
+  bool enable = false;
+  if (!parseFlagArg(args[0], enable)) {
+    replyError("Format: SET_FREE_WATER:1|0");
+    return;
   }
+  deviceConfig.enableFreeWater = enable;
+  replyOk("Free water %s", enable ? "enabled" : "disabled");
+}
 
-  // SET_FREE_WATER:1|0
-  else if (cmdUpper.startsWith("SET_FREE_WATER:")) {
-    int val = cmd.substring(15).toInt();
-    deviceConfig.enableFreeWater = (val == 1);
-    Serial.print("OK: Free water ");
-    Serial.println(deviceConfig.enableFreeWater ? "enabled" : "disabled");
+static void cmdSetFreeWaterAmount(char **args) {
+  float raw = 0.0f;
+  float amount = parseFloatArg(args[0], raw) ? normalizeFreeWaterAmount(raw)
+                                             : 0.0f;
+  if (amount <= 0.0f || amount > 5.0f) {
+    replyError("Amount must be 1-5000 ml");
+    return;
   }
+  deviceConfig.freeWaterAmount = amount;
+  replyOk("Free water amount set to %.0f ml", amount * 1000.0f);
+}
 
-  // SET_RELAY_ACTIVE:1|0
-  else if (cmdUpper.startsWith("SET_RELAY_ACTIVE:")) {
-    // Hardware policy: project relay is fixed Active-HIGH.
-    deviceConfig.relayActiveHigh = true;
-    config.relayActiveHigh = true;
-    // Keep valve safely closed.
-    setRelay(false);
-    Serial.println("OK: Relay mode fixed to ACTIVE_HIGH");
-  }
-
-  // SET_FREE_WATER_COOLDOWN:seconds|ms
-  else if (cmdUpper.startsWith("SET_FREE_WATER_COOLDOWN:")) {
-    unsigned long raw = cmd.substring(24).toInt();
-    unsigned long cooldown = normalizeSecondsOrMs(raw);
-    if (cooldown >= 60000 && cooldown <= 7200000) {
-      deviceConfig.freeWaterCooldown = cooldown;
-      Serial.print("OK: Free water cooldown set to ");
-      Serial.print(cooldown / 1000);
-      Serial.println(" seconds");
-    } else {
-      Serial.println("ERROR: Cooldown must be 60-7200 seconds");
-    }
+static void cmdSetFreeWaterCooldown(char **args) {
+  long raw = 0;
+  unsigned long cooldown = 0;
+  if (parseLongArg(args[0], raw) && raw > 0) {
+    cooldown = normalizeSecondsOrMs((unsigned long)raw);
+  }
+  if (cooldown < 60000 || cooldown > 7200000) {
+    replyError("Cooldown must be 60-7200 seconds");
+    return;
   }
+  deviceConfig.freeWaterCooldown = cooldown;
+  replyOk("Free water cooldown set to %lu seconds", cooldown / 1000);
+}
 
-  // SET_FREE_WATER_AMOUNT:liters|ml
-  else if (cmdUpper.startsWith("SET_FREE_WATER_AMOUNT:")) {
-    float raw = cmd.substring(22).toFloat();
-    float amount = normalizeFreeWaterAmount(raw);
-    if (amount > 0.0f && amount <= 5.0f) {
-      deviceConfig.freeWaterAmount = amount;
-      Serial.print("OK: Free water amount set to ");
-      Serial.print(amount * 1000.0f, 0);
-      Serial.println(" ml");
-    } else {
-      Serial.println("ERROR: Amount must be 1-5000 ml");
-    }
+static void cmdSetGroup(char **args) {
+  char *groupId = trimInPlace(args[0]);
+  size_t len = strlen(groupId);
+  if (len == 0 || len >= sizeof(deviceConfig.groupId)) {
+    replyError("Group ID must be 1-31 characters");
+    return;
+  }
+  copyToBuffer(deviceConfig.groupId, sizeof(deviceConfig.groupId), groupId);
+  if (!batchActive) {
+    saveConfigToStorage(); // Batches/frames persist once at the end
   }
+  generateMQTTTopics(); // Regenerate topics with new groupId
+  replyOk("Group ID set to '%s'", deviceConfig.groupId);
+  replyNote("Note: Reconnect MQTT to subscribe to group topics");
+}
 
-  // SET_PULSES_PER_LITER:value
-  else if (cmdUpper.startsWith("SET_PULSES_PER_LITER:")) {
-    float pulses = cmd.substring(21).toFloat();
-    if (pulses > 0.0f && pulses <= 5000.0f) {
-      deviceConfig.pulsesPerLiter = pulses;
-      Serial.print("OK: Pulses per liter set to ");
-      Serial.println(pulses, 2);
-    } else {
-      Serial.println("ERROR: Pulses per liter must be 1-5000");
-    }
+static void cmdSetHeartbeatInterval(char **args) {
+  long interval = 0;
+  if (!parseLongArg(args[0], interval) || interval < 1000 ||
+      interval > 3600000) {
+    replyError("Heartbeat interval must be 1000-3600000 ms");
+    return;
   }
+  deviceConfig.heartbeatInterval = (unsigned long)interval;
+  replyOk("Heartbeat interval set to %ld ms", interval);
+}
 
-  // SET_TDS_THRESHOLD:value
-  else if (cmdUpper.startsWith("SET_TDS_THRESHOLD:")) {
-    int threshold = cmd.substring(18).toInt();
-    if (threshold >= 0 && threshold <= 5000) {
-      deviceConfig.tdsThreshold = threshold;
-      Serial.print("OK: TDS threshold set to ");
-      Serial.print(threshold);
-      Serial.println(" ppm");
-    } else {
-      Serial.println("ERROR: TDS threshold must be 0-5000");
-    }
+static void cmdSetMqtt(char **args) {
+  long port = 0;
+  size_t brokerLen = strlen(args[0]);
+  if (brokerLen == 0 || brokerLen >= sizeof(deviceConfig.mqtt_broker) ||
+      !parseLongArg(args[1], port) || port <= 0 || port >= 65536) {
+    replyError("Invalid broker or port");
+    return;
   }
+  copyToBuffer(deviceConfig.mqtt_broker, sizeof(deviceConfig.mqtt_broker),
+               args[0]);
+  deviceConfig.mqtt_port = (int)port;
+  replyOk("MQTT broker configured");
+  replyNote("Note: Use SAVE_CONFIG to persist");
+}
 
-  // SET_TDS_TEMP:value
-  else if (cmdUpper.startsWith("SET_TDS_TEMP:")) {
-    float temp = cmd.substring(13).toFloat();
-    if (temp >= 0.0f && temp <= 80.0f) {
-      deviceConfig.tdsTemperatureC = temp;
-      Serial.print("OK: TDS temperature set to ");
-      Serial.print(temp, 1);
-      Serial.println(" C");
-    } else {
-      Serial.println("ERROR: TDS temperature must be 0-80 C");
-    }
+static void cmdSetMqttAuth(char **args) {
+  if (strlen(args[0]) >= sizeof(deviceConfig.mqtt_username) ||
+      strlen(args[1]) >= sizeof(deviceConfig.mqtt_password)) {
+    replyError("Invalid MQTT auth length");
+    return;
   }
+  copyToBuffer(deviceConfig.mqtt_username, sizeof(deviceConfig.mqtt_username),
+               args[0]);
+  copyToBuffer(deviceConfig.mqtt_password, sizeof(deviceConfig.mqtt_password),
+               args[1]);
+  replyOk("MQTT auth configured");
+}
 
-  // SET_TDS_CALIB:value
-  else if (cmdUpper.startsWith("SET_TDS_CALIB:")) {
-    float factor = cmd.substring(14).toFloat();
-    if (factor > 0.0f && factor <= 5.0f) {
-      deviceConfig.tdsCalibrationFactor = factor;
-      Serial.print("OK: TDS calibration set to ");
-      Serial.println(factor, 3);
-    } else {
-      Serial.println("ERROR: TDS calibration must be 0-5");
-    }
+// Night power save window, local hours (start == end: no window)
+static bool parseHourArg(const char *s, int &out) {
+  long hour = 0;
+  if (!parseLongArg(s, hour) || hour < 0 || hour > 23) {
+    replyError("Hour must be 0-23");
+    return false;
   }
+  out = (int)hour;
+  return true;
+}
 
-  // SET_CASH_PULSE:value
-  else if (cmdUpper.startsWith("SET_CASH_PULSE:")) {
-    int value = cmd.substring(15).toInt();
-    if (value > 0 && value <= 100000) {
-      deviceConfig.cashPulseValue = value;
-      Serial.print("OK: Cash pulse value set to ");
-      Serial.print(value);
-      Serial.println(" so'm");
-    } else {
-      Serial.println("ERROR: Cash pulse value must be 1-100000");
-    }
+static void cmdSetNightEnd(char **args) {
+  int hour = 0;
+  if (parseHourArg(args[0], hour)) {
+    deviceConfig.deepSleepEndHour = hour;
+    replyOk("Night mode ends at %d:00", hour);
   }
+}
 
-  // SET_PAYMENT_INTERVAL:seconds|ms
-  else if (cmdUpper.startsWith("SET_PAYMENT_INTERVAL:")) {
-    unsigned long interval = cmd.substring(21).toInt();
-    if (interval >= 200 && interval <= 600000) {
-      deviceConfig.paymentCheckInterval = interval;
-      Serial.print("OK: Payment interval set to ");
-      Serial.print(interval);
-      Serial.println(" ms");
-    } else {
-      Serial.println("ERROR: Payment interval must be 200-600000 ms");
-    }
+static void cmdSetNightStart(char **args) {
+  int hour = 0;
+  if (parseHourArg(args[0], hour)) {
+    deviceConfig.deepSleepStartHour = hour;
+    replyOk("Night mode starts at %d:00", hour);
   }
+}
 
-  // SET_DISPLAY_INTERVAL:ms
-  else if (cmdUpper.startsWith("SET_DISPLAY_INTERVAL:")) {
-    unsigned long interval = cmd.substring(21).toInt();
-    if (interval >= 50 && interval <= 10000) {
-      deviceConfig.displayUpdateInterval = interval;
-      Serial.print("OK: Display interval set to ");
-      Serial.print(interval);
-      Serial.println(" ms");
-    } else {
-      Serial.println("ERROR: Display interval must be 50-10000 ms");
-    }
+// SET_NOZZLE:n:price:pulses - overrides for nozzle n (2..NOZZLE_COUNT).
+// price -1 / pulses 0 = use SET_PRICE / SET_PULSES_PER_LITER.
+static void cmdSetNozzle(char **args) {
+  long nozzle = 0;
+  long price = 0;
+  float pulses = 0.0f;
+  if (!parseLongArg(args[0], nozzle) || nozzle < 2 || nozzle > NOZZLE_COUNT) {
+    replyError("Nozzle must be 2-%d", NOZZLE_COUNT);
+    return;
+  }
+  if (!parseLongArg(args[1], price) ||
+      (price != -1 && (price <= 0 || price > 100000))) {
+    replyError("Price must be 1-100000 or -1");
+    return;
   }
+  if (!parseFloatArg(args[2], pulses) || pulses < 0.0f || pulses > 5000.0f) {
+    replyError("Pulses per liter must be 0-5000");
+    return;
+  }
+  deviceConfig.nozzlePricePerLiter[nozzle - 1] = (int)price;
+  deviceConfig.nozzlePulsesPerLiter[nozzle - 1] = pulses;
+  replyOk("Nozzle %ld: price %ld, pulses %.2f", nozzle, price, pulses);
+}
 
-  // SET_TDS_INTERVAL:seconds|ms
-  else if (cmdUpper.startsWith("SET_TDS_INTERVAL:")) {
-    unsigned long interval = cmd.substring(17).toInt();
-    if (interval >= 1000 && interval <= 600000) {
-      deviceConfig.tdsCheckInterval = interval;
-      Serial.print("OK: TDS interval set to ");
-      Serial.print(interval);
-      Serial.println(" ms");
-    } else {
-      Serial.println("ERROR: TDS interval must be 1000-600000 ms");
+static void cmdSetPaymentInterval(char **args) {
+  long interval = 0;
+  if (!parseLongArg(args[0], interval) || interval < 200 || interval > 600000) {
+    replyError("Payment interval must be 200-600000 ms");
+    return;
+  }
+  deviceConfig.paymentCheckInterval = (unsigned long)interval;
+  replyOk("Payment interval set to %ld ms", interval);
+}
+
+static void cmdSetPowerSave(char **args) {
+  bool enable = false;
+  if (!parseFlagArg(args[0], enable)) {
+    replyError("Format: SET_POWER_SAVE:1|0");
+    return;
+  }
+  deviceConfig.enablePowerSave = enable;
+  replyOk("Night power save %s", enable ? "enabled" : "disabled");
+}
+
+static void cmdSetPrice(char **args) {
+  long price = 0;
+  if (!parseLongArg(args[0], price) || price <= 0 || price > 100000) {
+    replyError("Price must be 1-100000");
+    return;
+  }
+  deviceConfig.pricePerLiter = (int)price;
+  replyOk("Price set to %ld so'm per liter", price);
+}
+
+static void cmdSetPulsesPerLiter(char **args) {
+  float pulses = 0.0f;
+  if (!parseFloatArg(args[0], pulses) || pulses <= 0.0f || pulses > 5000.0f) {
+    replyError("Pulses per liter must be 1-5000");
+    return;
+  }
+  deviceConfig.pulsesPerLiter = pulses;
+  replyOk("Pulses per liter set to %.2f", pulses);
+}
+
+static void cmdSetRelayActive(char **) {
+  // Hardware policy: project relay is fixed Active-HIGH.
+  deviceConfig.relayActiveHigh = true;
+  // Keep valve safely closed.
+  setRelay(false);
+  replyOk("Relay mode fixed to ACTIVE_HIGH");
+}
+
+static void cmdSetRequireSigned(char **args) {
+  bool required = false;
+  if (!parseFlagArg(args[0], required)) {
+    replyError("Format: SET_REQUIRE_SIGNED:1|0");
+    return;
+  }
+  deviceConfig.requireSignedMessages = required;
+  replyOk("Require signed messages %s", required ? "enabled" : "disabled");
+}
+
+// Takes the cash acceptor out of service (INHIBIT_SERVICE) for maintenance;
+// kept across reboots until SET_SERVICE_MODE:0
+static void cmdSetServiceMode(char **args) {
+  bool on = false;
+  if (!parseFlagArg(args[0], on)) {
+    replyError("Format: SET_SERVICE_MODE:1|0");
+    return;
+  }
+  setPaymentInhibit(INHIBIT_SERVICE, on);
+  replyOk("Service mode %s (cash acceptor %s)", on ? "on" : "off",
+          getPaymentInhibit() ? "inhibited" : "accepting");
+}
+
+static void cmdSetTdsCalib(char **args) {
+  float factor = 0.0f;
+  if (!parseFloatArg(args[0], factor) || factor <= 0.0f || factor > 5.0f) {
+    replyError("TDS calibration must be 0-5");
+    return;
+  }
+  deviceConfig.tdsCalibrationFactor = factor;
+  replyOk("TDS calibration set to %.3f", factor);
+}
+
+static void cmdSetTdsInterval(char **args) {
+  long interval = 0;
+  if (!parseLongArg(args[0], interval) || interval < 1000 ||
+      interval > 600000) {
+    replyError("TDS interval must be 1000-600000 ms");
+    return;
+  }
+  deviceConfig.tdsCheckInterval = (unsigned long)interval;
+  replyOk("TDS interval set to %ld ms", interval);
+}
+
+static void cmdSetTdsTemp(char **args) {
+  float temp = 0.0f;
+  if (!parseFloatArg(args[0], temp) || temp < 0.0f || temp > 80.0f) {
+    replyError("TDS temperature must be 0-80 C");
+    return;
+  }
+  deviceConfig.tdsTemperatureC = temp;
+  replyOk("TDS temperature set to %.1f C", temp);
+}
+
+static void cmdSetTdsThreshold(char **args) {
+  long threshold = 0;
+  if (!parseLongArg(args[0], threshold) || threshold < 0 ||
+      threshold > 5000) {
+    replyError("TDS threshold must be 0-5000");
+    return;
+  }
+  deviceConfig.tdsThreshold = (int)threshold;
+  replyOk("TDS threshold set to %ld ppm", threshold);
+}
+
+static void cmdSetTimeout(char **args) {
+  long raw = 0;
+  unsigned long timeout = 0;
+  if (parseLongArg(args[0], raw) && raw > 0) {
+    timeout = normalizeSecondsOrMs((unsigned long)raw);
+  }
+  if (timeout < 60000 || timeout > 3600000) {
+    replyError("Timeout must be 60-3600 seconds");
+    return;
+  }
+  deviceConfig.sessionTimeout = timeout;
+  replyOk("Timeout set to %lu seconds", timeout / 1000);
+}
+
+static void cmdSetWifi(char **args) {
+  size_t ssidLen = strlen(args[0]);
+  if (ssidLen == 0 || ssidLen >= sizeof(deviceConfig.wifi_ssid) ||
+      strlen(args[1]) >= sizeof(deviceConfig.wifi_password)) {
+    replyError("Invalid SSID length");
+    return;
+  }
+  copyToBuffer(deviceConfig.wifi_ssid, sizeof(deviceConfig.wifi_ssid),
+               args[0]);
+  copyToBuffer(deviceConfig.wifi_password, sizeof(deviceConfig.wifi_password),
+               args[1]);
+  deviceConfig.configured = true;
+  replyOk("WiFi configured");
+  replyNote("Note: Use SAVE_CONFIG to persist");
+}
+
+// TEST RELAY [ON|OFF|RAW 0|RAW 1] (space separated, hardware debugging)
+static void cmdTest(char **args) {
+  char *sub = args[0];
+  for (char *c = sub; *c; c++) {
+    *c = (char)toupper((unsigned char)*c);
+  }
+
+  if (strncmp(sub, "RELAY ", 6) != 0) {
+    replyError("Unknown test command");
+    return;
+  }
+  const char *action = sub + 6;
+  if (strcmp(action, "ON") == 0) {
+    Serial.println("TEST: Forcing Relay ON (Logic Level depends on config)");
+    setRelay(true);
+  } else if (strcmp(action, "OFF") == 0) {
+    Serial.println("TEST: Forcing Relay OFF");
+    setRelay(false);
+  } else if (strncmp(action, "RAW ", 4) == 0) {
+    long level = 0;
+    parseLongArg(action + 4, level);
+    Serial.print("TEST: Forcing Relay Pin RAW ");
+    Serial.println(level ? "HIGH" : "LOW");
+    digitalWrite(RELAY_PIN, level ? HIGH : LOW);
+  } else {
+    replyError("TEST RELAY [ON|OFF|RAW 0|RAW 1]");
+  }
+}
+
+// ============================================
+// CONFIG FRAME
+// ============================================
+// CFG_FRAME:<len>:<crc32 hex>:<compact JSON>
+//
+// Provisions many settings in one round trip. `len` is the JSON byte count
+// and `crc32` the IEEE CRC-32 of the JSON, so a truncated or corrupted line
+// is rejected before anything is parsed. Every field goes through the same
+// handler (and range check) as its SET_* command, against a snapshot: if any
+// field fails the whole frame is discarded, otherwise the config is
+// persisted once. Keys match the MQTT config update (camelCase).
+#define CFG_FRAME_VALUE_MAX 160 // > longest field (mqtt_broker)
+
+static uint32_t crc32Ieee(const char *data, size_t len) {
+  uint32_t crc = 0xFFFFFFFFUL;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint8_t)data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1UL)));
     }
   }
+  return ~crc;
+}
 
-  // SET_HEARTBEAT_INTERVAL:seconds|ms
-  else if (cmdUpper.startsWith("SET_HEARTBEAT_INTERVAL:")) {
-    unsigned long interval = cmd.substring(23).toInt();
-    if (interval >= 1000 && interval <= 3600000) {
-      deviceConfig.heartbeatInterval = interval;
-      Serial.print("OK: Heartbeat interval set to ");
-      Serial.print(interval);
-      Serial.println(" ms");
-    } else {
-      Serial.println("ERROR: Heartbeat interval must be 1000-3600000 ms");
+// Value used for the second argument when a pair key is omitted
+typedef void (*FramePairDefault)(char *out, size_t outSize);
+
+struct FrameField {
+  const char *key;
+  SerialCmdHandler handler;
+  const char *pairKey; // Second argument (SET_WIFI/SET_MQTT/SET_MQTT_AUTH)
+  FramePairDefault pairDefault;
+};
+
+static void currentWifiPassword(char *out, size_t outSize) {
+  copyToBuffer(out, outSize, deviceConfig.wifi_password);
+}
+static void currentMqttPort(char *out, size_t outSize) {
+  snprintf(out, outSize, "%d", deviceConfig.mqtt_port);
+}
+static void currentMqttPassword(char *out, size_t outSize) {
+  copyToBuffer(out, outSize, deviceConfig.mqtt_password);
+}
+
+static const FrameField FRAME_FIELDS[] = {
+    {"wifiSsid", cmdSetWifi, "wifiPassword", currentWifiPassword},
+    {"mqttBroker", cmdSetMqtt, "mqttPort", currentMqttPort},
+    {"mqttUsername", cmdSetMqttAuth, "mqttPassword", currentMqttPassword},
+    {"deviceId", cmdSetDeviceId, nullptr, nullptr},
+    {"groupId", cmdSetGroup, nullptr, nullptr},
+    {"apiSecret", cmdSetApiSecret, nullptr, nullptr},
+    {"requireSignedMessages", cmdSetRequireSigned, nullptr, nullptr},
+    {"allowRemoteNetworkConfig", cmdSetAllowRemoteNetcfg, nullptr, nullptr},
+    {"pricePerLiter", cmdSetPrice, nullptr, nullptr},
+    {"sessionTimeout", cmdSetTimeout, nullptr, nullptr},
+    {"enableFreeWater", cmdSetFreeWater, nullptr, nullptr},
+    {"relayActiveHigh", cmdSetRelayActive, nullptr, nullptr},
+    {"freeWaterCooldown", cmdSetFreeWaterCooldown, nullptr, nullptr},
+    {"freeWaterAmount", cmdSetFreeWaterAmount, nullptr, nullptr},
+    {"pulsesPerLiter", cmdSetPulsesPerLiter, nullptr, nullptr},
+    {"tdsThreshold", cmdSetTdsThreshold, nullptr, nullptr},
+    {"tdsTemperatureC", cmdSetTdsTemp, nullptr, nullptr},
+    {"tdsCalibrationFactor", cmdSetTdsCalib, nullptr, nullptr},
+    {"cashPulseValue", cmdSetCashPulse, nullptr, nullptr},
+    {"cashPulseGapMs", cmdSetCashGap, nullptr, nullptr},
+    {"paymentCheckInterval", cmdSetPaymentInterval, nullptr, nullptr},
+    {"displayUpdateInterval", cmdSetDisplayInterval, nullptr, nullptr},
+    {"tdsCheckInterval", cmdSetTdsInterval, nullptr, nullptr},
+    {"heartbeatInterval", cmdSetHeartbeatInterval, nullptr, nullptr},
+    {"enablePowerSave", cmdSetPowerSave, nullptr, nullptr},
+    {"deepSleepStartHour", cmdSetNightStart, nullptr, nullptr},
+    {"deepSleepEndHour", cmdSetNightEnd, nullptr, nullptr},
+};
+static const size_t FRAME_FIELD_COUNT =
+    sizeof(FRAME_FIELDS) / sizeof(FRAME_FIELDS[0]);
+
+static bool isFrameKey(const char *key) {
+  for (size_t i = 0; i < FRAME_FIELD_COUNT; i++) {
+    if (strcmp(key, FRAME_FIELDS[i].key) == 0 ||
+        (FRAME_FIELDS[i].pairKey &&
+         strcmp(key, FRAME_FIELDS[i].pairKey) == 0)) {
+      return true;
     }
   }
+  return false;
+}
 
-  // SET_PWR Removed
+// Render a JSON value as the text its SET_* command would receive.
+static bool frameValueToText(JsonVariantConst v, char *out, size_t outSize) {
+  if (v.is<const char *>()) {
+    const char *s = v.as<const char *>();
+    if (strlen(s) >= outSize) {
+      return false;
+    }
+    copyToBuffer(out, outSize, s);
+  } else if (v.is<bool>()) {
+    copyToBuffer(out, outSize, v.as<bool>() ? "1" : "0");
+  } else if (v.is<long>()) {
+    snprintf(out, outSize, "%ld", v.as<long>());
+  } else if (v.is<float>()) {
+    snprintf(out, outSize, "%.6g", (double)v.as<float>());
+  } else {
+    return false;
+  }
+  return true;
+}
 
-  // SET_CASH_GAP:ms
+static void cmdCfgFrame(char **args) {
+  long declaredLen = 0;
+  char *crcEnd = nullptr;
+  uint32_t declaredCrc = (uint32_t)strtoul(args[1], &crcEnd, 16);
+  char *json = args[2];
+  size_t jsonLen = strlen(json);
+
+  if (!parseLongArg(args[0], declaredLen) || declaredLen < 0 ||
+      (size_t)declaredLen != jsonLen) {
+    replyError("CFG_FRAME length mismatch (got %u bytes)", (unsigned)jsonLen);
+    return;
+  }
+  if (crcEnd == args[1] || *crcEnd != '\0' ||
+      declaredCrc != crc32Ieee(json, jsonLen)) {
+    replyError("CFG_FRAME CRC mismatch");
+    return;
+  }
 
-  // SET_CASH_GAP:ms
-  else if (cmdUpper.startsWith("SET_CASH_GAP:")) {
-    int gap = cmd.substring(13).toInt();
-    if (gap >= 20 && gap <= 1000) {
-      deviceConfig.cashPulseGapMs = gap;
-      Serial.print("OK: Cash pulse gap set to ");
-      Serial.print(gap);
-      Serial.println(" ms");
-    } else {
-      Serial.println("ERROR: Cash pulse gap must be 20-1000 ms");
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, json, jsonLen);
+  if (err || !doc.is<JsonObject>()) {
+    replyError("CFG_FRAME invalid JSON");
+    return;
+  }
+  for (JsonPairConst kv : doc.as<JsonObjectConst>()) {
+    if (!isFrameKey(kv.key().c_str())) {
+      replyError("CFG_FRAME unknown field %s", kv.key().c_str());
+      return;
+    }
+  }
+  // A pair key is only read along with its first key; alone it would be
+  // dropped while the frame still reports success
+  for (size_t i = 0; i < FRAME_FIELD_COUNT; i++) {
+    const FrameField &f = FRAME_FIELDS[i];
+    if (f.pairKey && !doc[f.pairKey].isNull() && doc[f.key].isNull()) {
+      replyError("CFG_FRAME %s needs %s", f.pairKey, f.key);
+      return;
     }
   }
 
-  // APPLY_CONFIG
-  else if (cmdUpper == "APPLY_CONFIG") {
-    applyRuntimeConfig();
-    applyConfigStateEffects();
-    setupWiFi();
-    mqttClient.disconnect();
-    mqttClient.setServer(deviceConfig.mqtt_broker, deviceConfig.mqtt_port);
-    reconnectMQTT();
-    Serial.println("OK: Configuration applied");
-  }
-
-  // SET_GROUP:groupId
-  else if (cmdUpper.startsWith("SET_GROUP:")) {
-    String groupId = cmd.substring(10);
-    groupId.trim();
-    if (groupId.length() > 0 && groupId.length() < 32) {
-      strncpy(deviceConfig.groupId, groupId.c_str(), 31);
-      deviceConfig.groupId[31] = '\0';
-      saveConfigToStorage();
-      generateMQTTTopics(); // Regenerate topics with new groupId
-      Serial.print("OK: Group ID set to '");
-      Serial.print(deviceConfig.groupId);
-      Serial.println("'");
-      Serial.println("Note: Reconnect MQTT to subscribe to group topics");
-    } else {
-      Serial.println("ERROR: Group ID must be 1-31 characters");
+  // Apply every field against a snapshot; replies are collected, not printed
+  DeviceConfig snapshot = deviceConfig;
+  batchActive = true;
+  batchOkCount = 0;
+  batchErrorCount = 0;
+  batchFirstError[0] = '\0';
+
+  char value[CFG_FRAME_VALUE_MAX];
+  char pair[CFG_FRAME_VALUE_MAX];
+  for (size_t i = 0; i < FRAME_FIELD_COUNT; i++) {
+    const FrameField &f = FRAME_FIELDS[i];
+    JsonVariantConst v = doc[f.key];
+    if (v.isNull()) {
+      continue;
+    }
+    char *fieldArgs[SERIAL_CMD_MAX_ARGS] = {value, pair, nullptr};
+    pair[0] = '\0';
+    bool ok = frameValueToText(v, value, sizeof(value));
+    if (ok && f.pairKey) {
+      JsonVariantConst pv = doc[f.pairKey];
+      if (pv.isNull()) {
+        f.pairDefault(pair, sizeof(pair));
+      } else {
+        ok = frameValueToText(pv, pair, sizeof(pair));
+      }
+    }
+    if (!ok) {
+      replyError("%s: bad value", f.key);
+      continue;
     }
+    f.handler(fieldArgs);
+  }
+  batchActive = false;
+
+  if (batchErrorCount > 0) {
+    deviceConfig = snapshot;
+    generateMQTTTopics(); // groupId may have been touched
+    replyError("CFG_FRAME rejected, nothing applied (%s)", batchFirstError);
+    return;
   }
 
-  // GET_GROUP
-  else if (cmdUpper == "GET_GROUP") {
-    if (strlen(deviceConfig.groupId) > 0) {
-      Serial.print("Group ID: ");
-      Serial.println(deviceConfig.groupId);
+  unsigned long saveStart = millis();
+  saveConfigToStorage();
+  replyOk("CFG_FRAME %u fields saved (%lu ms)", (unsigned)batchOkCount,
+          millis() - saveStart);
+}
+
+// ============================================
+// COMMAND TABLE
+// ============================================
+// MUST stay sorted by name (strcmp order) - looked up with binary search.
+// `argc` fields are split on ':'; the last field takes the remainder of the
+// line, so passwords/secrets may contain ':'.
+struct SerialCommand {
+  const char *name;
+  uint8_t argc;
+  bool allowedInBatch;
+  SerialCmdHandler handler;
+};
+
+static const SerialCommand COMMANDS[] = {
+    {"APPLY_CONFIG", 0, true, cmdApplyConfig},
+    {"BATCH_BEGIN", 0, false, cmdBatchBegin},
+    {"BATCH_END", 0, true, cmdBatchEnd},
+    {"CFG_FRAME", 3, false, cmdCfgFrame},
+    {"FACTORY_RESET", 0, false, cmdFactoryReset},
+    {"GET_CONFIG", 0, true, cmdGetConfig},
+    {"GET_GROUP", 0, true, cmdGetGroup},
+    {"GET_STATUS", 0, true, cmdGetStatus},
+    {"HELP", 0, true, cmdHelp},
+    {"LOAD_CONFIG", 0, true, cmdLoadConfig},
+    {"RESTART", 0, false, cmdRestart},
+    {"SAVE_CONFIG", 0, true, cmdSaveConfig},
+    {"SET_ALLOW_REMOTE_NETCFG", 1, true, cmdSetAllowRemoteNetcfg},
+    {"SET_API_SECRET", 1, true, cmdSetApiSecret},
+    {"SET_CASH_GAP", 1, true, cmdSetCashGap},
+    {"SET_CASH_PULSE", 1, true, cmdSetCashPulse},
+    {"SET_DEVICE_ID", 1, true, cmdSetDeviceId},
+    {"SET_DISPLAY_INTERVAL", 1, true, cmdSetDisplayInterval},
+    {"SET_FREE_WATER", 1, true, cmdSetFreeWater},
+    {"SET_FREE_WATER_AMOUNT", 1, true, cmdSetFreeWaterAmount},
+    {"SET_FREE_WATER_COOLDOWN", 1, true, cmdSetFreeWaterCooldown},
+    {"SET_GROUP", 1, true, cmdSetGroup},
+    {"SET_HEARTBEAT_INTERVAL", 1, true, cmdSetHeartbeatInterval},
+    {"SET_MQTT", 2, true, cmdSetMqtt},
+    {"SET_MQTT_AUTH", 2, true, cmdSetMqttAuth},
+    {"SET_NIGHT_END", 1, true, cmdSetNightEnd},
+    {"SET_NIGHT_START", 1, true, cmdSetNightStart},
+    {"SET_NOZZLE", 3, true, cmdSetNozzle},
+    {"SET_PAYMENT_INTERVAL", 1, true, cmdSetPaymentInterval},
+    {"SET_POWER_SAVE", 1, true, cmdSetPowerSave},
+    {"SET_PRICE", 1, true, cmdSetPrice},
+    {"SET_PULSES_PER_LITER", 1, true, cmdSetPulsesPerLiter},
+    {"SET_RELAY_ACTIVE", 1, true, cmdSetRelayActive},
+    {"SET_REQUIRE_SIGNED", 1, true, cmdSetRequireSigned},
+    {"SET_SERVICE_MODE", 1, false, cmdSetServiceMode},
+    {"SET_TDS_CALIB", 1, true, cmdSetTdsCalib},
+    {"SET_TDS_INTERVAL", 1, true, cmdSetTdsInterval},
+    {"SET_TDS_TEMP", 1, true, cmdSetTdsTemp},
+    {"SET_TDS_THRESHOLD", 1, true, cmdSetTdsThreshold},
+    {"SET_TIMEOUT", 1, true, cmdSetTimeout},
+    {"SET_WIFI", 2, true, cmdSetWifi},
+    {"TEST", 1, false, cmdTest},
+};
+static const size_t COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+
+static const SerialCommand *findCommand(const char *name) {
+  size_t lo = 0;
+  size_t hi = COMMAND_COUNT;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    int cmp = strcmp(name, COMMANDS[mid].name);
+    if (cmp == 0) {
+      return &COMMANDS[mid];
+    }
+    if (cmp < 0) {
+      hi = mid;
     } else {
-      Serial.println("Group ID: (not set)");
+      lo = mid + 1;
     }
   }
+  return nullptr;
+}
 
-  // SAVE_CONFIG
-  else if (cmdUpper == "SAVE_CONFIG") {
-    saveConfigToStorage();
-    Serial.println("OK: Configuration saved to EEPROM");
+// ============================================
+// INITIALIZATION
+// ============================================
+void initSerialConfig() {
+  for (size_t i = 1; i < COMMAND_COUNT; i++) {
+    if (strcmp(COMMANDS[i - 1].name, COMMANDS[i].name) >= 0) {
+      Serial.print("BUG: serial command table unsorted at ");
+      Serial.println(COMMANDS[i].name);
+    }
   }
 
-  // LOAD_CONFIG
-  else if (cmdUpper == "LOAD_CONFIG") {
-    loadConfigFromStorage();
-    Serial.println("OK: Configuration reloaded from EEPROM");
-    printCurrentConfig();
-  }
+  Serial.println("\n╔════════════════════════════════════════╗");
+  Serial.println("║   eWater Vending Machine v2.0         ║");
+  Serial.println("║   Serial Configuration Interface       ║");
+  Serial.println("╚════════════════════════════════════════╝");
+  Serial.println("\nType 'HELP' for available commands\n");
+}
 
-  // FACTORY_RESET
-  else if (cmdUpper == "FACTORY_RESET") {
-    Serial.println("WARNING: This will reset all settings!");
-    Serial.println("Type 'YES' to confirm...");
-
-    unsigned long startTime = millis();
-    while (millis() - startTime < 10000) {
-      if (Serial.available()) {
-        String confirm = Serial.readStringUntil('\n');
-        confirm.trim();
-        String confirmUpper = confirm;
-        confirmUpper.toUpperCase();
-
-        if (confirmUpper == "YES") {
-          loadDefaultConfig();
-          saveConfigToStorage();
-          Serial.println("OK: Factory reset completed");
-          Serial.println("Device will restart in 3 seconds...");
-          delay(3000);
-          ESP.restart();
-          return;
-        } else {
-          Serial.println("CANCELLED: Factory reset aborted");
-          return;
-        }
+// ============================================
+// HANDLE SERIAL INPUT
+// ============================================
+void handleSerialConfig() {
+  static char buffer[SERIAL_CMD_MAX_LEN + 1];
+  static size_t len = 0;
+  static bool overflow = false;
+
+  while (Serial.available()) {
+    char c = (char)Serial.read();
+
+    if (c == '\n' || c == '\r') {
+      if (overflow) {
+        replyError("Command too long (max %d chars)", SERIAL_CMD_MAX_LEN);
+      } else if (len > 0) {
+        buffer[len] = '\0';
+        processCommand(buffer);
       }
-      delay(10);
+      len = 0;
+      overflow = false;
+      continue;
+    }
+
+    if (len < SERIAL_CMD_MAX_LEN) {
+      buffer[len++] = c;
+    } else {
+      overflow = true;
     }
-    Serial.println("TIMEOUT: Factory reset aborted");
   }
+}
 
-  // GET_STATUS
-  else if (cmdUpper == "GET_STATUS") {
-    showStatus();
+// ============================================
+// PROCESS COMMAND
+// ============================================
+// Tokenizes `line` in place: NAME[:arg1[:arg2]] (TEST uses a space).
+void processCommand(char *line) {
+  HeapScope heapScope(HEAP_MOD_SERIAL);
+  line = trimInPlace(line);
+  if (*line == '\0') {
+    return;
   }
 
-  // RESTART
-  else if (cmdUpper == "RESTART") {
-    Serial.println("OK: Restarting device...");
-    delay(500);
-    ESP.restart();
+  // Command name (case-insensitive)
+  char name[SERIAL_CMD_NAME_MAX];
+  size_t nameLen = 0;
+  char *p = line;
+  while (*p && *p != ':' && *p != ' ' && nameLen < sizeof(name) - 1) {
+    name[nameLen++] = (char)toupper((unsigned char)*p);
+    p++;
   }
+  name[nameLen] = '\0';
 
-  // HELP
-  else if (cmdUpper == "HELP") {
-    showHelp();
+  if (!batchActive) {
+    Serial.print("> ");
+    // Config frames carry secrets and can be long: echo the name only
+    Serial.println(strcmp(name, "CFG_FRAME") == 0 ? name : line);
   }
 
-  // TEST functionality for hardware debugging
-  else if (cmdUpper.startsWith("TEST ")) {
-    String subCmd = cmdUpper.substring(5);
+  const SerialCommand *cmd = findCommand(name);
+  if (!cmd || (*p && *p != ':' && *p != ' ')) {
+    replyError("Unknown command. Type 'HELP' for available commands");
+    if (!batchActive) {
+      Serial.println();
+    }
+    return;
+  }
 
-    if (subCmd.startsWith("RELAY ")) {
-      String action = subCmd.substring(6);
-      if (action == "ON") {
-        Serial.println(
-            "TEST: Forcing Relay ON (Logic Level depends on config)");
-        setRelay(true);
-      } else if (action == "OFF") {
-        Serial.println("TEST: Forcing Relay OFF");
-        setRelay(false);
-      } else if (action.startsWith("RAW ")) {
-        int level = action.substring(4).toInt();
-        Serial.print("TEST: Forcing Relay Pin RAW ");
-        Serial.println(level ? "HIGH" : "LOW");
-        digitalWrite(RELAY_PIN, level ? HIGH : LOW);
-      } else {
-        Serial.println("ERROR: TEST RELAY [ON|OFF|RAW 0|RAW 1]");
+  // Split arguments
+  char *args[SERIAL_CMD_MAX_ARGS] = {nullptr};
+  uint8_t found = 0;
+  if (*p) {
+    p++; // Skip separator
+    while (found < cmd->argc) {
+      args[found++] = p;
+      if (found == cmd->argc) {
+        break; // Last field keeps the remainder
       }
-    } else {
-      Serial.println("ERROR: Unknown test command");
+      char *sep = strchr(p, ':');
+      if (!sep) {
+        break;
+      }
+      *sep = '\0';
+      p = sep + 1;
     }
   }
 
-  // Unknown command
-  else {
-    Serial.println(
-        "ERROR: Unknown command. Type 'HELP' for available commands");
+  if (found < cmd->argc) {
+    replyError("Format: %s%s", cmd->name,
+               cmd->argc == 1 ? ":value"
+               : cmd->argc == 2 ? ":value1:value2"
+                                : ":len:crc32:json");
+  } else if (batchActive && !cmd->allowedInBatch) {
+    replyError("%s not allowed in batch", cmd->name);
+  } else {
+    cmd->handler(args);
   }
 
-  Serial.println(); // Blank line for readability
+  if (!batchActive) {
+    Serial.println(); // Blank line for readability
+  }
 }
 
 // ============================================
@@ -558,7 +1027,8 @@ void showHelp() {
   Serial.println("  SET_DEVICE_ID:name               - Set device identifier");
   Serial.println(
       "  SET_PRICE:amount                 - Set price per liter (so'm)");
-  Serial.println("  SET_TIMEOUT:seconds              - Set session timeout");
+  Serial.println(
+      "  SET_TIMEOUT:seconds|ms           - Set session timeout");
   Serial.println(
       "  SET_FREE_WATER:1|0               - Enable/disable free water");
   Serial.println(
@@ -575,6 +1045,10 @@ void showHelp() {
   Serial.println("  SET_FREE_WATER_AMOUNT:ml         - Free water amount");
   Serial.println(
       "  SET_PULSES_PER_LITER:value       - Flow sensor calibration");
+  if (NOZZLE_COUNT > 1) {
+    Serial.println(
+        "  SET_NOZZLE:n:price:pulses        - Nozzle n price/calibration");
+  }
   Serial.println("  SET_TDS_THRESHOLD:ppm            - TDS warning threshold");
   Serial.println("  SET_TDS_TEMP:celsius             - TDS temperature");
   Serial.println("  SET_TDS_CALIB:factor             - TDS calibration factor");
@@ -583,6 +1057,9 @@ void showHelp() {
       "  SET_DISPLAY_INTERVAL:ms          - Display refresh interval");
   Serial.println("  SET_TDS_INTERVAL:ms              - TDS check interval");
   Serial.println("  SET_HEARTBEAT_INTERVAL:ms        - Heartbeat interval");
+  Serial.println("  SET_POWER_SAVE:1|0               - Night power save");
+  Serial.println("  SET_NIGHT_START:hour             - Night mode start (0-23)");
+  Serial.println("  SET_NIGHT_END:hour               - Night mode end (0-23)");
   Serial.println("  APPLY_CONFIG                     - Apply settings now");
 
   Serial.println("\n[Storage]");
@@ -591,8 +1068,14 @@ void showHelp() {
   Serial.println("  LOAD_CONFIG                      - Reload from EEPROM");
   Serial.println(
       "  FACTORY_RESET                    - Reset to factory defaults");
+  Serial.println(
+      "  BATCH_BEGIN / BATCH_END          - Apply many SET_* with one reply");
+  Serial.println(
+      "  CFG_FRAME:len:crc32:json         - Apply + save a config frame");
 
   Serial.println("\n[System]");
+  Serial.println(
+      "  SET_SERVICE_MODE:1|0     - Take cash acceptor out of service");
   Serial.println("  SAVE_CONFIG              - Save config to flash");
   Serial.println("  SET_GROUP:id             - Set group ID for fleet");
   Serial.println("  GET_GROUP                - Show current group ID");
@@ -656,6 +1139,13 @@ void showStatus() {
   Serial.print(totalDispensedLiters, 2);
   Serial.println(" L");
 
+  for (uint8_t i = 1; i < NOZZLE_COUNT; i++) {
+    Serial.printf("Nozzle %u: %s, balance %ld so'm, %.2f L, relay %s\n",
+                  (unsigned)(i + 1), getStateName(nozzles[i].state),
+                  (long)nozzles[i].balance, nozzles[i].totalDispensedLiters,
+                  isNozzleRelayOn(i) ? "ON" : "OFF");
+  }
+
   Serial.print("TDS: ");
   Serial.print(tdsPPM);
   Serial.println(" ppm");
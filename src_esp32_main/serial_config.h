@@ -14,7 +14,7 @@
  * - SET_MQTT_AUTH:user:pass       → Set MQTT auth
  * - SET_DEVICE_ID:name            → Set device ID
  * - SET_PRICE:amount              → Set price per liter
- * - SET_TIMEOUT:seconds           → Set session timeout
+ * - SET_TIMEOUT:seconds|ms        → Set session timeout
  * - SET_FREE_WATER:1|0            → Enable/disable free water
  * - SET_CASH_PULSE:value          → Cash acceptor: so'm per pulse
  * - SET_CASH_GAP:ms               → Cash acceptor: pulse gap (ms)
@@ -24,6 +24,16 @@
  * - GET_STATUS                    → Show device status
  * - RESTART                       → Restart device
  * - HELP                          → Show available commands
+ * - BATCH_BEGIN / BATCH_END       → Silence per-command replies; BATCH_END
+ *                                   prints one summary (ok/failed count)
+ * - CFG_FRAME:len:crc32:json      → Bulk provisioning: compact JSON (MQTT
+ *                                   config keys), length + CRC-32 checked,
+ *                                   all-or-nothing, saved once; a pair key
+ *                                   (mqttPort...) needs its first key
+ *
+ * Parsing is allocation-free: the line is tokenized in place and the command
+ * name is looked up in a sorted table (see COMMANDS in serial_config.cpp).
+ * The last argument takes the rest of the line, so passwords may contain ':'.
  */
 
 // ============================================
@@ -31,7 +41,7 @@
 // ============================================
 void initSerialConfig();
 void handleSerialConfig();
-void processCommand(String cmd);
+void processCommand(char *line); // Tokenized in place
 void showHelp();
 void showStatus();
 
@@ -0,0 +1,708 @@
+#include "session_ledger.h"
+#include "../shared/logger.h"
+#include "config.h"
+#include "config_storage.h"
+#include "mqtt_handler.h"
+#include "sensors.h"
+#include "state_machine.h"
+#include <ArduinoJson.h>
+#include <cstdlib>
+#include <time.h>
+
+#if defined(ESP32)
+#include <esp_partition.h>
+#define LEDGER_PARTITION_SUBTYPE 0x40 // Custom data subtype (partitions_main.csv)
+#define LEDGER_RAM_FALLBACK_SIZE (2 * LEDGER_SECTOR_SIZE)
+static const esp_partition_t *ledgerPartition = nullptr;
+#endif
+
+// ============================================
+// LEDGER STATE
+// ============================================
+static uint8_t *ledgerRam = nullptr; // Host, or ESP32 without the partition
+static size_t ledgerSize = 0;
+static uint32_t totalSlots = 0;
+static bool ledgerReady = false;
+
+static uint32_t nextSeq = 1;
+static uint32_t ackedSeq = 0;
+static uint32_t droppedCount = 0;
+static uint16_t bootCount = 0;
+
+static uint32_t inflightLastSeq = 0;
+static unsigned long inflightSentMs = 0;
+static unsigned long pendingSinceMs = 0;
+static uint32_t batchId = 0;
+
+// Open session (RAM only until it ends)
+struct OpenSession {
+  bool open;
+  SessionRecord rec;
+  unsigned long startMs;
+  float paidLiters;
+  float freeLiters;
+  float overshootLiters;
+};
+static OpenSession sessions[NOZZLE_COUNT]; // One per nozzle
+
+// Upload scratch buffers (static to keep them off the loop task stack)
+#define LEDGER_BATCH_BUF 1024
+static SessionRecord batchRecords[LEDGER_BATCH_MAX];
+static uint8_t batchBin[LEDGER_BATCH_BUF];
+static char batchB64[((LEDGER_BATCH_BUF + 2) / 3) * 4 + 1];
+
+// ============================================
+// STORAGE BACKEND
+// ============================================
+static bool storageOpen() {
+#if defined(ESP32)
+  ledgerPartition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)LEDGER_PARTITION_SUBTYPE,
+      "ledger");
+  if (ledgerPartition) {
+    ledgerSize = ledgerPartition->size -
+                 (ledgerPartition->size % LEDGER_SECTOR_SIZE);
+    return ledgerSize >= 2 * LEDGER_SECTOR_SIZE;
+  }
+  // Devices updated over the air keep their old partition table: fall back
+  // to a small RAM ring so sessions are still uploaded while online.
+  LOG_WARN("Ledger partition missing, using RAM ring");
+  ledgerSize = LEDGER_RAM_FALLBACK_SIZE;
+#else
+  ledgerSize = LEDGER_PARTITION_SIZE;
+#endif
+  if (!ledgerRam) {
+    ledgerRam = static_cast<uint8_t *>(malloc(ledgerSize));
+    if (!ledgerRam) {
+      return false;
+    }
+    memset(ledgerRam, 0xFF, ledgerSize);
+  }
+  return true;
+}
+
+static bool storageRead(size_t offset, void *dst, size_t len) {
+#if defined(ESP32)
+  if (ledgerPartition) {
+    return esp_partition_read(ledgerPartition, offset, dst, len) == ESP_OK;
+  }
+#endif
+  memcpy(dst, ledgerRam + offset, len);
+  return true;
+}
+
+static bool storageWrite(size_t offset, const void *src, size_t len) {
+#if defined(ESP32)
+  if (ledgerPartition) {
+    return esp_partition_write(ledgerPartition, offset, src, len) == ESP_OK;
+  }
+#endif
+  // NOR semantics: programming can only clear bits
+  const uint8_t *bytes = static_cast<const uint8_t *>(src);
+  for (size_t i = 0; i < len; i++) {
+    ledgerRam[offset + i] &= bytes[i];
+  }
+  return true;
+}
+
+static bool storageEraseSector(size_t offset) {
+#if defined(ESP32)
+  if (ledgerPartition) {
+    return esp_partition_erase_range(ledgerPartition, offset,
+                                     LEDGER_SECTOR_SIZE) == ESP_OK;
+  }
+#endif
+  memset(ledgerRam + offset, 0xFF, LEDGER_SECTOR_SIZE);
+  return true;
+}
+
+// ============================================
+// SLOT LAYOUT
+// ============================================
+// Slot = seq % totalSlots. Every sector holds LEDGER_RECORDS_PER_SECTOR
+// slots and is erased when the writer enters it, recycling the oldest
+// records. The unused tail of each sector is never written.
+static size_t slotOffset(uint32_t seq) {
+  const uint32_t slot = seq % totalSlots;
+  return (slot / LEDGER_RECORDS_PER_SECTOR) * LEDGER_SECTOR_SIZE +
+         (slot % LEDGER_RECORDS_PER_SECTOR) * sizeof(SessionRecord);
+}
+
+static bool slotBlank(size_t offset) {
+  uint8_t buf[sizeof(SessionRecord)];
+  if (!storageRead(offset, buf, sizeof(buf))) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    if (buf[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool recordValid(const SessionRecord &rec, uint32_t expectedSeq) {
+  if (rec.seq == 0 || rec.seq == 0xFFFFFFFFUL || rec.seq != expectedSeq) {
+    return false;
+  }
+  return ledgerCrc16(reinterpret_cast<const uint8_t *>(&rec),
+                     offsetof(SessionRecord, crc16)) == rec.crc16;
+}
+
+// Oldest sequence that can still be on flash given the current write head.
+static uint32_t oldestStoredSeq() {
+  const uint32_t last = nextSeq - 1;
+  const uint32_t sectors = totalSlots / LEDGER_RECORDS_PER_SECTOR;
+  const uint32_t sectorStart = last - (last % LEDGER_RECORDS_PER_SECTOR);
+  const uint32_t span = (sectors - 1) * LEDGER_RECORDS_PER_SECTOR;
+  return (sectorStart > span) ? sectorStart - span : 1;
+}
+
+static uint32_t firstPendingSeq() {
+  const uint32_t oldest = oldestStoredSeq();
+  return (ackedSeq + 1 > oldest) ? ackedSeq + 1 : oldest;
+}
+
+static void persistAckedSeq() {
+  preferences.begin("ewater", false);
+  preferences.putULong("ldg_ack", ackedSeq);
+  preferences.end();
+}
+
+static bool appendRecord(SessionRecord &rec) {
+  // Bounded retry: a torn write (power loss mid-program) leaves a dirty slot,
+  // which is skipped. The next sector boundary always succeeds via erase.
+  for (uint32_t attempt = 0; attempt <= LEDGER_RECORDS_PER_SECTOR; attempt++) {
+    const uint32_t seq = nextSeq++;
+    const size_t offset = slotOffset(seq);
+
+    if (seq % LEDGER_RECORDS_PER_SECTOR == 0) {
+      // Recycling a sector: count records that were never acknowledged.
+      if (seq >= totalSlots) {
+        const uint32_t lo = seq - totalSlots;
+        const uint32_t hi = lo + LEDGER_RECORDS_PER_SECTOR - 1;
+        if (hi > ackedSeq) {
+          droppedCount += hi - ((lo > ackedSeq) ? lo - 1 : ackedSeq);
+        }
+      }
+      if (!storageEraseSector(offset)) {
+        LOG_ERROR("Ledger erase failed at 0x%x", (unsigned)offset);
+        return false;
+      }
+    } else if (!slotBlank(offset)) {
+      continue;
+    }
+
+    rec.seq = seq;
+    rec.crc16 = ledgerCrc16(reinterpret_cast<const uint8_t *>(&rec),
+                            offsetof(SessionRecord, crc16));
+    if (storageWrite(offset, &rec, sizeof(rec))) {
+      return true;
+    }
+    LOG_ERROR("Ledger write failed for seq %u", (unsigned)seq);
+  }
+  return false;
+}
+
+// ============================================
+// INITIALIZATION
+// ============================================
+static void closeAllSessions() {
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    sessions[i].open = false;
+  }
+}
+
+void initSessionLedger() {
+  closeAllSessions();
+  inflightLastSeq = 0;
+  droppedCount = 0;
+
+  ledgerReady = storageOpen();
+  if (!ledgerReady) {
+    LOG_ERROR("Ledger storage unavailable");
+    return;
+  }
+  totalSlots = (ledgerSize / LEDGER_SECTOR_SIZE) * LEDGER_RECORDS_PER_SECTOR;
+
+  preferences.begin("ewater", false);
+  bootCount = static_cast<uint16_t>(preferences.getULong("ldg_boot", 0) + 1);
+  preferences.putULong("ldg_boot", bootCount);
+  ackedSeq = preferences.getULong("ldg_ack", 0);
+  preferences.end();
+
+  // Recover the write head: highest valid sequence on flash.
+  uint32_t maxSeq = 0;
+  SessionRecord rec;
+  for (uint32_t slot = 0; slot < totalSlots; slot++) {
+    const size_t offset =
+        (slot / LEDGER_RECORDS_PER_SECTOR) * LEDGER_SECTOR_SIZE +
+        (slot % LEDGER_RECORDS_PER_SECTOR) * sizeof(SessionRecord);
+    if (!storageRead(offset, &rec, sizeof(rec))) {
+      continue;
+    }
+    if (rec.seq % totalSlots == slot && recordValid(rec, rec.seq) &&
+        rec.seq > maxSeq) {
+      maxSeq = rec.seq;
+    }
+  }
+
+  // Acknowledged records may already be gone (RAM ring, replaced partition):
+  // never reuse a sequence the backend has seen.
+  nextSeq = ((maxSeq > ackedSeq) ? maxSeq : ackedSeq) + 1;
+
+  if (maxSeq == 0 && !slotBlank(slotOffset(nextSeq))) {
+    // First boot on a region that held other data: start clean.
+    LOG_WARN("Ledger region not blank, formatting");
+    for (size_t off = 0; off < ledgerSize; off += LEDGER_SECTOR_SIZE) {
+      storageEraseSector(off);
+    }
+  }
+
+  pendingSinceMs = millis();
+  LOG_INFO("Ledger: %u slots, next seq %u, %u pending", (unsigned)totalSlots,
+           (unsigned)nextSeq, (unsigned)ledgerPendingCount());
+}
+
+void ledgerFormat() {
+  if (!ledgerReady) {
+    return;
+  }
+  for (size_t off = 0; off < ledgerSize; off += LEDGER_SECTOR_SIZE) {
+    storageEraseSector(off);
+  }
+  nextSeq = 1;
+  ackedSeq = 0;
+  droppedCount = 0;
+  inflightLastSeq = 0;
+  closeAllSessions();
+  persistAckedSeq();
+}
+
+// ============================================
+// SESSION HOOKS
+// ============================================
+// Session of `nozzle`, or nullptr for an unknown nozzle
+static OpenSession *sessionFor(uint8_t nozzle) {
+  return (nozzle < NOZZLE_COUNT) ? &sessions[nozzle] : nullptr;
+}
+
+static void openSession(uint8_t nozzle) {
+  OpenSession *s = sessionFor(nozzle);
+  if (!s || s->open) {
+    return;
+  }
+  memset(&s->rec, 0, sizeof(s->rec));
+  const time_t now = time(nullptr);
+  s->rec.bootCount = bootCount;
+  s->rec.endReason = LEDGER_NOZZLE_BITS(nozzle);
+  s->rec.startEpoch = (now > 1600000000) ? static_cast<uint32_t>(now) : 0;
+  s->startMs = millis();
+  s->rec.startUptimeS = s->startMs / 1000;
+  s->paidLiters = 0.0f;
+  s->freeLiters = 0.0f;
+  s->overshootLiters = 0.0f;
+  s->open = true;
+}
+
+void ledgerOnPayment(long amount, uint8_t nozzle) {
+  if (amount <= 0) {
+    return;
+  }
+  openSession(nozzle);
+  if (OpenSession *s = sessionFor(nozzle)) {
+    s->rec.paidAmount += static_cast<uint32_t>(amount);
+  }
+}
+
+void ledgerOnFreeWaterStart(uint8_t nozzle) { openSession(nozzle); }
+
+void ledgerOnPause(uint8_t nozzle) {
+  OpenSession *s = sessionFor(nozzle);
+  if (s && s->open && s->rec.pauseCount < 255) {
+    s->rec.pauseCount++;
+  }
+}
+
+void ledgerAddVolume(float liters, bool free, uint8_t nozzle) {
+  OpenSession *s = sessionFor(nozzle);
+  if (!s || !s->open || liters <= 0.0f) {
+    return;
+  }
+  if (free) {
+    s->freeLiters += liters;
+  } else {
+    s->paidLiters += liters;
+  }
+}
+
+void ledgerAddOvershoot(float liters, uint8_t nozzle) {
+  OpenSession *s = sessionFor(nozzle);
+  if (s && s->open && liters > 0.0f) {
+    s->overshootLiters += liters;
+  }
+}
+
+bool ledgerSessionOpen(uint8_t nozzle) {
+  const OpenSession *s = sessionFor(nozzle);
+  return s && s->open;
+}
+
+static uint16_t litersToMl16(float liters) {
+  const float ml = liters * 1000.0f + 0.5f;
+  return (ml >= 65535.0f) ? 65535 : static_cast<uint16_t>(ml);
+}
+
+void ledgerEndSession(LedgerEndReason reason, long balanceLost,
+                      uint8_t nozzle) {
+  OpenSession *s = sessionFor(nozzle);
+  if (!s || !s->open) {
+    return;
+  }
+  s->open = false;
+
+  SessionRecord &rec = s->rec;
+  rec.endReason = reason | LEDGER_NOZZLE_BITS(nozzle);
+  rec.durationS = (millis() - s->startMs) / 1000;
+  rec.balanceLost = (balanceLost > 0) ? static_cast<uint32_t>(balanceLost) : 0;
+  rec.paidMl = static_cast<uint32_t>(s->paidLiters * 1000.0f + 0.5f);
+  rec.freeMl = litersToMl16(s->freeLiters);
+  rec.overshootMl = litersToMl16(s->overshootLiters);
+  rec.tdsPpm = (tdsPPM > 0) ? static_cast<uint16_t>(tdsPPM) : 0;
+
+  if (!ledgerReady) {
+    return;
+  }
+  const bool wasEmpty = ledgerPendingCount() == 0;
+  if (!appendRecord(rec)) {
+    LOG_ERROR("Ledger append failed");
+    return;
+  }
+  if (wasEmpty) {
+    pendingSinceMs = millis();
+  }
+  LOG_DEBUG("Ledger seq %u: nozzle %u, paid %u, %u ml", (unsigned)rec.seq,
+            (unsigned)nozzle, (unsigned)rec.paidAmount, (unsigned)rec.paidMl);
+}
+
+// ============================================
+// QUERIES
+// ============================================
+uint32_t ledgerNextSeq() { return nextSeq; }
+uint32_t ledgerAckedSeq() { return ackedSeq; }
+uint32_t ledgerDroppedCount() { return droppedCount; }
+
+uint32_t ledgerPendingCount() {
+  if (!ledgerReady) {
+    return 0;
+  }
+  const uint32_t first = firstPendingSeq();
+  return (nextSeq > first) ? nextSeq - first : 0;
+}
+
+bool ledgerReadRecord(uint32_t seq, SessionRecord &out) {
+  if (!ledgerReady || seq == 0 || seq >= nextSeq || seq < oldestStoredSeq()) {
+    return false;
+  }
+  if (!storageRead(slotOffset(seq), &out, sizeof(out))) {
+    return false;
+  }
+  return recordValid(out, seq);
+}
+
+// ============================================
+// ENCODING
+// ============================================
+uint16_t ledgerCrc16(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= static_cast<uint16_t>(data[i]) << 8;
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static bool putVarint(uint8_t *out, size_t outSize, size_t &pos,
+                      uint64_t value) {
+  do {
+    if (pos >= outSize) {
+      return false;
+    }
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    out[pos++] = value ? (byte | 0x80) : byte;
+  } while (value);
+  return true;
+}
+
+static bool putSigned(uint8_t *out, size_t outSize, size_t &pos,
+                      int64_t value) {
+  const uint64_t zigzag =
+      (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+  return putVarint(out, outSize, pos, zigzag);
+}
+
+static bool getVarint(const uint8_t *in, size_t len, size_t &pos,
+                      uint64_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos >= len) {
+      return false;
+    }
+    const uint8_t byte = in[pos++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool getSigned(const uint8_t *in, size_t len, size_t &pos,
+                      int64_t &value) {
+  uint64_t zigzag = 0;
+  if (!getVarint(in, len, pos, zigzag)) {
+    return false;
+  }
+  value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+  return true;
+}
+
+// Batch layout: [version][count] then per record, as varints (S = zigzag
+// delta against the previous record in the batch, U = plain value):
+//   S seq, S bootCount, U reason|pauseCount<<3|nozzle<<11, S startEpoch,
+//   S startUptimeS, U durationS, U paidAmount, U balanceLost, U paidMl,
+//   U freeMl, U overshootMl, S tdsPpm
+// Version 1 had no nozzle bits; it still decodes (as nozzle 0).
+size_t ledgerEncodeBatch(const SessionRecord *records, uint8_t count,
+                         uint8_t *out, size_t outSize) {
+  if (outSize < 2) {
+    return 0;
+  }
+  size_t pos = 0;
+  out[pos++] = LEDGER_FORMAT_VERSION;
+  out[pos++] = count;
+
+  SessionRecord prev;
+  memset(&prev, 0, sizeof(prev));
+  for (uint8_t i = 0; i < count; i++) {
+    const SessionRecord &r = records[i];
+    const bool ok =
+        putSigned(out, outSize, pos, (int64_t)r.seq - prev.seq) &&
+        putSigned(out, outSize, pos, (int64_t)r.bootCount - prev.bootCount) &&
+        putVarint(out, outSize, pos,
+                  LEDGER_REASON(r) | ((uint32_t)r.pauseCount << 3) |
+                      ((uint32_t)LEDGER_NOZZLE(r) << 11)) &&
+        putSigned(out, outSize, pos, (int64_t)r.startEpoch - prev.startEpoch) &&
+        putSigned(out, outSize, pos,
+                  (int64_t)r.startUptimeS - prev.startUptimeS) &&
+        putVarint(out, outSize, pos, r.durationS) &&
+        putVarint(out, outSize, pos, r.paidAmount) &&
+        putVarint(out, outSize, pos, r.balanceLost) &&
+        putVarint(out, outSize, pos, r.paidMl) &&
+        putVarint(out, outSize, pos, r.freeMl) &&
+        putVarint(out, outSize, pos, r.overshootMl) &&
+        putSigned(out, outSize, pos, (int64_t)r.tdsPpm - prev.tdsPpm);
+    if (!ok) {
+      return 0;
+    }
+    prev = r;
+  }
+  return pos;
+}
+
+int ledgerDecodeBatch(const uint8_t *in, size_t len, SessionRecord *out,
+                      uint8_t maxRecords) {
+  if (len < 2 || in[0] < 1 || in[0] > LEDGER_FORMAT_VERSION ||
+      in[1] > maxRecords) {
+    return -1;
+  }
+  const uint8_t count = in[1];
+  size_t pos = 2;
+
+  SessionRecord prev;
+  memset(&prev, 0, sizeof(prev));
+  for (uint8_t i = 0; i < count; i++) {
+    SessionRecord &r = out[i];
+    int64_t d = 0;
+    uint64_t u = 0;
+
+    if (!getSigned(in, len, pos, d))
+      return -1;
+    r.seq = (uint32_t)(prev.seq + d);
+    if (!getSigned(in, len, pos, d))
+      return -1;
+    r.bootCount = (uint16_t)(prev.bootCount + d);
+    if (!getVarint(in, len, pos, u))
+      return -1;
+    r.endReason = (uint8_t)((u & 0x07) | LEDGER_NOZZLE_BITS(u >> 11));
+    r.pauseCount = (uint8_t)(u >> 3);
+    if (!getSigned(in, len, pos, d))
+      return -1;
+    r.startEpoch = (uint32_t)(prev.startEpoch + d);
+    if (!getSigned(in, len, pos, d))
+      return -1;
+    r.startUptimeS = (uint32_t)(prev.startUptimeS + d);
+    if (!getVarint(in, len, pos, u))
+      return -1;
+    r.durationS = (uint32_t)u;
+    if (!getVarint(in, len, pos, u))
+      return -1;
+    r.paidAmount = (uint32_t)u;
+    if (!getVarint(in, len, pos, u))
+      return -1;
+    r.balanceLost = (uint32_t)u;
+    if (!getVarint(in, len, pos, u))
+      return -1;
+    r.paidMl = (uint32_t)u;
+    if (!getVarint(in, len, pos, u))
+      return -1;
+    r.freeMl = (uint16_t)u;
+    if (!getVarint(in, len, pos, u))
+      return -1;
+    r.overshootMl = (uint16_t)u;
+    if (!getSigned(in, len, pos, d))
+      return -1;
+    r.tdsPpm = (uint16_t)(prev.tdsPpm + d);
+    r.crc16 = ledgerCrc16(reinterpret_cast<const uint8_t *>(&r),
+                          offsetof(SessionRecord, crc16));
+    prev = r;
+  }
+  return (pos == len) ? count : -1;
+}
+
+static size_t base64Encode(const uint8_t *in, size_t len, char *out,
+                           size_t outSize) {
+  static const char table[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const size_t needed = ((len + 2) / 3) * 4;
+  if (outSize < needed + 1) {
+    return 0;
+  }
+  size_t o = 0;
+  for (size_t i = 0; i < len; i += 3) {
+    const uint32_t b0 = in[i];
+    const uint32_t b1 = (i + 1 < len) ? in[i + 1] : 0;
+    const uint32_t b2 = (i + 2 < len) ? in[i + 2] : 0;
+    const uint32_t triple = (b0 << 16) | (b1 << 8) | b2;
+    out[o++] = table[(triple >> 18) & 0x3F];
+    out[o++] = table[(triple >> 12) & 0x3F];
+    out[o++] = (i + 1 < len) ? table[(triple >> 6) & 0x3F] : '=';
+    out[o++] = (i + 2 < len) ? table[triple & 0x3F] : '=';
+  }
+  out[o] = '\0';
+  return o;
+}
+
+// ============================================
+// UPLOAD
+// ============================================
+static bool publishLedgerBatch() {
+  const uint32_t first = firstPendingSeq();
+  uint8_t count = 0;
+  uint32_t seq = first;
+  while (count < LEDGER_BATCH_MAX && seq < nextSeq) {
+    if (ledgerReadRecord(seq, batchRecords[count])) {
+      count++;
+    }
+    seq++;
+  }
+
+  if (count == 0) {
+    // Window held only corrupt slots: skip past them.
+    droppedCount += seq - first;
+    ackedSeq = seq - 1;
+    persistAckedSeq();
+    return false;
+  }
+
+  const uint8_t gathered = count;
+  size_t binLen = 0;
+  while ((binLen = ledgerEncodeBatch(batchRecords, count, batchBin,
+                                     sizeof(batchBin))) == 0 &&
+         count > 1) {
+    count /= 2;
+  }
+  if (binLen == 0 ||
+      base64Encode(batchBin, binLen, batchB64, sizeof(batchB64)) == 0) {
+    LOG_ERROR("Ledger batch encode failed");
+    return false;
+  }
+  // A full batch also covers corrupt slots skipped inside the scan window.
+  const uint32_t lastSeq =
+      (count == gathered) ? seq - 1 : batchRecords[count - 1].seq;
+
+  JsonDocument doc;
+  doc["device_id"] = deviceConfig.device_id;
+  doc["v"] = LEDGER_FORMAT_VERSION;
+  doc["batch"] = ++batchId;
+  doc["boot"] = bootCount;
+  doc["first_seq"] = batchRecords[0].seq;
+  doc["last_seq"] = lastSeq;
+  doc["count"] = count;
+  doc["dropped"] = droppedCount;
+  doc["data"] = (const char *)batchB64;
+
+  String output;
+  serializeJson(doc, output);
+  if (!mqttClient.publish(TOPIC_LEDGER_OUT, output.c_str(), false)) {
+    LOG_WARN("Ledger batch publish failed (%u bytes)",
+             (unsigned)output.length());
+    return false;
+  }
+
+  inflightLastSeq = lastSeq;
+  inflightSentMs = millis();
+  LOG_DEBUG("Ledger batch %u: seq %u..%u (%u B)", (unsigned)batchId,
+            (unsigned)batchRecords[0].seq, (unsigned)lastSeq, (unsigned)binLen);
+  return true;
+}
+
+void processSessionLedger() {
+  if (!ledgerReady || !mqttClient.connected()) {
+    return;
+  }
+  const uint32_t pending = ledgerPendingCount();
+  if (pending == 0) {
+    return;
+  }
+
+  const unsigned long now = millis();
+  if (inflightLastSeq != 0) {
+    if (now - inflightSentMs < LEDGER_ACK_TIMEOUT_MS) {
+      return;
+    }
+    LOG_WARN("Ledger batch up to seq %u not acknowledged, resending",
+             (unsigned)inflightLastSeq);
+    inflightLastSeq = 0;
+  }
+
+  if (pending < LEDGER_BATCH_MIN &&
+      now - pendingSinceMs < LEDGER_UPLOAD_INTERVAL_MS) {
+    return;
+  }
+  // Keep the radio quiet while water is flowing.
+  if (isAnyNozzleFlowing()) {
+    return;
+  }
+  publishLedgerBatch();
+}
+
+bool ledgerHandleAck(uint32_t lastSeq) {
+  if (!ledgerReady || lastSeq <= ackedSeq || lastSeq >= nextSeq) {
+    LOG_WARN("Ledger ACK %u ignored (acked %u, next %u)", (unsigned)lastSeq,
+             (unsigned)ackedSeq, (unsigned)nextSeq);
+    return false;
+  }
+  ackedSeq = lastSeq;
+  persistAckedSeq();
+  if (lastSeq >= inflightLastSeq) {
+    inflightLastSeq = 0;
+  }
+  pendingSinceMs = millis();
+  LOG_INFO("Ledger acknowledged up to seq %u (%u pending)", (unsigned)lastSeq,
+           (unsigned)ledgerPendingCount());
+  return true;
+}
@@ -0,0 +1,114 @@
+#ifndef SESSION_LEDGER_H
+#define SESSION_LEDGER_H
+
+#include <Arduino.h>
+#include <cstddef>
+#include <cstdint>
+
+// ============================================
+// DISPENSE SESSION LEDGER
+// ============================================
+// One compact binary record per vending session (paid or free), written to a
+// dedicated flash ring ("ledger" data partition, see partitions_main.csv).
+// Records survive reboots and offline periods and are uploaded in delta/varint
+// compressed batches on TOPIC_LEDGER_OUT. The backend acknowledges the last
+// sequence it stored on TOPIC_LEDGER_ACK; only then is the upload window
+// advanced. This lets the backend reconcile cash against water per session
+// without relying on individual PAYMENT/PAUSE/TIMEOUT log messages.
+
+#define LEDGER_SECTOR_SIZE 4096
+#define LEDGER_PARTITION_SIZE 0x10000 // 64 KB = 16 sectors
+#define LEDGER_BATCH_MAX 32           // records per upload batch
+#define LEDGER_BATCH_MIN 8            // upload as soon as this many are pending
+#define LEDGER_UPLOAD_INTERVAL_MS 60000UL // ...or this long after the oldest
+#define LEDGER_ACK_TIMEOUT_MS 30000UL     // resend window if no ACK arrives
+#define LEDGER_FORMAT_VERSION 2 // 2: nozzle index in the reason field
+
+enum LedgerEndReason : uint8_t {
+  LEDGER_END_DEPLETED = 1, // Balance fully dispensed
+  LEDGER_END_TIMEOUT = 2,  // Session timed out (see balanceLost)
+  LEDGER_END_FREE_DONE = 3, // Free water portion completed
+  LEDGER_END_ABORTED = 4,   // Emergency shutdown / feature disabled
+};
+
+// endReason carries the nozzle in bits 4-5 (always 0 on single-nozzle units)
+#define LEDGER_REASON(r) ((r).endReason & 0x07)
+#define LEDGER_NOZZLE(r) (((r).endReason >> 4) & 0x03)
+#define LEDGER_NOZZLE_BITS(n) ((uint8_t)(((n) & 0x03) << 4))
+
+#pragma pack(push, 1)
+struct SessionRecord {
+  uint32_t seq;          // Monotonic, never 0
+  uint16_t bootCount;    // Boot the session belongs to
+  uint8_t endReason;     // LedgerEndReason | LEDGER_NOZZLE_BITS
+  uint8_t pauseCount;    // Saturates at 255
+  uint32_t startEpoch;   // Unix time, 0 if the clock was not synced
+  uint32_t startUptimeS; // Seconds since boot at session start
+  uint32_t durationS;    // Session length
+  uint32_t paidAmount;   // so'm credited (cash + MQTT)
+  uint32_t balanceLost;  // so'm forfeited on timeout/shutdown
+  uint32_t paidMl;       // Billed water
+  uint16_t freeMl;       // Free water
+  uint16_t overshootMl;  // Water poured beyond balance/free allowance
+  uint16_t tdsPpm;       // Last TDS reading at session end
+  uint16_t crc16;        // CRC-16/CCITT over all preceding bytes
+};
+#pragma pack(pop)
+
+static_assert(sizeof(SessionRecord) == 40, "SessionRecord must stay 40 bytes");
+
+#define LEDGER_RECORDS_PER_SECTOR (LEDGER_SECTOR_SIZE / sizeof(SessionRecord))
+
+// ============================================
+// LIFECYCLE
+// ============================================
+void initSessionLedger();
+
+// Call from loop(): schedules batch uploads while MQTT is connected.
+void processSessionLedger();
+
+// ============================================
+// SESSION HOOKS (state machine / payment path)
+// ============================================
+// Each nozzle has its own open session; `nozzle` defaults to the first one.
+void ledgerOnPayment(long amount, uint8_t nozzle = 0);
+void ledgerOnFreeWaterStart(uint8_t nozzle = 0);
+void ledgerOnPause(uint8_t nozzle = 0);
+void ledgerAddVolume(float liters, bool free, uint8_t nozzle = 0);
+void ledgerAddOvershoot(float liters, uint8_t nozzle = 0);
+void ledgerEndSession(LedgerEndReason reason, long balanceLost,
+                      uint8_t nozzle = 0);
+bool ledgerSessionOpen(uint8_t nozzle = 0);
+
+// ============================================
+// UPLOAD / ACK
+// ============================================
+// Advance the ACK cursor. Returns false if `lastSeq` is stale (<= current
+// cursor) or beyond the last written record.
+bool ledgerHandleAck(uint32_t lastSeq);
+
+uint32_t ledgerNextSeq();
+uint32_t ledgerAckedSeq();
+uint32_t ledgerPendingCount();
+uint32_t ledgerDroppedCount();
+
+// ============================================
+// ENCODING (exposed for tests / tooling)
+// ============================================
+// Erase the whole ring and reset the ACK cursor (tests / bench use only).
+void ledgerFormat();
+
+uint16_t ledgerCrc16(const uint8_t *data, size_t len);
+
+// Read a stored record by sequence number. False if missing or corrupt.
+bool ledgerReadRecord(uint32_t seq, SessionRecord &out);
+
+// Compress `count` records into `out`. Returns bytes written, 0 on overflow.
+size_t ledgerEncodeBatch(const SessionRecord *records, uint8_t count,
+                         uint8_t *out, size_t outSize);
+
+// Inverse of ledgerEncodeBatch. Returns records decoded, -1 on malformed input.
+int ledgerDecodeBatch(const uint8_t *in, size_t len, SessionRecord *out,
+                      uint8_t maxRecords);
+
+#endif
@@ -1,220 +1,554 @@
 #include "state_machine.h"
+#include "../shared/logger.h"
 #include "config.h"
 #include "display.h"
 #include "hardware.h"
 #include "mqtt_handler.h"
 #include "relay_control.h"
-
-// Note: lastSessionActivity is declared extern in state_machine.h
+#include "session_ledger.h"
+#include "telemetry.h"
 
 // ============================================
 // GLOBAL STATE VARIABLES
 // ============================================
-SystemState currentState = IDLE;
-volatile long balance = 0;
-float totalDispensedLiters = 0.0;
-float sessionStartBalance = 0.0;
-
-volatile unsigned long flowPulseCount = 0;
-float lastDispensedLiters = 0.0;
-
-float freeWaterDispensed = 0.0;
-bool freeWaterUsed = false;
-
-unsigned long lastSessionActivity = 0;
-unsigned long freeWaterAvailableTime = 0;
-static SystemState pausedFromState = IDLE;
+NozzleSession nozzles[NOZZLE_COUNT];
+
+SystemState &currentState = nozzles[0].state;
+volatile long &balance = nozzles[0].balance;
+float &totalDispensedLiters = nozzles[0].totalDispensedLiters;
+float &sessionStartBalance = nozzles[0].sessionStartBalance;
+
+volatile unsigned long &flowPulseCount = nozzles[0].flowPulseCount;
+float &lastDispensedLiters = nozzles[0].lastDispensedLiters;
+
+float &freeWaterDispensed = nozzles[0].freeWaterDispensed;
+bool &freeWaterUsed = nozzles[0].freeWaterUsed;
+
+unsigned long &lastSessionActivity = nozzles[0].lastSessionActivity;
+unsigned long &freeWaterAvailableTime = nozzles[0].freeWaterAvailableTime;
+
+// Event queue and deferred effects
+struct QueuedEvent {
+  uint8_t ev;
+  uint8_t nozzle;
+};
+static QueuedEvent eventQueue[SM_EVENT_QUEUE_LEN];
+static uint8_t eventHead = 0;
+static uint8_t eventCount = 0;
+static bool dispatching = false;
+static bool statusPending = false;
+static bool promptPending = false;
+
+// Nozzle picked by START without credit (see getFocusNozzle)
+static int selectedNozzle = -1;
+static unsigned long selectedAtMs = 0;
 
 // ============================================
 // INITIALIZATION
 // ============================================
+static void resetNozzle(NozzleSession &n) {
+  n.state = IDLE;
+  n.balance = 0;
+  n.totalDispensedLiters = 0.0;
+  n.sessionStartBalance = 0.0;
+  n.flowPulseCount = 0;
+  n.lastDispensedLiters = 0.0;
+  n.freeWaterDispensed = 0.0;
+  n.freeWaterUsed = false;
+  n.lastSessionActivity = millis();
+  n.freeWaterAvailableTime = millis() + config.freeWaterCooldown;
+  n.pausedFromState = IDLE;
+}
+
 void initStateMachine() {
-  currentState = IDLE;
-  balance = 0;
-  totalDispensedLiters = 0.0;
-  sessionStartBalance = 0.0;
-  flowPulseCount = 0;
-  lastDispensedLiters = 0.0;
-  freeWaterDispensed = 0.0;
-  freeWaterUsed = false;
-  lastSessionActivity = millis();
-  freeWaterAvailableTime = millis() + config.freeWaterCooldown;
-  pausedFromState = IDLE;
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    resetNozzle(nozzles[i]);
+  }
+  eventHead = 0;
+  eventCount = 0;
+  dispatching = false;
+  statusPending = false;
+  promptPending = false;
+  selectedNozzle = -1;
 }
 
 // ============================================
 // SESSION TIMER
 // ============================================
-void resetSessionTimer() { lastSessionActivity = millis(); }
+void resetSessionTimer(uint8_t nozzle) {
+  if (nozzle < NOZZLE_COUNT) {
+    nozzles[nozzle].lastSessionActivity = millis();
+  }
+}
 
-// ============================================
-// APPLY CONFIG EFFECTS (Runtime)
-// ============================================
-void applyConfigStateEffects() {
-  if (!config.enableFreeWater) {
-    if (currentState == FREE_WATER) {
-      currentState = IDLE;
-      setRelay(false);
-      publishLog("FREE_WATER", "Disabled");
-      publishStatus();
+const char *getStateName(SystemState state) {
+  static const char *const names[SM_STATE_COUNT] = {
+      "IDLE", "ACTIVE", "DISPENSING", "PAUSED", "FREE_WATER"};
+  const int i = static_cast<int>(state);
+  return (i >= 0 && i < SM_STATE_COUNT) ? names[i] : "UNKNOWN";
+}
+
+static bool isFlowing(SystemState s) {
+  return s == DISPENSING || s == FREE_WATER;
+}
+
+bool isAnyNozzleFlowing() {
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    if (isFlowing(nozzles[i].state)) {
+      return true;
     }
-    freeWaterUsed = true;
-    return;
   }
+  return false;
+}
 
-  if (currentState == IDLE) {
-    freeWaterUsed = false;
-    freeWaterAvailableTime = millis() + config.freeWaterCooldown;
+bool areAllNozzlesIdle() {
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    if (nozzles[i].state != IDLE) {
+      return false;
+    }
   }
+  return true;
+}
+
+uint8_t getFocusNozzle() {
+  if (selectedNozzle >= 0 && millis() - selectedAtMs < config.sessionTimeout) {
+    return static_cast<uint8_t>(selectedNozzle);
+  }
+  uint8_t best = 0;
+  bool found = false;
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    const NozzleSession &n = nozzles[i];
+    if (n.state == IDLE) {
+      continue;
+    }
+    if (!found || (long)(n.lastSessionActivity -
+                         nozzles[best].lastSessionActivity) > 0) {
+      best = i;
+      found = true;
+    }
+  }
+  return best;
+}
+
+// Fleet log line; multi-nozzle builds say which outlet ("N1 Started")
+static void logNozzle(uint8_t nozzle, const char *event, const char *msg) {
+#if NOZZLE_COUNT > 1
+  char buf[64];
+  snprintf(buf, sizeof(buf), "N%u %s", (unsigned)nozzle + 1, msg);
+  publishLog(event, buf);
+#else
+  publishLog(event, msg);
+#endif
 }
 
 // ============================================
-// SESSION TIMEOUT HANDLER
+// GUARDS
 // ============================================
-void handleSessionTimeout() {
-  Serial.println("Session timeout!");
+static bool hasBalance(uint8_t nozzle) { return nozzles[nozzle].balance > 0; }
+
+static bool freeWaterReady(uint8_t nozzle) {
+  const NozzleSession &n = nozzles[nozzle];
+  return config.enableFreeWater && millis() >= n.freeWaterAvailableTime &&
+         !n.freeWaterUsed;
+}
+
+// Resume the mode (paid/free) that was paused, if free water is still valid
+static bool canResumeFree(uint8_t nozzle) {
+  const NozzleSession &n = nozzles[nozzle];
+  return n.pausedFromState == FREE_WATER && config.enableFreeWater &&
+         !n.freeWaterUsed && n.freeWaterDispensed < config.freeWaterAmount;
+}
+
+// ============================================
+// ENTRY / EXIT ACTIONS
+// ============================================
+// `from` is the state being left (for entry) or the state itself (for exit)
+static void enterFlowing(uint8_t nozzle, SystemState from) {
+  nozzles[nozzle].flowPulseCount = 0;
+  nozzles[nozzle].lastDispensedLiters = 0.0;
+}
+
+static void enterPaused(uint8_t nozzle, SystemState from) {
+  NozzleSession &n = nozzles[nozzle];
+  n.pausedFromState = from;
+  ledgerOnPause(nozzle);
+
+  LOG_INFO("Nozzle %u paused from state %d, relay OFF", (unsigned)nozzle,
+           (int)from);
+  char msg[32];
+  if (from == DISPENSING) {
+    snprintf(msg, sizeof(msg), "%.2f", n.totalDispensedLiters);
+    logNozzle(nozzle, "PAUSE", msg);
+  } else {
+    snprintf(msg, sizeof(msg), "%.2f", n.freeWaterDispensed);
+    logNozzle(nozzle, "PAUSE_FREE", msg);
+  }
+}
+
+static void exitPaused(uint8_t nozzle, SystemState from) {
+  nozzles[nozzle].pausedFromState = IDLE;
+}
+
+// ============================================
+// TRANSITION ACTIONS
+// ============================================
+static void actOpenSession(uint8_t nozzle, SystemState from) {
+  nozzles[nozzle].sessionStartBalance = nozzles[nozzle].balance;
+  nozzles[nozzle].freeWaterUsed = false;
+}
+
+static void actStartPaid(uint8_t nozzle, SystemState from) {
+  nozzles[nozzle].sessionStartBalance = nozzles[nozzle].balance;
+  logNozzle(nozzle, "DISPENSE", "Started");
+}
+
+static void actStartFree(uint8_t nozzle, SystemState from) {
+  nozzles[nozzle].freeWaterDispensed = 0.0;
+  ledgerOnFreeWaterStart(nozzle);
+  logNozzle(nozzle, "FREE_WATER", "Started");
+}
+
+static void actResumePaid(uint8_t nozzle, SystemState from) {
+  logNozzle(nozzle, "DISPENSE", "Resumed");
+}
+
+static void actResumeFree(uint8_t nozzle, SystemState from) {
+  logNozzle(nozzle, "FREE_WATER", "Resumed");
+}
+
+// Feedback for user why start didn't work; the next cash goes to this nozzle
+static void actPromptPayment(uint8_t nozzle, SystemState from) {
+  promptPending = true;
+  selectedNozzle = nozzle;
+  selectedAtMs = millis();
+}
+
+static void actExtraPayment(uint8_t nozzle, SystemState from) {
+  LOG_DEBUG("Payment during %s - balance increased", getStateName(from));
+}
+
+// Cash inserted during free water: continue directly as paid dispensing so
+// the relay stays ON and flow is billed immediately
+static void actPaidOverFree(uint8_t nozzle, SystemState from) {
+  NozzleSession &n = nozzles[nozzle];
+  LOG_INFO("Payment during FREE_WATER -> DISPENSING");
+  n.sessionStartBalance = n.balance;
+  n.freeWaterUsed = true; // Don't allow free water again this session
+  n.totalDispensedLiters = 0.0;
+}
+
+static void actFreeDoneToPaid(uint8_t nozzle, SystemState from) {
+  NozzleSession &n = nozzles[nozzle];
+  n.sessionStartBalance = n.balance;
+  n.totalDispensedLiters = 0.0;
+  resetSessionTimer(nozzle);
+  LOG_INFO("FREE_WATER -> DISPENSING (balance available)");
+  logNozzle(nozzle, "FREE_WATER", "Completed");
+}
+
+static void actFreeDone(uint8_t nozzle, SystemState from) {
+  ledgerEndSession(LEDGER_END_FREE_DONE, 0, nozzle);
+  logNozzle(nozzle, "FREE_WATER", "Completed");
+}
+
+// Balance depleted - go to IDLE, not ACTIVE
+static void actDepleted(uint8_t nozzle, SystemState from) {
+  ledgerEndSession(LEDGER_END_DEPLETED, 0, nozzle);
+  resetSessionTimer(nozzle); // Prevent stale lastSessionActivity
+  logNozzle(nozzle, "BALANCE", "Depleted");
+}
+
+static void actTimeout(uint8_t nozzle, SystemState from) {
+  NozzleSession &n = nozzles[nozzle];
+  LOG_INFO("Session timeout (nozzle=%u, state=%d, balance=%ld)",
+           (unsigned)nozzle, (int)from, static_cast<long>(n.balance));
 
   // Log lost balance
-  if (balance > 0) {
+  if (n.balance > 0) {
     char logMsg[128];
+#if NOZZLE_COUNT > 1
+    snprintf(logMsg, sizeof(logMsg),
+             "{\"event\":\"TIMEOUT\",\"nozzle\":%u,\"balance_lost\":%.2f,"
+             "\"dispensed\":%.2f}",
+             (unsigned)nozzle + 1, (float)n.balance, n.totalDispensedLiters);
+#else
     snprintf(logMsg, sizeof(logMsg),
              "{\"event\":\"TIMEOUT\",\"balance_lost\":%.2f,\"dispensed\":%.2f}",
-             (float)balance, totalDispensedLiters);
+             (float)n.balance, n.totalDispensedLiters);
+#endif
     publishLog("TIMEOUT", logMsg);
   }
+  ledgerEndSession(LEDGER_END_TIMEOUT, n.balance, nozzle);
 
-  // Reset
-  balance = 0;
-  totalDispensedLiters = 0.0;
-  sessionStartBalance = 0.0;
-  currentState = IDLE;
-  pausedFromState = IDLE;
-
-  setRelay(false); // Close valve
+  n.balance = 0;
+  n.totalDispensedLiters = 0.0;
+  n.sessionStartBalance = 0.0;
 
   // Start free water timer
-  freeWaterAvailableTime = millis() + config.freeWaterCooldown;
-  freeWaterUsed = false;
+  n.freeWaterAvailableTime = millis() + config.freeWaterCooldown;
+  n.freeWaterUsed = false;
+}
 
-  publishStatus();
+static void actAbort(uint8_t nozzle, SystemState from) {
+  ledgerEndSession(LEDGER_END_ABORTED, nozzles[nozzle].balance, nozzle);
+  nozzles[nozzle].balance = 0;
 }
 
 // ============================================
-// START BUTTON HANDLER
+// TRANSITION TABLE
 // ============================================
-void handleStartButton() {
-  resetSessionTimer();
-
-  switch (currentState) {
-  case IDLE:
-    if (balance > 0) {
-      currentState = DISPENSING;
-      flowPulseCount = 0;
-      lastDispensedLiters = 0.0;
-      sessionStartBalance = balance;
-      setRelay(true);
-
-      // Dispense started
-      publishLog("DISPENSE", "Started");
-      publishStatus();
-    } else if (config.enableFreeWater && millis() >= freeWaterAvailableTime &&
-               !freeWaterUsed) {
-      currentState = FREE_WATER;
-      freeWaterDispensed = 0.0;
-      flowPulseCount = 0;
-      lastDispensedLiters = 0.0;
-      setRelay(true);
-
-      // Free water started
-      publishLog("FREE_WATER", "Started");
-      publishStatus();
-    } else {
-      // Feedback for user why start didn't work
-      showTemporaryMessage("PUL KIRITING", "Yoki kuting...");
+typedef bool (*SmGuard)(uint8_t nozzle);
+typedef void (*SmAction)(uint8_t nozzle, SystemState from);
+
+#define SM_STAY 0xFF     // Internal transition: action only, no exit/entry
+#define SM_MAX_CHOICES 3 // Guarded alternatives per [state][event]
+
+struct SmTransition {
+  SmGuard guard; // nullptr = always
+  uint8_t next;  // SystemState or SM_STAY
+  SmAction action;
+};
+
+struct SmStateActions {
+  SmAction entry;
+  SmAction exit;
+};
+
+// Indexed by SystemState; relays follow the state (see dispatchStateEvents)
+static constexpr SmStateActions STATE_ACTIONS[SM_STATE_COUNT] = {
+    {nullptr, nullptr},        // IDLE
+    {nullptr, nullptr},        // ACTIVE
+    {enterFlowing, nullptr},   // DISPENSING
+    {enterPaused, exitPaused}, // PAUSED
+    {enterFlowing, nullptr},   // FREE_WATER
+};
+
+// [state][event][choice]: the first alternative whose guard passes is taken.
+// Empty cells ignore the event. Unused alternatives are zero-filled, so a
+// real alternative targeting IDLE must have a guard or an action.
+static constexpr SmTransition
+    TRANSITIONS[SM_STATE_COUNT][SM_EV_COUNT][SM_MAX_CHOICES] = {
+        // IDLE
+        {
+            /* START */ {{hasBalance, DISPENSING, actStartPaid},
+                         {freeWaterReady, FREE_WATER, actStartFree},
+                         {nullptr, SM_STAY, actPromptPayment}},
+            /* PAUSE */ {},
+            /* PAYMENT */ {{nullptr, ACTIVE, actOpenSession}},
+            /* DEPLETED */ {},
+            /* FREE_DONE */ {},
+            /* TIMEOUT */ {},
+            /* ABORT */ {{nullptr, SM_STAY, actAbort}},
+        },
+        // ACTIVE
+        {
+            /* START */ {{hasBalance, DISPENSING, actStartPaid}},
+            /* PAUSE */ {},
+            /* PAYMENT */ {{nullptr, SM_STAY, actExtraPayment}},
+            /* DEPLETED */ {},
+            /* FREE_DONE */ {},
+            /* TIMEOUT */ {{nullptr, IDLE, actTimeout}},
+            /* ABORT */ {{nullptr, IDLE, actAbort}},
+        },
+        // DISPENSING
+        {
+            /* START */ {},
+            /* PAUSE */ {{nullptr, PAUSED, nullptr}},
+            /* PAYMENT */ {{nullptr, SM_STAY, actExtraPayment}},
+            /* DEPLETED */ {{nullptr, IDLE, actDepleted}},
+            /* FREE_DONE */ {},
+            /* TIMEOUT */ {{nullptr, IDLE, actTimeout}},
+            /* ABORT */ {{nullptr, IDLE, actAbort}},
+        },
+        // PAUSED
+        {
+            /* START */ {{canResumeFree, FREE_WATER, actResumeFree},
+                         {hasBalance, DISPENSING, actResumePaid},
+                         {nullptr, SM_STAY, actPromptPayment}},
+            /* PAUSE */ {},
+            /* PAYMENT */ {{nullptr, SM_STAY, actExtraPayment}},
+            /* DEPLETED */ {},
+            /* FREE_DONE */ {},
+            /* TIMEOUT */ {{nullptr, IDLE, actTimeout}},
+            /* ABORT */ {{nullptr, IDLE, actAbort}},
+        },
+        // FREE_WATER
+        {
+            /* START */ {},
+            /* PAUSE */ {{nullptr, PAUSED, nullptr}},
+            /* PAYMENT */ {{nullptr, DISPENSING, actPaidOverFree}},
+            /* DEPLETED */ {},
+            /* FREE_DONE */ {{hasBalance, DISPENSING, actFreeDoneToPaid},
+                             {nullptr, IDLE, actFreeDone}},
+            /* TIMEOUT */ {{nullptr, IDLE, actTimeout}},
+            /* ABORT */ {{nullptr, IDLE, actAbort}},
+        },
+};
+
+static const SmTransition *selectTransition(uint8_t nozzle, SystemState state,
+                                            StateEvent ev) {
+  const int s = static_cast<int>(state);
+  if (s < 0 || s >= SM_STATE_COUNT || ev >= SM_EV_COUNT) {
+    return nullptr;
+  }
+  for (const SmTransition &t : TRANSITIONS[s][ev]) {
+    if (!t.guard && !t.action && t.next == 0) {
+      return nullptr; // End of the filled alternatives
     }
-    break;
-
-  case ACTIVE:
-    if (balance > 0) {
-      currentState = DISPENSING;
-      flowPulseCount = 0;
-      lastDispensedLiters = 0.0;
-      sessionStartBalance = balance;
-      setRelay(true);
-
-      // Dispense started
-      publishLog("DISPENSE", "Started");
-      publishStatus();
+    if (!t.guard || t.guard(nozzle)) {
+      return &t;
     }
-    break;
-
-  case PAUSED:
-    // Resume the correct mode (paid/free) based on what was paused.
-    if (pausedFromState == FREE_WATER) {
-      if (config.enableFreeWater && !freeWaterUsed &&
-          freeWaterDispensed < config.freeWaterAmount) {
-        currentState = FREE_WATER;
-        flowPulseCount = 0;
-        lastDispensedLiters = 0.0;
-        setRelay(true);
-
-        pausedFromState = IDLE;
-        publishLog("FREE_WATER", "Resumed");
-        publishStatus();
-        break;
+  }
+  return nullptr;
+}
+
+// ============================================
+// EVENT QUEUE / DISPATCH
+// ============================================
+bool postStateEvent(StateEvent ev, uint8_t nozzle) {
+  if (nozzle >= NOZZLE_COUNT) {
+    return false;
+  }
+  if (eventCount >= SM_EVENT_QUEUE_LEN) {
+    LOG_WARN("State event %d dropped (queue full)", (int)ev);
+    return false;
+  }
+  eventQueue[(eventHead + eventCount) % SM_EVENT_QUEUE_LEN] = {ev, nozzle};
+  eventCount++;
+  return true;
+}
+
+static bool popStateEvent(QueuedEvent &out) {
+  if (eventCount == 0) {
+    return false;
+  }
+  out = eventQueue[eventHead];
+  eventHead = (eventHead + 1) % SM_EVENT_QUEUE_LEN;
+  eventCount--;
+  return true;
+}
+
+void dispatchStateEvents() {
+  if (dispatching) {
+    return; // Posted from inside an action; the outer loop picks it up
+  }
+  dispatching = true;
+
+  uint8_t touched = 0; // Nozzles whose relay must follow the new state
+  QueuedEvent q;
+  while (popStateEvent(q)) {
+    const uint8_t nozzle = q.nozzle;
+    const StateEvent ev = static_cast<StateEvent>(q.ev);
+    NozzleSession &n = nozzles[nozzle];
+    const SystemState from = n.state;
+    const SmTransition *t = selectTransition(nozzle, from, ev);
+    if (!t) {
+      continue;
+    }
+    touched |= (uint8_t)(1u << nozzle);
+    statusPending = true;
+    if (ev == SM_EV_PAYMENT && selectedNozzle == nozzle) {
+      selectedNozzle = -1; // Credit arrived where it was asked for
+    }
+
+    if (t->next == SM_STAY) {
+      if (t->action) {
+        t->action(nozzle, from);
       }
-      // Free water no longer valid, fall back to paid dispensing if possible.
+      continue;
+    }
+
+    const SystemState to = static_cast<SystemState>(t->next);
+    if (STATE_ACTIONS[from].exit) {
+      STATE_ACTIONS[from].exit(nozzle, from);
     }
+    if (t->action) {
+      t->action(nozzle, from);
+    }
+    n.state = to;
+    if (STATE_ACTIONS[to].entry) {
+      STATE_ACTIONS[to].entry(nozzle, from);
+    }
+    LOG_DEBUG("Nozzle %u: %s -> %s", (unsigned)nozzle, getStateName(from),
+              getStateName(to));
+  }
+
+  dispatching = false;
 
-    if (balance > 0) {
-      currentState = DISPENSING;
-      flowPulseCount = 0;
-      lastDispensedLiters = 0.0;
-      setRelay(true);
-
-      pausedFromState = IDLE;
-      publishLog("DISPENSE", "Resumed");
-      publishStatus();
-    } else {
-      showTemporaryMessage("PUL KIRITING", "Yoki kuting...");
+  // Deferred side effects, applied once for the final state
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    if (touched & (1u << i)) {
+      setNozzleRelay(i, isFlowing(nozzles[i].state));
     }
-    break;
+  }
+  if (promptPending) {
+    promptPending = false;
+    showTemporaryMessage("PUL KIRITING", "Yoki kuting...");
+  }
+}
+
+void requestStatusPublish() { statusPending = true; }
 
-  default:
-    break;
+bool isStatusPublishPending() { return statusPending; }
+
+void processStateMachine() {
+  dispatchStateEvents();
+  if (statusPending) {
+    statusPending = false;
+    publishStatus();
   }
 }
 
 // ============================================
-// PAUSE BUTTON HANDLER
+// APPLY CONFIG EFFECTS (Runtime)
 // ============================================
-void handlePauseButton() {
-  resetSessionTimer();
-
-  if (currentState == DISPENSING || currentState == FREE_WATER) {
-    const SystemState prevState = currentState;
-    pausedFromState = prevState;
-    currentState = PAUSED;
-    setRelay(false);
-
-    Serial.println("PAUSE button pressed - Relay OFF");
-    char msg[32];
-    if (prevState == DISPENSING) {
-      snprintf(msg, sizeof(msg), "%.2f", totalDispensedLiters);
-      publishLog("PAUSE", msg);
-    } else {
-      snprintf(msg, sizeof(msg), "%.2f", freeWaterDispensed);
-      publishLog("PAUSE_FREE", msg);
+void applyConfigStateEffects() {
+  for (uint8_t i = 0; i < NOZZLE_COUNT; i++) {
+    NozzleSession &n = nozzles[i];
+    if (!config.enableFreeWater) {
+      if (n.state == FREE_WATER) {
+        logNozzle(i, "FREE_WATER", "Disabled");
+        postStateEvent(SM_EV_ABORT, i);
+      }
+      n.freeWaterUsed = true;
+    } else if (n.state == IDLE) {
+      n.freeWaterUsed = false;
+      n.freeWaterAvailableTime = millis() + config.freeWaterCooldown;
     }
-    publishStatus();
   }
+  dispatchStateEvents();
+}
+
+// ============================================
+// INPUT HANDLERS
+// ============================================
+void handleSessionTimeout(uint8_t nozzle) {
+  postStateEvent(SM_EV_TIMEOUT, nozzle);
+  dispatchStateEvents();
+}
+
+void handleStartButton(uint8_t nozzle) {
+  resetSessionTimer(nozzle);
+  postStateEvent(SM_EV_START, nozzle);
+  dispatchStateEvents();
+}
+
+void handlePauseButton(uint8_t nozzle) {
+  resetSessionTimer(nozzle);
+  postStateEvent(SM_EV_PAUSE, nozzle);
+  dispatchStateEvents();
 }
 
 // ============================================
 // FLOW SENSOR PROCESSING
 // ============================================
-void processFlowSensor() {
-  if (config.pulsesPerLiter <= 0.0f) {
+void processFlowSensor(uint8_t nozzle) {
+  if (nozzle >= NOZZLE_COUNT) {
+    return;
+  }
+  NozzleSession &n = nozzles[nozzle];
+  const float pulsesPerLiter = nozzlePulsesPerLiter(nozzle);
+  if (pulsesPerLiter <= 0.0f) {
     return;
   }
 
@@ -223,73 +557,61 @@ void processFlowSensor() {
   noInterrupts();
   // Overflow protection - reset at 1M pulses (~450L @ 2200 pulses/L)
   const unsigned long FLOW_COUNTER_MAX = 1000000UL;
-  if (flowPulseCount > FLOW_COUNTER_MAX) {
-    Serial.println("⚠️ Flow counter reset (normal overflow prevention)");
-    flowPulseCount = 0;
-    lastDispensedLiters = 0.0;
+  if (n.flowPulseCount > FLOW_COUNTER_MAX) {
+    LOG_WARN("Flow counter reset (overflow prevention)");
+    n.flowPulseCount = 0;
+    n.lastDispensedLiters = 0.0;
   }
-  pulses = flowPulseCount;
+  pulses = n.flowPulseCount;
   interrupts();
 
-  float currentLiters = pulses / config.pulsesPerLiter;
-  float litersDiff = currentLiters - lastDispensedLiters;
+  float currentLiters = pulses / pulsesPerLiter;
+  float litersDiff = currentLiters - n.lastDispensedLiters;
 
   if (litersDiff >= 0.01) { // Every 10ml
-    lastDispensedLiters = currentLiters;
+    n.lastDispensedLiters = currentLiters;
 
     // HIGH FIX: Update lastSessionActivity ONLY when actual flow detected
     // This prevents timeout during active dispensing but allows timeout if flow
     // stops
-    lastSessionActivity = millis();
+    n.lastSessionActivity = millis();
+    telemetryAddVolume(litersDiff);
 
-    if (currentState == DISPENSING) {
+    if (n.state == DISPENSING) {
       // Deduct balance - FIX: Check BEFORE subtraction to prevent underflow
-      int cost = (int)(litersDiff * config.pricePerLiter);
+      const int price = nozzlePrice(nozzle);
+      int cost = (int)(litersDiff * price);
 
       // FIX: Always update totalDispensedLiters first
-      totalDispensedLiters += litersDiff;
-
-      if (cost >= balance) {
-        // Balance depleted - FIX: Go to IDLE, not ACTIVE
-        balance = 0;
-        currentState = IDLE;
-        setRelay(false);
-        resetSessionTimer(); // Prevent stale lastSessionActivity
-
-        publishLog("BALANCE", "Depleted");
-        publishStatus();
+      n.totalDispensedLiters += litersDiff;
+      ledgerAddVolume(litersDiff, false, nozzle);
+
+      if (cost >= n.balance) {
+        // Water beyond what the remaining balance paid for
+        if (price > 0) {
+          ledgerAddOvershoot(litersDiff - (float)n.balance / (float)price,
+                             nozzle);
+        }
+        n.balance = 0;
+        postStateEvent(SM_EV_DEPLETED, nozzle);
+        dispatchStateEvents();
       } else {
         // Normal deduction
-        balance -= cost;
+        n.balance -= cost;
       }
 
-    } else if (currentState == FREE_WATER) {
-      freeWaterDispensed += litersDiff;
-
-      if (freeWaterDispensed >= config.freeWaterAmount) {
-        freeWaterUsed = true;
-        freeWaterAvailableTime = millis() + config.freeWaterCooldown;
-
-        if (balance > 0) {
-          // Cash was inserted during free water - continue directly as paid
-          // dispensing so relay stays ON and flow is billed immediately.
-          currentState = DISPENSING;
-          sessionStartBalance = balance;
-          // Reset flow counters for paid dispensing
-          flowPulseCount = 0;
-          lastDispensedLiters = 0.0;
-          totalDispensedLiters = 0.0;
-          resetSessionTimer();
-          Serial.println("💰 FREE_WATER → DISPENSING (balance available)");
-          // Relay stays ON - water continues
-        } else {
-          // No balance - go back to idle
-          currentState = IDLE;
-          setRelay(false);
-        }
-
-        publishLog("FREE_WATER", "Completed");
-        publishStatus();
+    } else if (n.state == FREE_WATER) {
+      n.freeWaterDispensed += litersDiff;
+      ledgerAddVolume(litersDiff, true, nozzle);
+
+      if (n.freeWaterDispensed >= config.freeWaterAmount) {
+        ledgerAddOvershoot(n.freeWaterDispensed - config.freeWaterAmount,
+                           nozzle);
+        n.freeWaterUsed = true;
+        n.freeWaterAvailableTime = millis() + config.freeWaterCooldown;
+        // Continues as paid dispensing if cash came in meanwhile
+        postStateEvent(SM_EV_FREE_DONE, nozzle);
+        dispatchStateEvents();
       }
     }
   }
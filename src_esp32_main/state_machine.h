@@ -1,6 +1,7 @@
 #ifndef STATE_MACHINE_H
 #define STATE_MACHINE_H
 
+#include "hardware.h"
 #include <Arduino.h>
 
 // ============================================
@@ -15,34 +16,113 @@ enum SystemState {
 };
 
 // ============================================
-// GLOBAL STATE
+// PER-NOZZLE SESSION
 // ============================================
-extern SystemState currentState;
-extern volatile long balance;
-extern float totalDispensedLiters;
-extern float sessionStartBalance;
+// Every nozzle runs its own session (state, credit, flow, free water,
+// timers) through the same transition table.
+struct NozzleSession {
+  SystemState state;
+  volatile long balance;
+  float totalDispensedLiters;
+  float sessionStartBalance;
+
+  // Flow sensor (pulse counter written by the nozzle's ISR)
+  volatile unsigned long flowPulseCount;
+  float lastDispensedLiters;
+
+  // Free water
+  float freeWaterDispensed;
+  bool freeWaterUsed;
+
+  // Timers
+  unsigned long lastSessionActivity;
+  unsigned long freeWaterAvailableTime;
+
+  SystemState pausedFromState;
+};
+
+extern NozzleSession nozzles[NOZZLE_COUNT];
+
+// ============================================
+// GLOBAL STATE (nozzle 0)
+// ============================================
+// Aliases into nozzles[0] for single-outlet code paths
+extern SystemState &currentState;
+extern volatile long &balance;
+extern float &totalDispensedLiters;
+extern float &sessionStartBalance;
 
 // Flow sensor
-extern volatile unsigned long flowPulseCount;
-extern float lastDispensedLiters;
+extern volatile unsigned long &flowPulseCount;
+extern float &lastDispensedLiters;
 
 // Free water
-extern float freeWaterDispensed;
-extern bool freeWaterUsed;
+extern float &freeWaterDispensed;
+extern bool &freeWaterUsed;
 
 // Timers
-extern unsigned long lastSessionActivity;
-extern unsigned long freeWaterAvailableTime;
+extern unsigned long &lastSessionActivity;
+extern unsigned long &freeWaterAvailableTime;
+
+// ============================================
+// EVENTS
+// ============================================
+// Every state change goes through one transition table indexed by
+// [state][event]. Inputs post events to a small queue; dispatching runs the
+// exit action, transition action and entry action, then applies the relay
+// once for the resulting state. Status publishing is coalesced and sent by
+// processStateMachine() at most once per loop.
+enum StateEvent : uint8_t {
+  SM_EV_START,     // START button
+  SM_EV_PAUSE,     // PAUSE button
+  SM_EV_PAYMENT,   // Credit added to balance (cash or MQTT)
+  SM_EV_DEPLETED,  // Paid dispensing used up the balance
+  SM_EV_FREE_DONE, // Free water portion poured
+  SM_EV_TIMEOUT,   // No activity for config.sessionTimeout
+  SM_EV_ABORT,     // Emergency shutdown / free water disabled
+  SM_EV_COUNT
+};
+
+#define SM_STATE_COUNT 5
+#define SM_EVENT_QUEUE_LEN 8
 
 // ============================================
 // FUNCTIONS
 // ============================================
 void initStateMachine();
-void handleStartButton();
-void handlePauseButton();
-void handleSessionTimeout();
-void processFlowSensor();
-void resetSessionTimer();
+void handleStartButton(uint8_t nozzle = 0);
+void handlePauseButton(uint8_t nozzle = 0);
+void handleSessionTimeout(uint8_t nozzle = 0);
+void processFlowSensor(uint8_t nozzle = 0);
+void resetSessionTimer(uint8_t nozzle = 0);
 void applyConfigStateEffects();
 
+// Queue an event (false if the queue is full and it was dropped)
+bool postStateEvent(StateEvent ev, uint8_t nozzle = 0);
+
+// Run all queued events through the transition table, then set the relays.
+// Safe to call from inside an action (the outer call drains the queue).
+void dispatchStateEvents();
+
+// Once per loop: dispatch leftovers and send the coalesced status
+void processStateMachine();
+
+// Ask for one status publish at the end of this loop
+void requestStatusPublish();
+bool isStatusPublishPending();
+
+// Nozzle the customer is most likely at: the one where START was pressed
+// without credit (within the session timeout), else the most recently
+// active busy nozzle, else nozzle 0. Cash without a nozzle is credited
+// here and the LCD shows it.
+uint8_t getFocusNozzle();
+
+// True if any nozzle is dispensing (paid or free)
+bool isAnyNozzleFlowing();
+
+// True if every nozzle is IDLE (safe for blocking work such as reconnects)
+bool areAllNozzlesIdle();
+
+const char *getStateName(SystemState state);
+
 #endif
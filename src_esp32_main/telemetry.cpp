@@ -0,0 +1,161 @@
+#include "telemetry.h"
+#include "../shared/logger.h"
+#include "config.h"
+#include "config_storage.h"
+#include "mqtt_handler.h"
+#include "sensors.h"
+#include <Arduino.h>
+#include <WiFi.h>
+
+// ============================================
+// STATE
+// ============================================
+static TelemetryWindow window;
+static unsigned long lastSampleMs = 0;
+static float pendingLiters = 0.0f; // Poured since the last sample
+static uint32_t lastTickUs = 0;
+static uint32_t passMaxUs = 0; // Longest loop() pass since the last sample
+
+static TelemetryAlertState alerts[TELEM_ALERT_COUNT];
+static float alertValue[TELEM_ALERT_COUNT];    // Reading that flipped it
+static float alertThreshold[TELEM_ALERT_COUNT]; // Edge it crossed
+static bool alertUnsent[TELEM_ALERT_COUNT];     // Retried each sample
+
+// MessagePack record (a full window encodes to ~100 bytes)
+static uint8_t recordBuf[192];
+
+void initTelemetry() {
+  telemetryWindowReset(window);
+  lastSampleMs = millis();
+  lastTickUs = micros();
+}
+
+void telemetryLoopTick() {
+  const uint32_t now = micros();
+  const uint32_t pass = now - lastTickUs;
+  lastTickUs = now;
+  if (pass > passMaxUs) {
+    passMaxUs = pass;
+  }
+}
+
+void telemetryAddVolume(float liters) { pendingLiters += liters; }
+
+bool isTelemetryAlertActive(TelemetryAlert alert) {
+  return alert < TELEM_ALERT_COUNT && alerts[alert].active;
+}
+
+// ============================================
+// ALERTS
+// ============================================
+static bool publishAlert(uint8_t a) {
+  if (!mqttClient.connected()) {
+    return false;
+  }
+  const bool active = alerts[a].active;
+  char msg[200];
+  const int n =
+      snprintf(msg, sizeof(msg),
+               "{\"device_id\":\"%s\",\"alert\":\"%s\",\"state\":\"%s\","
+               "\"value\":%ld,\"threshold\":%ld,\"uptime\":%lu}",
+               deviceConfig.device_id, telemetryAlertName(a),
+               active ? "raised" : "cleared", lroundf(alertValue[a]),
+               lroundf(alertThreshold[a]), millis() / 1000);
+  if (n <= 0 || n >= (int)sizeof(msg)) {
+    return true; // Cannot be sent as is; do not retry forever
+  }
+  return mqttClient.publish(TOPIC_ALERTS, msg);
+}
+
+static void updateAlert(TelemetryAlert a, float v, float raiseAt,
+                        float clearAt, bool above) {
+  const TelemetryAlertEdge edge =
+      telemetryAlertUpdate(alerts[a], v, raiseAt, clearAt, above);
+  if (edge == TELEM_EDGE_NONE) {
+    return;
+  }
+  alertValue[a] = v;
+  alertThreshold[a] = edge == TELEM_EDGE_RAISED ? raiseAt : clearAt;
+  if (edge == TELEM_EDGE_RAISED) {
+    LOG_WARN("Alert %s raised: %ld", telemetryAlertName(a), lroundf(v));
+  } else {
+    LOG_INFO("Alert %s cleared: %ld", telemetryAlertName(a), lroundf(v));
+  }
+  alertUnsent[a] = !publishAlert(a);
+}
+
+void telemetryRecordTds(int ppm) {
+  const int threshold = config.tdsThreshold;
+  if (threshold <= 0) {
+    // No threshold set: an alert raised under the old one clears now
+    TelemetryAlertState &s = alerts[TELEM_ALERT_TDS_HIGH];
+    s.streak = 0;
+    if (s.active) {
+      s.active = false;
+      alertValue[TELEM_ALERT_TDS_HIGH] = (float)ppm;
+      alertThreshold[TELEM_ALERT_TDS_HIGH] = 0.0f;
+      LOG_INFO("Alert %s cleared: threshold off",
+               telemetryAlertName(TELEM_ALERT_TDS_HIGH));
+      alertUnsent[TELEM_ALERT_TDS_HIGH] = !publishAlert(TELEM_ALERT_TDS_HIGH);
+    }
+    return;
+  }
+  updateAlert(TELEM_ALERT_TDS_HIGH, (float)ppm, (float)threshold,
+              threshold * TELEMETRY_TDS_CLEAR_PCT / 100.0f, true);
+}
+
+// ============================================
+// SAMPLING AND FLUSH
+// ============================================
+static void flushWindow() {
+  if (mqttClient.connected()) {
+    JsonDocument doc;
+    telemetryFillRecord(doc, window, millis() / 1000);
+    const size_t len = serializeMsgPack(doc, recordBuf, sizeof(recordBuf));
+    if (len > 0 && len < sizeof(recordBuf)) {
+      mqttClient.publish(TOPIC_TELEMETRY, recordBuf, len);
+    }
+  }
+  // Offline windows are dropped: the stream is for trends, not accounting
+  // (liters are in the session ledger)
+  telemetryWindowReset(window);
+}
+
+void processTelemetry() {
+  const unsigned long now = millis();
+  const unsigned long elapsed = now - lastSampleMs;
+  if (elapsed < TELEMETRY_SAMPLE_MS) {
+    return;
+  }
+  lastSampleMs = now;
+
+  const bool wifiUp = WiFi.status() == WL_CONNECTED;
+  const int rssi = wifiUp ? WiFi.RSSI() : 0;
+  const uint32_t freeHeap = ESP.getFreeHeap();
+
+  telemetryStatAdd(window.stat[TELEM_FLOW],
+                   telemetryFlowLpm(pendingLiters, elapsed));
+  window.volumeL += pendingLiters;
+  pendingLiters = 0.0f;
+  telemetryStatAdd(window.stat[TELEM_TDS], (float)tdsPPM);
+  telemetryStatAdd(window.stat[TELEM_RSSI], (float)rssi);
+  telemetryStatAdd(window.stat[TELEM_HEAP], (float)freeHeap);
+  telemetryStatAdd(window.stat[TELEM_LOOP], (float)passMaxUs);
+  passMaxUs = 0;
+
+  if (wifiUp) {
+    updateAlert(TELEM_ALERT_RSSI_LOW, (float)rssi, TELEMETRY_RSSI_LOW,
+                TELEMETRY_RSSI_CLEAR, false);
+  }
+  updateAlert(TELEM_ALERT_HEAP_LOW, (float)freeHeap, TELEMETRY_HEAP_LOW,
+              TELEMETRY_HEAP_CLEAR, false);
+  for (uint8_t a = 0; a < TELEM_ALERT_COUNT; a++) {
+    if (alertUnsent[a]) {
+      alertUnsent[a] = !publishAlert(a);
+    }
+  }
+
+  if (window.stat[TELEM_FLOW].count >= TELEMETRY_FLUSH_S) {
+    flushWindow();
+  }
+}
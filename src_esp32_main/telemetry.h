@@ -0,0 +1,183 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <ArduinoJson.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// ============================================
+// BINARY TELEMETRY STREAM
+// ============================================
+// Once a second the loop takes one sample of each channel below and folds
+// it into min / mean / max for the current window. Every TELEMETRY_FLUSH_S
+// the window goes out on TOPIC_TELEMETRY as one MessagePack map (around 100
+// bytes, against several hundred for the same data in the JSON messages).
+// The JSON "boot" and "heap" reports share the topic; a decoder tells them
+// apart by the first byte ('{' is JSON, 0x80-0x8f a MessagePack map).
+//
+//   v     record version (TELEMETRY_VERSION)
+//   t     uptime (s) at the end of the window
+//   n     samples in the window
+//   vol   liters poured in the window, all nozzles
+//   flow  [min, mean, max] L/min, all nozzles
+//   tds   [min, mean, max] ppm (last TDS reading at each sample)
+//   rssi  [min, mean, max] dBm (0 while WiFi is down)
+//   heap  [min, mean, max] free heap, bytes
+//   loop  [min, mean, max] longest loop() pass of each second, us
+//
+// Threshold crossings go to TOPIC_ALERTS as they happen (JSON, see
+// TelemetryAlert), once when raised and once when cleared.
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_SAMPLE_MS 1000
+#ifndef TELEMETRY_FLUSH_S
+#define TELEMETRY_FLUSH_S 60 // Samples per record
+#endif
+
+#define TELEMETRY_ALERT_SAMPLES 3 // Consecutive readings to raise or clear
+#define TELEMETRY_TDS_CLEAR_PCT 90  // Clears below this % of tdsThreshold
+#define TELEMETRY_RSSI_LOW -85      // dBm
+#define TELEMETRY_RSSI_CLEAR -80
+#define TELEMETRY_HEAP_LOW 20000 // Free bytes
+#define TELEMETRY_HEAP_CLEAR 30000
+
+enum TelemetryChannel : uint8_t {
+  TELEM_FLOW,
+  TELEM_TDS,
+  TELEM_RSSI,
+  TELEM_HEAP,
+  TELEM_LOOP,
+  TELEM_CHANNEL_COUNT
+};
+
+struct TelemetryStat {
+  float min;
+  float max;
+  float sum;
+  uint16_t count;
+};
+
+struct TelemetryWindow {
+  TelemetryStat stat[TELEM_CHANNEL_COUNT];
+  float volumeL;
+};
+
+inline void telemetryStatAdd(TelemetryStat &s, float v) {
+  if (s.count == 0 || v < s.min) {
+    s.min = v;
+  }
+  if (s.count == 0 || v > s.max) {
+    s.max = v;
+  }
+  s.sum += v;
+  s.count++;
+}
+
+inline float telemetryStatMean(const TelemetryStat &s) {
+  return s.count ? s.sum / s.count : 0.0f;
+}
+
+inline void telemetryWindowReset(TelemetryWindow &w) {
+  memset(&w, 0, sizeof(w));
+}
+
+// Liters poured over `elapsedMs` as L/min
+inline float telemetryFlowLpm(float liters, unsigned long elapsedMs) {
+  return elapsedMs ? liters * 60000.0f / elapsedMs : 0.0f;
+}
+
+inline const char *telemetryChannelKey(uint8_t c) {
+  static const char *const keys[TELEM_CHANNEL_COUNT] = {"flow", "tds", "rssi",
+                                                        "heap", "loop"};
+  return c < TELEM_CHANNEL_COUNT ? keys[c] : "?";
+}
+
+// Flow keeps two decimals; the other channels are whole units, which
+// MessagePack stores in 1-5 bytes instead of a 5-byte float
+inline void telemetryAddStat(JsonArray out, uint8_t c, float v) {
+  if (c == TELEM_FLOW) {
+    out.add(roundf(v * 100.0f) / 100.0f);
+  } else {
+    out.add((int32_t)lroundf(v));
+  }
+}
+
+// The record described above; serialize it with serializeMsgPack()
+inline void telemetryFillRecord(JsonDocument &doc, const TelemetryWindow &w,
+                                uint32_t uptimeS) {
+  doc["v"] = TELEMETRY_VERSION;
+  doc["t"] = uptimeS;
+  doc["n"] = w.stat[TELEM_FLOW].count; // Every sample feeds every channel
+  doc["vol"] = roundf(w.volumeL * 1000.0f) / 1000.0f;
+  for (uint8_t c = 0; c < TELEM_CHANNEL_COUNT; c++) {
+    const TelemetryStat &s = w.stat[c];
+    JsonArray a = doc[telemetryChannelKey(c)].to<JsonArray>();
+    telemetryAddStat(a, c, s.min);
+    telemetryAddStat(a, c, telemetryStatMean(s));
+    telemetryAddStat(a, c, s.max);
+  }
+}
+
+// ============================================
+// THRESHOLD ALERTS
+// ============================================
+enum TelemetryAlert : uint8_t {
+  TELEM_ALERT_TDS_HIGH,
+  TELEM_ALERT_RSSI_LOW,
+  TELEM_ALERT_HEAP_LOW,
+  TELEM_ALERT_COUNT
+};
+
+enum TelemetryAlertEdge : uint8_t {
+  TELEM_EDGE_NONE,
+  TELEM_EDGE_RAISED,
+  TELEM_EDGE_CLEARED
+};
+
+struct TelemetryAlertState {
+  bool active;
+  uint8_t streak; // Consecutive readings past the edge that would flip it
+};
+
+// Hysteresis plus debounce: raised after TELEMETRY_ALERT_SAMPLES readings
+// beyond `raiseAt`, cleared after as many back past `clearAt`. `above`:
+// the alert is for high values (TDS) rather than low ones (RSSI, heap).
+inline TelemetryAlertEdge telemetryAlertUpdate(TelemetryAlertState &s,
+                                               float v, float raiseAt,
+                                               float clearAt, bool above) {
+  const bool flip = s.active ? (above ? v < clearAt : v > clearAt)
+                             : (above ? v > raiseAt : v < raiseAt);
+  if (!flip) {
+    s.streak = 0;
+    return TELEM_EDGE_NONE;
+  }
+  if (++s.streak < TELEMETRY_ALERT_SAMPLES) {
+    return TELEM_EDGE_NONE;
+  }
+  s.streak = 0;
+  s.active = !s.active;
+  return s.active ? TELEM_EDGE_RAISED : TELEM_EDGE_CLEARED;
+}
+
+inline const char *telemetryAlertName(uint8_t a) {
+  static const char *const names[TELEM_ALERT_COUNT] = {"tds_high", "rssi_low",
+                                                       "heap_low"};
+  return a < TELEM_ALERT_COUNT ? names[a] : "?";
+}
+
+// ============================================
+// FUNCTIONS
+// ============================================
+void initTelemetry();
+// At the top of every loop() pass: times the pass before it
+void telemetryLoopTick();
+// Samples once a second, flushes every TELEMETRY_FLUSH_S, sends alerts
+void processTelemetry();
+// Liters poured since the last call (from processFlowSensor)
+void telemetryAddVolume(float liters);
+// Each new TDS reading (the TDS alert debounces over readings, not seconds)
+void telemetryRecordTds(int ppm);
+bool isTelemetryAlertActive(TelemetryAlert alert);
+
+#endif
@@ -1,5 +1,8 @@
 #include "uart_receiver.h"
+#include "../shared/logger.h"
 #include "../shared/uart_protocol.h"
+#include "config.h"
+#include "config_storage.h"
 #include "hardware.h"
 #include "mqtt_handler.h"
 #include "state_machine.h"
@@ -8,6 +11,9 @@
 // CONFIGURATION
 // ============================================
 #define CONNECTION_TIMEOUT_MS 15000
+#define SYNC_RETRY_FAST_MS 100  // Resend an unacknowledged snapshot...
+#define SYNC_RETRY_SLOW_MS 5000 // ...then back off if Payment is away
+#define SYNC_FAST_TRIES 3
 
 // ============================================
 // VARIABLES
@@ -17,6 +23,36 @@ static bool paymentEspConnected = false;
 static uint32_t recentPaymentSeq[16] = {0};
 static uint8_t recentPaymentSeqIdx = 0;
 
+// Line assembly (no blocking readBytesUntil)
+static char rxLine[UART_MSG_BUFFER_SIZE];
+static int rxLen = 0;
+static bool rxOverflow = false;
+
+// Link training (Main is the responder, see shared/uart_link.h)
+enum LinkTrainState : uint8_t {
+  LINK_TRAIN_IDLE,
+  LINK_TRAIN_WAIT_BLOCK,  // Switched to trainBaud, expecting Payment's block
+  LINK_TRAIN_WAIT_COMMIT, // Sent RES + our block, expecting COMMIT
+};
+
+static UartLinkStats linkStats;
+static UartLinkStats peerLinkStats; // Reported by Payment ESP32 ($LQS)
+static LinkTrainState trainState = LINK_TRAIN_IDLE;
+static uint32_t trainBaud = 0;
+static uint32_t trainPrevBaud = UART_BAUD;
+static unsigned long trainDeadlineMs = 0;
+static LinkBlockRx blockRx;
+static volatile uint32_t hwErrorsPending = 0;
+
+// State replication to Payment ESP32 (see shared/state_sync.h)
+static uint8_t paymentInhibit = 0;
+static StateSnapshot syncSent = {0, 0, 0, 0, 0};  // Latest version sent
+static StateSnapshot syncAcked = {0, 0, 0, 0, 0}; // Held by Payment
+static bool syncAckedValid = false;
+static bool syncPending = true; // First snapshot goes out right away
+static uint8_t syncTries = 0;
+static unsigned long syncSentMs = 0;
+
 static bool isDuplicatePaymentSeq(uint32_t seq) {
   if (seq == 0) {
     return false;
@@ -32,14 +68,23 @@ static bool isDuplicatePaymentSeq(uint32_t seq) {
   return false;
 }
 
+// Runs in the UART driver's event task
+static void onUartError(hardwareSerial_error_t err) {
+  if (err == UART_FRAME_ERROR || err == UART_PARITY_ERROR ||
+      err == UART_BREAK_ERROR) {
+    hwErrorsPending = hwErrorsPending + 1;
+  }
+}
+
 // ============================================
 // INITIALIZATION
 // ============================================
 void initUartReceiver() {
   Serial2.begin(UART_BAUD, SERIAL_8N1, UART_RX_PIN, UART_TX_PIN);
+  Serial2.onReceiveError(onUartError);
 
-  // Flush stale data from UART buffer (from before boot/reflash)
-  delay(100); // Wait for any pending bytes
+  // Drop whatever is already buffered (from before boot/reflash). No wait:
+  // a frame cut in half still arriving fails the '$'/checksum check.
   while (Serial2.available()) {
     Serial2.read();
   }
@@ -48,6 +93,19 @@ void initUartReceiver() {
   memset(recentPaymentSeq, 0, sizeof(recentPaymentSeq));
   recentPaymentSeqIdx = 0;
 
+  linkStatsReset(linkStats, UART_BAUD);
+  linkStatsReset(peerLinkStats, UART_BAUD);
+
+  // An emergency stop or service lock outlives a reboot; the first snapshot
+  // hands it to the Payment ESP32
+  preferences.begin("ewater", true);
+  paymentInhibit = preferences.getUChar("inhibit", 0) & INHIBIT_LATCHED;
+  preferences.end();
+  if (paymentInhibit) {
+    LOG_WARN("Cash acceptor inhibited since last boot (mask 0x%02x)",
+             paymentInhibit);
+  }
+
   Serial.print("✓ UART Receiver initialized (RX:");
   Serial.print(UART_RX_PIN);
   Serial.print(", TX:");
@@ -78,84 +136,325 @@ void sendStatusToPaymentEsp(const char *state, long bal) {
   Serial2.print(buffer);
 }
 
+// ============================================
+// LINK TRAINING
+// ============================================
+static void sendLinkFrame(const char *op, uint32_t baud) {
+  char buffer[UART_MSG_BUFFER_SIZE];
+  char data[UART_MAX_DATA_LEN + 1];
+  snprintf(data, sizeof(data), "%s,%lu", op, static_cast<unsigned long>(baud));
+  buildMessage(buffer, CMD_LINK, data);
+  Serial2.print(buffer);
+}
+
+static void setLinkBaud(uint32_t baud) {
+  Serial2.flush(); // Let the last frame leave at the old baud
+  Serial2.updateBaudRate(baud);
+  linkStats.baud = baud;
+  linkStats.window = 0;
+  rxLen = 0;
+  rxOverflow = false;
+  lastMessageMs = millis(); // Silence timer restarts at the new baud
+}
+
+static void linkFallback(const char *reason) {
+  if (linkStats.baud == UART_BAUD) {
+    return;
+  }
+  LOG_WARN("UART link fallback %lu -> %d baud (%s)",
+           static_cast<unsigned long>(linkStats.baud), UART_BAUD, reason);
+  sendLinkFrame(LINK_OP_DOWN, UART_BAUD);
+  setLinkBaud(UART_BAUD);
+  linkStats.fallbacks++;
+  trainState = LINK_TRAIN_IDLE;
+}
+
+static void handleLinkFrame(const char *data) {
+  char op[8] = {0};
+  unsigned long baud = 0;
+  if (sscanf(data, "%7[^,],%lu", op, &baud) != 2) {
+    return;
+  }
+
+  if (strcmp(op, LINK_OP_REQ) == 0) {
+    if (trainState != LINK_TRAIN_IDLE || !linkBaudSupported(baud)) {
+      sendLinkFrame(LINK_OP_NAK, baud);
+      return;
+    }
+    sendLinkFrame(LINK_OP_OK, baud);
+    trainPrevBaud = linkStats.baud;
+    trainBaud = baud;
+    setLinkBaud(baud);
+    linkBlockRxReset(blockRx);
+    trainState = LINK_TRAIN_WAIT_BLOCK;
+    trainDeadlineMs = millis() + LINK_TRAIN_TIMEOUT_MS;
+  } else if (strcmp(op, LINK_OP_COMMIT) == 0) {
+    if (trainState != LINK_TRAIN_WAIT_COMMIT || baud != trainBaud) {
+      return;
+    }
+    sendLinkFrame(LINK_OP_DONE, baud);
+    trainState = LINK_TRAIN_IDLE;
+    linkStats.trainings++;
+    LOG_INFO("UART link trained to %lu baud", baud);
+  } else if (strcmp(op, LINK_OP_DOWN) == 0) {
+    if (linkStats.baud != UART_BAUD) {
+      LOG_WARN("UART link fallback requested by Payment ESP");
+      setLinkBaud(UART_BAUD);
+      linkStats.fallbacks++;
+      trainState = LINK_TRAIN_IDLE;
+    }
+  }
+}
+
+// Payment's block arrived at trainBaud: report the result and answer with
+// our own block so Payment can check the other direction.
+static void finishBlockRx() {
+  uint16_t bitErrors = 0;
+  const bool ok = linkBlockCheck(blockRx, trainBaud, bitErrors);
+  linkStats.lastBitErrors = bitErrors;
+
+  char buffer[UART_MSG_BUFFER_SIZE];
+  char data[UART_MAX_DATA_LEN + 1];
+  snprintf(data, sizeof(data), "%s,%lu,%d,%u", LINK_OP_RES,
+           static_cast<unsigned long>(trainBaud), ok ? 1 : 0, bitErrors);
+  buildMessage(buffer, CMD_LINK, data);
+  Serial2.print(buffer);
+
+  uint8_t block[LINK_BLOCK_LEN];
+  linkBuildBlock(block, trainBaud);
+  Serial2.write(block, sizeof(block));
+
+  trainState = LINK_TRAIN_WAIT_COMMIT;
+  trainDeadlineMs = millis() + LINK_TRAIN_TIMEOUT_MS;
+}
+
+// ============================================
+// STATE REPLICATION
+// ============================================
+// The Payment ESP32 mirrors the nozzle that inserted cash will be credited to
+static void buildSnapshot(StateSnapshot &s) {
+  const uint8_t focus = getFocusNozzle();
+  s.state = (uint8_t)nozzles[focus].state;
+  s.balance = (int32_t)nozzles[focus].balance;
+  s.inhibit = paymentInhibit;
+  s.price = nozzlePrice(focus);
+}
+
+static void sendSnapshot() {
+  char buffer[UART_MSG_BUFFER_SIZE];
+  char data[UART_MAX_DATA_LEN + 1];
+  // Retries after the first go out in full in case the base was lost
+  const bool delta = syncAckedValid && syncTries == 0;
+  if (!syncEncode(data, sizeof(data), syncSent, delta ? &syncAcked : nullptr) ||
+      buildMessage(buffer, CMD_SYNC, data) == 0) {
+    LOG_WARN("State snapshot does not fit a frame");
+    syncPending = false;
+    return;
+  }
+  Serial2.print(buffer);
+  syncTries++;
+  syncSentMs = millis();
+}
+
+static void handleSyncAck(uint16_t ver) {
+  if (ver == syncSent.version) {
+    syncAcked = syncSent;
+    syncAckedValid = true;
+    syncPending = false;
+    return;
+  }
+  // Payment holds something else (rebooted, missed a delta): resync in full
+  if (!syncPending) {
+    syncPending = true;
+    syncTries = 0;
+  }
+  syncAckedValid = false;
+}
+
+static void processStateSync() {
+  if (trainState != LINK_TRAIN_IDLE) {
+    return; // Nothing else on the wire while the link is being trained
+  }
+
+  StateSnapshot cur;
+  buildSnapshot(cur);
+  if (syncDiff(cur, syncSent) != 0 || syncSent.version == 0) {
+    cur.version = syncNextVersion(syncSent.version);
+    syncSent = cur;
+    syncPending = true;
+    syncTries = 0;
+  }
+  if (!syncPending) {
+    return;
+  }
+
+  const unsigned long retryMs =
+      syncTries < SYNC_FAST_TRIES ? SYNC_RETRY_FAST_MS : SYNC_RETRY_SLOW_MS;
+  if (syncTries == 0 || millis() - syncSentMs >= retryMs) {
+    sendSnapshot();
+  }
+}
+
+void setPaymentInhibit(uint8_t reason, bool on) {
+  const uint8_t before = paymentInhibit;
+  if (on) {
+    paymentInhibit |= reason;
+  } else {
+    paymentInhibit &= (uint8_t)~reason;
+  }
+  if (paymentInhibit != before) {
+    LOG_INFO("Cash acceptor inhibit mask 0x%02x -> 0x%02x", before,
+             paymentInhibit);
+  }
+  if ((paymentInhibit ^ before) & INHIBIT_LATCHED) {
+    preferences.begin("ewater", false);
+    preferences.putUChar("inhibit", paymentInhibit & INHIBIT_LATCHED);
+    preferences.end();
+  }
+}
+
+uint8_t getPaymentInhibit() { return paymentInhibit; }
+
+bool syncPaymentStateNow(unsigned long timeoutMs) {
+  const unsigned long start = millis();
+  processStateSync();
+  while (syncPending && millis() - start < timeoutMs) {
+    delay(5);
+    processUartReceiver();
+  }
+  return !syncPending;
+}
+
 // ============================================
 // PROCESS INCOMING MESSAGES
 // ============================================
+static void handleLine(const char *buffer, int len) {
+  LOG_DEBUG("UART rx [%d]: %s", len, buffer);
+
+  char cmd[16], data[UART_MAX_DATA_LEN + 1];
+  if (!parseMessage(buffer, cmd, data)) {
+    linkRecordFrame(linkStats, false);
+    LOG_WARN("UART parse failed: %s", buffer);
+    return;
+  }
+  linkRecordFrame(linkStats, true);
+  lastMessageMs = millis();
+  paymentEspConnected = true;
+
+  if (strcmp(cmd, CMD_PAYMENT) == 0) {
+    // Payment received from Payment ESP32
+    int amount = 0;
+    uint32_t seq = 0;
+    const char *comma = strchr(data, ',');
+    if (comma != nullptr) {
+      amount = atoi(data);
+      seq = static_cast<uint32_t>(strtoul(comma + 1, nullptr, 10));
+    } else {
+      // Backward compatible: $PAY,amount
+      amount = atoi(data);
+      seq = 0;
+    }
+
+    // Send ACK immediately
+    sendAck(seq);
+
+    // Check for duplicate payment sequence
+    if (isDuplicatePaymentSeq(seq)) {
+      LOG_WARN("UART payment duplicate rejected, seq=%lu",
+               static_cast<unsigned long>(seq));
+      return;
+    }
+
+    const uint8_t nozzle = getFocusNozzle();
+    const long balanceBefore = nozzles[nozzle].balance;
+    processPayment(amount, "cash_uart", nullptr, nullptr, nozzle);
+    LOG_INFO("UART payment %d seq=%lu nozzle %u balance %ld -> %ld", amount,
+             static_cast<unsigned long>(seq), (unsigned)nozzle, balanceBefore,
+             static_cast<long>(nozzles[nozzle].balance));
+
+  } else if (strcmp(cmd, CMD_HEARTBEAT) == 0) {
+    sendAck(0);
+    // $HB,<uptime>,<snapshot version, hex> (missing on old firmware)
+    const char *comma = strchr(data, ',');
+    if (comma != nullptr &&
+        strtoul(comma + 1, nullptr, 16) != syncAcked.version) {
+      handleSyncAck((uint16_t)strtoul(comma + 1, nullptr, 16));
+    }
+  } else if (strcmp(cmd, CMD_SYNC_ACK) == 0) {
+    handleSyncAck((uint16_t)strtoul(data, nullptr, 16));
+  } else if (strcmp(cmd, CMD_LINK) == 0) {
+    handleLinkFrame(data);
+  } else if (strcmp(cmd, CMD_LINK_STATS) == 0) {
+    unsigned long good = 0, bad = 0, hw = 0;
+    if (sscanf(data, "%lu,%lu,%lu", &good, &bad, &hw) == 3) {
+      peerLinkStats.baud = linkStats.baud;
+      peerLinkStats.goodFrames = good;
+      peerLinkStats.badFrames = bad;
+      peerLinkStats.hwErrors = hw;
+    }
+  }
+}
+
 void processUartReceiver() {
+  const uint32_t hwErrors = hwErrorsPending;
+  if (hwErrors != 0) {
+    hwErrorsPending = hwErrorsPending - hwErrors;
+    linkRecordHwErrors(linkStats, hwErrors);
+  }
+
   while (Serial2.available()) {
-    char buffer[64];
-    int len = Serial2.readBytesUntil('\n', buffer, sizeof(buffer) - 1);
-    buffer[len] = '\0';
-
-    // DEBUG: Print raw received data
-    if (len > 0) {
-      Serial.print("📩 Rx RAW [");
-      Serial.print(len);
-      Serial.print("]: ");
-      Serial.println(buffer);
+    const char c = (char)Serial2.read();
+
+    if (trainState == LINK_TRAIN_WAIT_BLOCK) {
+      if (linkBlockRxFeed(blockRx, (uint8_t)c)) {
+        finishBlockRx();
+      }
+      continue;
     }
 
-    char cmd[16], data[32];
-    if (parseMessage(buffer, cmd, data)) {
-      lastMessageMs = millis();
-      paymentEspConnected = true;
-
-      Serial.print("📋 Parsed CMD=");
-      Serial.print(cmd);
-      Serial.print(" DATA=");
-      Serial.println(data);
-
-      if (strcmp(cmd, CMD_PAYMENT) == 0) {
-        // Payment received from Payment ESP32
-        int amount = 0;
-        uint32_t seq = 0;
-        const char *comma = strchr(data, ',');
-        if (comma != nullptr) {
-          amount = atoi(data);
-          seq = static_cast<uint32_t>(strtoul(comma + 1, nullptr, 10));
-        } else {
-          // Backward compatible: $PAY,amount
-          amount = atoi(data);
-          seq = 0;
-        }
-
-        Serial.println("============================");
-        Serial.print("💵 UART Payment: ");
-        Serial.print(amount);
-        Serial.print(" so'm (seq=");
-        Serial.print(static_cast<unsigned long>(seq));
-        Serial.println(")");
-        Serial.print("   Balance BEFORE: ");
-        Serial.println(balance);
-
-        // Send ACK immediately
-        sendAck(seq);
-
-        // Check for duplicate payment sequence
-        if (isDuplicatePaymentSeq(seq)) {
-          Serial.print("⚠️ Duplicate REJECTED, seq=");
-          Serial.println(seq);
-          continue;
-        }
-
-        Serial.println("✅ Processing payment...");
-        processPayment(amount, "cash_uart", nullptr, nullptr);
-
-        Serial.print("   Balance AFTER: ");
-        Serial.println(balance);
-        Serial.print("   State: ");
-        Serial.println(currentState);
-        Serial.println("============================");
-
-      } else if (strcmp(cmd, CMD_HEARTBEAT) == 0) {
-        sendAck(0);
+    if (c == '\r') {
+      continue;
+    }
+    if (c != '\n') {
+      if (rxLen < (int)sizeof(rxLine) - 1) {
+        rxLine[rxLen++] = c;
+      } else {
+        rxOverflow = true;
       }
-    } else if (len > 0) {
-      Serial.print("❌ Parse FAILED for: ");
-      Serial.println(buffer);
+      continue;
+    }
+    rxLine[rxLen] = '\0';
+    if (rxOverflow) {
+      linkRecordFrame(linkStats, false);
+      LOG_WARN("UART line too long, dropped");
+    } else if (rxLen > 0) {
+      handleLine(rxLine, rxLen);
     }
+    rxLen = 0;
+    rxOverflow = false;
+  }
+
+  const unsigned long now = millis();
+
+  // Training stalled: go back to the last good baud
+  if (trainState != LINK_TRAIN_IDLE && (long)(now - trainDeadlineMs) > 0) {
+    LOG_WARN("UART link training to %lu baud timed out",
+             static_cast<unsigned long>(trainBaud));
+    setLinkBaud(trainPrevBaud);
+    linkStats.trainFailures++;
+    trainState = LINK_TRAIN_IDLE;
   }
 
+  if (trainState == LINK_TRAIN_IDLE && linkStats.baud != UART_BAUD) {
+    if (linkErrorSpike(linkStats)) {
+      linkFallback("error spike");
+    } else if (now - lastMessageMs > LINK_SILENCE_MS) {
+      linkFallback("silence");
+    }
+  }
+
+  processStateSync();
+
   // Check connection timeout
   if (millis() - lastMessageMs > CONNECTION_TIMEOUT_MS) {
     paymentEspConnected = false;
@@ -166,3 +465,7 @@ void processUartReceiver() {
 // STATUS
 // ============================================
 bool isPaymentEspConnected() { return paymentEspConnected; }
+
+const UartLinkStats &getUartLinkStats() { return linkStats; }
+
+const UartLinkStats &getPeerUartLinkStats() { return peerLinkStats; }
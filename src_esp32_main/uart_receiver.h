@@ -1,6 +1,8 @@
 #ifndef UART_RECEIVER_H
 #define UART_RECEIVER_H
 
+#include "../shared/state_sync.h"
+#include "../shared/uart_link.h"
 #include <Arduino.h>
 
 // ============================================
@@ -20,7 +22,22 @@ void sendAck(uint32_t seq);
 // Send status update to Payment ESP32
 void sendStatusToPaymentEsp(const char *state, long balance);
 
+// Set/clear a reason (INHIBIT_* from shared/state_sync.h) for the Payment
+// ESP32 to inhibit the cash acceptor. State, balance, price and the inhibit
+// mask are replicated to Payment ESP32 automatically on every change.
+// INHIBIT_LATCHED reasons are saved to NVS and restored at boot.
+void setPaymentInhibit(uint8_t reason, bool on);
+uint8_t getPaymentInhibit();
+
+// Push the current snapshot and wait (blocking) until Payment ESP32 ACKs it.
+// For use right before the loop is blocked for a long time (e.g. OTA).
+bool syncPaymentStateNow(unsigned long timeoutMs);
+
 // Check if Payment ESP32 is connected
 bool isPaymentEspConnected();
 
+// Link quality as seen by this side / as last reported by Payment ESP32
+const UartLinkStats &getUartLinkStats();
+const UartLinkStats &getPeerUartLinkStats();
+
 #endif
@@ -0,0 +1,162 @@
+#ifndef WIFI_CACHE_H
+#define WIFI_CACHE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// ============================================
+// FAST WIFI RECONNECT CACHE
+// ============================================
+// After every successful connection the AP's BSSID and channel plus the IP
+// settings are kept in RTC_NOINIT memory (survives every reset but power
+// loss) and in NVS (survives power loss). The next connect tries, in order:
+//
+//   FAST_IP  cached BSSID + channel, cached IP as static config (no scan,
+//            no DHCP). Only while the DHCP lease behind that IP, obtained
+//            during this power cycle, has not run out (WiFiLease).
+//   FAST     cached BSSID + channel, DHCP (cache restored from NVS)
+//   FULL     normal scan + DHCP
+//
+// A fast attempt that times out falls straight through to FULL; after
+// WIFI_FAST_MAX_FAILS failures in a row the cache is dropped (AP replaced or
+// moved channel) until the next successful connect refills it.
+
+#define WIFI_CACHE_MAGIC 0x57464331 // "WFC1"
+#define WIFI_FAST_TIMEOUT_MS 3000   // Fast attempt (no scan) before falling back
+#define WIFI_FULL_TIMEOUT_MS 10000  // Full scan + DHCP
+#define WIFI_RETRY_MS 10000         // Wait after a failed full attempt
+#define WIFI_FAST_MAX_FAILS 2
+
+#define WIFI_LEASE_MAGIC 0x574C5331  // "WLS1"
+#define WIFI_LEASE_DEFAULT_S 3600    // When the DHCP client reports none
+#define WIFI_LEASE_MARGIN_S 300      // Stop reusing the IP this long before
+
+enum WiFiConnectMode : uint8_t {
+  WIFI_CONNECT_FAST_IP,
+  WIFI_CONNECT_FAST,
+  WIFI_CONNECT_FULL
+};
+
+struct WiFiCache {
+  uint32_t magic;
+  uint32_t credHash; // SSID + password; a config change invalidates the cache
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t fastFails;
+  uint32_t ip; // IPv4 as IPAddress stores it (0 = DHCP only)
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+// DHCP lease behind WiFiCache::ip. RTC only: after power loss the IP is
+// never reused. A FAST_IP connect does not renew it; only DHCP does.
+struct WiFiLease {
+  uint32_t magic;
+  uint32_t ip;
+  uint32_t endS;  // time() at which the lease runs out
+  uint32_t check; // Rejects RTC memory left over from power loss
+};
+
+struct WiFiConnectStats {
+  uint32_t connects;   // Successful connects (including the first)
+  uint32_t fastOk;     // ... that used the cached BSSID/channel
+  uint32_t fastFailed; // Fast attempts that fell back to a full scan
+  uint32_t lastMs;     // Outage/boot to connected, last connect
+  uint32_t maxMs;      // Worst connect time since boot
+  uint8_t lastMode;    // WiFiConnectMode of the last successful connect
+};
+
+// FNV-1a over SSID, a separator and password
+inline uint32_t wifiHashStr(uint32_t h, const char *s) {
+  for (; s && *s; s++) {
+    h = (h ^ (uint8_t)*s) * 16777619u;
+  }
+  return h;
+}
+
+inline uint32_t wifiCredHash(const char *ssid, const char *pass) {
+  const uint32_t h = (wifiHashStr(2166136261u, ssid) ^ '\n') * 16777619u;
+  return wifiHashStr(h, pass);
+}
+
+inline bool wifiCacheUsable(const WiFiCache &c, uint32_t credHash) {
+  static const uint8_t zero[6] = {0};
+  return c.magic == WIFI_CACHE_MAGIC && c.credHash == credHash &&
+         c.channel >= 1 && c.channel <= 14 &&
+         memcmp(c.bssid, zero, sizeof(zero)) != 0 &&
+         c.fastFails < WIFI_FAST_MAX_FAILS;
+}
+
+inline uint32_t wifiLeaseCheck(const WiFiLease &l) {
+  uint32_t h = 2166136261u;
+  const uint32_t words[3] = {l.magic, l.ip, l.endS};
+  for (uint32_t w : words) {
+    for (int i = 0; i < 4; i++) {
+      h = (h ^ ((w >> (8 * i)) & 0xFF)) * 16777619u;
+    }
+  }
+  return h;
+}
+
+inline void wifiLeaseSet(WiFiLease &l, uint32_t ip, uint32_t nowS,
+                         uint32_t leaseS) {
+  l.magic = WIFI_LEASE_MAGIC;
+  l.ip = ip;
+  l.endS = nowS + (leaseS ? leaseS : WIFI_LEASE_DEFAULT_S);
+  l.check = wifiLeaseCheck(l);
+}
+
+// True while `ip` may still be used as a static address: it is the leased
+// one and the lease has more than WIFI_LEASE_MARGIN_S left. A clock that
+// jumped forward (first SNTP sync) ends the lease early, which is safe.
+inline bool wifiLeaseUsable(const WiFiLease &l, uint32_t ip, uint32_t nowS) {
+  return l.magic == WIFI_LEASE_MAGIC && l.check == wifiLeaseCheck(l) &&
+         ip != 0 && l.ip == ip && nowS < l.endS &&
+         l.endS - nowS > WIFI_LEASE_MARGIN_S;
+}
+
+// `leaseValid`: the cached IP's DHCP lease is still ours (wifiLeaseUsable)
+inline WiFiConnectMode wifiPickMode(const WiFiCache &c, uint32_t credHash,
+                                    bool leaseValid) {
+  if (!wifiCacheUsable(c, credHash)) {
+    return WIFI_CONNECT_FULL;
+  }
+  return (leaseValid && c.ip != 0 && c.subnet != 0) ? WIFI_CONNECT_FAST_IP
+                                                    : WIFI_CONNECT_FAST;
+}
+
+// Fast attempt timed out. Returns true if the cache was dropped.
+inline bool wifiCacheFastFailed(WiFiCache &c) {
+  if (++c.fastFails >= WIFI_FAST_MAX_FAILS) {
+    c.magic = 0;
+    return true;
+  }
+  return false;
+}
+
+inline void wifiStatsRecord(WiFiConnectStats &s, WiFiConnectMode mode,
+                            uint32_t elapsedMs) {
+  s.connects++;
+  if (mode != WIFI_CONNECT_FULL) {
+    s.fastOk++;
+  }
+  s.lastMs = elapsedMs;
+  if (elapsedMs > s.maxMs) {
+    s.maxMs = elapsedMs;
+  }
+  s.lastMode = mode;
+}
+
+inline const char *wifiModeName(uint8_t mode) {
+  switch (mode) {
+  case WIFI_CONNECT_FAST_IP:
+    return "fast_ip";
+  case WIFI_CONNECT_FAST:
+    return "fast";
+  default:
+    return "full";
+  }
+}
+
+#endif
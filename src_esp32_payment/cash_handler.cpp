@@ -1,24 +1,67 @@
 #include "cash_handler.h"
 #include "hardware.h"
+#include "payment_events.h"
+#include "pulse_decoder.h"
+#include <esp_timer.h>
+
+// ============================================
+// EDGE CAPTURE RING (ISR -> loop)
+// ============================================
+// The ISR only timestamps edges with the 64-bit hardware timer
+// (esp_timer_get_time, 1 us resolution); debounce and classification run in
+// processCashPulses(). 64 edges = 32 pulses of headroom per drain.
+#define CASH_EDGE_RING 64
+
+struct CashEdge {
+  uint32_t us;
+  uint8_t level;
+};
+
+static CashEdge edgeRing[CASH_EDGE_RING];
+static volatile uint32_t edgeHead = 0;
+static volatile uint32_t edgeTail = 0;
+static volatile uint32_t edgeOverflows = 0;
 
 // ============================================
 // VARIABLES
 // ============================================
-static volatile unsigned long pulseCount = 0;
-static volatile unsigned long lastPulseMs = 0;
 static int cashPulseValue = CASH_PULSE_VALUE;
 static int pendingPayment = 0;
+static uint32_t pendingInsertedUs = 0; // First pulse of the oldest unsent note
+static uint32_t reportedOverflows = 0;
+static bool cashInhibited = false;
+
+// One entry per CASH_NOTE_UNITS note (pulse_decoder.h)
+static CashDenomination denominations[CASH_NOTE_COUNT];
+static CashDecoder decoder;
 
 // ============================================
 // ISR - Interrupt Service Routine
 // ============================================
 void IRAM_ATTR cashPulseISR() {
-  unsigned long now = millis();
+  const uint32_t now = (uint32_t)esp_timer_get_time();
+  const uint8_t level = digitalRead(CASH_PULSE_PIN) ? 1 : 0;
+
+  const uint32_t head = edgeHead;
+  if (head - edgeTail >= CASH_EDGE_RING) {
+    edgeOverflows++;
+    return;
+  }
+  edgeRing[head % CASH_EDGE_RING] = {now, level};
+  edgeHead = head + 1;
+  notifyPaymentLoopFromISR(PAYMENT_EVT_CASH_EDGE);
+}
 
-  // Hardware debounce
-  if (now - lastPulseMs > CASH_DEBOUNCE_MS) {
-    pulseCount++;
-    lastPulseMs = now;
+// ============================================
+// DENOMINATION TABLE
+// ============================================
+static void buildDenominationTable() {
+  for (size_t i = 0; i < CASH_NOTE_COUNT; i++) {
+    denominations[i].pulses =
+        (uint16_t)(CASH_NOTE_UNITS[i] * CASH_PULSES_PER_UNIT);
+    denominations[i].minWidthMs = 0; // Width is only checked for consistency
+    denominations[i].maxWidthMs = 0;
+    denominations[i].value = (int32_t)CASH_NOTE_UNITS[i] * cashPulseValue;
   }
 }
 
@@ -26,8 +69,20 @@ void IRAM_ATTR cashPulseISR() {
 // INITIALIZATION
 // ============================================
 void initCashHandler() {
+  buildDenominationTable();
+
+  CashDecoderConfig cfg;
+  cfg.glitchUs = CASH_GLITCH_MS * 1000UL;
+  cfg.maxPulseUs = CASH_MAX_PULSE_MS * 1000UL;
+  cfg.burstGapUs = CASH_PULSE_GAP_MS * 1000UL;
+  cfg.widthJitterPct = CASH_WIDTH_JITTER_PCT;
+  cashDecoderInit(decoder, cfg, denominations, CASH_NOTE_COUNT);
+
+  pinMode(CASH_INHIBIT_PIN, OUTPUT);
+  digitalWrite(CASH_INHIBIT_PIN, CASH_INHIBIT_ACTIVE == HIGH ? LOW : HIGH);
+
   pinMode(CASH_PULSE_PIN, INPUT_PULLUP);
-  attachInterrupt(digitalPinToInterrupt(CASH_PULSE_PIN), cashPulseISR, FALLING);
+  attachInterrupt(digitalPinToInterrupt(CASH_PULSE_PIN), cashPulseISR, CHANGE);
 
   Serial.print("✓ Cash handler initialized on GPIO ");
   Serial.println(CASH_PULSE_PIN);
@@ -36,43 +91,60 @@ void initCashHandler() {
 // ============================================
 // PROCESS PULSES
 // ============================================
-void processCashPulses() {
-  // Check if we have pulses and enough time passed
-  unsigned long now = millis();
-
-  noInterrupts();
-  unsigned long pulses = pulseCount;
-  unsigned long lastMs = lastPulseMs;
-  interrupts();
+static void reportBurst(const CashBurst &burst) {
+  if (burst.result == CASH_BURST_ACCEPTED) {
+    Serial.print("💵 Cash received: ");
+    Serial.print(burst.value);
+    Serial.print(" so'm (");
+  } else {
+    Serial.print("⚠️ Cash burst rejected (");
+    Serial.print(cashBurstResultName(burst.result));
+    Serial.print(", ");
+  }
+  Serial.print(burst.pulses);
+  Serial.print(" pulses, ");
+  Serial.print(burst.minWidthUs / 1000);
+  Serial.print("-");
+  Serial.print(burst.maxWidthUs / 1000);
+  Serial.println(" ms)");
+}
 
-  if (pulses == 0) {
-    return;
+int processCashPulses() {
+  // Drain edges captured since the last call
+  while (edgeTail != edgeHead) {
+    const CashEdge edge = edgeRing[edgeTail % CASH_EDGE_RING];
+    edgeTail = edgeTail + 1;
+#if CASH_TRACE_EDGES
+    Serial.printf("E,%lu,%u\n", (unsigned long)edge.us, edge.level);
+#endif
+    cashDecoderEdge(decoder, edge.us, edge.level != 0);
   }
 
-  // Wait for pulse gap (all pulses received)
-  if (now - lastMs < CASH_PULSE_GAP_MS) {
-    return;
+  const uint32_t overflows = edgeOverflows;
+  if (overflows != reportedOverflows) {
+    Serial.print("⚠️ Cash edge ring overflow: ");
+    Serial.println(overflows - reportedOverflows);
+    reportedOverflows = overflows;
   }
 
-  // Clear counter
-  noInterrupts();
-  pulseCount = 0;
-  interrupts();
-
-  // Calculate payment
-  int amount = (int)pulses * cashPulseValue / 2;
-  pendingPayment += amount;
-
-  Serial.print("💵 Cash received: ");
-  Serial.print(amount);
-  Serial.print(" so'm (");
-  Serial.print(pulses);
-  Serial.println(" pulses)");
-
-  // Blink LED
-  digitalWrite(LED_PIN, HIGH);
-  delay(100);
-  digitalWrite(LED_PIN, LOW);
+  int accepted = 0;
+  CashBurst burst;
+  while (cashDecoderPoll(decoder, (uint32_t)esp_timer_get_time(), burst)) {
+    reportBurst(burst);
+    if (burst.result == CASH_BURST_ACCEPTED && cashInhibited) {
+      // Note was already in the acceptor when inhibit went active; the money
+      // is taken, so it is still forwarded and Main decides.
+      Serial.println("⚠️ Note accepted while inhibited, forwarding anyway");
+    }
+    if (burst.result == CASH_BURST_ACCEPTED) {
+      if (pendingPayment == 0 && accepted == 0) {
+        pendingInsertedUs = burst.startUs;
+      }
+      accepted += burst.value;
+    }
+  }
+  pendingPayment += accepted;
+  return accepted;
 }
 
 // ============================================
@@ -80,11 +152,43 @@ void processCashPulses() {
 // ============================================
 int getPendingPayment() { return pendingPayment; }
 
+uint32_t getPendingPaymentInsertedUs() { return pendingInsertedUs; }
+
 void clearPendingPayment() { pendingPayment = 0; }
 
+uint32_t getCashWaitMs() {
+  if (edgeTail != edgeHead) {
+    return 0;
+  }
+  uint32_t deadlineUs = 0;
+  if (!cashDecoderDeadline(decoder, deadlineUs)) {
+    return UINT32_MAX;
+  }
+  const int32_t remainUs =
+      (int32_t)(deadlineUs - (uint32_t)esp_timer_get_time());
+  if (remainUs <= 0) {
+    return 0;
+  }
+  return ((uint32_t)remainUs + 999) / 1000;
+}
+
+void setCashInhibit(bool inhibit) {
+  if (inhibit == cashInhibited) {
+    return;
+  }
+  cashInhibited = inhibit;
+  const int idle = CASH_INHIBIT_ACTIVE == HIGH ? LOW : HIGH;
+  digitalWrite(CASH_INHIBIT_PIN, inhibit ? CASH_INHIBIT_ACTIVE : idle);
+  Serial.println(inhibit ? "⛔ Cash acceptor inhibited"
+                         : "✓ Cash acceptor enabled");
+}
+
+bool isCashInhibited() { return cashInhibited; }
+
 void setCashPulseValue(int value) {
   if (value > 0 && value <= 1000000) {
     cashPulseValue = value;
+    buildDenominationTable();
     Serial.print("Cash pulse value set to: ");
     Serial.println(value);
   }
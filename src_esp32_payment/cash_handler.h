@@ -6,22 +6,45 @@
 // ============================================
 // CONFIGURATION
 // ============================================
-#define CASH_PULSE_VALUE 1000 // So'm per pulse (default)
-#define CASH_PULSE_GAP_MS 200 // Minimum gap between pulse groups
-#define CASH_DEBOUNCE_MS 40   // Debounce time
+#define CASH_PULSE_VALUE 1000   // So'm per unit (default)
+#define CASH_PULSES_PER_UNIT 2  // Acceptor pulses per CASH_PULSE_VALUE
+#define CASH_PULSE_GAP_MS 200   // Idle gap that closes a pulse burst
+#define CASH_GLITCH_MS 10       // Narrower LOW pulses are bounce/noise
+#define CASH_MAX_PULSE_MS 250   // Longer LOW = stuck line / wiring fault
+#define CASH_WIDTH_JITTER_PCT 50 // Allowed width spread inside one burst
+
+// Build with -D CASH_TRACE_EDGES=1 to print every edge as "E,<us>,<level>"
+// for capture with scripts/cash_trace_replay.cpp.
+#ifndef CASH_TRACE_EDGES
+#define CASH_TRACE_EDGES 0
+#endif
 
 // ============================================
 // FUNCTIONS
 // ============================================
 void initCashHandler();
-void processCashPulses();
+
+// Drain captured edges and classify finished bursts. Returns the amount
+// accepted during this call (0 if none).
+int processCashPulses();
 
 // Get pending payment amount (0 if none)
 int getPendingPayment();
 
+// esp_timer time (us) of the first pulse of the oldest pending note
+uint32_t getPendingPaymentInsertedUs();
+
+// Milliseconds until processCashPulses() can close a burst
+// (0 = now, UINT32_MAX = line idle, only an edge can change anything).
+uint32_t getCashWaitMs();
+
 // Clear pending payment after sending
 void clearPendingPayment();
 
+// Drive the acceptor INHIBIT line (CASH_INHIBIT_PIN)
+void setCashInhibit(bool inhibit);
+bool isCashInhibited();
+
 // Set pulse value (can be updated via UART from main)
 void setCashPulseValue(int value);
 
@@ -20,6 +20,8 @@
 // ============================================
 #define CASH_PULSE_PIN 32 // Genius 7 pulse input
      // INPUT_PULLUP, FALLING edge
+#define CASH_INHIBIT_PIN 33       // Acceptor INHIBIT input (via transistor)
+#define CASH_INHIBIT_ACTIVE HIGH  // Pin level that inhibits the acceptor
 
 // ============================================
 // UART (to Main ESP32)
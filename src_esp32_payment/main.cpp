@@ -6,6 +6,7 @@
 
 #include "cash_handler.h"
 #include "hardware.h"
+#include "payment_events.h"
 #include "uart_sender.h"
 #include <Arduino.h>
 #include <esp_task_wdt.h>
@@ -13,7 +14,132 @@
 // ============================================
 // CONFIGURATION
 // ============================================
-#define LOOP_DELAY_MS 10
+#define LOOP_MAX_WAIT_MS 1000 // Upper bound so the watchdog is still fed
+#define LED_FLASH_CASH_MS 100 // Feedback when a note is accepted
+#define LED_FLASH_SENT_MS 200 // Feedback when Main ESP ACKs the payment
+
+// Build with -D PAYMENT_LIGHT_SLEEP=1 to let FreeRTOS enter automatic light
+// sleep while the loop is blocked. Needs CONFIG_PM_ENABLE in the SDK config;
+// the cash pin wakes the chip, and sleep is held off while a reply from Main
+// ESP is expected because UART bytes arriving during light sleep are lost.
+#ifndef PAYMENT_LIGHT_SLEEP
+#define PAYMENT_LIGHT_SLEEP 0
+#endif
+
+#if PAYMENT_LIGHT_SLEEP
+#include <driver/gpio.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#endif
+
+// ============================================
+// LOOP WAKE-UP (task notifications)
+// ============================================
+static TaskHandle_t loopTaskHandle = nullptr;
+
+void notifyPaymentLoop(uint32_t bits) {
+  if (loopTaskHandle) {
+    xTaskNotify(loopTaskHandle, bits, eSetBits);
+  }
+}
+
+void IRAM_ATTR notifyPaymentLoopFromISR(uint32_t bits) {
+  if (!loopTaskHandle) {
+    return;
+  }
+  BaseType_t woken = pdFALSE;
+  xTaskNotifyFromISR(loopTaskHandle, bits, eSetBits, &woken);
+  if (woken) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+// ============================================
+// STATUS LED (non-blocking)
+// ============================================
+// Base pattern: solid when Main ESP is connected, 1 Hz blink when offline.
+// A feedback flash inverts the base level for a short time.
+static unsigned long ledFlashUntilMs = 0;
+
+static unsigned long lastBlinkMs = 0;
+static bool blinkLevel = false;
+
+static void flashStatusLed(unsigned long durationMs) {
+  ledFlashUntilMs = millis() + durationMs;
+}
+
+static void updateStatusLed() {
+  const unsigned long now = millis();
+
+  bool level = true;
+  if (!isMainEspConnected()) {
+    if (now - lastBlinkMs >= 1000) {
+      lastBlinkMs = now;
+      blinkLevel = !blinkLevel;
+    }
+    level = blinkLevel;
+  }
+  if ((long)(ledFlashUntilMs - now) > 0) {
+    level = !level;
+  }
+  digitalWrite(LED_PIN, level ? HIGH : LOW);
+}
+
+// Milliseconds until the LED pattern changes on its own
+static uint32_t getLedWaitMs() {
+  const unsigned long now = millis();
+  uint32_t wait = UINT32_MAX;
+  const long flashRemain = (long)(ledFlashUntilMs - now);
+  if (flashRemain > 0) {
+    wait = (uint32_t)flashRemain;
+  }
+  if (!isMainEspConnected()) {
+    const long blinkRemain = (long)(lastBlinkMs + 1000 - now);
+    const uint32_t ms = blinkRemain > 0 ? (uint32_t)blinkRemain : 0;
+    if (ms < wait) {
+      wait = ms;
+    }
+  }
+  return wait;
+}
+
+// ============================================
+// LIGHT SLEEP (optional)
+// ============================================
+#if PAYMENT_LIGHT_SLEEP
+static esp_pm_lock_handle_t noSleepLock = nullptr;
+static bool noSleepHeld = false;
+
+static void initLightSleep() {
+  esp_pm_config_esp32_t pm = {};
+  pm.max_freq_mhz = getCpuFrequencyMhz();
+  pm.min_freq_mhz = getCpuFrequencyMhz(); // No DFS: keeps UART baud exact
+  pm.light_sleep_enable = true;
+  const esp_err_t err = esp_pm_configure(&pm);
+  if (err != ESP_OK) {
+    Serial.print("⚠️ Light sleep unavailable: ");
+    Serial.println(esp_err_to_name(err));
+    return;
+  }
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "payment", &noSleepLock);
+  gpio_wakeup_enable((gpio_num_t)CASH_PULSE_PIN, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  Serial.println("✓ Automatic light sleep enabled");
+}
+
+// Hold off light sleep while a note is being decoded or a reply is due
+static void updateSleepLock(bool busy) {
+  if (!noSleepLock || busy == noSleepHeld) {
+    return;
+  }
+  if (busy) {
+    esp_pm_lock_acquire(noSleepLock);
+  } else {
+    esp_pm_lock_release(noSleepLock);
+  }
+  noSleepHeld = busy;
+}
+#endif
 
 // ============================================
 // SETUP
@@ -41,6 +167,9 @@ void setup() {
   esp_task_wdt_add(NULL);      // Add current task to watchdog
   Serial.println("✓ Watchdog enabled");
 
+  // Event sources below notify this task; register it before they start
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+
   // Initialize UART to Main ESP32
   initUartSender();
 
@@ -55,6 +184,10 @@ void setup() {
   Serial.println(pinState == HIGH ? "HIGH (Normal for Pullup)"
                                   : "LOW (Warning: Start Active?)");
 
+#if PAYMENT_LIGHT_SLEEP
+  initLightSleep();
+#endif
+
   Serial.println();
   Serial.println("✓ Payment Controller Ready!");
   Serial.println("  Waiting for cash...");
@@ -72,56 +205,62 @@ void setup() {
 // ============================================
 // MAIN LOOP
 // ============================================
+// Event-driven: each pass handles whatever is ready, then blocks until a
+// cash edge, UART bytes or the nearest module deadline (burst gap, ACK
+// timeout, heartbeat, LED) - no fixed polling delay.
 void loop() {
   // Reset watchdog timer - "I'm alive!"
   esp_task_wdt_reset();
 
   // Process cash pulses
-  processCashPulses();
+  if (processCashPulses() > 0) {
+    flashStatusLed(LED_FLASH_CASH_MS);
+  }
 
-  // Check for pending payment
+  // Hand pending payment to the sender; it transmits in the same pass
   int payment = getPendingPayment();
   if (payment > 0) {
     Serial.print("💰 Pending Payment Detected: ");
     Serial.println(payment);
 
-    // Send to Main ESP32
-    bool sent = sendPayment(payment);
-
-    if (sent) {
+    if (sendPayment(payment, getPendingPaymentInsertedUs())) {
       clearPendingPayment();
-      Serial.println("✅ Payment sent successfully!");
-
-      // Blink LED to confirm
-      digitalWrite(LED_PIN, HIGH);
-      delay(200);
-      digitalWrite(LED_PIN, LOW);
     } else {
-      Serial.println("❌ Failed to send payment (Main ESP offline?)");
+      Serial.println("❌ Failed to queue payment, will retry");
     }
   }
 
-  // Send heartbeat periodically
-  static unsigned long lastHb = 0;
-  if (millis() - lastHb > 2000) { // More frequent heartbeat for debug
-    lastHb = millis();
-    // Serial.println("💓 Sending heartbeat..."); // Reduce spam
-    sendHeartbeat();
+  // UART: frames from Main ESP, ACK matching, retries, heartbeat
+  if (processUartSender() > 0) {
+    Serial.println("✅ Payment sent successfully!");
+    flashStatusLed(LED_FLASH_SENT_MS);
   }
 
-  // Process incoming UART messages
-  processUartReceive();
+  // Inhibit follows Main's replicated state in the same pass it arrives
+  setCashInhibit(isPaymentInhibited());
 
-  // Status LED - solid if connected, blink if offline
-  static unsigned long lastBlinkMs = 0;
-  if (!isMainEspConnected()) {
-    if (millis() - lastBlinkMs > 1000) {
-      lastBlinkMs = millis();
-      digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+  // Status LED - solid if connected, blink if offline, flash on feedback
+  updateStatusLed();
+
+  // Sleep until the next event or deadline
+  uint32_t waitMs = LOOP_MAX_WAIT_MS;
+  const uint32_t deadlines[] = {getCashWaitMs(), getUartWaitMs(),
+                                getLedWaitMs()};
+  for (uint32_t ms : deadlines) {
+    if (ms < waitMs) {
+      waitMs = ms;
     }
-  } else {
-    digitalWrite(LED_PIN, HIGH); // Solid ON if connected
   }
+  if (getPendingPayment() > 0) {
+    waitMs = min(waitMs, (uint32_t)100); // Queue was full; try again soon
+  }
+
+#if PAYMENT_LIGHT_SLEEP
+  updateSleepLock(getCashWaitMs() != UINT32_MAX || isUartAwaitingReply());
+#endif
 
-  delay(LOOP_DELAY_MS);
+  if (waitMs > 0) {
+    uint32_t events = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(waitMs));
+  }
 }
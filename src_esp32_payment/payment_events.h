@@ -0,0 +1,21 @@
+#ifndef PAYMENT_EVENTS_H
+#define PAYMENT_EVENTS_H
+
+#include <Arduino.h>
+
+// ============================================
+// LOOP WAKE-UP EVENTS
+// ============================================
+// The Payment ESP32 loop blocks on a FreeRTOS task notification instead of
+// polling with a fixed delay. Event sources set one of these bits; timers
+// (burst gap, ACK timeout, heartbeat, LED) are covered by the wait timeout.
+#define PAYMENT_EVT_CASH_EDGE (1UL << 0) // Cash pulse edge captured (ISR)
+#define PAYMENT_EVT_UART_RX (1UL << 1)   // Bytes received from Main ESP32
+
+// Wake the loop task from task context (e.g. UART event task callback)
+void notifyPaymentLoop(uint32_t bits);
+
+// Wake the loop task from an interrupt handler (must be IRAM-safe)
+void notifyPaymentLoopFromISR(uint32_t bits);
+
+#endif
@@ -0,0 +1,193 @@
+#include "pulse_decoder.h"
+
+// ============================================
+// INITIALIZATION
+// ============================================
+void cashDecoderInit(CashDecoder &d, const CashDecoderConfig &cfg,
+                     const CashDenomination *table, uint8_t tableSize) {
+  d.cfg = cfg;
+  d.table = table;
+  d.tableSize = tableSize;
+  d.lineLow = false;
+  d.stuckReported = false;
+  d.lowSinceUs = 0;
+  d.lastEdgeUs = 0;
+  d.inBurst = false;
+  d.burstStuck = false;
+  d.pulses = 0;
+  d.burstStartUs = 0;
+  d.minWidthUs = 0;
+  d.maxWidthUs = 0;
+  d.glitches = 0;
+  d.accepted = 0;
+  d.rejected = 0;
+}
+
+// ============================================
+// EDGE INPUT
+// ============================================
+static void addPulse(CashDecoder &d, uint32_t startUs, uint32_t widthUs) {
+  if (!d.inBurst) {
+    d.inBurst = true;
+    d.burstStuck = false;
+    d.pulses = 0;
+    d.burstStartUs = startUs;
+    d.minWidthUs = UINT32_MAX;
+    d.maxWidthUs = 0;
+  }
+  if (d.pulses < UINT16_MAX) {
+    d.pulses++;
+  }
+  if (widthUs < d.minWidthUs) {
+    d.minWidthUs = widthUs;
+  }
+  if (widthUs > d.maxWidthUs) {
+    d.maxWidthUs = widthUs;
+  }
+  if (widthUs > d.cfg.maxPulseUs) {
+    d.burstStuck = true;
+  }
+}
+
+void cashDecoderEdge(CashDecoder &d, uint32_t tUs, bool level) {
+  if (!level) {
+    // Falling edge: pulse start. A repeated LOW (missed rising edge) keeps
+    // the original start time.
+    if (!d.lineLow) {
+      d.lineLow = true;
+      d.lowSinceUs = tUs;
+    }
+    return;
+  }
+
+  if (!d.lineLow) {
+    return; // Repeated HIGH
+  }
+  d.lineLow = false;
+  d.lastEdgeUs = tUs;
+
+  if (d.stuckReported) {
+    // End of a stuck-low period that was already reported as a burst.
+    d.stuckReported = false;
+    return;
+  }
+
+  const uint32_t widthUs = tUs - d.lowSinceUs;
+  if (widthUs < d.cfg.glitchUs) {
+    d.glitches++;
+    return;
+  }
+  addPulse(d, d.lowSinceUs, widthUs);
+}
+
+// ============================================
+// CLASSIFICATION
+// ============================================
+static CashBurstResult classify(const CashDecoder &d, int32_t &value) {
+  value = 0;
+  if (d.burstStuck) {
+    return CASH_BURST_REJECT_STUCK;
+  }
+
+  // A real acceptor produces pulses of one width; EMI bursts do not.
+  const uint32_t spread = d.maxWidthUs - d.minWidthUs;
+  if ((uint64_t)spread * 100 > (uint64_t)d.maxWidthUs * d.cfg.widthJitterPct) {
+    return CASH_BURST_REJECT_WIDTH;
+  }
+
+  bool countMatched = false;
+  for (uint8_t i = 0; i < d.tableSize; i++) {
+    const CashDenomination &den = d.table[i];
+    if (den.pulses != d.pulses) {
+      continue;
+    }
+    countMatched = true;
+    const uint32_t minUs = (uint32_t)den.minWidthMs * 1000UL;
+    const uint32_t maxUs = (uint32_t)den.maxWidthMs * 1000UL;
+    if ((minUs == 0 || d.minWidthUs >= minUs) &&
+        (maxUs == 0 || d.maxWidthUs <= maxUs)) {
+      value = den.value;
+      return CASH_BURST_ACCEPTED;
+    }
+  }
+  return countMatched ? CASH_BURST_REJECT_WIDTH : CASH_BURST_REJECT_COUNT;
+}
+
+static void closeBurst(CashDecoder &d, CashBurstResult result, int32_t value,
+                       uint32_t endUs, CashBurst &out) {
+  out.result = result;
+  out.pulses = d.pulses;
+  out.startUs = d.burstStartUs;
+  out.endUs = endUs;
+  out.minWidthUs = d.pulses ? d.minWidthUs : 0;
+  out.maxWidthUs = d.maxWidthUs;
+  out.value = value;
+
+  if (result == CASH_BURST_ACCEPTED) {
+    d.accepted++;
+  } else {
+    d.rejected++;
+  }
+  d.inBurst = false;
+  d.pulses = 0;
+}
+
+// ============================================
+// POLL
+// ============================================
+bool cashDecoderPoll(CashDecoder &d, uint32_t nowUs, CashBurst &out) {
+  if (d.lineLow) {
+    if (d.stuckReported || nowUs - d.lowSinceUs <= d.cfg.maxPulseUs) {
+      return false; // Pulse in progress
+    }
+    // Line held LOW: reject whatever was collected and report once.
+    if (!d.inBurst) {
+      d.inBurst = true;
+      d.pulses = 0;
+      d.burstStartUs = d.lowSinceUs;
+      d.minWidthUs = 0;
+      d.maxWidthUs = 0;
+    }
+    d.stuckReported = true;
+    closeBurst(d, CASH_BURST_REJECT_STUCK, 0, nowUs, out);
+    return true;
+  }
+
+  if (!d.inBurst || nowUs - d.lastEdgeUs < d.cfg.burstGapUs) {
+    return false;
+  }
+  int32_t value = 0;
+  const CashBurstResult result = classify(d, value);
+  closeBurst(d, result, value, d.lastEdgeUs, out);
+  return true;
+}
+
+bool cashDecoderDeadline(const CashDecoder &d, uint32_t &deadlineUs) {
+  if (d.lineLow) {
+    if (d.stuckReported) {
+      return false; // Waiting for the line to be released
+    }
+    deadlineUs = d.lowSinceUs + d.cfg.maxPulseUs + 1;
+    return true;
+  }
+  if (d.inBurst) {
+    deadlineUs = d.lastEdgeUs + d.cfg.burstGapUs;
+    return true;
+  }
+  return false;
+}
+
+const char *cashBurstResultName(CashBurstResult result) {
+  switch (result) {
+  case CASH_BURST_ACCEPTED:
+    return "accepted";
+  case CASH_BURST_REJECT_COUNT:
+    return "bad_count";
+  case CASH_BURST_REJECT_WIDTH:
+    return "bad_width";
+  case CASH_BURST_REJECT_STUCK:
+    return "stuck";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef PULSE_DECODER_H
+#define PULSE_DECODER_H
+
+#include <cstdint>
+
+// ============================================
+// CASH PULSE-TRAIN DECODER
+// ============================================
+// Pure logic (no Arduino calls) so the same code runs on the Payment ESP32
+// and in host replay tools/tests. It consumes timestamped line edges
+// (active LOW: falling = pulse start, rising = pulse end) and turns each
+// burst into one classified banknote:
+//   - pulses shorter than glitchUs are contact bounce / EMI and ignored
+//   - a burst ends after burstGapUs of idle line
+//   - pulse count (and optionally pulse width) selects the denomination
+//   - bursts with unknown counts, inconsistent widths or a stuck-low line
+//     are rejected instead of being paid out
+
+// UZS banknotes in units of the pulse value (1k..200k so'm at 1000 per
+// unit). A 200k note is 400 pulses at 2 pulses per unit, so pulse counts
+// are 16-bit. Shared by the Payment firmware and the replay tool.
+static const uint16_t CASH_NOTE_UNITS[] = {1, 2, 5, 10, 20, 50, 100, 200};
+#define CASH_NOTE_COUNT (sizeof(CASH_NOTE_UNITS) / sizeof(CASH_NOTE_UNITS[0]))
+
+struct CashDenomination {
+  uint16_t pulses;     // Exact pulse count of this note
+  uint16_t minWidthMs; // Nominal pulse width window (0 = any)
+  uint16_t maxWidthMs;
+  int32_t value; // so'm
+};
+
+struct CashDecoderConfig {
+  uint32_t glitchUs;     // Pulses narrower than this are ignored
+  uint32_t maxPulseUs;   // Longer LOW = line stuck / wiring fault
+  uint32_t burstGapUs;   // Idle time that closes a burst
+  uint8_t widthJitterPct; // Max (widest - narrowest) / widest in a burst
+};
+
+enum CashBurstResult : uint8_t {
+  CASH_BURST_ACCEPTED = 0,
+  CASH_BURST_REJECT_COUNT, // No denomination with this pulse count
+  CASH_BURST_REJECT_WIDTH, // Widths inconsistent or outside the window
+  CASH_BURST_REJECT_STUCK, // Line held LOW longer than maxPulseUs
+};
+
+struct CashBurst {
+  CashBurstResult result;
+  uint16_t pulses;
+  uint32_t startUs;
+  uint32_t endUs;
+  uint32_t minWidthUs;
+  uint32_t maxWidthUs;
+  int32_t value; // 0 unless accepted
+};
+
+struct CashDecoder {
+  CashDecoderConfig cfg;
+  const CashDenomination *table;
+  uint8_t tableSize;
+
+  // Line / burst tracking
+  bool lineLow;
+  bool stuckReported;
+  uint32_t lowSinceUs;
+  uint32_t lastEdgeUs;
+  bool inBurst;
+  bool burstStuck;
+  uint16_t pulses;
+  uint32_t burstStartUs;
+  uint32_t minWidthUs;
+  uint32_t maxWidthUs;
+
+  // Statistics
+  uint32_t glitches;
+  uint32_t accepted;
+  uint32_t rejected;
+};
+
+// ============================================
+// FUNCTIONS
+// ============================================
+void cashDecoderInit(CashDecoder &d, const CashDecoderConfig &cfg,
+                     const CashDenomination *table, uint8_t tableSize);
+
+// Feed one edge. `level` is the line level after the edge (false = LOW).
+void cashDecoderEdge(CashDecoder &d, uint32_t tUs, bool level);
+
+// Call periodically (and after draining edges). Returns true and fills `out`
+// when a burst has been closed.
+bool cashDecoderPoll(CashDecoder &d, uint32_t nowUs, CashBurst &out);
+
+// Earliest time at which cashDecoderPoll() can produce a result, so an
+// event-driven caller can sleep until then. Returns false if idle.
+bool cashDecoderDeadline(const CashDecoder &d, uint32_t &deadlineUs);
+
+const char *cashBurstResultName(CashBurstResult result);
+
+#endif
@@ -1,101 +1,132 @@
 #include "uart_sender.h"
-#include "../shared/uart_protocol.h"
+#include "../shared/state_sync.h"
+#include "../shared/uart_link.h"
 #include "hardware.h"
+#include "payment_events.h"
+#include <esp_timer.h>
 
 // ============================================
 // CONFIGURATION
 // ============================================
 #define HEARTBEAT_INTERVAL_MS 10000
-#define ACK_TIMEOUT_MS 500 // Reduced from 500ms to minimize blocking
+#define ACK_TIMEOUT_MS 500
 #define MAX_RETRIES 3
 #define OFFLINE_BUFFER_SIZE 10
+#define OFFLINE_RETRY_MS 5000    // Re-probe an offline Main ESP this often
+#define LATENCY_REPORT_EVERY 10  // Print a latency summary every N payments
+#define LINK_FIRST_TRAIN_MS 3000 // Let Main ESP finish booting first
+#define LINK_RETRY_MS 600000     // After a failed step, retry it in 10 min
+#define LINK_CEILING_HOLD_MS 3600000 // After a fallback, cap baud for 1 h
+#define LINK_REGAIN_MS 5000          // ...but climb back to the cap soon
+#define LINK_STATS_INTERVAL_MS 60000 // Report link stats to Main ESP
 
 // ============================================
 // VARIABLES
 // ============================================
 static unsigned long lastHeartbeatMs = 0;
 static unsigned long lastAckMs = 0;
+static unsigned long lastTxMs = 0;
 static bool mainEspConnected = false;
 
 struct PaymentTx {
   int amount;
   uint32_t seq;
+  uint32_t insertedUs; // Note insertion (first pulse)
+  uint32_t queuedUs;   // Handed to the sender
 };
 
-// Offline buffer - store payments when Main ESP is offline
-static PaymentTx offlineBuffer[OFFLINE_BUFFER_SIZE];
-static int offlineBufferCount = 0;
+// Payment queue (doubles as offline buffer). Only the head is in flight;
+// it is removed when Main ESP ACKs its seq.
+static PaymentTx txQueue[OFFLINE_BUFFER_SIZE];
+static int txQueueCount = 0;
 static uint32_t nextPaymentSeq = 0; // Will be randomized in initUartSender()
 
-static bool trySendPaymentTx(const PaymentTx &tx) {
-  char buffer[64];
-  char data[32];
-
-  snprintf(data, sizeof(data), "%d,%lu", tx.amount,
-           static_cast<unsigned long>(tx.seq));
-  buildMessage(buffer, CMD_PAYMENT, data);
-
-  Serial.print("📤 Sending: ");
-  Serial.print(buffer);
-
-  // Try to send with retries
-  for (int retry = 0; retry < MAX_RETRIES; retry++) {
-    Serial2.print(buffer);
-
-    // Wait for ACK
-    unsigned long startMs = millis();
-    while (millis() - startMs < ACK_TIMEOUT_MS) {
-      if (!Serial2.available()) {
-        delay(10);
-        continue;
-      }
-
-      char response[64];
-      int len = Serial2.readBytesUntil('\n', response, sizeof(response) - 1);
-      response[len] = '\0';
-
-      char cmd[16], respData[32];
-      if (!parseMessage(response, cmd, respData)) {
-        continue;
-      }
-
-      if (strcmp(cmd, CMD_ACK) == 0) {
-        const unsigned long ackSeq = strtoul(respData, nullptr, 10);
-        lastAckMs = millis();
-        mainEspConnected = true;
-
-        if (ackSeq == tx.seq) {
-          Serial.println("✓ ACK received");
-          return true;
-        }
+static bool txInFlight = false;
+static int txAttempts = 0;
+static unsigned long txSentMs = 0;
+static unsigned long offlineRetryAtMs = 0;
+static bool offlineBackoff = false;
+
+// Line assembly for incoming frames (no blocking readBytesUntil)
+static char rxLine[UART_MSG_BUFFER_SIZE];
+static int rxLen = 0;
+static bool rxOverflow = false;
+
+// Link training (Payment is the initiator, see shared/uart_link.h)
+enum LinkTrainState : uint8_t {
+  LINK_IDLE,
+  LINK_WAIT_OK,    // REQ sent at the current baud
+  LINK_SETTLE,     // Switched to trainBaud, let Main switch too
+  LINK_WAIT_RES,   // Our block sent, waiting for Main's verdict
+  LINK_WAIT_BLOCK, // Collecting Main's block (raw bytes)
+  LINK_WAIT_DONE,  // COMMIT sent
+};
 
-        // ACK for something else (e.g. heartbeat or other message). Keep
-        // waiting.
-        continue;
-      }
+static UartLinkStats linkStats;
+static LinkTrainState linkState = LINK_IDLE;
+static uint32_t trainBaud = 0;
+static uint32_t trainPrevBaud = UART_BAUD;
+static bool trainResOk = false;
+static unsigned long linkDeadlineMs = 0;
+static unsigned long nextTrainMs = LINK_FIRST_TRAIN_MS;
+static uint32_t linkCeiling = UART_LINK_MAX_BAUD;
+static unsigned long linkCeilingUntilMs = 0;
+static unsigned long lastValidRxMs = 0;
+static unsigned long lastLinkStatsMs = 0;
+static uint32_t reportedBadFrames = 0;
+static LinkBlockRx blockRx;
+static volatile uint32_t hwErrorsPending = 0;
+
+// Snapshot replicated from Main ESP (see shared/state_sync.h)
+static StateSnapshot mainSnapshot = {0, 0, 0, 0, 0};
+
+// Insertion -> ACK latency, measured on the device
+struct LatencyStats {
+  uint32_t count;
+  uint32_t sumMs;
+  uint32_t minMs;
+  uint32_t maxMs;
+};
 
-      if (strcmp(cmd, CMD_STATUS) == 0) {
-        lastAckMs = millis();
-        mainEspConnected = true;
-        Serial.print("📥 Status: ");
-        Serial.println(respData);
-      }
-    }
+static LatencyStats insertToAck = {0, 0, UINT32_MAX, 0};
+static LatencyStats queueToAck = {0, 0, UINT32_MAX, 0};
 
-    Serial.print("⚠️ No ACK, retry ");
-    Serial.println(retry + 1);
+static void addLatency(LatencyStats &s, uint32_t ms) {
+  s.count++;
+  s.sumMs += ms;
+  if (ms < s.minMs) {
+    s.minMs = ms;
   }
+  if (ms > s.maxMs) {
+    s.maxMs = ms;
+  }
+}
 
-  mainEspConnected = false;
-  return false;
+static void printLatency(const char *label, const LatencyStats &s) {
+  Serial.print("   ");
+  Serial.print(label);
+  Serial.print(" avg ");
+  Serial.print(s.count ? s.sumMs / s.count : 0);
+  Serial.print(" ms, min ");
+  Serial.print(s.count ? s.minMs : 0);
+  Serial.print(" ms, max ");
+  Serial.print(s.maxMs);
+  Serial.println(" ms");
 }
 
-static bool enqueuePaymentTx(const PaymentTx &tx) {
-  if (offlineBufferCount >= OFFLINE_BUFFER_SIZE) {
-    return false;
+// ============================================
+// UART RX CALLBACK
+// ============================================
+// Runs in the UART driver's event task when bytes arrive (FIFO threshold or
+// RX idle timeout); it only wakes the loop, which does the parsing.
+static void onUartReceive() { notifyPaymentLoop(PAYMENT_EVT_UART_RX); }
+
+static void onUartError(hardwareSerial_error_t err) {
+  if (err == UART_FRAME_ERROR || err == UART_PARITY_ERROR ||
+      err == UART_BREAK_ERROR) {
+    hwErrorsPending = hwErrorsPending + 1;
   }
-  offlineBuffer[offlineBufferCount++] = tx;
-  return true;
+  notifyPaymentLoop(PAYMENT_EVT_UART_RX);
 }
 
 // ============================================
@@ -108,6 +139,9 @@ void initUartSender() {
   while (Serial2.available()) {
     Serial2.read();
   }
+  Serial2.onReceive(onUartReceive);
+  Serial2.onReceiveError(onUartError);
+  linkStatsReset(linkStats, UART_BAUD);
 
   // Randomize starting seq to prevent collisions after restart
   // Main ESP tracks recent seq numbers - if we always start at 1,
@@ -123,104 +157,504 @@ void initUartSender() {
 }
 
 // ============================================
-// SEND PAYMENT
+// TRANSMIT
 // ============================================
-bool sendPayment(int amount) {
-  if (amount <= 0) {
-    return true;
+static void transmitHead() {
+  const PaymentTx &tx = txQueue[0];
+  char buffer[UART_MSG_BUFFER_SIZE];
+  char data[32];
+
+  snprintf(data, sizeof(data), "%d,%lu", tx.amount,
+           static_cast<unsigned long>(tx.seq));
+  buildMessage(buffer, CMD_PAYMENT, data);
+  Serial2.print(buffer);
+
+  txInFlight = true;
+  txAttempts++;
+  txSentMs = millis();
+  lastTxMs = txSentMs;
+
+  Serial.print(txAttempts > 1 ? "🔁 Resending: " : "📤 Sending: ");
+  Serial.print(buffer);
+}
+
+static void sendHeartbeat(unsigned long now) {
+  lastHeartbeatMs = now;
+
+  char buffer[UART_MSG_BUFFER_SIZE];
+  char data[24];
+
+  // Uptime in seconds, held snapshot version (Main resyncs on mismatch)
+  snprintf(data, sizeof(data), "%lu,%x", now / 1000, mainSnapshot.version);
+  buildMessage(buffer, CMD_HEARTBEAT, data);
+
+  Serial2.print(buffer);
+  lastTxMs = now;
+
+  // Check if we got ACK recently
+  if (now - lastAckMs > HEARTBEAT_INTERVAL_MS * 3) {
+    mainEspConnected = false;
   }
+}
+
+// ============================================
+// LINK TRAINING
+// ============================================
+static void printLinkStats() {
+  Serial.print("🔗 UART link ");
+  Serial.print(linkStats.baud);
+  Serial.print(" baud: good ");
+  Serial.print(linkStats.goodFrames);
+  Serial.print(", bad ");
+  Serial.print(linkStats.badFrames);
+  Serial.print(", hw err ");
+  Serial.print(linkStats.hwErrors);
+  Serial.print(", trained ");
+  Serial.print(linkStats.trainings);
+  Serial.print("/");
+  Serial.print(linkStats.trainings + linkStats.trainFailures);
+  Serial.print(", fallbacks ");
+  Serial.print(linkStats.fallbacks);
+  Serial.print(", last bit errors ");
+  Serial.println(linkStats.lastBitErrors);
+}
 
-  PaymentTx tx{amount, nextPaymentSeq++};
+static void sendLinkFrame(const char *op, uint32_t baud) {
+  char buffer[UART_MSG_BUFFER_SIZE];
+  char data[UART_MAX_DATA_LEN + 1];
+  snprintf(data, sizeof(data), "%s,%lu", op, static_cast<unsigned long>(baud));
+  buildMessage(buffer, CMD_LINK, data);
+  Serial2.print(buffer);
+  lastTxMs = millis();
+}
 
-  // Try immediate send. If it fails, queue exactly once.
-  if (trySendPaymentTx(tx)) {
-    return true;
+static void setLinkBaud(uint32_t baud) {
+  Serial2.flush(); // Let the last frame leave at the old baud
+  Serial2.updateBaudRate(baud);
+  linkStats.baud = baud;
+  linkStats.window = 0;
+  rxLen = 0;
+  rxOverflow = false;
+  lastValidRxMs = millis(); // Silence timer restarts at the new baud
+}
+
+static void startLinkTraining(uint32_t baud) {
+  trainBaud = baud;
+  trainPrevBaud = linkStats.baud;
+  trainResOk = false;
+  sendLinkFrame(LINK_OP_REQ, baud);
+  linkState = LINK_WAIT_OK;
+  linkDeadlineMs = millis() + LINK_REPLY_TIMEOUT_MS;
+}
+
+static void linkTrainingFailed(const char *reason) {
+  if (linkStats.baud != trainPrevBaud) {
+    setLinkBaud(trainPrevBaud);
   }
+  linkState = LINK_IDLE;
+  linkStats.trainFailures++;
+  linkCeiling = trainPrevBaud;
+  linkCeilingUntilMs = millis() + LINK_RETRY_MS;
+
+  Serial.print("⚠️ UART link training to ");
+  Serial.print(trainBaud);
+  Serial.print(" baud failed (");
+  Serial.print(reason);
+  Serial.println(")");
+}
 
-  Serial.println("❌ Main ESP offline, buffering payment");
-  if (!enqueuePaymentTx(tx)) {
-    Serial.println("⚠️ Offline buffer full!");
-    return false;
+static void linkTrainingDone() {
+  linkState = LINK_IDLE;
+  linkStats.trainings++;
+  linkStats.window = 0;
+  nextTrainMs = millis(); // Try the next step right away
+  printLinkStats();
+}
+
+// Drop to UART_BAUD (the rendezvous baud) and cap retraining below the
+// baud that failed.
+static void linkFallback(const char *reason, bool notifyMain) {
+  if (linkStats.baud == UART_BAUD) {
+    return;
   }
+  const uint32_t failedBaud = linkStats.baud;
+  if (notifyMain) {
+    sendLinkFrame(LINK_OP_DOWN, UART_BAUD);
+  }
+  setLinkBaud(UART_BAUD);
+  linkState = LINK_IDLE;
+  linkStats.fallbacks++;
+  linkCeiling = linkLowerBaud(failedBaud);
+  linkCeilingUntilMs = millis() + LINK_CEILING_HOLD_MS;
+  nextTrainMs = millis() + LINK_REGAIN_MS;
+
+  Serial.print("⚠️ UART link fallback from ");
+  Serial.print(failedBaud);
+  Serial.print(" baud (");
+  Serial.print(reason);
+  Serial.println(")");
+}
 
-  return true;
+static void handleLinkFrame(const char *data) {
+  char op[8] = {0};
+  unsigned long baud = 0;
+  int ok = 0;
+  unsigned bitErrors = 0;
+  const int fields = sscanf(data, "%7[^,],%lu,%d,%u", op, &baud, &ok,
+                            &bitErrors);
+  if (fields < 2) {
+    return;
+  }
+
+  if (strcmp(op, LINK_OP_DOWN) == 0) {
+    linkFallback("requested by Main", false);
+    return;
+  }
+  if (baud != trainBaud) {
+    return;
+  }
+
+  if (linkState == LINK_WAIT_OK && strcmp(op, LINK_OP_OK) == 0) {
+    setLinkBaud(trainBaud);
+    linkState = LINK_SETTLE;
+    linkDeadlineMs = millis() + LINK_SETTLE_MS;
+  } else if (linkState == LINK_WAIT_OK && strcmp(op, LINK_OP_NAK) == 0) {
+    linkTrainingFailed("refused");
+  } else if (linkState == LINK_WAIT_RES && strcmp(op, LINK_OP_RES) == 0 &&
+             fields == 4) {
+    trainResOk = ok != 0;
+    linkStats.lastBitErrors = (uint16_t)bitErrors;
+    linkBlockRxReset(blockRx);
+    linkState = LINK_WAIT_BLOCK;
+    linkDeadlineMs = millis() + LINK_REPLY_TIMEOUT_MS;
+  } else if (linkState == LINK_WAIT_DONE && strcmp(op, LINK_OP_DONE) == 0) {
+    linkTrainingDone();
+  }
 }
 
-// ============================================
-// SEND HEARTBEAT
-// ============================================
-void sendHeartbeat() {
-  unsigned long now = millis();
+// Main's block arrived: both directions checked, commit or revert
+static void finishBlockRx() {
+  uint16_t bitErrors = 0;
+  const bool ok = linkBlockCheck(blockRx, trainBaud, bitErrors);
+  if (bitErrors > linkStats.lastBitErrors) {
+    linkStats.lastBitErrors = bitErrors;
+  }
+  if (!ok || !trainResOk) {
+    linkTrainingFailed(trainResOk ? "bad block from Main" : "bad block at Main");
+    return;
+  }
+  sendLinkFrame(LINK_OP_COMMIT, trainBaud);
+  linkState = LINK_WAIT_DONE;
+  linkDeadlineMs = millis() + LINK_REPLY_TIMEOUT_MS;
+}
 
-  if (now - lastHeartbeatMs < HEARTBEAT_INTERVAL_MS) {
+static void processLinkTraining(unsigned long now) {
+  if (linkState == LINK_SETTLE && (long)(now - linkDeadlineMs) >= 0) {
+    uint8_t block[LINK_BLOCK_LEN];
+    linkBuildBlock(block, trainBaud);
+    Serial2.write(block, sizeof(block));
+    lastTxMs = now;
+    linkState = LINK_WAIT_RES;
+    linkDeadlineMs = now + LINK_REPLY_TIMEOUT_MS;
+    return;
+  }
+  if (linkState != LINK_IDLE) {
+    if ((long)(now - linkDeadlineMs) > 0) {
+      linkTrainingFailed("timeout");
+    }
     return;
   }
-  lastHeartbeatMs = now;
 
-  char buffer[64];
-  char data[16];
+  if (linkStats.baud != UART_BAUD) {
+    if (linkErrorSpike(linkStats)) {
+      linkFallback("error spike", true);
+      return;
+    }
+    if (now - lastValidRxMs > LINK_SILENCE_MS) {
+      linkFallback("silence", true);
+      return;
+    }
+  }
 
-  snprintf(data, sizeof(data), "%lu", now / 1000); // Uptime in seconds
-  buildMessage(buffer, CMD_HEARTBEAT, data);
+  if ((long)(now - linkCeilingUntilMs) >= 0) {
+    linkCeiling = UART_LINK_MAX_BAUD;
+  }
+  const uint32_t next = linkNextBaud(linkStats.baud, linkCeiling);
+  if (next != 0 && mainEspConnected && !txInFlight && txQueueCount == 0 &&
+      (long)(now - nextTrainMs) >= 0) {
+    startLinkTraining(next);
+    return;
+  }
 
-  Serial2.print(buffer);
+  if (mainEspConnected && now - lastLinkStatsMs >= LINK_STATS_INTERVAL_MS) {
+    lastLinkStatsMs = now;
+    char buffer[UART_MSG_BUFFER_SIZE];
+    char data[UART_MAX_DATA_LEN + 1];
+    snprintf(data, sizeof(data), "%lu,%lu,%lu",
+             static_cast<unsigned long>(linkStats.goodFrames % 100000000UL),
+             static_cast<unsigned long>(linkStats.badFrames % 100000000UL),
+             static_cast<unsigned long>(linkStats.hwErrors % 10000000UL));
+    buildMessage(buffer, CMD_LINK_STATS, data);
+    Serial2.print(buffer);
+    lastTxMs = now;
+    if (linkStats.badFrames != reportedBadFrames) {
+      reportedBadFrames = linkStats.badFrames;
+      printLinkStats();
+    }
+  }
+}
 
-  // Check if we got ACK recently
-  if (now - lastAckMs > HEARTBEAT_INTERVAL_MS * 3) {
-    mainEspConnected = false;
+// ============================================
+// SEND PAYMENT
+// ============================================
+bool sendPayment(int amount, uint32_t insertedUs) {
+  if (amount <= 0) {
+    return true;
+  }
+  if (txQueueCount >= OFFLINE_BUFFER_SIZE) {
+    Serial.println("⚠️ Payment queue full!");
+    return false;
+  }
+
+  txQueue[txQueueCount++] = {amount, nextPaymentSeq++, insertedUs,
+                             (uint32_t)esp_timer_get_time()};
+  return true;
+}
+
+// ============================================
+// STATE REPLICATION
+// ============================================
+static void handleSyncFrame(const char *data) {
+  const uint8_t inhibitBefore = mainSnapshot.inhibit;
+  const int changed = syncApply(mainSnapshot, data);
+
+  // Always report what we hold; a stale base makes Main send a full snapshot.
+  // Replies are skipped mid-training, Main retries.
+  if (linkState == LINK_IDLE) {
+    char buffer[UART_MSG_BUFFER_SIZE];
+    char ack[8];
+    snprintf(ack, sizeof(ack), "%x", mainSnapshot.version);
+    buildMessage(buffer, CMD_SYNC_ACK, ack);
+    Serial2.print(buffer);
+    lastTxMs = millis();
+  }
+
+  if (changed > 0 && mainSnapshot.inhibit != inhibitBefore) {
+    Serial.print("📥 Main inhibit mask: 0x");
+    Serial.println(mainSnapshot.inhibit, HEX);
   }
 }
 
 // ============================================
 // PROCESS INCOMING MESSAGES
 // ============================================
-void processUartReceive() {
+// Returns true if the frame acknowledged the in-flight payment.
+static bool handleFrame(const char *line) {
+  char cmd[16], data[UART_MAX_DATA_LEN + 1];
+  if (!parseMessage(line, cmd, data)) {
+    linkRecordFrame(linkStats, false);
+    return false;
+  }
+  linkRecordFrame(linkStats, true);
+  lastValidRxMs = millis();
+
+  if (strcmp(cmd, CMD_LINK) == 0) {
+    handleLinkFrame(data);
+    return false;
+  }
+  if (strcmp(cmd, CMD_SYNC) == 0) {
+    handleSyncFrame(data);
+  } else if (strcmp(cmd, CMD_STATUS) == 0) {
+    Serial.print("📥 Status: ");
+    Serial.println(data);
+  } else if (strcmp(cmd, CMD_ACK) != 0) {
+    return false;
+  }
+
+  // Any valid reply proves the link is up; flush the queue right away
+  lastAckMs = millis();
+  mainEspConnected = true;
+  offlineBackoff = false;
+
+  if (strcmp(cmd, CMD_ACK) != 0 || !txInFlight) {
+    return false;
+  }
+  const unsigned long ackSeq = strtoul(data, nullptr, 10);
+  if (ackSeq != txQueue[0].seq) {
+    return false; // Heartbeat ACK (seq 0) or a stale retry
+  }
+
+  const PaymentTx tx = txQueue[0];
+  txQueueCount--;
+  if (txQueueCount > 0) {
+    memmove(txQueue, &txQueue[1], txQueueCount * sizeof(PaymentTx));
+  }
+  txInFlight = false;
+  txAttempts = 0;
+
+  const uint32_t nowUs = (uint32_t)esp_timer_get_time();
+  const uint32_t linkMs = millis() - txSentMs;
+  addLatency(insertToAck, (nowUs - tx.insertedUs) / 1000);
+  addLatency(queueToAck, (nowUs - tx.queuedUs) / 1000);
+
+  Serial.print("✓ ACK seq=");
+  Serial.print(tx.seq);
+  Serial.print(" (link ");
+  Serial.print(linkMs);
+  Serial.print(" ms, insert→ACK ");
+  Serial.print((nowUs - tx.insertedUs) / 1000);
+  Serial.println(" ms)");
+
+  if (insertToAck.count % LATENCY_REPORT_EVERY == 0) {
+    Serial.print("📊 Payment latency (n=");
+    Serial.print(insertToAck.count);
+    Serial.println("):");
+    printLatency("insert→ACK", insertToAck);
+    printLatency("queue→ACK ", queueToAck);
+  }
+  return true;
+}
+
+static int drainUartRx() {
+  int acked = 0;
   while (Serial2.available()) {
-    char buffer[64];
-    int len = Serial2.readBytesUntil('\n', buffer, sizeof(buffer) - 1);
-    buffer[len] = '\0';
-
-    char cmd[16], data[32];
-    if (parseMessage(buffer, cmd, data)) {
-      if (strcmp(cmd, CMD_ACK) == 0) {
-        lastAckMs = millis();
-        mainEspConnected = true;
-      } else if (strcmp(cmd, CMD_STATUS) == 0) {
-        // Main ESP sent status update
-        lastAckMs = millis();
-        mainEspConnected = true;
-        Serial.print("📥 Status: ");
-        Serial.println(data);
+    const char c = (char)Serial2.read();
+    if (linkState == LINK_WAIT_BLOCK) {
+      if (linkBlockRxFeed(blockRx, (uint8_t)c)) {
+        finishBlockRx();
+      }
+      continue;
+    }
+    if (c == '\r') {
+      continue;
+    }
+    if (c != '\n') {
+      if (rxLen < (int)sizeof(rxLine) - 1) {
+        rxLine[rxLen++] = c;
+      } else {
+        rxOverflow = true; // Drop the rest of an oversized line
       }
+      continue;
+    }
+    rxLine[rxLen] = '\0';
+    if (rxOverflow) {
+      linkRecordFrame(linkStats, false);
+    } else if (rxLen > 0 && handleFrame(rxLine)) {
+      acked++;
     }
+    rxLen = 0;
+    rxOverflow = false;
   }
+  return acked;
+}
 
-  // Try to flush offline buffer if connected
-  if (mainEspConnected && offlineBufferCount > 0) {
-    Serial.print("📤 Flushing offline buffer (");
-    Serial.print(offlineBufferCount);
-    Serial.println(" payments)");
+// ============================================
+// SERVICE
+// ============================================
+int processUartSender() {
+  const uint32_t hwErrors = hwErrorsPending;
+  if (hwErrors != 0) {
+    hwErrorsPending = hwErrorsPending - hwErrors;
+    linkRecordHwErrors(linkStats, hwErrors);
+  }
 
-    int sentCount = 0;
-    for (int i = 0; i < offlineBufferCount; i++) {
-      if (!trySendPaymentTx(offlineBuffer[i])) {
-        break;
-      }
-      sentCount++;
+  const int acked = drainUartRx();
+  const unsigned long now = millis();
+
+  processLinkTraining(now);
+
+  // ACK timeout: retry, then treat Main ESP as offline and keep the queue
+  if (txInFlight && now - txSentMs >= ACK_TIMEOUT_MS) {
+    txInFlight = false;
+    Serial.print("⚠️ No ACK, retry ");
+    Serial.println(txAttempts);
+    if (txAttempts >= MAX_RETRIES && linkStats.baud != UART_BAUD) {
+      // Probably the link, not Main: retry at the rendezvous baud
+      linkFallback("no ACK", true);
+      txAttempts = 0;
+    } else if (txAttempts >= MAX_RETRIES) {
+      Serial.print("❌ Main ESP offline, buffering ");
+      Serial.print(txQueueCount);
+      Serial.println(" payment(s)");
+      mainEspConnected = false;
+      txAttempts = 0;
+      offlineBackoff = true;
+      offlineRetryAtMs = now + OFFLINE_RETRY_MS;
     }
+  }
 
-    if (sentCount > 0) {
-      const int remaining = offlineBufferCount - sentCount;
-      if (remaining > 0) {
-        memmove(offlineBuffer, &offlineBuffer[sentCount],
-                remaining * sizeof(PaymentTx));
-      }
-      offlineBufferCount = remaining;
+  if (offlineBackoff && (long)(now - offlineRetryAtMs) >= 0) {
+    offlineBackoff = false;
+  }
+
+  // Nothing else goes on the wire while the link is being trained
+  if (linkState != LINK_IDLE) {
+    return acked;
+  }
+
+  if (!txInFlight && !offlineBackoff && txQueueCount > 0) {
+    transmitHead();
+  }
+
+  if (now - lastHeartbeatMs >= HEARTBEAT_INTERVAL_MS) {
+    sendHeartbeat(now);
+  }
+  return acked;
+}
+
+uint32_t getUartWaitMs() {
+  if (Serial2.available()) {
+    return 0;
+  }
+  const unsigned long now = millis();
+  uint32_t wait = UINT32_MAX;
+
+  auto until = [&](unsigned long atMs) {
+    const long remain = (long)(atMs - now);
+    const uint32_t ms = remain > 0 ? (uint32_t)remain : 0;
+    if (ms < wait) {
+      wait = ms;
     }
+  };
+
+  if (linkState != LINK_IDLE) {
+    until(linkDeadlineMs);
+    return wait;
+  }
+  // Same gate as processLinkTraining(): while training is blocked (Main
+  // offline, frame outstanding) a passed nextTrainMs must not read as due.
+  // Whatever unblocks it (a frame from Main, an ACK) wakes the loop anyway.
+  if (linkNextBaud(linkStats.baud, linkCeiling) != 0 && mainEspConnected &&
+      !txInFlight && txQueueCount == 0) {
+    until(nextTrainMs);
   }
+  until(lastHeartbeatMs + HEARTBEAT_INTERVAL_MS);
+  if (txInFlight) {
+    until(txSentMs + ACK_TIMEOUT_MS);
+  } else if (txQueueCount > 0) {
+    if (offlineBackoff) {
+      until(offlineRetryAtMs);
+    } else {
+      wait = 0;
+    }
+  }
+  return wait;
+}
+
+bool isUartAwaitingReply() {
+  return txInFlight || linkState != LINK_IDLE ||
+         millis() - lastTxMs < ACK_TIMEOUT_MS || rxLen > 0;
 }
 
 // ============================================
 // STATUS
 // ============================================
 bool isMainEspConnected() { return mainEspConnected; }
+
+bool isPaymentInhibited() {
+  return mainSnapshot.inhibit != 0 || txQueueCount >= OFFLINE_BUFFER_SIZE;
+}
+
+const StateSnapshot &getMainSnapshot() { return mainSnapshot; }
+
+const UartLinkStats &getUartLinkStats() { return linkStats; }
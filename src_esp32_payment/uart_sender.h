@@ -1,6 +1,8 @@
 #ifndef UART_SENDER_H
 #define UART_SENDER_H
 
+#include "../shared/state_sync.h"
+#include "../shared/uart_link.h"
 #include <Arduino.h>
 
 // ============================================
@@ -10,18 +12,36 @@
 // Initialize UART communication
 void initUartSender();
 
-// Send payment to Main ESP32
-// Returns true if delivered or queued for retry (false only if offline buffer
-// is full and the payment could not be queued).
-bool sendPayment(int amount);
+// Queue payment for Main ESP32. Transmission starts on the next
+// processUartSender() call; retries and offline buffering are handled there.
+// `insertedUs` is the esp_timer time the note started (for latency stats).
+// Returns false only if the queue is full and the payment was not accepted.
+bool sendPayment(int amount, uint32_t insertedUs);
 
-// Send heartbeat to Main ESP32
-void sendHeartbeat();
+// Non-blocking UART service: assemble received frames, match ACKs, retry on
+// timeout, transmit queued payments and heartbeats. Returns the number of
+// payments acknowledged during this call.
+int processUartSender();
 
-// Process incoming messages from Main ESP32
-void processUartReceive();
+// Milliseconds until processUartSender() has timer work to do
+// (0 = now, UINT32_MAX = nothing scheduled).
+uint32_t getUartWaitMs();
+
+// True while a reply from Main ESP32 is expected (light sleep must not drop
+// the incoming bytes).
+bool isUartAwaitingReply();
 
 // Check if Main ESP32 is connected
 bool isMainEspConnected();
 
+// True if the acceptor should refuse notes: Main asked for it (emergency,
+// OTA, service) or the payment queue is full.
+bool isPaymentInhibited();
+
+// Latest state replicated from Main ESP32 (version 0 = none yet)
+const StateSnapshot &getMainSnapshot();
+
+// Link quality as seen by this side (baud, frame/hardware errors, training)
+const UartLinkStats &getUartLinkStats();
+
 #endif
@@ -90,8 +90,16 @@ public:
 };
 
 // Serial Mock
+class IPAddress;
+
 class SerialMock {
 public:
+  // No input: the serial console tests call processCommand() directly
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual size_t readBytesUntil(char, char *, size_t) { return 0; }
+  virtual size_t printf(const char *, ...) { return 0; }
+
   // Print overloads
   virtual size_t print(const char *s) { return strlen(s); }
   virtual size_t print(const String &s) { return s.length(); }
@@ -112,6 +120,7 @@ public:
   virtual size_t println(double v, int d = 2) { return 1; }
   virtual size_t println(float v, int d = 2) { return 1; } // Explicit float
   virtual size_t println() { return 1; }                   // Empty println
+  virtual size_t println(const IPAddress &) { return 1; }
 };
 
 extern SerialMock Serial;
@@ -150,6 +159,7 @@ inline String operator+(const char *lhs, const String &rhs) {
 class EspClass {
 public:
   void restart() {}
+  uint32_t getFreeHeap() { return 200000; }
 };
 extern EspClass ESP;
 
@@ -43,6 +43,8 @@ char TOPIC_OTA_IN[64];
 char TOPIC_TELEMETRY[64];
 char TOPIC_ALERTS[64];
 char TOPIC_DIAGNOSTICS[64];
+char TOPIC_LEDGER_OUT[64];
+char TOPIC_LEDGER_ACK[64];
 char TOPIC_BROADCAST_CONFIG[64];
 char TOPIC_BROADCAST_COMMAND[64];
 char TOPIC_GROUP_CONFIG[64];
@@ -61,3 +63,10 @@ void processWiFi() {}
 void initConfig() {}
 void applyRuntimeConfig() {}
 void generateMQTTTopics() {}
+
+// ============================================
+// TELEMETRY MOCK
+// ============================================
+// telemetry.cpp needs the ESP/WiFi runtime; its pure parts are in
+// telemetry.h and tested directly
+void telemetryAddVolume(float liters) {}
@@ -30,9 +30,27 @@ void displayStatus() {}
 void displayError(const char *msg) {}
 
 // Define Relay Mock
+#include "../../src_esp32_main/hardware.h"
 #include "../../src_esp32_main/relay_control.h"
-void setRelay(bool on) {}
-bool isRelayOn() { return false; }
+static bool mockRelayOn[NOZZLE_MAX] = {};
+void setNozzleRelay(uint8_t nozzle, bool on) {
+  if (nozzle < NOZZLE_MAX)
+    mockRelayOn[nozzle] = on;
+}
+bool isNozzleRelayOn(uint8_t nozzle) {
+  return nozzle < NOZZLE_MAX && mockRelayOn[nozzle];
+}
+void setRelay(bool on) { setNozzleRelay(0, on); }
+bool isRelayOn() { return isNozzleRelayOn(0); }
+
+// Define UART Receiver Mock (inhibit mask only)
+#include "../../src_esp32_main/uart_receiver.h"
+static uint8_t mockPaymentInhibit = 0;
+void setPaymentInhibit(uint8_t reason, bool on) {
+  mockPaymentInhibit = on ? (mockPaymentInhibit | reason)
+                          : (mockPaymentInhibit & (uint8_t)~reason);
+}
+uint8_t getPaymentInhibit() { return mockPaymentInhibit; }
 
 // Define OTA Mock
 #include "ota_handler.h"
@@ -46,6 +64,7 @@ void esp_task_wdt_reset() { wdt_reset_count++; }
 // Define Sensors Mock (readTDS)
 // We need to declare it if we don't include sensors.h
 int readTDS() { return 100; }
+int tdsPPM = 100;
 
 // Define Alerts Mock (legacy; kept for linkage even if unused)
 enum AlertCategory { CAT_SYSTEM = 0 };
@@ -18,6 +18,8 @@ public:
   int status() { return WL_CONNECTED; }
   void begin(const char *ssid, const char *pass) {}
   IPAddress localIP() { return IPAddress(192, 168, 1, 100); }
+  String SSID() { return String("MockWiFi"); }
+  int RSSI() { return -60; }
 };
 
 extern WiFiClass WiFi;
@@ -5,6 +5,7 @@
 #include "mocks/display.h"
 #include "mocks/esp_task_wdt.h"
 #include "mocks/ota_handler.h"
+#include <stdio.h>
 #include <unity.h>
 
 // Include implementations for linkage
@@ -12,14 +13,30 @@
 #include "mocks/MockImpl.cpp" // Arduino/Preferences globals
 
 // Include source files under test
+#include "../../shared/logger.cpp"
 #define copyToBuffer copyToBuffer_config
 #include "../../src_esp32_main/config_storage.cpp"
 #undef copyToBuffer
 #include "../../src_esp32_main/config_storage_validation.cpp"
 #include "../../src_esp32_main/state_machine.cpp"
+#include "../../src_esp32_main/session_ledger.cpp"
+#include "../../src_esp32_payment/pulse_decoder.cpp"
+#include "../../src_esp32_main/boot_timing.h"
+#include "../../src_esp32_main/config_snapshot.h"
+#include "../../src_esp32_main/diagnostics.h"
+#include "../../src_esp32_main/heap_monitor.h"
+#include "../../src_esp32_main/json_arena.h"
+#include "../../src_esp32_main/ota_download.h"
+#include "../../src_esp32_main/power_save.h"
+#include "../../src_esp32_main/telemetry.h"
+#include "../../shared/state_sync.h"
+#include "../../shared/uart_link.h"
 #define copyToBuffer copyToBuffer_mqtt
 #include "../../src_esp32_main/mqtt_handler.cpp" // Now included!
 #undef copyToBuffer
+#define copyToBuffer copyToBuffer_serial
+#include "../../src_esp32_main/serial_config.cpp"
+#undef copyToBuffer
 
 // ============================================
 // SETUP / TEARDOWN
@@ -33,6 +50,7 @@ void setUp(void) {
 
   // Reset Config
   loadDefaultConfig();
+  config = runtimeConfigFrom(deviceConfig);
 
   // Sync 'config' global with 'deviceConfig'
   config.pricePerLiter = 1000;
@@ -41,6 +59,10 @@ void setUp(void) {
   config.freeWaterAmount = 0.2;
   config.freeWaterCooldown = 0;
   config.sessionTimeout = 300000;
+  for (int i = 0; i < NOZZLE_MAX; i++) {
+    config.nozzlePricePerLiter[i] = -1;
+    config.nozzlePulsesPerLiter[i] = 0;
+  }
   // config.requireSignedMessages does not exist in Config struct
 
   // Sync deviceConfig
@@ -52,6 +74,11 @@ void setUp(void) {
   strcpy(TOPIC_CONFIG_IN, "water/config");
   strcpy(TOPIC_BROADCAST_COMMAND, "water/broadcast/command");
   strcpy(TOPIC_GROUP_COMMAND, "water/group/command");
+  strcpy(TOPIC_LEDGER_ACK, "water/ledger/ack");
+
+  // Fresh session ledger (RAM-backed on host)
+  initSessionLedger();
+  ledgerFormat();
   // ... others as needed
 }
 
@@ -81,6 +108,89 @@ void test_config_validation(void) {
   TEST_ASSERT_EQUAL_UINT32(300000, deviceConfig.sessionTimeout);
 }
 
+// MQTT config, SET_TIMEOUT and CFG_FRAME share this: 300 and 300000 both
+// mean five minutes
+void test_config_durations_seconds_or_ms(void) {
+  TEST_ASSERT_EQUAL_UINT32(300000, normalizeSecondsOrMs(300));
+  TEST_ASSERT_EQUAL_UINT32(300000, normalizeSecondsOrMs(300000));
+  TEST_ASSERT_EQUAL_UINT32(3600000, normalizeSecondsOrMs(3600));
+  TEST_ASSERT_EQUAL_UINT32(3601, normalizeSecondsOrMs(3601));
+  TEST_ASSERT_EQUAL_UINT32(0, normalizeSecondsOrMs(0));
+}
+
+// CFG_FRAME line as the desktop app builds it
+static void sendConfigFrame(const char *json) {
+  static char line[512];
+  const size_t len = strlen(json);
+  snprintf(line, sizeof(line), "CFG_FRAME:%u:%lx:%s", (unsigned)len,
+           (unsigned long)crc32Ieee(json, len), json);
+  processCommand(line);
+}
+
+// mqttPort is only read with mqttBroker: alone it must fail the frame, not
+// be dropped behind an OK
+void test_cfg_frame_rejects_pair_key_alone(void) {
+  const int port = deviceConfig.mqtt_port;
+  sendConfigFrame("{\"deviceId\":\"EW_PAIR\",\"mqttPort\":1884}");
+  TEST_ASSERT_EQUAL_INT(port, deviceConfig.mqtt_port);
+  TEST_ASSERT_TRUE(strcmp("EW_PAIR", deviceConfig.device_id) != 0);
+
+  sendConfigFrame("{\"mqttBroker\":\"broker.local\",\"mqttPort\":1884}");
+  TEST_ASSERT_EQUAL_INT(1884, deviceConfig.mqtt_port);
+  TEST_ASSERT_EQUAL_STRING("broker.local", deviceConfig.mqtt_broker);
+}
+
+// ============================================
+// SERIAL CONSOLE TESTS
+// ============================================
+// findCommand() binary-searches COMMANDS, so a name added out of order is
+// silently unreachable
+void test_serial_command_table_sorted(void) {
+  for (size_t i = 1; i < COMMAND_COUNT; i++) {
+    TEST_ASSERT_TRUE_MESSAGE(
+        strcmp(COMMANDS[i - 1].name, COMMANDS[i].name) < 0, COMMANDS[i].name);
+  }
+  for (size_t i = 0; i < COMMAND_COUNT; i++) {
+    TEST_ASSERT_EQUAL_PTR(&COMMANDS[i], findCommand(COMMANDS[i].name));
+  }
+  TEST_ASSERT_NULL(findCommand("SET_PRICES"));
+}
+
+void test_serial_parsers_are_strict(void) {
+  long v = 0;
+  TEST_ASSERT_TRUE(parseLongArg("1500", v));
+  TEST_ASSERT_EQUAL(1500, v);
+  TEST_ASSERT_FALSE(parseLongArg("12abc", v));
+  TEST_ASSERT_FALSE(parseLongArg("", v));
+  TEST_ASSERT_FALSE(parseLongArg("99999999999999999999", v));
+  float f = 0.0f;
+  TEST_ASSERT_FALSE(parseFloatArg("4.5x", f));
+  bool b = false;
+  TEST_ASSERT_FALSE(parseFlagArg("10", b));
+
+  const int price = deviceConfig.pricePerLiter;
+  char line[64];
+  strcpy(line, "SET_PRICE:12abc");
+  processCommand(line);
+  TEST_ASSERT_EQUAL_INT(price, deviceConfig.pricePerLiter);
+  strcpy(line, "SET_PRICE:100001");
+  processCommand(line);
+  TEST_ASSERT_EQUAL_INT(price, deviceConfig.pricePerLiter);
+  strcpy(line, "set_price:1500");
+  processCommand(line);
+  TEST_ASSERT_EQUAL_INT(1500, deviceConfig.pricePerLiter);
+
+  const int port = deviceConfig.mqtt_port;
+  strcpy(line, "SET_MQTT:host:70000");
+  processCommand(line);
+  TEST_ASSERT_EQUAL_INT(port, deviceConfig.mqtt_port);
+  TEST_ASSERT_TRUE(strcmp("host", deviceConfig.mqtt_broker) != 0);
+  strcpy(line, "SET_MQTT:host:1884");
+  processCommand(line);
+  TEST_ASSERT_EQUAL_INT(1884, deviceConfig.mqtt_port);
+  TEST_ASSERT_EQUAL_STRING("host", deviceConfig.mqtt_broker);
+}
+
 void test_config_save_load(void) {
   deviceConfig.pricePerLiter = 2000;
   strcpy(deviceConfig.wifi_ssid, "TestWiFi");
@@ -129,6 +239,969 @@ void test_sm_flow_logic(void) {
   TEST_ASSERT_EQUAL_FLOAT(0.5, totalDispensedLiters);
 }
 
+void test_sm_transition_table_exhaustive(void) {
+  // Expected state after each event, with balance > 0 and free water ready
+  static const SystemState expected[SM_STATE_COUNT][SM_EV_COUNT] = {
+      // START, PAUSE, PAYMENT, DEPLETED, FREE_DONE, TIMEOUT, ABORT
+      {DISPENSING, IDLE, ACTIVE, IDLE, IDLE, IDLE, IDLE},
+      {DISPENSING, ACTIVE, ACTIVE, ACTIVE, ACTIVE, IDLE, IDLE},
+      {DISPENSING, PAUSED, DISPENSING, IDLE, DISPENSING, IDLE, IDLE},
+      {DISPENSING, PAUSED, PAUSED, PAUSED, PAUSED, IDLE, IDLE},
+      {FREE_WATER, PAUSED, DISPENSING, FREE_WATER, DISPENSING, IDLE, IDLE},
+  };
+  for (int s = 0; s < SM_STATE_COUNT; s++) {
+    for (int e = 0; e < SM_EV_COUNT; e++) {
+      initStateMachine();
+      currentState = static_cast<SystemState>(s);
+      balance = 500;
+      setRelay(false);
+
+      TEST_ASSERT_TRUE(postStateEvent(static_cast<StateEvent>(e)));
+      dispatchStateEvents();
+      TEST_ASSERT_EQUAL(expected[s][e], currentState);
+      if (currentState != s) {
+        // Relay follows the state after every real transition
+        TEST_ASSERT_EQUAL(currentState == DISPENSING ||
+                              currentState == FREE_WATER,
+                          isRelayOn());
+      }
+    }
+  }
+}
+
+void test_sm_event_queue_order_and_status_coalescing(void) {
+  config.pulsesPerLiter = 100.0;
+  balance = 1000;
+
+  // Queued events run in order; the status publish is requested once
+  TEST_ASSERT_TRUE(postStateEvent(SM_EV_PAYMENT));
+  TEST_ASSERT_TRUE(postStateEvent(SM_EV_START));
+  TEST_ASSERT_TRUE(postStateEvent(SM_EV_PAUSE));
+  TEST_ASSERT_TRUE(postStateEvent(SM_EV_START));
+  TEST_ASSERT_FALSE(isStatusPublishPending());
+  dispatchStateEvents();
+  TEST_ASSERT_EQUAL(DISPENSING, currentState);
+  TEST_ASSERT_TRUE(isRelayOn());
+  TEST_ASSERT_TRUE(isStatusPublishPending());
+  processStateMachine();
+  TEST_ASSERT_FALSE(isStatusPublishPending());
+
+  // Bounded queue: overflow is refused, not overwritten
+  for (int i = 0; i < SM_EVENT_QUEUE_LEN; i++) {
+    TEST_ASSERT_TRUE(postStateEvent(SM_EV_PAYMENT));
+  }
+  TEST_ASSERT_FALSE(postStateEvent(SM_EV_PAUSE));
+  dispatchStateEvents();
+  TEST_ASSERT_EQUAL(DISPENSING, currentState);
+
+  // Paid flow to depletion goes through the table to IDLE, relay OFF
+  flowPulseCount = 100;
+  processFlowSensor();
+  TEST_ASSERT_EQUAL(IDLE, currentState);
+  TEST_ASSERT_FALSE(isRelayOn());
+}
+
+// ============================================
+// MULTI-NOZZLE TESTS (native_test builds NOZZLE_COUNT=2)
+// ============================================
+void test_nozzles_run_independent_sessions(void) {
+  TEST_ASSERT_EQUAL(2, NOZZLE_COUNT);
+  config.enableFreeWater = false;
+  config.pulsesPerLiter = 100.0;
+  config.nozzlePricePerLiter[1] = 2000;
+  config.nozzlePulsesPerLiter[1] = 200.0;
+
+  // START without credit selects the nozzle; unaddressed cash goes there
+  handleStartButton(1);
+  TEST_ASSERT_EQUAL(IDLE, nozzles[1].state);
+  TEST_ASSERT_EQUAL_UINT8(1, getFocusNozzle());
+  processPayment(2000, "cash", nullptr, nullptr);
+  TEST_ASSERT_EQUAL(ACTIVE, nozzles[1].state);
+  TEST_ASSERT_EQUAL(2000, nozzles[1].balance);
+  TEST_ASSERT_EQUAL(IDLE, currentState);
+  TEST_ASSERT_EQUAL(0, balance);
+
+  // Addressed payment for nozzle 0 (alias globals follow nozzle 0)
+  processPayment(1000, "mqtt", "t1", nullptr, 0);
+  TEST_ASSERT_EQUAL(ACTIVE, currentState);
+  TEST_ASSERT_EQUAL(1000, balance);
+
+  handleStartButton(0);
+  handleStartButton(1);
+  TEST_ASSERT_TRUE(isNozzleRelayOn(0));
+  TEST_ASSERT_TRUE(isNozzleRelayOn(1));
+
+  // Nozzle 1 bills with its own calibration and price: 0.5L * 2000
+  nozzles[1].flowPulseCount = 100;
+  processFlowSensor(1);
+  TEST_ASSERT_EQUAL(1000, nozzles[1].balance);
+  TEST_ASSERT_EQUAL(1000, balance);
+
+  handlePauseButton(0);
+  TEST_ASSERT_EQUAL(PAUSED, currentState);
+  TEST_ASSERT_FALSE(isNozzleRelayOn(0));
+  TEST_ASSERT_TRUE(isNozzleRelayOn(1));
+
+  nozzles[1].flowPulseCount = 200;
+  processFlowSensor(1);
+  TEST_ASSERT_EQUAL(IDLE, nozzles[1].state);
+  TEST_ASSERT_FALSE(isNozzleRelayOn(1));
+  TEST_ASSERT_EQUAL(PAUSED, currentState);
+
+  // Each nozzle has its own ledger session
+  SessionRecord rec;
+  TEST_ASSERT_TRUE(ledgerReadRecord(1, rec));
+  TEST_ASSERT_EQUAL_UINT8(1, LEDGER_NOZZLE(rec));
+  TEST_ASSERT_EQUAL_UINT8(LEDGER_END_DEPLETED, LEDGER_REASON(rec));
+  TEST_ASSERT_EQUAL_UINT32(2000, rec.paidAmount);
+  TEST_ASSERT_EQUAL_UINT32(1000, rec.paidMl);
+  TEST_ASSERT_TRUE(ledgerSessionOpen(0));
+  TEST_ASSERT_FALSE(ledgerSessionOpen(1));
+}
+
+void test_nozzle_config_fallback_and_ledger_encoding(void) {
+  // Nozzle 0 always uses the base values; others fall back when unset
+  config.nozzlePricePerLiter[0] = 5000;
+  TEST_ASSERT_EQUAL(1000, nozzlePrice(0));
+  TEST_ASSERT_EQUAL(1000, nozzlePrice(1));
+  TEST_ASSERT_EQUAL_FLOAT(450.0f, nozzlePulsesPerLiter(1));
+  config.nozzlePricePerLiter[1] = 1500;
+  config.nozzlePulsesPerLiter[1] = 300.0f;
+  TEST_ASSERT_EQUAL(1500, nozzlePrice(1));
+  TEST_ASSERT_EQUAL_FLOAT(300.0f, nozzlePulsesPerLiter(1));
+
+  // Validation clamps bad overrides back to "use base"
+  deviceConfig.nozzlePricePerLiter[1] = -50;
+  deviceConfig.nozzlePulsesPerLiter[1] = -1.0f;
+  validateConfig();
+  TEST_ASSERT_EQUAL(-1, deviceConfig.nozzlePricePerLiter[1]);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, deviceConfig.nozzlePulsesPerLiter[1]);
+
+  // v2 batches carry the nozzle; v1 batches still decode (as nozzle 0)
+  SessionRecord recs[2];
+  memset(recs, 0, sizeof(recs));
+  recs[0].seq = 7;
+  recs[0].endReason = LEDGER_END_TIMEOUT | LEDGER_NOZZLE_BITS(1);
+  recs[0].pauseCount = 255;
+  recs[1].seq = 8;
+  recs[1].endReason = LEDGER_END_DEPLETED;
+  for (SessionRecord &r : recs) {
+    r.crc16 = ledgerCrc16(reinterpret_cast<const uint8_t *>(&r),
+                          offsetof(SessionRecord, crc16));
+  }
+  uint8_t bin[64];
+  const size_t len = ledgerEncodeBatch(recs, 2, bin, sizeof(bin));
+  TEST_ASSERT_GREATER_THAN(0, (int)len);
+  TEST_ASSERT_EQUAL_UINT8(2, bin[0]);
+
+  SessionRecord decoded[2];
+  TEST_ASSERT_EQUAL_INT(2, ledgerDecodeBatch(bin, len, decoded, 2));
+  TEST_ASSERT_EQUAL_MEMORY(recs, decoded, sizeof(recs));
+  TEST_ASSERT_EQUAL_UINT8(1, LEDGER_NOZZLE(decoded[0]));
+  TEST_ASSERT_EQUAL_UINT8(LEDGER_END_TIMEOUT, LEDGER_REASON(decoded[0]));
+
+  bin[0] = 3; // Unknown future version
+  TEST_ASSERT_EQUAL_INT(-1, ledgerDecodeBatch(bin, len, decoded, 2));
+  recs[0].endReason = LEDGER_END_TIMEOUT;
+  const size_t v1Len = ledgerEncodeBatch(recs, 2, bin, sizeof(bin));
+  bin[0] = 1;
+  TEST_ASSERT_EQUAL_INT(2, ledgerDecodeBatch(bin, v1Len, decoded, 2));
+  TEST_ASSERT_EQUAL_UINT8(0, LEDGER_NOZZLE(decoded[0]));
+}
+
+// ============================================
+// LOGGER TESTS
+// ============================================
+void test_logger_format_binary_args(void) {
+  LogRecord rec;
+  rec.ms = 42;
+  rec.fmt = "Payment %d seq=%lu from %s (%.1fL)";
+  rec.level = LOG_LEVEL_INFO;
+  rec.argc = 0;
+  rec.strUsed = 0;
+  char source[16];
+  strcpy(source, "cash_uart");
+  logCaptureArgs(rec, 5000, 123UL, source, 1.5f);
+  source[0] = 'X'; // Record must hold its own copy
+
+  char line[LOG_LINE_MAX];
+  logFormatRecord(rec, line, sizeof(line));
+  TEST_ASSERT_EQUAL_STRING(
+      "[     42][I] Payment 5000 seq=123 from cash_uart (1.5L)", line);
+}
+
+void test_logger_ring_drops_when_full(void) {
+  logInit();
+  for (int i = 0; i < LOG_RING_SIZE + 5; i++) {
+    logWrite(LOG_LEVEL_WARN, "n=%d", i);
+  }
+  TEST_ASSERT_EQUAL_UINT32(LOG_RING_SIZE, logPendingCount());
+  TEST_ASSERT_EQUAL_UINT32(5, logDroppedCount());
+  TEST_ASSERT_EQUAL_INT(LOG_RING_SIZE, logDrain(LOG_RING_SIZE * 2));
+  TEST_ASSERT_EQUAL_UINT32(0, logPendingCount());
+}
+
+// ============================================
+// SESSION LEDGER TESTS
+// ============================================
+void test_ledger_paid_session_and_ack(void) {
+  config.pulsesPerLiter = 100.0;
+  processPayment(1000, "cash", nullptr, nullptr);
+  handleStartButton();
+  handlePauseButton();
+  handleStartButton();
+
+  flowPulseCount = 105; // 1.05L for a 1L balance
+  processFlowSensor();
+  TEST_ASSERT_EQUAL(IDLE, currentState);
+  TEST_ASSERT_FALSE(ledgerSessionOpen());
+
+  SessionRecord rec;
+  TEST_ASSERT_TRUE(ledgerReadRecord(1, rec));
+  TEST_ASSERT_EQUAL_UINT8(LEDGER_END_DEPLETED, rec.endReason);
+  TEST_ASSERT_EQUAL_UINT32(1000, rec.paidAmount);
+  TEST_ASSERT_EQUAL_UINT32(1050, rec.paidMl);
+  TEST_ASSERT_EQUAL_UINT16(50, rec.overshootMl);
+  TEST_ASSERT_EQUAL_UINT8(1, rec.pauseCount);
+  TEST_ASSERT_EQUAL_UINT32(1, ledgerPendingCount());
+
+  char topicBuf[] = "water/ledger/ack";
+  char payloadBuf[] = "{\"last_seq\": 1}";
+  mqttCallback(topicBuf, (byte *)payloadBuf, strlen(payloadBuf));
+  TEST_ASSERT_EQUAL_UINT32(1, ledgerAckedSeq());
+  TEST_ASSERT_EQUAL_UINT32(0, ledgerPendingCount());
+  TEST_ASSERT_FALSE(ledgerHandleAck(1)); // Stale ACK ignored
+
+  // Cursor and sequence survive a reboot
+  initSessionLedger();
+  TEST_ASSERT_EQUAL_UINT32(1, ledgerAckedSeq());
+  TEST_ASSERT_EQUAL_UINT32(2, ledgerNextSeq());
+}
+
+void test_ledger_batch_roundtrip_and_wrap(void) {
+  const uint32_t capacity =
+      (LEDGER_PARTITION_SIZE / LEDGER_SECTOR_SIZE) * LEDGER_RECORDS_PER_SECTOR;
+  for (uint32_t i = 0; i < capacity + LEDGER_RECORDS_PER_SECTOR; i++) {
+    ledgerOnPayment(500 + (i % 3) * 500);
+    ledgerAddVolume(0.25f, false);
+    ledgerEndSession(LEDGER_END_TIMEOUT, 100);
+  }
+  const uint32_t last = ledgerNextSeq() - 1;
+  TEST_ASSERT_EQUAL_UINT32(capacity + LEDGER_RECORDS_PER_SECTOR, last);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, ledgerDroppedCount());
+
+  SessionRecord rec;
+  TEST_ASSERT_FALSE(ledgerReadRecord(1, rec)); // Recycled
+  TEST_ASSERT_TRUE(ledgerReadRecord(last, rec));
+
+  SessionRecord batch[LEDGER_BATCH_MAX];
+  for (uint8_t i = 0; i < LEDGER_BATCH_MAX; i++) {
+    TEST_ASSERT_TRUE(ledgerReadRecord(last - LEDGER_BATCH_MAX + 1 + i, batch[i]));
+  }
+  uint8_t bin[LEDGER_BATCH_BUF];
+  const size_t len = ledgerEncodeBatch(batch, LEDGER_BATCH_MAX, bin, sizeof(bin));
+  TEST_ASSERT_GREATER_THAN(0, (int)len);
+  TEST_ASSERT_LESS_THAN((int)(LEDGER_BATCH_MAX * sizeof(SessionRecord) / 2),
+                        (int)len);
+
+  SessionRecord decoded[LEDGER_BATCH_MAX];
+  TEST_ASSERT_EQUAL_INT(LEDGER_BATCH_MAX,
+                        ledgerDecodeBatch(bin, len, decoded, LEDGER_BATCH_MAX));
+  TEST_ASSERT_EQUAL_MEMORY(batch, decoded, sizeof(batch));
+}
+
+// ============================================
+// CASH PULSE DECODER TESTS
+// ============================================
+static const CashDenomination TEST_NOTES[] = {
+    {2, 0, 0, 1000}, {4, 0, 0, 2000}, {10, 0, 0, 5000}};
+static const CashDecoderConfig TEST_DECODER_CFG = {10000, 250000, 200000, 50};
+
+static void replayPulses(CashDecoder &d, uint32_t &t, int count,
+                         uint32_t widthUs, bool bounce) {
+  for (int i = 0; i < count; i++) {
+    cashDecoderEdge(d, t, false);
+    if (bounce) {
+      cashDecoderEdge(d, t + 300, true);
+      cashDecoderEdge(d, t + 600, false);
+    }
+    t += widthUs;
+    cashDecoderEdge(d, t, true);
+    t += 50000;
+  }
+}
+
+void test_cash_decoder_bounce_and_denomination(void) {
+  CashDecoder d;
+  cashDecoderInit(d, TEST_DECODER_CFG, TEST_NOTES, 3);
+  uint32_t t = 1000000;
+  CashBurst burst;
+  uint32_t deadline = 0;
+
+  replayPulses(d, t, 4, 50000, true);
+  TEST_ASSERT_FALSE(cashDecoderPoll(d, t, burst)); // Gap not reached yet
+  TEST_ASSERT_TRUE(cashDecoderDeadline(d, deadline));
+  TEST_ASSERT_EQUAL_UINT32(t + 150000, deadline); // Last edge + gap
+  TEST_ASSERT_TRUE(cashDecoderPoll(d, t + 200000, burst));
+  TEST_ASSERT_FALSE(cashDecoderDeadline(d, deadline));
+  TEST_ASSERT_EQUAL(CASH_BURST_ACCEPTED, burst.result);
+  TEST_ASSERT_EQUAL_INT(4, burst.pulses);
+  TEST_ASSERT_EQUAL_INT(2000, burst.value);
+  TEST_ASSERT_EQUAL_UINT32(4, d.glitches);
+
+  t += 500000;
+  replayPulses(d, t, 3, 50000, false); // No 3-pulse note
+  TEST_ASSERT_TRUE(cashDecoderPoll(d, t + 200000, burst));
+  TEST_ASSERT_EQUAL(CASH_BURST_REJECT_COUNT, burst.result);
+  TEST_ASSERT_EQUAL_INT(0, burst.value);
+}
+
+void test_cash_decoder_rejects_noise_and_stuck_line(void) {
+  CashDecoder d;
+  cashDecoderInit(d, TEST_DECODER_CFG, TEST_NOTES, 3);
+  uint32_t t = 1000000;
+  CashBurst burst;
+
+  // Two pulses of wildly different width: EMI, not a 1000 so'm note
+  cashDecoderEdge(d, t, false);
+  cashDecoderEdge(d, t + 12000, true);
+  cashDecoderEdge(d, t + 60000, false);
+  cashDecoderEdge(d, t + 140000, true);
+  TEST_ASSERT_TRUE(cashDecoderPoll(d, t + 400000, burst));
+  TEST_ASSERT_EQUAL(CASH_BURST_REJECT_WIDTH, burst.result);
+
+  // Line held LOW: reported once, then decoding recovers
+  t += 1000000;
+  cashDecoderEdge(d, t, false);
+  uint32_t deadline = 0;
+  TEST_ASSERT_TRUE(cashDecoderDeadline(d, deadline));
+  TEST_ASSERT_EQUAL_UINT32(t + 250001, deadline);
+  TEST_ASSERT_TRUE(cashDecoderPoll(d, t + 300000, burst));
+  TEST_ASSERT_EQUAL(CASH_BURST_REJECT_STUCK, burst.result);
+  TEST_ASSERT_FALSE(cashDecoderDeadline(d, deadline)); // Until released
+  TEST_ASSERT_FALSE(cashDecoderPoll(d, t + 600000, burst));
+  cashDecoderEdge(d, t + 900000, true);
+
+  t += 1000000;
+  replayPulses(d, t, 2, 50000, false);
+  TEST_ASSERT_TRUE(cashDecoderPoll(d, t + 200000, burst));
+  TEST_ASSERT_EQUAL_INT(1000, burst.value);
+  TEST_ASSERT_EQUAL_UINT32(1, d.accepted);
+  TEST_ASSERT_EQUAL_UINT32(2, d.rejected);
+}
+
+void test_cash_decoder_accepts_100k_and_200k_notes(void) {
+  // The firmware's own note table at 2 pulses per 1000 so'm
+  CashDenomination notes[CASH_NOTE_COUNT];
+  for (size_t i = 0; i < CASH_NOTE_COUNT; i++) {
+    notes[i] = {(uint16_t)(CASH_NOTE_UNITS[i] * 2), 0, 0,
+                (int32_t)CASH_NOTE_UNITS[i] * 1000};
+  }
+  CashDecoder d;
+  cashDecoderInit(d, TEST_DECODER_CFG, notes, CASH_NOTE_COUNT);
+  uint32_t t = 1000000;
+  CashBurst burst;
+
+  replayPulses(d, t, 200, 50000, false);
+  TEST_ASSERT_TRUE(cashDecoderPoll(d, t + 200000, burst));
+  TEST_ASSERT_EQUAL(CASH_BURST_ACCEPTED, burst.result);
+  TEST_ASSERT_EQUAL_UINT16(200, burst.pulses);
+  TEST_ASSERT_EQUAL_INT(100000, burst.value);
+
+  t += 500000;
+  replayPulses(d, t, 400, 50000, false); // Past 8 bits
+  TEST_ASSERT_TRUE(cashDecoderPoll(d, t + 200000, burst));
+  TEST_ASSERT_EQUAL(CASH_BURST_ACCEPTED, burst.result);
+  TEST_ASSERT_EQUAL_UINT16(400, burst.pulses);
+  TEST_ASSERT_EQUAL_INT(200000, burst.value);
+
+  // 144 pulses would be 400 mod 256: no such note
+  t += 500000;
+  replayPulses(d, t, 144, 50000, false);
+  TEST_ASSERT_TRUE(cashDecoderPoll(d, t + 200000, burst));
+  TEST_ASSERT_EQUAL(CASH_BURST_REJECT_COUNT, burst.result);
+}
+
+// ============================================
+// UART LINK TRAINING TESTS
+// ============================================
+void test_uart_link_block_check(void) {
+  uint8_t block[LINK_BLOCK_LEN];
+  linkBuildBlock(block, 115200);
+
+  // Sync is found after line garbage, including a stray sync byte
+  LinkBlockRx rx;
+  linkBlockRxReset(rx);
+  const uint8_t garbage[] = {'$', 0x00, LINK_SYNC0, 0x13, LINK_SYNC0};
+  for (uint8_t c : garbage) {
+    TEST_ASSERT_FALSE(linkBlockRxFeed(rx, c));
+  }
+  bool complete = false;
+  for (size_t i = 1; i < LINK_BLOCK_LEN; i++) {
+    complete = linkBlockRxFeed(rx, block[i]);
+  }
+  TEST_ASSERT_TRUE(complete);
+  uint16_t bitErrors = 99;
+  TEST_ASSERT_TRUE(linkBlockCheck(rx, 115200, bitErrors));
+  TEST_ASSERT_EQUAL_UINT16(0, bitErrors);
+
+  // A block trained for another baud does not pass
+  TEST_ASSERT_FALSE(linkBlockCheck(rx, 57600, bitErrors));
+
+  // One flipped bit is counted and fails the CRC
+  rx.buf[10] ^= 0x04;
+  TEST_ASSERT_FALSE(linkBlockCheck(rx, 115200, bitErrors));
+  TEST_ASSERT_EQUAL_UINT16(1, bitErrors);
+}
+
+void test_uart_link_ladder_and_error_spike(void) {
+  TEST_ASSERT_EQUAL_UINT32(19200, linkNextBaud(UART_BAUD, UART_LINK_MAX_BAUD));
+  TEST_ASSERT_EQUAL_UINT32(0, linkNextBaud(57600, 57600)); // Capped
+  TEST_ASSERT_EQUAL_UINT32(0, linkNextBaud(UART_LINK_MAX_BAUD, 1000000));
+  TEST_ASSERT_EQUAL_UINT32(57600, linkLowerBaud(115200));
+  TEST_ASSERT_EQUAL_UINT32(UART_BAUD, linkLowerBaud(UART_BAUD));
+  TEST_ASSERT_FALSE(linkBaudSupported(12345));
+
+  UartLinkStats s;
+  linkStatsReset(s, 115200);
+  for (int i = 0; i < 3; i++) {
+    linkRecordFrame(s, false);
+    linkRecordFrame(s, true);
+  }
+  TEST_ASSERT_FALSE(linkErrorSpike(s));
+  linkRecordHwErrors(s, 1);
+  TEST_ASSERT_TRUE(linkErrorSpike(s));
+  TEST_ASSERT_EQUAL_UINT32(3, s.badFrames);
+  TEST_ASSERT_EQUAL_UINT32(1, s.hwErrors);
+
+  // Bad frames age out of the 16-frame window
+  for (int i = 0; i < 16; i++) {
+    linkRecordFrame(s, true);
+  }
+  TEST_ASSERT_FALSE(linkErrorSpike(s));
+}
+
+// ============================================
+// STATE REPLICATION TESTS
+// ============================================
+void test_state_sync_delta_and_resync(void) {
+  StateSnapshot main = {1, ACTIVE, 0, 2500, 1000};
+  StateSnapshot held = {0, 0, 0, 0, 0};
+  char data[UART_MAX_DATA_LEN + 1];
+
+  // Full snapshot seeds an empty replica
+  TEST_ASSERT_TRUE(syncEncode(data, sizeof(data), main, nullptr));
+  TEST_ASSERT_EQUAL_INT(SYNC_F_ALL & ~SYNC_F_INHIBIT, syncApply(held, data));
+  TEST_ASSERT_EQUAL_UINT16(1, held.version);
+  TEST_ASSERT_EQUAL_INT32(2500, held.balance);
+
+  // Delta carries only the inhibit flag
+  const StateSnapshot acked = main;
+  main.version = syncNextVersion(main.version);
+  main.inhibit = INHIBIT_EMERGENCY;
+  TEST_ASSERT_TRUE(syncEncode(data, sizeof(data), main, &acked));
+  TEST_ASSERT_EQUAL_STRING("2,1,4,1", data);
+  TEST_ASSERT_EQUAL_INT(SYNC_F_INHIBIT, syncApply(held, data));
+  TEST_ASSERT_EQUAL_UINT8(INHIBIT_EMERGENCY, held.inhibit);
+
+  // A delta against a version the replica no longer holds is refused
+  TEST_ASSERT_EQUAL_INT(-1, syncApply(held, "3,1,2,0"));
+  TEST_ASSERT_EQUAL_UINT16(2, held.version);
+  TEST_ASSERT_EQUAL_INT(-1, syncApply(held, "3,0,2,0")); // Full needs all
+
+  // Worst case still fits one frame
+  const StateSnapshot big = {0xFFFF, FREE_WATER, 0xFF, -1, 0x7FFFFFFF};
+  TEST_ASSERT_TRUE(syncEncode(data, sizeof(data), big, nullptr));
+  TEST_ASSERT_TRUE(syncApply(held, data) >= 0);
+  TEST_ASSERT_EQUAL_INT32(-1, held.balance);
+  TEST_ASSERT_EQUAL_UINT16(1, syncNextVersion(0xFFFF));
+}
+
+void test_emergency_shutdown_inhibits_acceptor(void) {
+  deviceConfig.requireSignedMessages = false;
+  setPaymentInhibit(0xFF, false);
+  currentState = ACTIVE;
+  balance = 3000;
+  // Nozzle 1 is pouring: the stop must close its valve too
+  processPayment(2000, "mqtt", "t_estop", nullptr, 1);
+  handleStartButton(1);
+  TEST_ASSERT_EQUAL(DISPENSING, nozzles[1].state);
+  TEST_ASSERT_TRUE(isNozzleRelayOn(1));
+
+  char topicBuf[] = "water/broadcast/command";
+  char payloadBuf[128];
+  strcpy(payloadBuf, "{\"action\": \"emergencyShutdown\"}");
+  mqttCallback(topicBuf, (byte *)payloadBuf, strlen(payloadBuf));
+  TEST_ASSERT_EQUAL(IDLE, currentState);
+  TEST_ASSERT_EQUAL(IDLE, nozzles[1].state);
+  TEST_ASSERT_FALSE(isNozzleRelayOn(1));
+  TEST_ASSERT_EQUAL_UINT8(INHIBIT_EMERGENCY, getPaymentInhibit());
+
+  strcpy(payloadBuf, "{\"action\": \"resume\"}");
+  mqttCallback(topicBuf, (byte *)payloadBuf, strlen(payloadBuf));
+  TEST_ASSERT_EQUAL_UINT8(0, getPaymentInhibit());
+}
+
+// ============================================
+// WIFI FAST RECONNECT TESTS
+// ============================================
+static WiFiCache makeWiFiCache(const char *ssid, const char *pass) {
+  WiFiCache c;
+  memset(&c, 0, sizeof(c));
+  c.magic = WIFI_CACHE_MAGIC;
+  c.credHash = wifiCredHash(ssid, pass);
+  const uint8_t bssid[6] = {0x24, 0x0A, 0xC4, 0x01, 0x02, 0x03};
+  memcpy(c.bssid, bssid, sizeof(bssid));
+  c.channel = 6;
+  c.ip = 0x6401A8C0; // 192.168.1.100
+  c.gateway = 0x0101A8C0;
+  c.subnet = 0x00FFFFFF;
+  return c;
+}
+
+void test_wifi_cache_picks_connect_mode(void) {
+  const uint32_t cred = wifiCredHash("Site", "secret");
+  WiFiCache c = makeWiFiCache("Site", "secret");
+
+  TEST_ASSERT_EQUAL(WIFI_CONNECT_FAST_IP, wifiPickMode(c, cred, true));
+  // Cache restored from NVS after power loss: lease may be gone, use DHCP
+  TEST_ASSERT_EQUAL(WIFI_CONNECT_FAST, wifiPickMode(c, cred, false));
+  c.ip = 0;
+  TEST_ASSERT_EQUAL(WIFI_CONNECT_FAST, wifiPickMode(c, cred, true));
+
+  // Changed credentials, missing AP data or no cache: full scan
+  TEST_ASSERT_EQUAL(WIFI_CONNECT_FULL,
+                    wifiPickMode(c, wifiCredHash("Site", "secret2"), true));
+  TEST_ASSERT_NOT_EQUAL(wifiCredHash("ab", "c"), wifiCredHash("a", "bc"));
+  c.channel = 0;
+  TEST_ASSERT_EQUAL(WIFI_CONNECT_FULL, wifiPickMode(c, cred, true));
+  WiFiCache empty;
+  memset(&empty, 0, sizeof(empty));
+  TEST_ASSERT_EQUAL(WIFI_CONNECT_FULL, wifiPickMode(empty, cred, true));
+}
+
+void test_wifi_cache_fast_failures_and_stats(void) {
+  const uint32_t cred = wifiCredHash("Site", "secret");
+  WiFiCache c = makeWiFiCache("Site", "secret");
+
+  // One miss keeps the cache (AP rebooting); repeated misses drop it
+  TEST_ASSERT_FALSE(wifiCacheFastFailed(c));
+  TEST_ASSERT_EQUAL(WIFI_CONNECT_FAST_IP, wifiPickMode(c, cred, true));
+  TEST_ASSERT_TRUE(wifiCacheFastFailed(c));
+  TEST_ASSERT_EQUAL(WIFI_CONNECT_FULL, wifiPickMode(c, cred, true));
+
+  WiFiConnectStats stats;
+  memset(&stats, 0, sizeof(stats));
+  wifiStatsRecord(stats, WIFI_CONNECT_FULL, 6100);
+  wifiStatsRecord(stats, WIFI_CONNECT_FAST_IP, 420);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.connects);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.fastOk);
+  TEST_ASSERT_EQUAL_UINT32(420, stats.lastMs);
+  TEST_ASSERT_EQUAL_UINT32(6100, stats.maxMs);
+  TEST_ASSERT_EQUAL_STRING("fast_ip", wifiModeName(stats.lastMode));
+}
+
+void test_wifi_lease_expires_cached_ip(void) {
+  const uint32_t ip = 0x6401A8C0;
+  WiFiLease l;
+  wifiLeaseSet(l, ip, 1000, 3600);
+  TEST_ASSERT_TRUE(wifiLeaseUsable(l, ip, 1000));
+  TEST_ASSERT_TRUE(wifiLeaseUsable(l, ip, 4600 - WIFI_LEASE_MARGIN_S - 1));
+  TEST_ASSERT_FALSE(wifiLeaseUsable(l, ip, 4600 - WIFI_LEASE_MARGIN_S));
+  TEST_ASSERT_FALSE(wifiLeaseUsable(l, ip, 90000));    // Long past
+  TEST_ASSERT_FALSE(wifiLeaseUsable(l, ip + 1, 1000)); // Not this address
+
+  // No lease time from DHCP: a conservative default
+  wifiLeaseSet(l, ip, 0, 0);
+  TEST_ASSERT_EQUAL_UINT32(WIFI_LEASE_DEFAULT_S, l.endS);
+
+  // RTC memory left over from power loss
+  l.endS += 100000;
+  TEST_ASSERT_FALSE(wifiLeaseUsable(l, ip, 10));
+  memset(&l, 0xA5, sizeof(l));
+  TEST_ASSERT_FALSE(wifiLeaseUsable(l, 0xA5A5A5A5, 10));
+}
+
+// ============================================
+// PHASED BOOT TESTS
+// ============================================
+void test_boot_record_phase_durations(void) {
+  BootRecord r;
+  bootRecordStart(r, 40, 3);
+  TEST_ASSERT_EQUAL_UINT32(BOOT_TIMING_MAGIC, r.magic);
+  TEST_ASSERT_FALSE(r.reported);
+
+  bootRecordMark(r, BOOT_PHASE_IO, 45);
+  bootRecordMark(r, BOOT_PHASE_CONFIG, 90);
+  bootRecordMark(r, BOOT_PHASE_PAYMENT, 130);
+  bootRecordMark(r, BOOT_PHASE_PAYMENT, 900); // First mark wins
+  // DISPLAY skipped: WIFI is timed from the end of PAYMENT
+  bootRecordMark(r, BOOT_PHASE_WIFI, 1630);
+
+  TEST_ASSERT_EQUAL_UINT32(5, bootPhaseDuration(r, BOOT_PHASE_IO));
+  TEST_ASSERT_EQUAL_UINT32(45, bootPhaseDuration(r, BOOT_PHASE_CONFIG));
+  TEST_ASSERT_EQUAL_UINT32(40, bootPhaseDuration(r, BOOT_PHASE_PAYMENT));
+  TEST_ASSERT_EQUAL_UINT32(0, bootPhaseDuration(r, BOOT_PHASE_DISPLAY));
+  TEST_ASSERT_EQUAL_UINT32(1500, bootPhaseDuration(r, BOOT_PHASE_WIFI));
+  TEST_ASSERT_EQUAL_UINT32(0, bootPhaseDuration(r, BOOT_PHASE_MQTT));
+  TEST_ASSERT_EQUAL_UINT32(130, r.phaseMs[BOOT_PHASE_PAYMENT]);
+  TEST_ASSERT_EQUAL_UINT8(3, r.resetReason);
+
+  // A phase ending at millis() == 0 still counts as reached
+  BootRecord z;
+  bootRecordStart(z, 0, 0);
+  bootRecordMark(z, BOOT_PHASE_IO, 0);
+  TEST_ASSERT_NOT_EQUAL(0, z.phaseMs[BOOT_PHASE_IO]);
+}
+
+void test_boot_mqtt_jitter_spreads_devices(void) {
+  const uint32_t a = bootMqttJitterMs("VendingMachine_001");
+  TEST_ASSERT_EQUAL_UINT32(a, bootMqttJitterMs("VendingMachine_001"));
+  TEST_ASSERT_LESS_THAN(BOOT_MQTT_JITTER_MS, a);
+
+  // Neighbouring ids must not all land on the same instant
+  int distinct = 0;
+  uint32_t prev = a;
+  char id[24];
+  for (int i = 2; i <= 10; i++) {
+    snprintf(id, sizeof(id), "VendingMachine_%03d", i);
+    const uint32_t j = bootMqttJitterMs(id);
+    TEST_ASSERT_LESS_THAN(BOOT_MQTT_JITTER_MS, j);
+    if (j != prev) {
+      distinct++;
+    }
+    prev = j;
+  }
+  TEST_ASSERT_GREATER_THAN(5, distinct);
+
+  TEST_ASSERT_LESS_THAN(BOOT_MQTT_JITTER_MS, bootMqttJitterMs(nullptr));
+  TEST_ASSERT_EQUAL_STRING("payment", bootPhaseName(BOOT_PHASE_PAYMENT));
+  TEST_ASSERT_EQUAL_STRING("mqtt", bootPhaseName(BOOT_PHASE_MQTT));
+}
+
+// ============================================
+// NIGHT POWER SAVE TESTS
+// ============================================
+void test_power_night_window_and_mode(void) {
+  // Window past midnight (22:00-06:00) and within a day (01:00-06:00)
+  TEST_ASSERT_TRUE(powerInNightWindow(23, 22, 6));
+  TEST_ASSERT_TRUE(powerInNightWindow(0, 22, 6));
+  TEST_ASSERT_FALSE(powerInNightWindow(6, 22, 6));
+  TEST_ASSERT_FALSE(powerInNightWindow(12, 22, 6));
+  TEST_ASSERT_TRUE(powerInNightWindow(1, 1, 6));
+  TEST_ASSERT_FALSE(powerInNightWindow(0, 1, 6));
+  // start == end or invalid hours: no window
+  TEST_ASSERT_FALSE(powerInNightWindow(3, 3, 3));
+  TEST_ASSERT_FALSE(powerInNightWindow(3, -1, 6));
+
+  const uint32_t quiet = POWER_WAKE_HOLD_MS;
+  TEST_ASSERT_EQUAL(POWER_MODE_NIGHT,
+                    powerPickMode(true, true, 2, 1, 6, true, quiet));
+  // Disabled, clock not synced, a busy nozzle or recent activity: day
+  TEST_ASSERT_EQUAL(POWER_MODE_DAY,
+                    powerPickMode(false, true, 2, 1, 6, true, quiet));
+  TEST_ASSERT_EQUAL(POWER_MODE_DAY,
+                    powerPickMode(true, false, 2, 1, 6, true, quiet));
+  TEST_ASSERT_EQUAL(POWER_MODE_DAY,
+                    powerPickMode(true, true, 2, 1, 6, false, quiet));
+  TEST_ASSERT_EQUAL(POWER_MODE_DAY,
+                    powerPickMode(true, true, 2, 1, 6, true, quiet - 1));
+  TEST_ASSERT_EQUAL(POWER_MODE_DAY,
+                    powerPickMode(true, true, 7, 1, 6, true, quiet));
+}
+
+void test_power_average_current_per_mode(void) {
+  PowerStats s;
+  memset(&s, 0, sizeof(s));
+  TEST_ASSERT_EQUAL_UINT32(POWER_DAY_NOMINAL_MA, powerAverageMa(s));
+
+  // 18 h day + 6 h night at nominal draw
+  s.modeMs[POWER_MODE_DAY] = 18UL * 3600000UL;
+  s.modeMs[POWER_MODE_NIGHT] = 6UL * 3600000UL;
+  TEST_ASSERT_EQUAL_UINT32(
+      (18 * POWER_DAY_NOMINAL_MA + 6 * POWER_NIGHT_NOMINAL_MA) / 24,
+      powerAverageMa(s));
+
+  // Measured samples replace the nominal figure of their mode
+  s.samples[POWER_MODE_NIGHT] = 4;
+  s.sampleSumMa[POWER_MODE_NIGHT] = 4 * 22;
+  TEST_ASSERT_EQUAL_UINT32(22, powerModeMa(s, POWER_MODE_NIGHT));
+  TEST_ASSERT_EQUAL_UINT32(POWER_DAY_NOMINAL_MA,
+                           powerModeMa(s, POWER_MODE_DAY));
+  TEST_ASSERT_EQUAL_UINT32((18 * POWER_DAY_NOMINAL_MA + 6 * 22) / 24,
+                           powerAverageMa(s));
+  TEST_ASSERT_EQUAL_STRING("night", powerModeName(POWER_MODE_NIGHT));
+}
+
+// ============================================
+// HEALTH SCORING TESTS
+// ============================================
+void test_diag_scores_from_live_inputs(void) {
+  // Leak: a few stray pulses are vibration, a steady drip fails
+  TEST_ASSERT_EQUAL_UINT8(100, diagScoreLeak(2));
+  TEST_ASSERT_EQUAL_UINT8(DIAG_DEGRADED, diagLevel(diagScoreLeak(10)));
+  TEST_ASSERT_EQUAL_UINT8(DIAG_FAIL, diagLevel(diagScoreLeak(40)));
+
+  // TDS: steady water is healthy, a jumping reading is not
+  DiagTdsStats steady;
+  memset(&steady, 0, sizeof(steady));
+  for (int i = 0; i < 32; i++) {
+    diagTdsAdd(steady, 120.0f + (i % 2 ? 3.0f : -3.0f));
+  }
+  TEST_ASSERT_EQUAL_UINT8(100, diagScoreTds(steady));
+  DiagTdsStats noisy;
+  memset(&noisy, 0, sizeof(noisy));
+  for (int i = 0; i < 32; i++) {
+    diagTdsAdd(noisy, i % 2 ? 400.0f : 50.0f);
+  }
+  TEST_ASSERT_EQUAL_UINT8(DIAG_FAIL, diagLevel(diagScoreTds(noisy)));
+  DiagTdsStats dry;
+  memset(&dry, 0, sizeof(dry));
+  for (int i = 0; i < 8; i++) {
+    diagTdsAdd(dry, 0.0f);
+  }
+  TEST_ASSERT_EQUAL_UINT8(DIAG_DEGRADED, diagLevel(diagScoreTds(dry)));
+  diagTdsAdd(steady, 2500.0f);
+  TEST_ASSERT_EQUAL_UINT8(0, diagScoreTds(steady));
+
+  // Payment link, LCD probe, WiFi, MQTT
+  TEST_ASSERT_EQUAL_UINT8(0, diagScoreLink(false, 0, 0));
+  TEST_ASSERT_EQUAL_UINT8(100, diagScoreLink(true, 0, 0));
+  TEST_ASSERT_EQUAL_UINT8(70, diagScoreLink(true, 0x0101, 1));
+  TEST_ASSERT_EQUAL_UINT8(90, diagScoreDisplay(0x0004));
+  TEST_ASSERT_EQUAL_UINT8(0, diagScoreDisplay(0x0003));
+  TEST_ASSERT_EQUAL_UINT8(100, diagScoreWifi(true, -60));
+  TEST_ASSERT_EQUAL_UINT8(20, diagScoreWifi(true, -87));
+  TEST_ASSERT_EQUAL_UINT8(0, diagScoreWifi(false, -40));
+  TEST_ASSERT_EQUAL_UINT8(100, diagScoreMqtt(true, 0));
+  TEST_ASSERT_EQUAL_UINT8(DIAG_DEGRADED, diagLevel(diagScoreMqtt(true, 2)));
+  TEST_ASSERT_EQUAL_UINT8(0, diagScoreMqtt(false, 0));
+}
+
+void test_diag_publishes_only_on_change(void) {
+  HealthReport a;
+  memset(&a, 0, sizeof(a));
+  for (uint8_t c = 0; c < DIAG_COMPONENT_COUNT; c++) {
+    a.score[c] = 100;
+    a.level[c] = diagLevel(100);
+  }
+  HealthReport b = a;
+  b.score[DIAG_WIFI] = 92; // Small RSSI wobble
+  TEST_ASSERT_FALSE(diagShouldPublish(b, a));
+  b.score[DIAG_WIFI] = 90;
+  TEST_ASSERT_TRUE(diagShouldPublish(b, a));
+  b = a;
+  b.score[DIAG_FLOW] = 95;
+  b.level[DIAG_FLOW] = DIAG_DEGRADED; // Level change always counts
+  TEST_ASSERT_TRUE(diagShouldPublish(b, a));
+
+  // Hourly counters: two half-hour buckets, old events age out
+  DiagHourCount n;
+  memset(&n, 0, sizeof(n));
+  diagCountAdd(n, 3, 1000);
+  diagCountAdd(n, 2, 1000 + DIAG_WINDOW_MS / 2);
+  TEST_ASSERT_EQUAL_UINT32(5, diagCountGet(n, 1000 + DIAG_WINDOW_MS / 2));
+  TEST_ASSERT_EQUAL_UINT32(2, diagCountGet(n, 1000 + DIAG_WINDOW_MS));
+  TEST_ASSERT_EQUAL_UINT32(0, diagCountGet(n, 1000 + 3 * DIAG_WINDOW_MS));
+}
+
+// ============================================
+// RESUMABLE OTA DOWNLOAD TESTS
+// ============================================
+void test_ota_parse_content_range(void) {
+  uint32_t start = 0;
+  uint32_t total = 0;
+  TEST_ASSERT_TRUE(otaParseContentRange("bytes 0-1023/4096", start, total));
+  TEST_ASSERT_EQUAL_UINT32(0, start);
+  TEST_ASSERT_EQUAL_UINT32(4096, total);
+  TEST_ASSERT_TRUE(
+      otaParseContentRange("bytes 524288-917503/917504", start, total));
+  TEST_ASSERT_EQUAL_UINT32(524288, start);
+  TEST_ASSERT_EQUAL_UINT32(917504, total);
+
+  TEST_ASSERT_FALSE(otaParseContentRange("bytes */4096", start, total));
+  TEST_ASSERT_FALSE(otaParseContentRange("bytes 10-5/4096", start, total));
+  TEST_ASSERT_FALSE(otaParseContentRange("bytes 0-4096/4096", start, total));
+  TEST_ASSERT_FALSE(otaParseContentRange("items 0-1/2", start, total));
+  TEST_ASSERT_FALSE(otaParseContentRange(nullptr, start, total));
+}
+
+void test_ota_retry_delay_backoff_and_jitter(void) {
+  // Exponential without Retry-After, capped
+  const uint32_t d1 = otaRetryDelayMs(1, 0, 42);
+  TEST_ASSERT_TRUE(d1 >= OTA_BACKOFF_BASE_MS);
+  TEST_ASSERT_TRUE(d1 <= OTA_BACKOFF_BASE_MS * 3 / 2);
+  TEST_ASSERT_TRUE(otaRetryDelayMs(3, 0, 42) >= 4 * OTA_BACKOFF_BASE_MS);
+  TEST_ASSERT_TRUE(otaRetryDelayMs(9, 0, 42) <= OTA_BACKOFF_MAX_MS * 3 / 2);
+
+  // Server Retry-After wins; devices turned away together spread out
+  uint32_t lo = UINT32_MAX;
+  uint32_t hi = 0;
+  for (uint32_t seed = 1; seed <= 50; seed++) {
+    const uint32_t d = otaRetryDelayMs(1, 10, seed * 7919u);
+    TEST_ASSERT_TRUE(d >= 10000 && d <= 15000);
+    lo = d < lo ? d : lo;
+    hi = d > hi ? d : hi;
+  }
+  TEST_ASSERT_TRUE(hi - lo > 2500);
+}
+
+// ============================================
+// SIGNING CONFORMANCE TESTS
+// ============================================
+// test/signing_vectors.json pins the canonical string of each signed
+// message type; the desktop app checks the same file
+// (desktop-app/signing_conformance.js). Run from the project root.
+#define SIGNING_VECTORS_PATH "test/signing_vectors.json"
+
+static bool loadSigningVectors(JsonDocument &vectors) {
+  FILE *f = fopen(SIGNING_VECTORS_PATH, "rb");
+  if (!f) {
+    return false;
+  }
+  std::string text;
+  char buf[512];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    text.append(buf, n);
+  }
+  fclose(f);
+  return deserializeJson(vectors, text) == DeserializationError::Ok;
+}
+
+static String firmwareCanonical(const char *type, const JsonDocument &doc) {
+  if (strcmp(type, "payment") == 0)
+    return canonicalPayment(doc);
+  if (strcmp(type, "config") == 0)
+    return canonicalConfig(doc);
+  if (strcmp(type, "command") == 0)
+    return canonicalCommand(doc);
+  if (strcmp(type, "ota") == 0)
+    return canonicalOta(doc);
+  return String("");
+}
+
+void test_signing_vectors_match_firmware_canonical(void) {
+  JsonDocument vectors;
+  TEST_ASSERT_TRUE_MESSAGE(loadSigningVectors(vectors),
+                           "Cannot read " SIGNING_VECTORS_PATH);
+
+  for (JsonObject v : vectors["vectors"].as<JsonArray>()) {
+    const char *name = v["name"] | "?";
+    strncpy(deviceConfig.device_id, v["device_id"] | "",
+            sizeof(deviceConfig.device_id) - 1);
+    deviceConfig.device_id[sizeof(deviceConfig.device_id) - 1] = '\0';
+
+    JsonDocument msg;
+    TEST_ASSERT_TRUE_MESSAGE(
+        deserializeJson(msg, v["message"].as<const char *>()) ==
+            DeserializationError::Ok,
+        name);
+    const String canonical = firmwareCanonical(v["type"] | "", msg);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(v["canonical"].as<const char *>(),
+                                     canonical.c_str(), name);
+  }
+}
+
+void test_signing_vectors_cover_every_type(void) {
+  JsonDocument vectors;
+  TEST_ASSERT_TRUE(loadSigningVectors(vectors));
+
+  const char *types[] = {"payment", "config", "command", "ota"};
+  for (const char *type : types) {
+    int count = 0;
+    for (JsonObject v : vectors["vectors"].as<JsonArray>()) {
+      if (strcmp(v["type"] | "", type) == 0) {
+        count++;
+      }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(count > 0, type);
+  }
+}
+
+// ============================================
+// CONFIG SCHEMA TESTS
+// ============================================
+void test_config_schema_canonical_in_schema_order(void) {
+  strcpy(deviceConfig.device_id, "EW_1");
+  JsonDocument msg;
+  deserializeJson(msg, "{\"ts\":5,\"bogus\":1,\"pricePerLiter\":1200,"
+                       "\"apply\":\"now\",\"relay_active_high\":true}");
+  TEST_ASSERT_EQUAL_STRING("{\"apply\":\"now\",\"pricePerLiter\":1200,"
+                           "\"relay_active_high\":true,\"ts\":5,"
+                           "\"device_id\":\"EW_1\"}",
+                           canonicalConfig(msg));
+
+  // Payment always signs amount, null when missing
+  deserializeJson(msg, "{\"source\":\"app\"}");
+  TEST_ASSERT_EQUAL_STRING(
+      "{\"amount\":null,\"source\":\"app\",\"device_id\":\"EW_1\"}",
+      canonicalPayment(msg));
+}
+
+void test_config_schema_validate_and_persist(void) {
+  // Defaults pass their own checks (nothing is saved)
+  validateConfig();
+  TEST_ASSERT_FALSE(preferences.getBool("has_config", false));
+
+  deviceConfig.mqtt_port = 70000;
+  deviceConfig.tdsCalibrationFactor = 20.0f;
+  deviceConfig.deepSleepEndHour = -1;
+  deviceConfig.freeWaterAmount = -1.0f;
+  validateConfig();
+  TEST_ASSERT_EQUAL_INT(1883, deviceConfig.mqtt_port);
+  TEST_ASSERT_EQUAL_FLOAT(0.5f, deviceConfig.tdsCalibrationFactor);
+  TEST_ASSERT_EQUAL_INT(6, deviceConfig.deepSleepEndHour);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, deviceConfig.freeWaterAmount);
+
+  strcpy(deviceConfig.groupId, "north");
+  deviceConfig.heartbeatInterval = 45000;
+  deviceConfig.enablePowerSave = true;
+  saveConfigToStorage();
+  TEST_ASSERT_EQUAL_STRING("north", preferences.getString("group_id").c_str());
+  loadDefaultConfig();
+  loadConfigFromStorage();
+  TEST_ASSERT_EQUAL_STRING("north", deviceConfig.groupId);
+  TEST_ASSERT_EQUAL_UINT32(45000, deviceConfig.heartbeatInterval);
+  TEST_ASSERT_TRUE(deviceConfig.enablePowerSave);
+  TEST_ASSERT_EQUAL_INT(1883, deviceConfig.mqtt_port);
+}
+
+// ============================================
+// RUNTIME CONFIG SNAPSHOT TESTS
+// ============================================
+void test_config_snapshot_swaps_whole_values(void) {
+  ConfigSnapshot<Config> snap;
+  Config seen = config;
+  uint32_t seenVersion = 0;
+  TEST_ASSERT_FALSE(snap.readIfNewer(seen, seenVersion));
+
+  snap.publish(runtimeConfigFrom(deviceConfig));
+  deviceConfig.pricePerLiter = 1500;
+  deviceConfig.pulsesPerLiter = 300.0f;
+  snap.publish(runtimeConfigFrom(deviceConfig));
+
+  // Only the latest publish is seen, with both fields
+  TEST_ASSERT_TRUE(snap.readIfNewer(seen, seenVersion));
+  TEST_ASSERT_EQUAL_UINT32(2, seenVersion);
+  TEST_ASSERT_EQUAL_INT(1500, seen.pricePerLiter);
+  TEST_ASSERT_EQUAL_FLOAT(300.0f, seen.pulsesPerLiter);
+  TEST_ASSERT_FALSE(snap.readIfNewer(seen, seenVersion));
+}
+
+void test_config_update_rejected_as_a_whole(void) {
+  JsonDocument doc;
+  deserializeJson(doc, "{\"pricePerLiter\":1500,\"tdsCalibrationFactor\":9}");
+  handleConfigUpdate(doc);
+  TEST_ASSERT_EQUAL_INT(1000, deviceConfig.pricePerLiter);
+  TEST_ASSERT_EQUAL_FLOAT(0.5f, deviceConfig.tdsCalibrationFactor);
+
+  deserializeJson(doc, "{\"pricePerLiter\":1500,\"tdsCalibrationFactor\":0.7}");
+  handleConfigUpdate(doc);
+  TEST_ASSERT_EQUAL_INT(1500, deviceConfig.pricePerLiter);
+  TEST_ASSERT_EQUAL_FLOAT(0.7f, deviceConfig.tdsCalibrationFactor);
+}
+
 // ============================================
 // INTEGRATION TESTS
 // ============================================
@@ -218,6 +1291,210 @@ void test_integration_ota_trigger(void) {
   TEST_ASSERT_TRUE(true);
 }
 
+// ============================================
+// MQTT JSON ARENA TESTS
+// ============================================
+void test_json_arena_resize_rewind_and_overflow(void) {
+  alignas(JSON_ARENA_ALIGN) static uint8_t buf[256];
+  JsonArena arena(buf, sizeof(buf));
+
+  // The newest block grows and shrinks in place
+  char *a = static_cast<char *>(arena.allocate(10));
+  strcpy(a, "abcdefghi");
+  TEST_ASSERT_EQUAL_PTR(a, arena.reallocate(a, 40));
+  TEST_ASSERT_EQUAL_PTR(a, arena.reallocate(a, 12));
+
+  // An older block moves and keeps its bytes
+  void *b = arena.allocate(16);
+  char *moved = static_cast<char *>(arena.reallocate(a, 30));
+  TEST_ASSERT_TRUE(moved != a);
+  TEST_ASSERT_EQUAL_STRING("abcdefghi", moved);
+
+  // Freeing from the top gives the space straight back
+  arena.deallocate(moved);
+  arena.deallocate(b);
+  TEST_ASSERT_EQUAL_UINT32(JSON_ARENA_ALIGN + 16, arena.used());
+
+  // Too large: refused and counted, nothing overrun
+  TEST_ASSERT_NULL(arena.allocate(sizeof(buf)));
+  TEST_ASSERT_EQUAL_UINT32(1, arena.failures());
+
+  JsonArenaAllocator allocator(arena);
+  const size_t before = arena.used();
+  {
+    JsonArenaScope scope(arena);
+    JsonDocument doc(&allocator);
+    std::string big = "[\"" + std::string(300, 'x') + "\"]";
+    TEST_ASSERT_TRUE(deserializeJson(doc, big) ==
+                     DeserializationError::NoMemory);
+  }
+  TEST_ASSERT_EQUAL_UINT32(before, arena.used());
+  TEST_ASSERT_TRUE(arena.highWater() <= arena.capacity());
+}
+
+void test_mqtt_message_filtered_into_arena(void) {
+  deviceConfig.requireSignedMessages = false;
+  currentState = IDLE;
+  balance = 0;
+
+  // Hundreds of members no handler reads are skipped while parsing
+  static char payloadBuf[MQTT_BUFFER_SIZE];
+  int n = snprintf(payloadBuf, sizeof(payloadBuf), "{");
+  for (int i = 0; n < (int)sizeof(payloadBuf) - 64; i++) {
+    n += snprintf(payloadBuf + n, sizeof(payloadBuf) - n, "\"k%d\":%d,", i,
+                  i);
+  }
+  snprintf(payloadBuf + n, sizeof(payloadBuf) - n,
+           "\"amount\":2000,\"source\":\"app\"}");
+  char topicBuf[] = "water/payment";
+  const uint32_t overflows = getMqttArenaStats().overflows;
+  mqttCallback(topicBuf, (byte *)payloadBuf, strlen(payloadBuf));
+
+  TEST_ASSERT_EQUAL(2000, balance);
+  TEST_ASSERT_EQUAL_UINT32(0, mqttArena.used()); // All given back
+  const MqttArenaStats stats = getMqttArenaStats();
+  TEST_ASSERT_EQUAL_UINT32(overflows, stats.overflows);
+  TEST_ASSERT_TRUE(stats.peak[MQTT_MSG_PAYMENT] > 0);
+  TEST_ASSERT_TRUE(stats.peak[MQTT_MSG_PAYMENT] <= stats.highWater);
+  TEST_ASSERT_TRUE(stats.highWater <= stats.capacity);
+  TEST_ASSERT_EQUAL_STRING("payment", mqttMessageKindName(MQTT_MSG_PAYMENT));
+}
+
+// ============================================
+// HEAP MONITOR TESTS
+// ============================================
+void test_heap_fragmentation_and_module_counts(void) {
+  TEST_ASSERT_EQUAL_UINT8(0, heapFragmentationPct(100000, 100000));
+  TEST_ASSERT_EQUAL_UINT8(75, heapFragmentationPct(40000, 10000));
+  TEST_ASSERT_EQUAL_UINT8(0, heapFragmentationPct(0, 0));
+  TEST_ASSERT_TRUE(heapFragmented(40000, 10000));
+  TEST_ASSERT_FALSE(heapFragmented(100000, 30000)); // Big block left
+
+  HeapModuleStats s = {};
+  heapModuleNoteAlloc(s, 64);
+  heapModuleNoteAlloc(s, 32);
+  heapModuleNoteFree(s);
+  heapModuleNoteAlloc(s, 16);
+  TEST_ASSERT_EQUAL_INT32(2, heapModuleLive(s));
+  TEST_ASSERT_EQUAL_INT32(2, s.peakLive);
+  TEST_ASSERT_EQUAL_UINT32(112, s.bytes);
+  TEST_ASSERT_EQUAL_STRING("mqtt", heapModuleName(HEAP_MOD_MQTT));
+}
+
+void test_heap_trend_flags_steady_loss_only(void) {
+  HeapTrend t;
+  heapTrendReset(t);
+  heapTrendCloseInterval(t); // No samples, no point
+  TEST_ASSERT_EQUAL_UINT8(0, t.count);
+
+  // Lows of each interval, losing 300 B per 5 min (3600 B/h)
+  for (int i = 0; i < HEAP_TREND_POINTS; i++) {
+    heapTrendSample(t, 100000 - i * 300 + 500);
+    heapTrendSample(t, 100000 - i * 300);
+    heapTrendCloseInterval(t);
+    if (i + 1 < HEAP_TREND_MIN_POINTS) {
+      TEST_ASSERT_EQUAL_INT32(0, heapTrendSlopePerHour(t));
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(100000, heapTrendPoint(t, 0));
+  TEST_ASSERT_INT32_WITHIN(10, -3600, heapTrendSlopePerHour(t));
+  TEST_ASSERT_TRUE(heapLeakSuspected(t));
+
+  // The ring rolls over; a recovery back above the oldest point clears it
+  heapTrendSample(t, 120000);
+  heapTrendCloseInterval(t);
+  TEST_ASSERT_EQUAL_UINT32(100000 - 300, heapTrendPoint(t, 0));
+  TEST_ASSERT_EQUAL_UINT32(120000, heapTrendPoint(t, HEAP_TREND_POINTS - 1));
+  TEST_ASSERT_FALSE(heapLeakSuspected(t));
+
+  // Flat heap with noise is no leak
+  heapTrendReset(t);
+  for (int i = 0; i < HEAP_TREND_POINTS; i++) {
+    heapTrendSample(t, 100000 + (i % 2) * 400);
+    heapTrendCloseInterval(t);
+  }
+  TEST_ASSERT_FALSE(heapLeakSuspected(t));
+}
+
+// ============================================
+// TELEMETRY TESTS
+// ============================================
+void test_telemetry_window_encodes_to_msgpack(void) {
+  TelemetryWindow w;
+  telemetryWindowReset(w);
+  const float flow[3] = {0.0f, 3.0f, 6.0f};
+  for (int i = 0; i < 3; i++) {
+    telemetryStatAdd(w.stat[TELEM_FLOW], flow[i]);
+    telemetryStatAdd(w.stat[TELEM_TDS], 100.0f + i * 10);
+    telemetryStatAdd(w.stat[TELEM_RSSI], -60.0f - i);
+    telemetryStatAdd(w.stat[TELEM_HEAP], 150000.0f);
+    telemetryStatAdd(w.stat[TELEM_LOOP], 1200.0f + i * 300);
+  }
+  w.volumeL = 0.15f;
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 3.0f, telemetryFlowLpm(0.05f, 1000));
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, telemetryFlowLpm(0.05f, 0));
+
+  JsonDocument doc;
+  telemetryFillRecord(doc, w, 3600);
+  uint8_t buf[192];
+  const size_t len = serializeMsgPack(doc, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(len > 0 && len < 128);
+  TEST_ASSERT_EQUAL_HEX8(0x89, buf[0]); // fixmap, 9 keys
+
+  JsonDocument back;
+  TEST_ASSERT_EQUAL(DeserializationError::Ok,
+                    deserializeMsgPack(back, buf, len).code());
+  TEST_ASSERT_EQUAL_INT(TELEMETRY_VERSION, back["v"].as<int>());
+  TEST_ASSERT_EQUAL_UINT32(3600, back["t"].as<uint32_t>());
+  TEST_ASSERT_EQUAL_INT(3, back["n"].as<int>());
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.15f, back["vol"].as<float>());
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 3.0f, back["flow"][1].as<float>());
+  TEST_ASSERT_EQUAL_INT(100, back["tds"][0].as<int>());
+  TEST_ASSERT_EQUAL_INT(110, back["tds"][1].as<int>());
+  TEST_ASSERT_EQUAL_INT(-62, back["rssi"][0].as<int>());
+  TEST_ASSERT_EQUAL_INT(150000, back["heap"][2].as<int>());
+  TEST_ASSERT_EQUAL_INT(1800, back["loop"][2].as<int>());
+}
+
+void test_telemetry_alert_debounce_and_hysteresis(void) {
+  TelemetryAlertState s = {};
+  // TDS high at 500 ppm, clears below 450: one spike is not enough
+  TEST_ASSERT_EQUAL(TELEM_EDGE_NONE,
+                    telemetryAlertUpdate(s, 600, 500, 450, true));
+  TEST_ASSERT_EQUAL(TELEM_EDGE_NONE,
+                    telemetryAlertUpdate(s, 300, 500, 450, true));
+  for (int i = 0; i < TELEMETRY_ALERT_SAMPLES - 1; i++) {
+    TEST_ASSERT_EQUAL(TELEM_EDGE_NONE,
+                      telemetryAlertUpdate(s, 520, 500, 450, true));
+  }
+  TEST_ASSERT_EQUAL(TELEM_EDGE_RAISED,
+                    telemetryAlertUpdate(s, 520, 500, 450, true));
+  TEST_ASSERT_TRUE(s.active);
+
+  // Between the edges it stays raised
+  for (int i = 0; i < 5; i++) {
+    TEST_ASSERT_EQUAL(TELEM_EDGE_NONE,
+                      telemetryAlertUpdate(s, 480, 500, 450, true));
+  }
+  for (int i = 0; i < TELEMETRY_ALERT_SAMPLES - 1; i++) {
+    telemetryAlertUpdate(s, 400, 500, 450, true);
+  }
+  TEST_ASSERT_EQUAL(TELEM_EDGE_CLEARED,
+                    telemetryAlertUpdate(s, 400, 500, 450, true));
+  TEST_ASSERT_FALSE(s.active);
+
+  // Low-side alert (RSSI)
+  TelemetryAlertState r = {};
+  for (int i = 0; i < TELEMETRY_ALERT_SAMPLES - 1; i++) {
+    telemetryAlertUpdate(r, -90, TELEMETRY_RSSI_LOW, TELEMETRY_RSSI_CLEAR,
+                         false);
+  }
+  TEST_ASSERT_EQUAL(TELEM_EDGE_RAISED,
+                    telemetryAlertUpdate(r, -90, TELEMETRY_RSSI_LOW,
+                                         TELEMETRY_RSSI_CLEAR, false));
+  TEST_ASSERT_EQUAL_STRING("rssi_low", telemetryAlertName(TELEM_ALERT_RSSI_LOW));
+}
+
 // ============================================
 // MAIN
 // ============================================
@@ -227,13 +1504,89 @@ int main(int argc, char **argv) {
   // Config
   RUN_TEST(test_config_load_defaults);
   RUN_TEST(test_config_validation);
+  RUN_TEST(test_config_durations_seconds_or_ms);
+  RUN_TEST(test_cfg_frame_rejects_pair_key_alone);
   RUN_TEST(test_config_save_load);
 
+  // Serial console
+  RUN_TEST(test_serial_command_table_sorted);
+  RUN_TEST(test_serial_parsers_are_strict);
+
   // SM
   RUN_TEST(test_sm_initial_state);
   RUN_TEST(test_sm_free_water);
   RUN_TEST(test_sm_paid_dispense);
   RUN_TEST(test_sm_flow_logic);
+  RUN_TEST(test_sm_transition_table_exhaustive);
+  RUN_TEST(test_sm_event_queue_order_and_status_coalescing);
+  RUN_TEST(test_nozzles_run_independent_sessions);
+  RUN_TEST(test_nozzle_config_fallback_and_ledger_encoding);
+
+  // Logger
+  RUN_TEST(test_logger_format_binary_args);
+  RUN_TEST(test_logger_ring_drops_when_full);
+
+  // Session ledger
+  RUN_TEST(test_ledger_paid_session_and_ack);
+  RUN_TEST(test_ledger_batch_roundtrip_and_wrap);
+
+  // Cash pulse decoder
+  RUN_TEST(test_cash_decoder_bounce_and_denomination);
+  RUN_TEST(test_cash_decoder_rejects_noise_and_stuck_line);
+  RUN_TEST(test_cash_decoder_accepts_100k_and_200k_notes);
+
+  // UART link training
+  RUN_TEST(test_uart_link_block_check);
+  RUN_TEST(test_uart_link_ladder_and_error_spike);
+
+  // State replication
+  RUN_TEST(test_state_sync_delta_and_resync);
+  RUN_TEST(test_emergency_shutdown_inhibits_acceptor);
+
+  // WiFi fast reconnect
+  RUN_TEST(test_wifi_cache_picks_connect_mode);
+  RUN_TEST(test_wifi_cache_fast_failures_and_stats);
+  RUN_TEST(test_wifi_lease_expires_cached_ip);
+
+  // Phased boot
+  RUN_TEST(test_boot_record_phase_durations);
+  RUN_TEST(test_boot_mqtt_jitter_spreads_devices);
+
+  // Night power save
+  RUN_TEST(test_power_night_window_and_mode);
+  RUN_TEST(test_power_average_current_per_mode);
+
+  // Health scoring
+  RUN_TEST(test_diag_scores_from_live_inputs);
+  RUN_TEST(test_diag_publishes_only_on_change);
+
+  // Resumable OTA download
+  RUN_TEST(test_ota_parse_content_range);
+  RUN_TEST(test_ota_retry_delay_backoff_and_jitter);
+
+  // Signing conformance with the desktop app
+  RUN_TEST(test_signing_vectors_match_firmware_canonical);
+  RUN_TEST(test_signing_vectors_cover_every_type);
+
+  // Config field schema
+  RUN_TEST(test_config_schema_canonical_in_schema_order);
+  RUN_TEST(test_config_schema_validate_and_persist);
+
+  // Runtime config snapshot
+  RUN_TEST(test_config_snapshot_swaps_whole_values);
+  RUN_TEST(test_config_update_rejected_as_a_whole);
+
+  // MQTT JSON arena
+  RUN_TEST(test_json_arena_resize_rewind_and_overflow);
+  RUN_TEST(test_mqtt_message_filtered_into_arena);
+
+  // Heap health monitor
+  RUN_TEST(test_heap_fragmentation_and_module_counts);
+  RUN_TEST(test_heap_trend_flags_steady_loss_only);
+
+  // Binary telemetry and alerts
+  RUN_TEST(test_telemetry_window_encodes_to_msgpack);
+  RUN_TEST(test_telemetry_alert_debounce_and_hysteresis);
 
   // Integration
   RUN_TEST(test_integration_mqtt_payment);